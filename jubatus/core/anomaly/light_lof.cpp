@@ -478,7 +478,8 @@ void light_lof::update_entries(const unordered_set<string>& neighbors) {
 
 light_lof::parameter light_lof::get_row_parameter(const string& row)
     const {
-  shared_ptr<column_table> table = mixable_scores_->get_model();
+  // const, so that a mapped column is not copied on read
+  shared_ptr<const column_table> table = mixable_scores_->get_model();
   pair<bool, uint64_t> hit = table->exact_match(row);
   if (!hit.first) {
     throw JUBATUS_EXCEPTION(common::exception::runtime_error(
@@ -29,7 +29,9 @@
 #include "anomaly_type.hpp"
 #include "../common/exception.hpp"
 #include "../common/jsonconfig.hpp"
+#include "../common/thread_pool.hpp"
 #include "../common/vector_util.hpp"
+#include "../nearest_neighbor/bit_vector_ranking.hpp"
 #include "../recommender/euclid_lsh.hpp"
 #include "../recommender/recommender_factory.hpp"
 
@@ -58,7 +60,9 @@ const bool lof_storage::DEFAULT_IGNORE_KTH_SAME_POINT = false;
 lof_storage::config::config()
     : nearest_neighbor_num(DEFAULT_NEIGHBOR_NUM),
       reverse_nearest_neighbor_num(DEFAULT_REVERSE_NN_NUM),
-      ignore_kth_same_point(DEFAULT_IGNORE_KTH_SAME_POINT) {
+      ignore_kth_same_point(DEFAULT_IGNORE_KTH_SAME_POINT),
+      threads(),
+      neighbor_cache() {
 }
 
 lof_storage::lof_storage()
@@ -66,6 +70,8 @@ lof_storage::lof_storage()
       reverse_nn_num_(DEFAULT_REVERSE_NN_NUM),
       ignore_kth_same_point_(DEFAULT_IGNORE_KTH_SAME_POINT),
       ignored_count_(0),
+      threads_(0),
+      neighbor_cache_(false),
       nn_engine_(recommender::recommender_factory::create_recommender(
           "euclid_lsh",
           common::jsonconfig::config(jubatus::util::text::json::to_json(
@@ -78,6 +84,8 @@ lof_storage::lof_storage(
       reverse_nn_num_(DEFAULT_REVERSE_NN_NUM),
       ignore_kth_same_point_(DEFAULT_IGNORE_KTH_SAME_POINT),
       ignored_count_(0),
+      threads_(0),
+      neighbor_cache_(false),
       nn_engine_(nn_engine) {
 }
 
@@ -89,6 +97,8 @@ lof_storage::lof_storage(
       ignore_kth_same_point_(
           config.ignore_kth_same_point && *config.ignore_kth_same_point),
       ignored_count_(0),
+      threads_(nearest_neighbor::read_threads_config(config.threads)),
+      neighbor_cache_(config.neighbor_cache && *config.neighbor_cache),
       nn_engine_(nn_engine) {
 }
 
@@ -143,11 +153,14 @@ double lof_storage::collect_lrds(
 void lof_storage::remove_row(const string& row) {
   mark_removed(lof_table_diff_[row]);
   nn_engine_->clear_row(row);
+  invalidate_neighbors(row);
+  invalidate_reverse_neighbors(row);
 }
 
 void lof_storage::clear() {
   lof_table_t().swap(lof_table_);
   lof_table_t().swap(lof_table_diff_);
+  clear_neighbor_cache();
   nn_engine_->clear();
   ignored_count_ = 0;
 }
@@ -206,7 +219,7 @@ bool lof_storage::update_row(
   }
 
   nn_engine_->update_row(data.first, data.second);
-  collect_neighbors(data.first, update_set);
+  collect_moved_neighbors(data.first, update_set);
   update_set.insert(data.first);
   return true;
 }
@@ -243,7 +256,7 @@ bool lof_storage::update_row(const string& row, const common::sfv_t& diff) {
   }
 
   nn_engine_->update_row(row, diff);
-  collect_neighbors(row, update_set);
+  collect_moved_neighbors(row, update_set);
 
   update_set.insert(row);
 
@@ -297,19 +310,27 @@ void lof_storage::update_all() {
   vector<string> ids;
   get_all_row_ids(ids);
 
+  clear_neighbor_cache();
+  vector<neighbor_list> neighbors;
+  query_neighbors(ids, neighbors);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    cache_neighbors(ids[i], neighbors[i]);
+  }
+
   // NOTE: These two loops are separated, since update_lrd requires new kdist
   // values of k-NN.
   for (size_t i = 0; i < ids.size(); ++i) {
-    update_kdist(ids[i]);
+    update_kdist_with_neighbors(ids[i], neighbors[i]);
   }
   for (size_t i = 0; i < ids.size(); ++i) {
-    update_lrd(ids[i]);
+    update_lrd_with_neighbors(ids[i], neighbors[i]);
   }
 }
 
 void lof_storage::set_nn_engine(
     shared_ptr<recommender::recommender_base> nn_engine) {
   nn_engine_ = nn_engine;
+  clear_neighbor_cache();
 }
 
 void lof_storage::get_diff(lof_table_t& diff) const {
@@ -317,6 +338,9 @@ void lof_storage::get_diff(lof_table_t& diff) const {
 }
 
 bool lof_storage::put_diff(const lof_table_t& mixed_diff) {
+  // rows of the nearest neighbor engine are also mixed
+  clear_neighbor_cache();
+
   for (lof_table_t::const_iterator it = mixed_diff.begin();
        it != mixed_diff.end(); ++it) {
     if (is_removed(it->second)) {
@@ -434,6 +458,168 @@ void lof_storage::collect_neighbors(
   }
 }
 
+/**
+ * Collect neighbors for the given ID which has just been updated, and keep
+ * the k-NN cache consistent with the new position of the row.
+ */
+void lof_storage::collect_moved_neighbors(
+    const string& row,
+    unordered_set<string>& nn) {
+  neighbor_list neighbors;
+  nn_engine_->neighbor_row(row, neighbors, reverse_nn_num_);
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    nn.insert(neighbors[i].first);
+  }
+
+  // Cached k-NN that contained the row at the old position are stale.
+  invalidate_neighbors(row);
+  invalidate_reverse_neighbors(row);
+
+  // Rows found by the reverse query know their distance to the row; add it
+  // to their k-NN if it is closer than their k-th neighbor.
+  unordered_set<string> known;
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    const string& id = neighbors[i].first;
+    known.insert(id);
+    unordered_map<string, neighbor_list>::iterator it = knn_cache_.find(id);
+    if (id == row || it == knn_cache_.end()) {
+      continue;
+    }
+    const double dist = neighbors[i].second;
+    neighbor_list list = it->second;
+    if (list.size() >= neighbor_num_ && list.back().second < dist) {
+      continue;
+    }
+    bool tie = false;
+    for (size_t j = 0; j < list.size(); ++j) {
+      tie = tie || list[j].second == dist;
+    }
+    if (tie) {
+      // the order among equidistant neighbors is up to the engine
+      invalidate_neighbors(id);
+      continue;
+    }
+    neighbor_list::iterator pos = list.begin();
+    while (pos != list.end() && pos->second < dist) {
+      ++pos;
+    }
+    list.insert(pos, std::make_pair(row, dist));
+    if (list.size() > neighbor_num_) {
+      list.pop_back();
+    }
+    cache_neighbors(id, list);
+  }
+
+  // Other rows are not closer to the row than the farthest one found;
+  // rows whose k-distance reaches it may have the row as a new neighbor.
+  if (neighbors.size() >= reverse_nn_num_) {
+    const double bound = neighbors.back().second;
+    vector<string> stale;
+    for (std::set<pair<double, string> >::const_iterator it =
+             kdist_index_.lower_bound(std::make_pair(bound, string()));
+         it != kdist_index_.end(); ++it) {
+      if (known.count(it->second) == 0) {
+        stale.push_back(it->second);
+      }
+    }
+    for (size_t i = 0; i < stale.size(); ++i) {
+      invalidate_neighbors(stale[i]);
+    }
+  }
+}
+
+/**
+ * Query k-NN of the rows, in parallel if threads are configured.
+ */
+void lof_storage::query_neighbors(
+    const vector<string>& rows,
+    vector<neighbor_list>& neighbors) const {
+  neighbors.clear();
+  neighbors.resize(rows.size());
+  if (threads_ > 1 && rows.size() > 1) {
+    common::default_thread_pool::parallel_for(
+        0, rows.size(), threads_,
+        jubatus::util::lang::bind(
+            &lof_storage::query_neighbors_range, this, &rows, &neighbors,
+            jubatus::util::lang::_1, jubatus::util::lang::_2));
+  } else {
+    query_neighbors_range(&rows, &neighbors, 0, rows.size());
+  }
+}
+
+void lof_storage::query_neighbors_range(
+    const vector<string>* rows,
+    vector<neighbor_list>* neighbors,
+    size_t begin,
+    size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    nn_engine_->neighbor_row((*rows)[i], (*neighbors)[i], neighbor_num_);
+  }
+}
+
+void lof_storage::cache_neighbors(
+    const string& row,
+    const neighbor_list& neighbors) {
+  invalidate_neighbors(row);
+  if (!neighbor_cache_) {
+    return;
+  }
+  knn_cache_[row] = neighbors;
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    reverse_knn_[neighbors[i].first].insert(row);
+  }
+  kdist_index_.insert(std::make_pair(cached_kdist(neighbors), row));
+}
+
+/**
+ * k-distance of a cached row; rows with less than k neighbors accept any
+ * new neighbor.
+ */
+double lof_storage::cached_kdist(const neighbor_list& neighbors) const {
+  if (neighbors.size() < neighbor_num_) {
+    return numeric_limits<double>::infinity();
+  }
+  return neighbors.back().second;
+}
+
+void lof_storage::invalidate_neighbors(const string& row) {
+  unordered_map<string, neighbor_list>::iterator it = knn_cache_.find(row);
+  if (it == knn_cache_.end()) {
+    return;
+  }
+  const neighbor_list& neighbors = it->second;
+  for (size_t i = 0; i < neighbors.size(); ++i) {
+    unordered_map<string, unordered_set<string> >::iterator rev =
+        reverse_knn_.find(neighbors[i].first);
+    if (rev != reverse_knn_.end()) {
+      rev->second.erase(row);
+      if (rev->second.empty()) {
+        reverse_knn_.erase(rev);
+      }
+    }
+  }
+  kdist_index_.erase(std::make_pair(cached_kdist(neighbors), row));
+  knn_cache_.erase(it);
+}
+
+void lof_storage::invalidate_reverse_neighbors(const string& row) {
+  unordered_map<string, unordered_set<string> >::iterator it =
+      reverse_knn_.find(row);
+  if (it == reverse_knn_.end()) {
+    return;
+  }
+  const vector<string> rows(it->second.begin(), it->second.end());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    invalidate_neighbors(rows[i]);
+  }
+}
+
+void lof_storage::clear_neighbor_cache() {
+  unordered_map<string, neighbor_list>().swap(knn_cache_);
+  unordered_map<string, unordered_set<string> >().swap(reverse_knn_);
+  std::set<pair<double, string> >().swap(kdist_index_);
+}
+
 /**
  * Update kdist and LRD for given points and its neighbors.
  */
@@ -444,9 +630,23 @@ void lof_storage::update_entries(const unordered_set<string>& rows) {
     rows_to_neighbors_type;
 
   rows_to_neighbors_type rows_to_neighbors;
+  vector<string> missing;
   for (unordered_set<string>::const_iterator it = rows.begin();
        it != rows.end(); ++it) {
-    nn_engine_->neighbor_row(*it, rows_to_neighbors[*it], neighbor_num_);
+    unordered_map<string, neighbor_list>::const_iterator cached =
+        knn_cache_.find(*it);
+    if (cached != knn_cache_.end()) {
+      rows_to_neighbors[*it] = cached->second;
+    } else {
+      missing.push_back(*it);
+    }
+  }
+
+  vector<neighbor_list> neighbors;
+  query_neighbors(missing, neighbors);
+  for (size_t i = 0; i < missing.size(); ++i) {
+    cache_neighbors(missing[i], neighbors[i]);
+    rows_to_neighbors[missing[i]].swap(neighbors[i]);
   }
 
   for (rows_to_neighbors_type::const_iterator it = rows_to_neighbors.begin();
@@ -459,15 +659,6 @@ void lof_storage::update_entries(const unordered_set<string>& rows) {
   }
 }
 
-/**
- * Update kdist for the row.
- */
-void lof_storage::update_kdist(const string& row) {
-  vector<pair<string, double> > neighbors;
-  nn_engine_->neighbor_row(row, neighbors, neighbor_num_);
-  update_kdist_with_neighbors(row, neighbors);
-}
-
 /**
  * Update kdist for the row using given NN search result (`neighbors`).
  * Note that this method expects `neighbors` to be sorted by score.
@@ -480,15 +671,6 @@ void lof_storage::update_kdist_with_neighbors(
   }
 }
 
-/**
- * Update LRD for the row.
- */
-void lof_storage::update_lrd(const string& row) {
-  vector<pair<string, double> > neighbors;
-  nn_engine_->neighbor_row(row, neighbors, neighbor_num_);
-  update_lrd_with_neighbors(row, neighbors);
-}
-
 /**
  * Update LRD for the row using given NN search result (`neighbors`).
  */
@@ -19,6 +19,7 @@
 
 #include <iosfwd>
 #include <map>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -64,13 +65,20 @@ class lof_storage {
     int nearest_neighbor_num;
     int reverse_nearest_neighbor_num;
     jubatus::util::data::optional<bool> ignore_kth_same_point;
+    // number of threads used to refresh neighbors of updated rows
+    jubatus::util::data::optional<int32_t> threads;
+    // cache k-NN of rows between updates; exact only if the nearest
+    // neighbor engine finds neighbors symmetrically
+    jubatus::util::data::optional<bool> neighbor_cache;
 
     template<typename Ar>
     void serialize(Ar& ar) {
       ar
           & JUBA_MEMBER(nearest_neighbor_num)
           & JUBA_MEMBER(reverse_nearest_neighbor_num)
-          & JUBA_MEMBER(ignore_kth_same_point);
+          & JUBA_MEMBER(ignore_kth_same_point)
+          & JUBA_MEMBER(threads)
+          & JUBA_MEMBER(neighbor_cache);
     }
   };
 
@@ -149,12 +157,15 @@ class lof_storage {
   }
   void unpack(msgpack::object o) {
     o.convert(this);
+    clear_neighbor_cache();
   }
 
   MSGPACK_DEFINE(lof_table_, lof_table_diff_,
       neighbor_num_, reverse_nn_num_, ignore_kth_same_point_);
 
  private:
+  typedef std::vector<std::pair<std::string, double> > neighbor_list;
+
   static void mark_removed(lof_entry& entry);
   static bool is_removed(const lof_entry& entry);
 
@@ -166,11 +177,27 @@ class lof_storage {
   void collect_neighbors(
       const std::string& row,
       jubatus::util::data::unordered_set<std::string>& nn) const;
+  void collect_moved_neighbors(
+      const std::string& row,
+      jubatus::util::data::unordered_set<std::string>& nn);
+
+  void query_neighbors(
+      const std::vector<std::string>& rows,
+      std::vector<neighbor_list>& neighbors) const;
+  void query_neighbors_range(
+      const std::vector<std::string>* rows,
+      std::vector<neighbor_list>* neighbors,
+      size_t begin,
+      size_t end) const;
+
+  void cache_neighbors(const std::string& row, const neighbor_list& neighbors);
+  double cached_kdist(const neighbor_list& neighbors) const;
+  void invalidate_neighbors(const std::string& row);
+  void invalidate_reverse_neighbors(const std::string& row);
+  void clear_neighbor_cache();
 
   void update_entries(
       const jubatus::util::data::unordered_set<std::string>& rows);
-  void update_kdist(const std::string& row);
-  void update_lrd(const std::string& row);
 
   void update_kdist_with_neighbors(
       const std::string& row,
@@ -186,6 +213,26 @@ class lof_storage {
   uint32_t reverse_nn_num_;  // ck of ck-nn as an approx. of k-reverse-nn
   bool ignore_kth_same_point_;
   uint64_t ignored_count_;
+  uint32_t threads_;
+  bool neighbor_cache_;
+
+  /**
+   * Cache of the k-NN of rows (same as ``neighbor_row`` of ``nn_engine_``
+   * with ``neighbor_num_``), so that unaffected rows need not be queried
+   * again when a row is updated.  ``reverse_knn_`` maps a row to the rows
+   * whose cached k-NN contains it, and ``kdist_index_`` orders cached rows
+   * by their k-distance.  Rows are taken as affected by an update when the
+   * reverse query of the updated row finds them, or when their k-distance
+   * reaches beyond its farthest result; this holds for exact engines, while
+   * LSH-based engines may miss some of them.  The cache is not serialized
+   * and is dropped on MIX, as other nodes may change the nearest neighbor
+   * engine.
+   */
+  jubatus::util::data::unordered_map<std::string, neighbor_list> knn_cache_;
+  jubatus::util::data::unordered_map<
+      std::string, jubatus::util::data::unordered_set<std::string> >
+      reverse_knn_;
+  std::set<std::pair<double, std::string> > kdist_index_;
 
   jubatus::util::lang::shared_ptr<core::recommender::recommender_base>
     nn_engine_;
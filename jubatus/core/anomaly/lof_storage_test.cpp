@@ -143,6 +143,55 @@ TEST(lof_storage, ignore_kth_same_point) {
   EXPECT_EQ(status["num_ignored"], "1");
 }
 
+TEST(lof_storage, neighbor_cache) {
+  // Distances between points of integer coordinates are exact, so the
+  // results must be the same with and without the cache.
+  shared_ptr<recommender::recommender_base> cached_nn(
+      recommender_factory::create_recommender(
+          "inverted_index_euclid", common::jsonconfig::config(), ""));
+  shared_ptr<recommender::recommender_base> fresh_nn(
+      recommender_factory::create_recommender(
+          "inverted_index_euclid", common::jsonconfig::config(), ""));
+  lof_storage::config config;
+  config.nearest_neighbor_num = 3;
+  config.reverse_nearest_neighbor_num = 6;
+  config.threads = 2;
+  lof_storage fresh(config, fresh_nn);
+  config.neighbor_cache = true;
+  lof_storage cached(config, cached_nn);
+
+  jubatus::util::math::random::mtrand rand(0);
+  for (int i = 0; i < 300; ++i) {
+    const string id = lexical_cast<string>(rand.next_int(40));
+    if (rand.next_int(10) == 0) {
+      cached.remove_row(id);
+      fresh.remove_row(id);
+    } else {
+      common::sfv_t v;
+      v.push_back(std::make_pair("x", rand.next_int(100)));
+      v.push_back(std::make_pair("y", rand.next_int(100)));
+      cached.update_row(id, v);
+      fresh.update_row(id, v);
+    }
+
+    vector<string> ids;
+    fresh.get_all_row_ids(ids);
+    for (size_t j = 0; j < ids.size(); ++j) {
+      ASSERT_EQ(fresh.get_kdist(ids[j]), cached.get_kdist(ids[j]));
+      ASSERT_EQ(fresh.get_lrd(ids[j]), cached.get_lrd(ids[j]));
+    }
+  }
+
+  cached.update_all();
+  fresh.update_all();
+  vector<string> ids;
+  fresh.get_all_row_ids(ids);
+  for (size_t j = 0; j < ids.size(); ++j) {
+    EXPECT_EQ(fresh.get_kdist(ids[j]), cached.get_kdist(ids[j]));
+    EXPECT_EQ(fresh.get_lrd(ids[j]), cached.get_lrd(ids[j]));
+  }
+}
+
 // One dimensional example (points = { -1, 0, 1, 10 }, k = 2)
 class lof_storage_one_dimensional_test : public ::testing::Test {
  protected:
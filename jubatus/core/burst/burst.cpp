@@ -22,6 +22,7 @@
 #include <vector>
 #include "jubatus/util/lang/noncopyable.h"
 #include "jubatus/util/data/unordered_map.h"
+#include "jubatus/util/data/string/aho_corasick.h"
 
 #include "../common/assert.hpp"
 #include "../common/exception.hpp"
@@ -222,13 +223,16 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
       aggregators_.insert(
           std::make_pair(keyword,
                          aggregate_helper_(options_, r.first->second)));
+      invalidate_matcher_();
     }
 
     return true;
   }
 
   bool remove_keyword(const string& keyword) {
-    aggregators_.erase(keyword);
+    if (aggregators_.erase(keyword) > 0) {
+      invalidate_matcher_();
+    }
     return storages_.erase(keyword) > 0;
   }
 
@@ -265,12 +269,27 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
   }
 
   bool add_document(const string& str, double pos) {
+    if (!matcher_) {
+      build_matcher_();
+    }
+
+    // scan the document once; word IDs follow the iteration order of
+    // aggregators_, which is unchanged since the matcher was built
+    std::vector<std::pair<int, int> > found;
+    matcher_->search(str, found);
+    std::vector<char> hits(aggregators_.size(), 0);
+    for (size_t i = 0; i < found.size(); ++i) {
+      hits[found[i].first] = 1;
+    }
+
     bool result = true;
+    size_t i = 0;
     for (aggregators_t::iterator iter = aggregators_.begin();
-         iter != aggregators_.end(); ++iter) {
+         iter != aggregators_.end(); ++iter, ++i) {
       const string& keyword = iter->first;
       aggregate_helper_& a = iter->second;
-      int r = str.find(keyword) != str.npos ? 1 : 0;
+      // an empty keyword is found in every document
+      int r = (hits[i] || keyword.empty()) ? 1 : 0;
       result = a.add_document(1, r, pos) && result;
     }
     return result;
@@ -370,6 +389,9 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
     for (size_t i = 0; i < to_be_removed.size(); ++i) {
       aggregators_.erase(to_be_removed[i]);
     }
+    if (!to_be_removed.empty()) {
+      invalidate_matcher_();
+    }
 
     has_been_mixed_ = true;
     return true;
@@ -398,6 +420,7 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
         aggregators_.insert(
             std::make_pair(keywords[i],
                            aggregate_helper_(options_, s->second)));
+        invalidate_matcher_();
       }
     }
   }
@@ -405,6 +428,7 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
   void clear() {
     aggregators_t().swap(aggregators_);
     storages_t().swap(storages_);
+    invalidate_matcher_();
   }
   storage::version get_version() const {
     return storage::version();
@@ -443,6 +467,7 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
     options_ = unpacked_options;
     storages_.swap(unpacked_storages);
     aggregators_.swap(unpacked_aggregators);
+    invalidate_matcher_();
   }
 
  private:
@@ -451,6 +476,25 @@ class burst::impl_ : jubatus::util::lang::noncopyable {
   storages_t storages_;
   bool has_been_mixed_;
 
+  // Aho-Corasick automaton over the keys of aggregators_, built lazily by
+  // add_document and dropped whenever the set of aggregators changes
+  shared_ptr<jubatus::util::data::string::aho_corasick> matcher_;
+
+  void build_matcher_() {
+    std::vector<string> keywords;
+    keywords.reserve(aggregators_.size());
+    for (aggregators_t::const_iterator iter = aggregators_.begin();
+         iter != aggregators_.end(); ++iter) {
+      keywords.push_back(iter->first);
+    }
+    matcher_.reset(
+        new jubatus::util::data::string::aho_corasick(keywords));
+  }
+
+  void invalidate_matcher_() {
+    matcher_.reset();
+  }
+
   const result_storage* get_storage_(const string& keyword) const {
     storages_t::const_iterator iter = storages_.find(keyword);
     if (iter == storages_.end()) {
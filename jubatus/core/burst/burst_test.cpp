@@ -193,6 +193,35 @@ TEST(burst, simple) {
   }
 }
 
+TEST(burst, overlapping_keywords) {
+  burst tested(default_burst_options);
+  const keyword_params& params = default_keyword_params;
+  ASSERT_TRUE(tested.add_keyword("has", params, true));
+  ASSERT_TRUE(tested.add_keyword("haskell", params, true));
+  ASSERT_TRUE(tested.add_keyword("kell", params, true));
+
+  ASSERT_TRUE(tested.add_document("haskell", 0.5));
+  ASSERT_TRUE(tested.add_document("ask hell", 0.5));
+  ASSERT_TRUE(tested.add_document("kellhas", 0.5));
+
+  // keywords changed between documents
+  ASSERT_TRUE(tested.remove_keyword("kell"));
+  ASSERT_TRUE(tested.add_keyword("ell", params, true));
+  ASSERT_TRUE(tested.add_document("hello haskell", 1.5));
+
+  tested.calculate_results();
+
+  EXPECT_EQ(3, tested.get_result("has").get_batch_at(0.5).d);
+  EXPECT_EQ(2, tested.get_result("has").get_batch_at(0.5).r);
+  EXPECT_EQ(1, tested.get_result("haskell").get_batch_at(0.5).r);
+
+  EXPECT_EQ(1, tested.get_result("has").get_batch_at(1.5).r);
+  EXPECT_EQ(1, tested.get_result("haskell").get_batch_at(1.5).r);
+  EXPECT_EQ(1, tested.get_result("ell").get_batch_at(1.5).d);
+  EXPECT_EQ(1, tested.get_result("ell").get_batch_at(1.5).r);
+  EXPECT_FALSE(tested.get_result("kell").is_valid());
+}
+
 }  // namespace burst
 }  // namespace core
 }  // namespace jubatus
@@ -20,8 +20,6 @@
 #include <cmath>
 #include <string>
 
-#include "jubatus/util/concurrent/lock.h"
-#include "classifier_util.hpp"
 #include "../common/exception.hpp"
 
 using std::string;
@@ -30,6 +28,31 @@ namespace jubatus {
 namespace core {
 namespace classifier {
 
+namespace {
+
+struct arow_update {
+  arow_update(double alpha, double beta)
+      : alpha(alpha), beta(beta) {
+  }
+
+  void operator()(
+      double val,
+      storage::val2_t& pos_val,
+      storage::val2_t& neg_val) const {
+    pos_val = storage::val2_t(
+        pos_val.v1 + alpha * pos_val.v2 * val,
+        pos_val.v2 - beta * pos_val.v2 * pos_val.v2 * val * val);
+    neg_val = storage::val2_t(
+        neg_val.v1 - alpha * neg_val.v2 * val,
+        neg_val.v2 - beta * neg_val.v2 * neg_val.v2 * val * val);
+  }
+
+  double alpha;
+  double beta;
+};
+
+}  // namespace
+
 arow::arow(storage_ptr storage)
     : linear_classifier(storage) {
 }
@@ -71,32 +94,7 @@ void arow::update(
     double beta,
     const std::string& pos_label,
     const std::string& neg_label) {
-  util::concurrent::scoped_wlock lk(storage_->get_lock());
-  for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
-    const string& feature = it->first;
-    double val = it->second;
-    storage::feature_val2_t ret;
-    storage_->get2_nolock(feature, ret);
-
-    storage::val2_t pos_val(0.0, 1.0);
-    storage::val2_t neg_val(0.0, 1.0);
-    ClassifierUtil::get_two(ret, pos_label, neg_label, pos_val, neg_val);
-
-    storage_->set2_nolock(
-        feature,
-        pos_label,
-        storage::val2_t(
-            pos_val.v1 + alpha * pos_val.v2 * val,
-            pos_val.v2 - beta * pos_val.v2 * pos_val.v2 * val * val));
-    if (neg_label != "") {
-      storage_->set2_nolock(
-          feature,
-          neg_label,
-          storage::val2_t(
-              neg_val.v1 - alpha * neg_val.v2 * val,
-              neg_val.v2 - beta * neg_val.v2 * neg_val.v2 * val * val));
-    }
-  }
+  update_weights2(sfv, pos_label, neg_label, arow_update(alpha, beta));
   touch(pos_label);
 }
 
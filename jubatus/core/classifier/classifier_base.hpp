@@ -45,6 +45,17 @@ class classifier_base {
   virtual void classify_with_scores(
       const common::sfv_t& fv, classify_result& scores) const = 0;
 
+  // Classifies all of |fvs| at once.  Implementations may override this to
+  // share locks and scratch buffers over the whole batch.
+  virtual void bulk_classify_with_scores(
+      const std::vector<common::sfv_t>& fvs,
+      std::vector<classify_result>& scores) const {
+    scores.resize(fvs.size());
+    for (size_t i = 0; i < fvs.size(); ++i) {
+      classify_with_scores(fvs[i], scores[i]);
+    }
+  }
+
   virtual void set_label_unlearner(
       jubatus::util::lang::shared_ptr<unlearner::unlearner_base>
           label_unlearner) = 0;
@@ -59,6 +70,19 @@ class classifier_base {
 
   virtual void pack(framework::packer& pk) const = 0;
   virtual void unpack(msgpack::object o) = 0;
+
+  // Writes the model to be read by |unpack_chunked|.  Classifiers whose
+  // storage can be written in batches of at most |chunk_rows| rows override
+  // these; the default writes the model as a single object.
+  virtual void pack_chunked(framework::packer& pk, size_t chunk_rows) const {
+    pack(pk);
+  }
+  virtual void unpack_chunked(framework::unpacker& unpacker) {
+    msgpack::unpacked model;
+    unpacker.next(model);
+    unpack(model.get());
+  }
+
   virtual void clear() = 0;
 
   virtual std::vector<framework::mixable*> get_mixables() = 0;
@@ -21,7 +21,9 @@
 #include "classifier.hpp"
 #include "../common/exception.hpp"
 #include "../common/jsonconfig.hpp"
+#include "../framework/diff_codec.hpp"
 #include "../storage/storage_base.hpp"
+#include "../storage/storage_factory.hpp"
 #include "../unlearner/unlearner_factory.hpp"
 #include "../nearest_neighbor/nearest_neighbor_factory.hpp"
 
@@ -44,12 +46,46 @@ struct unlearner_config {
   }
 };
 
+struct mix_compression_config {
+  jubatus::util::data::optional<framework::diff_codec_config>
+      mix_compression;
+
+  template<typename Ar>
+  void serialize(Ar& ar) {
+    ar & JUBA_MEMBER(mix_compression);
+  }
+};
+
+struct weight_storage_config {
+  // "local_mixture" (default) or "local_flat", which keeps the weights of
+  // all labels of a feature in one row and scores them in a single pass
+  jubatus::util::data::optional<std::string> storage;
+
+  template<typename Ar>
+  void serialize(Ar& ar) {
+    ar & JUBA_MEMBER(storage);
+  }
+};
+
+struct linear_classifier_config
+    : public unlearner_config, mix_compression_config, weight_storage_config {
+  template<typename Ar>
+  void serialize(Ar& ar) {
+    unlearner_config::serialize(ar);
+    mix_compression_config::serialize(ar);
+    weight_storage_config::serialize(ar);
+  }
+};
+
 struct unlearning_classifier_config
-    : public classifier_config, unlearner_config {
+    : public classifier_config, unlearner_config, mix_compression_config,
+      weight_storage_config {
   template<typename Ar>
   void serialize(Ar& ar) {
     classifier_config::serialize(ar);
     unlearner_config::serialize(ar);
+    mix_compression_config::serialize(ar);
+    weight_storage_config::serialize(ar);
   }
 };
 
@@ -95,6 +131,20 @@ create_unlearner(const unlearner_config& conf) {
   }
 }
 
+// returns the storage selected by the config, or `storage` if not set
+shared_ptr<storage::storage_base> select_storage(
+    const weight_storage_config& conf,
+    shared_ptr<storage::storage_base> storage) {
+  if (!conf.storage) {
+    return storage;
+  }
+  if (*conf.storage != "local_mixture" && *conf.storage != "local_flat") {
+    throw JUBATUS_EXCEPTION(common::invalid_parameter(
+        "storage must be local_mixture or local_flat"));
+  }
+  return storage::storage_factory::create_storage(*conf.storage);
+}
+
 }  // namespace
 
 shared_ptr<classifier_base> classifier_factory::create_classifier(
@@ -102,19 +152,26 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     const common::jsonconfig::config& param,
     jubatus::util::lang::shared_ptr<storage::storage_base> storage) {
   jubatus::util::lang::shared_ptr<unlearner::unlearner_base> unlearner;
+  jubatus::util::data::optional<framework::diff_codec_config> mix_compression;
   shared_ptr<classifier_base> res;
   if (name == "perceptron") {
     // perceptron doesn't have parameter
     if (param.type() != jubatus::util::text::json::json::Null) {
-      unlearner_config conf = config_cast_check<unlearner_config>(param);
+      linear_classifier_config conf =
+          config_cast_check<linear_classifier_config>(param);
       unlearner = create_unlearner(conf);
+      mix_compression = conf.mix_compression;
+      storage = select_storage(conf, storage);
     }
     res.reset(new perceptron(storage));
   } else if (name == "PA" || name == "passive_aggressive") {
     // passive_aggressive doesn't have parameter
     if (param.type() != jubatus::util::text::json::json::Null) {
-      unlearner_config conf = config_cast_check<unlearner_config>(param);
+      linear_classifier_config conf =
+          config_cast_check<linear_classifier_config>(param);
       unlearner = create_unlearner(conf);
+      mix_compression = conf.mix_compression;
+      storage = select_storage(conf, storage);
     }
     res.reset(new passive_aggressive(storage));
   } else if (name == "PA1" || name == "passive_aggressive_1") {
@@ -126,6 +183,8 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     unlearning_classifier_config conf
         = config_cast_check<unlearning_classifier_config>(param);
     unlearner = create_unlearner(conf);
+    mix_compression = conf.mix_compression;
+    storage = select_storage(conf, storage);
     res.reset(new passive_aggressive_1(conf, storage));
   } else if (name == "PA2" || name == "passive_aggressive_2") {
     if (param.type() == jubatus::util::text::json::json::Null) {
@@ -136,6 +195,8 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     unlearning_classifier_config conf
         = config_cast_check<unlearning_classifier_config>(param);
     unlearner = create_unlearner(conf);
+    mix_compression = conf.mix_compression;
+    storage = select_storage(conf, storage);
     res.reset(new passive_aggressive_2(conf, storage));
   } else if (name == "CW" || name == "confidence_weighted") {
     if (param.type() == jubatus::util::text::json::json::Null) {
@@ -146,6 +207,8 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     unlearning_classifier_config conf
         = config_cast_check<unlearning_classifier_config>(param);
     unlearner = create_unlearner(conf);
+    mix_compression = conf.mix_compression;
+    storage = select_storage(conf, storage);
     res.reset(new confidence_weighted(conf, storage));
   } else if (name == "AROW" || name == "arow") {
     if (param.type() == jubatus::util::text::json::json::Null) {
@@ -156,6 +219,8 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     unlearning_classifier_config conf
         = config_cast_check<unlearning_classifier_config>(param);
     unlearner = create_unlearner(conf);
+    mix_compression = conf.mix_compression;
+    storage = select_storage(conf, storage);
     res.reset(new arow(conf, storage));
   } else if (name == "NHERD" || name == "normal_herd") {
     if (param.type() == jubatus::util::text::json::json::Null) {
@@ -166,6 +231,8 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
     unlearning_classifier_config conf
         = config_cast_check<unlearning_classifier_config>(param);
     unlearner = create_unlearner(conf);
+    mix_compression = conf.mix_compression;
+    storage = select_storage(conf, storage);
     res.reset(new normal_herd(conf, storage));
   } else if (name == "NN" || name == "nearest_neighbor") {
     if (param.type() == jubatus::util::text::json::json::Null) {
@@ -211,6 +278,11 @@ shared_ptr<classifier_base> classifier_factory::create_classifier(
   if (unlearner) {
     res->set_label_unlearner(unlearner);
   }
+  if (mix_compression) {
+    // only set for linear classifiers
+    static_cast<linear_classifier&>(*res).set_mix_compression(
+        *mix_compression);
+  }
   return res;
 }
 
@@ -14,6 +14,7 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <map>
 #include <string>
 #include <gtest/gtest.h>
 
@@ -23,6 +24,7 @@
 #include "../storage/local_storage.hpp"
 #include "../storage/storage_base.hpp"
 
+using jubatus::util::lang::shared_ptr;
 using jubatus::util::text::json::json;
 using jubatus::util::text::json::json_null;
 using jubatus::util::text::json::json_object;
@@ -94,6 +96,60 @@ TEST(classifier_factory, create_with_unlearner) {
   }
 }
 
+TEST(classifier_factory, create_with_mix_compression) {
+  storage_ptr s(new storage::local_storage);
+
+  json js(new json_object);
+  js["mix_compression"] = new json_object;
+  js["mix_compression"]["quantization"] = to_json(std::string("int8"));
+  js["mix_compression"]["top_k"] = to_json(1000);
+  {
+    common::jsonconfig::config conf(js);
+    EXPECT_NO_THROW(
+        classifier_factory::create_classifier("perceptron", conf, s));
+    EXPECT_NO_THROW(classifier_factory::create_classifier("PA", conf, s));
+  }
+
+  js["regularization_weight"] = to_json(1.0);
+  {
+    common::jsonconfig::config conf(js);
+    EXPECT_NO_THROW(classifier_factory::create_classifier("AROW", conf, s));
+  }
+
+  js["mix_compression"]["quantization"] = to_json(std::string("int4"));
+  common::jsonconfig::config invalid(js);
+  EXPECT_THROW(classifier_factory::create_classifier("AROW", invalid, s),
+               common::invalid_parameter);
+}
+
+TEST(classifier_factory, create_with_storage) {
+  storage_ptr s(new storage::local_storage);
+
+  json js(new json_object);
+  js["storage"] = to_json(std::string("local_flat"));
+  {
+    common::jsonconfig::config conf(js);
+    EXPECT_NO_THROW(
+        classifier_factory::create_classifier("perceptron", conf, s));
+  }
+
+  js["regularization_weight"] = to_json(1.0);
+  {
+    common::jsonconfig::config conf(js);
+    shared_ptr<classifier_base> c =
+        classifier_factory::create_classifier("AROW", conf, s);
+    std::map<std::string, std::string> status;
+    c->get_status(status);
+    // only reported by local_storage_flat
+    EXPECT_EQ(1u, status.count("num_slots"));
+  }
+
+  js["storage"] = to_json(std::string("local"));
+  common::jsonconfig::config invalid(js);
+  EXPECT_THROW(classifier_factory::create_classifier("AROW", invalid, s),
+               common::invalid_parameter);
+}
+
 // --- validation test ---
 
 TEST(classifier_factory, invalid_unlearner_config) {
@@ -28,6 +28,8 @@
 
 #include "classifier.hpp"
 #include "../storage/local_storage.hpp"
+#include "../storage/local_storage_flat.hpp"
+#include "../storage/local_storage_mixture.hpp"
 #include "../common/exception.hpp"
 #include "../common/jsonconfig.hpp"
 #include "../unlearner/lru_unlearner.hpp"
@@ -247,6 +249,120 @@ typedef testing::Types<
 
 INSTANTIATE_TYPED_TEST_CASE_P(cl, classifier_test, classifier_types);
 
+template<typename T>
+class linear_classifier_test : public testing::Test {
+};
+
+TYPED_TEST_CASE_P(linear_classifier_test);
+
+TYPED_TEST_P(linear_classifier_test, dense_storage) {
+  // label-indexed rows must give the same model as the generic storage
+  storage_ptr s(new local_storage);
+  storage_ptr flat(new storage::local_storage_flat);
+  TypeParam p(s);
+  TypeParam q(flat);
+
+  jubatus::util::math::random::mtrand rand(0);
+  for (size_t i = 0; i < 300; ++i) {
+    pair<string, vector<double> > d = gen_random_data(rand);
+    common::sfv_t fv = convert(d.second);
+    p.train(fv, d.first);
+    q.train(fv, d.first);
+  }
+
+  for (size_t i = 0; i < 50; ++i) {
+    pair<string, vector<double> > d = gen_random_data(rand);
+    common::sfv_t fv = convert(d.second);
+    classify_result expected;
+    classify_result actual;
+    p.classify_with_scores(fv, expected);
+    q.classify_with_scores(fv, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      bool found = false;
+      for (size_t k = 0; k < actual.size(); ++k) {
+        if (actual[k].label == expected[j].label) {
+          EXPECT_NEAR(expected[j].score, actual[k].score, 1e-9);
+          found = true;
+        }
+      }
+      EXPECT_TRUE(found);
+    }
+    EXPECT_EQ(p.classify(fv), q.classify(fv));
+
+    vector<common::sfv_t> fvs(1, fv);
+    vector<classify_result> bulk;
+    q.bulk_classify_with_scores(fvs, bulk);
+    ASSERT_EQ(1u, bulk.size());
+    EXPECT_EQ(actual.size(), bulk[0].size());
+  }
+}
+
+void mix(linear_classifier& lhs, linear_classifier& rhs) {
+  framework::linear_function_mixer* l =
+      dynamic_cast<framework::linear_function_mixer*>(lhs.get_mixables()[0]);
+  framework::linear_function_mixer* r =
+      dynamic_cast<framework::linear_function_mixer*>(rhs.get_mixables()[0]);
+  framework::diffv mixed, diff;
+  l->get_diff(mixed);
+  r->get_diff(diff);
+  l->mix(diff, mixed);
+  ASSERT_TRUE(l->put_diff(mixed));
+  ASSERT_TRUE(r->put_diff(mixed));
+}
+
+TYPED_TEST_P(linear_classifier_test, dense_storage_mix) {
+  // MIX of label-indexed rows must give the same model as local_mixture
+  TypeParam p1(storage_ptr(new storage::local_storage_mixture));
+  TypeParam p2(storage_ptr(new storage::local_storage_mixture));
+  TypeParam q1(storage_ptr(new storage::local_storage_flat));
+  TypeParam q2(storage_ptr(new storage::local_storage_flat));
+
+  jubatus::util::math::random::mtrand rand(0);
+  for (int round = 0; round < 3; ++round) {
+    for (size_t i = 0; i < 100; ++i) {
+      pair<string, vector<double> > d = gen_random_data(rand);
+      common::sfv_t fv = convert(d.second);
+      if (i % 2 == 0) {
+        p1.train(fv, d.first);
+        q1.train(fv, d.first);
+      } else {
+        p2.train(fv, d.first);
+        q2.train(fv, d.first);
+      }
+    }
+    mix(p1, p2);
+    mix(q1, q2);
+  }
+
+  for (size_t i = 0; i < 50; ++i) {
+    pair<string, vector<double> > d = gen_random_data(rand);
+    common::sfv_t fv = convert(d.second);
+    classify_result expected;
+    classify_result actual;
+    p1.classify_with_scores(fv, expected);
+    q2.classify_with_scores(fv, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      for (size_t k = 0; k < actual.size(); ++k) {
+        if (actual[k].label == expected[j].label) {
+          EXPECT_NEAR(expected[j].score, actual[k].score, 1e-9);
+        }
+      }
+    }
+  }
+}
+
+REGISTER_TYPED_TEST_CASE_P(linear_classifier_test, dense_storage,
+                           dense_storage_mix);
+
+typedef testing::Types<
+  perceptron, passive_aggressive, passive_aggressive_1, passive_aggressive_2,
+  confidence_weighted, arow, normal_herd> linear_classifier_types;
+
+INSTANTIATE_TYPED_TEST_CASE_P(
+    cl, linear_classifier_test, linear_classifier_types);
+
 TEST(classifier_config_test, regularization_weight) {
   storage_ptr s(new local_storage);
   classifier_config c;
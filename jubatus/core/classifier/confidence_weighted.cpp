@@ -20,8 +20,6 @@
 #include <cmath>
 #include <string>
 
-#include "jubatus/util/concurrent/lock.h"
-#include "classifier_util.hpp"
 #include "../common/exception.hpp"
 
 using std::string;
@@ -30,6 +28,32 @@ namespace jubatus {
 namespace core {
 namespace classifier {
 
+namespace {
+
+struct cw_update {
+  cw_update(double step_width, float C)
+      : step_width(step_width), C(C) {
+  }
+
+  void operator()(
+      double val,
+      storage::val2_t& pos_val,
+      storage::val2_t& neg_val) const {
+    double covar_pos_step = 2.0 * step_width * val * val * C;
+    double covar_neg_step = 2.0 * step_width * val * val * C;
+
+    pos_val = storage::val2_t(pos_val.v1 + step_width * pos_val.v2 * val,
+                              1.0 / (1.0 / pos_val.v2 + covar_pos_step));
+    neg_val = storage::val2_t(neg_val.v1 - step_width * neg_val.v2 * val,
+                              1.0 / (1.0 / neg_val.v2 + covar_neg_step));
+  }
+
+  double step_width;
+  float C;
+};
+
+}  // namespace
+
 confidence_weighted::confidence_weighted(storage_ptr storage)
     : linear_classifier(storage) {
 }
@@ -72,34 +96,8 @@ void confidence_weighted::update(
     double step_width,
     const string& pos_label,
     const string& neg_label) {
-  util::concurrent::scoped_wlock lk(storage_->get_lock());
-  for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
-    const string& feature = it->first;
-    double val = it->second;
-    storage::feature_val2_t val2;
-    storage_->get2_nolock(feature, val2);
-
-    storage::val2_t pos_val(0.0, 1.0);
-    storage::val2_t neg_val(0.0, 1.0);
-    ClassifierUtil::get_two(val2, pos_label, neg_label, pos_val, neg_val);
-
-    const float C = config_.regularization_weight;
-    double covar_pos_step = 2.0 * step_width * val * val * C;
-    double covar_neg_step = 2.0 * step_width * val * val * C;
-
-    storage_->set2_nolock(
-        feature,
-        pos_label,
-        storage::val2_t(pos_val.v1 + step_width * pos_val.v2 * val,
-                        1.0 / (1.0 / pos_val.v2 + covar_pos_step)));
-    if (neg_label != "") {
-      storage_->set2_nolock(
-          feature,
-          neg_label,
-          storage::val2_t(neg_val.v1 - step_width * neg_val.v2 * val,
-                          1.0 / (1.0 / neg_val.v2 + covar_neg_step)));
-    }
-  }
+  const float C = config_.regularization_weight;
+  update_weights2(sfv, pos_label, neg_label, cw_update(step_width, C));
   touch(pos_label);
 }
 
@@ -40,7 +40,10 @@ namespace core {
 namespace classifier {
 
 linear_classifier::linear_classifier(storage_ptr storage)
-  : storage_(storage), mixable_storage_(storage_),
+  : storage_(storage),
+    dense_storage_(
+        dynamic_cast<core::storage::local_storage_flat*>(storage.get())),
+    mixable_storage_(storage_),
     labels_(core::storage::mixable_labels::model_ptr(
         new core::storage::labels())) {
 }
@@ -71,6 +74,13 @@ void linear_classifier::classify_with_scores(
     const common::sfv_t& sfv,
     classify_result& scores) const {
   scores.clear();
+  if (dense_storage_) {
+    util::concurrent::scoped_rlock lk(storage_->get_lock());
+    vector<double> dense_scores;
+    dense_storage_->inp_dense_nolock(sfv, dense_scores);
+    make_classify_result(dense_scores, scores);
+    return;
+  }
 
   map_feature_val1_t ret;
   storage_->inp(sfv, ret);
@@ -80,7 +90,65 @@ void linear_classifier::classify_with_scores(
   }
 }
 
+void linear_classifier::bulk_classify_with_scores(
+    const std::vector<common::sfv_t>& fvs,
+    std::vector<classify_result>& scores) const {
+  scores.resize(fvs.size());
+
+  // Take the storage lock once for the whole batch and reuse the
+  // intermediate map among all queries.
+  util::concurrent::scoped_rlock lk(storage_->get_lock());
+  if (dense_storage_) {
+    vector<double> dense_scores;
+    for (size_t i = 0; i < fvs.size(); ++i) {
+      dense_storage_->inp_dense_nolock(fvs[i], dense_scores);
+      make_classify_result(dense_scores, scores[i]);
+    }
+    return;
+  }
+
+  map_feature_val1_t ret;
+  for (size_t i = 0; i < fvs.size(); ++i) {
+    classify_result& s = scores[i];
+    s.clear();
+    storage_->inp_nolock(fvs[i], ret);
+    s.reserve(ret.size());
+    for (map_feature_val1_t::const_iterator it = ret.begin(); it != ret.end();
+        ++it) {
+      s.push_back(classify_result_elem(it->first, it->second));
+    }
+  }
+}
+
+void linear_classifier::make_classify_result(
+    const vector<double>& scores,
+    classify_result& result) const {
+  result.clear();
+  result.reserve(scores.size());
+  for (size_t i = 0; i < scores.size(); ++i) {
+    result.push_back(classify_result_elem(
+        dense_storage_->get_label_nolock(i), scores[i]));
+  }
+}
+
 string linear_classifier::classify(const common::sfv_t& fv) const {
+  if (dense_storage_) {
+    // pick the label on label IDs and build only its name
+    util::concurrent::scoped_rlock lk(storage_->get_lock());
+    vector<double> scores;
+    dense_storage_->inp_dense_nolock(fv, scores);
+    if (scores.empty()) {
+      return string();
+    }
+    size_t max_id = 0;
+    for (size_t i = 1; i < scores.size(); ++i) {
+      if (scores[i] > scores[max_id]) {
+        max_id = i;
+      }
+    }
+    return dense_storage_->get_label_nolock(max_id);
+  }
+
   classify_result result;
   classify_with_scores(fv, result);
   double max_score = -DBL_MAX;
@@ -95,9 +163,17 @@ string linear_classifier::classify(const common::sfv_t& fv) const {
   return max_class;
 }
 
+void linear_classifier::set_mix_compression(
+    const framework::diff_codec_config& conf) {
+  mixable_storage_.set_diff_codec(
+      jubatus::util::lang::shared_ptr<framework::diff_codec>(
+          new framework::diff_codec(conf)));
+}
+
 void linear_classifier::clear() {
   storage_->clear();
   labels_.get_model()->clear();
+  mixable_storage_.clear_diff_residual();
   if (unlearner_) {
     util::concurrent::scoped_lock unlearner_lk(unlearner_mutex_);
     unlearner_->clear();
@@ -163,6 +239,14 @@ double linear_classifier::calc_margin(
     const common::sfv_t& fv,
     const string& label,
     string& incorrect_label) const {
+  if (dense_storage_) {
+    util::concurrent::scoped_rlock lk(storage_->get_lock());
+    int64_t label_id;
+    int64_t incorrect_label_id;
+    return calc_dense_margin(
+        fv, label, incorrect_label, label_id, incorrect_label_id);
+  }
+
   classify_result scores;
   incorrect_label = get_largest_incorrect_label(fv, label, scores);
   double correct_score = 0.0;
@@ -183,6 +267,17 @@ double linear_classifier::calc_margin_and_variance(
     const string& label,
     string& incorrect_label,
     double& var) const {
+  if (dense_storage_) {
+    util::concurrent::scoped_rlock lk(storage_->get_lock());
+    int64_t label_id;
+    int64_t incorrect_label_id;
+    const double margin = calc_dense_margin(
+        sfv, label, incorrect_label, label_id, incorrect_label_id);
+    var = dense_storage_->calc_variance_nolock(
+        sfv, label_id, incorrect_label_id);
+    return margin;
+  }
+
   double margin = calc_margin(sfv, label, incorrect_label);
   var = 0.0;
 
@@ -206,6 +301,40 @@ double linear_classifier::calc_margin_and_variance(
   return margin;
 }
 
+// Same as calc_margin, on label-indexed scores; the caller holds the lock.
+double linear_classifier::calc_dense_margin(
+    const common::sfv_t& sfv,
+    const string& label,
+    string& incorrect_label,
+    int64_t& label_id,
+    int64_t& incorrect_label_id) const {
+  vector<double> scores;
+  dense_storage_->inp_dense_nolock(sfv, scores);
+  label_id = dense_storage_->get_label_id_nolock(label);
+  incorrect_label_id = -1;
+  for (size_t i = 0; i < scores.size(); ++i) {
+    const int64_t id = i;
+    if (id == label_id) {
+      continue;
+    }
+    if (incorrect_label_id < 0 || scores[i] > scores[incorrect_label_id]) {
+      incorrect_label_id = id;
+    }
+  }
+
+  incorrect_label.clear();
+  double correct_score = 0.0;
+  double incorrect_score = 0.0;
+  if (label_id >= 0) {
+    correct_score = scores[label_id];
+  }
+  if (incorrect_label_id >= 0) {
+    incorrect_label = dense_storage_->get_label_nolock(incorrect_label_id);
+    incorrect_score = scores[incorrect_label_id];
+  }
+  return incorrect_score - correct_score;
+}
+
 double linear_classifier::squared_norm(const common::sfv_t& fv) {
   double ret = 0.0;
   for (size_t i = 0; i < fv.size(); ++i) {
@@ -248,6 +377,43 @@ void linear_classifier::unpack(msgpack::object o) {
 
   storage_->unpack(o.via.array.ptr[i]);
   labels_.get_model()->unpack(o.via.array.ptr[i+1]);
+  mixable_storage_.clear_diff_residual();
+}
+
+void linear_classifier::pack_chunked(
+    framework::packer& pk, size_t chunk_rows) const {
+  // the unlearner and the labels are written as a header before the
+  // storage batches
+  if (unlearner_) {
+    pk.pack_array(2);
+
+    util::concurrent::scoped_lock unlearner_lk(unlearner_mutex_);
+    unlearner_->pack(pk);
+  } else {
+    pk.pack_array(1);
+  }
+  labels_.get_model()->pack(pk);
+
+  storage_->pack_chunked(pk, chunk_rows);
+}
+
+void linear_classifier::unpack_chunked(framework::unpacker& unpacker) {
+  msgpack::unpacked header;
+  unpacker.next(header);
+  const msgpack::object o = header.get();
+  if (o.type != msgpack::type::ARRAY ||
+      o.via.array.size != (unlearner_ ? 2 : 1)) {
+    throw msgpack::type_error();
+  }
+
+  if (unlearner_) {
+    util::concurrent::scoped_lock unlearner_lk(unlearner_mutex_);
+    unlearner_->unpack(o.via.array.ptr[0]);
+  }
+  labels_.get_model()->unpack(o.via.array.ptr[o.via.array.size - 1]);
+
+  storage_->unpack_chunked(unpacker);
+  mixable_storage_.clear_diff_residual();
 }
 
 std::vector<framework::mixable*> linear_classifier::get_mixables() {
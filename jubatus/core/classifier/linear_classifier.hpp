@@ -23,15 +23,18 @@
 #include <map>
 #include <string>
 #include <vector>
+#include "jubatus/util/concurrent/lock.h"
 #include "jubatus/util/concurrent/mutex.h"
 
 #include "../common/type.hpp"
 #include "../framework/linear_function_mixer.hpp"
 #include "../storage/labels.hpp"
+#include "../storage/local_storage_flat.hpp"
 #include "../storage/storage_base.hpp"
 #include "../unlearner/unlearner_base.hpp"
 #include "classifier_type.hpp"
 #include "classifier_base.hpp"
+#include "classifier_util.hpp"
 
 namespace jubatus {
 namespace core {
@@ -52,9 +55,15 @@ class linear_classifier : public classifier_base {
     return unlearner_;
   }
 
+  // compresses the weight diffs exchanged in MIX
+  void set_mix_compression(const framework::diff_codec_config& conf);
+
   std::string classify(const common::sfv_t& fv) const;
   void classify_with_scores(const common::sfv_t& fv,
                             classify_result& scores) const;
+  void bulk_classify_with_scores(
+      const std::vector<common::sfv_t>& fvs,
+      std::vector<classify_result>& scores) const;
   bool delete_label(const std::string& label);
   bool unlearn_label(const std::string& label);
   void clear();
@@ -71,6 +80,8 @@ class linear_classifier : public classifier_base {
 
   void pack(framework::packer& pk) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& pk, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
 
   std::vector<framework::mixable*> get_mixables();
 
@@ -94,15 +105,59 @@ class linear_classifier : public classifier_base {
       const std::string& label,
       classify_result& scores) const;
 
+  // Calls update(x, pos, neg) for each feature value x of sfv with the
+  // (v1, v2) weights of the labels, (0.0, 1.0) if absent, and stores the
+  // updated weights.  neg is discarded if neg_label is empty.
+  template <typename Update>
+  void update_weights2(
+      const common::sfv_t& sfv,
+      const std::string& pos_label,
+      const std::string& neg_label,
+      const Update& update) {
+    util::concurrent::scoped_wlock lk(storage_->get_lock());
+    if (dense_storage_) {
+      dense_storage_->update2_nolock(sfv, pos_label, neg_label, update);
+      return;
+    }
+    for (common::sfv_t::const_iterator it = sfv.begin();
+         it != sfv.end(); ++it) {
+      storage::feature_val2_t ret;
+      storage_->get2_nolock(it->first, ret);
+
+      storage::val2_t pos_val(0.0, 1.0);
+      storage::val2_t neg_val(0.0, 1.0);
+      ClassifierUtil::get_two(ret, pos_label, neg_label, pos_val, neg_val);
+      update(it->second, pos_val, neg_val);
+
+      storage_->set2_nolock(it->first, pos_label, pos_val);
+      if (neg_label != "") {
+        storage_->set2_nolock(it->first, neg_label, neg_val);
+      }
+    }
+  }
+
   static double squared_norm(const common::sfv_t& sfv);
   void check_touchable(const std::string& label);
   void touch(const std::string& label);
 
   storage_ptr storage_;
+  // storage_ if it keeps weights in label-indexed rows, or NULL
+  storage::local_storage_flat* dense_storage_;
   jubatus::util::lang::shared_ptr<unlearner::unlearner_base> unlearner_;
   framework::linear_function_mixer mixable_storage_;
   storage::mixable_labels labels_;
   mutable jubatus::util::concurrent::mutex unlearner_mutex_;
+
+ private:
+  void make_classify_result(
+      const std::vector<double>& scores,
+      classify_result& result) const;
+  double calc_dense_margin(
+      const common::sfv_t& sfv,
+      const std::string& label,
+      std::string& incorrect_label,
+      int64_t& label_id,
+      int64_t& incorrect_label_id) const;
 };
 
 }  // namespace classifier
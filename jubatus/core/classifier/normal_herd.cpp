@@ -20,8 +20,6 @@
 #include <cmath>
 #include <string>
 
-#include "jubatus/util/concurrent/lock.h"
-#include "classifier_util.hpp"
 #include "../common/exception.hpp"
 
 using std::string;
@@ -30,6 +28,43 @@ namespace jubatus {
 namespace core {
 namespace classifier {
 
+namespace {
+
+struct normal_herd_update {
+  normal_herd_update(double margin, double variance, float C)
+      : margin(margin), variance(variance), C(C) {
+  }
+
+  void operator()(
+      double val,
+      storage::val2_t& pos_val,
+      storage::val2_t& neg_val) const {
+    double val_covariance_pos = val * pos_val.v2;
+    double val_covariance_neg = val * neg_val.v2;
+
+    pos_val = storage::val2_t(
+        pos_val.v1
+            + (1.0 - margin) * val_covariance_pos
+                / (variance + 1.0 / C),
+        1.0
+            / ((1.0 / pos_val.v2) + (2 * C + C * C * variance)
+                * val * val));
+    neg_val = storage::val2_t(
+        neg_val.v1
+            - (1.0 - margin) * val_covariance_neg
+                / (variance + 1.0 / C),
+        1.0
+            / ((1.0 / neg_val.v2) + (2 * C + C * C * variance)
+                * val * val));
+  }
+
+  double margin;
+  double variance;
+  float C;
+};
+
+}  // namespace
+
 normal_herd::normal_herd(storage_ptr storage)
     : linear_classifier(storage) {
   config_.regularization_weight = 0.1f;
@@ -69,44 +104,9 @@ void normal_herd::update(
     double variance,
     const string& pos_label,
     const string& neg_label) {
-  util::concurrent::scoped_wlock lk(storage_->get_lock());
-  for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
-    const string& feature = it->first;
-    double val = it->second;
-    storage::feature_val2_t ret;
-    storage_->get2_nolock(feature, ret);
-
-    storage::val2_t pos_val(0.0, 1.0);
-    storage::val2_t neg_val(0.0, 1.0);
-    ClassifierUtil::get_two(ret, pos_label, neg_label, pos_val, neg_val);
-
-    double val_covariance_pos = val * pos_val.v2;
-    double val_covariance_neg = val * neg_val.v2;
-
-    const float C = config_.regularization_weight;
-    storage_->set2_nolock(
-        feature,
-        pos_label,
-        storage::val2_t(
-            pos_val.v1
-                + (1.0 - margin) * val_covariance_pos
-                    / (variance + 1.0 / C),
-            1.0
-                / ((1.0 / pos_val.v2) + (2 * C + C * C * variance)
-                    * val * val)));
-    if (neg_label != "") {
-      storage_->set2_nolock(
-          feature,
-          neg_label,
-          storage::val2_t(
-              neg_val.v1
-                  - (1.0 - margin) * val_covariance_neg
-                      / (variance + 1.0 / C),
-              1.0
-                  / ((1.0 / neg_val.v2) + (2 * C + C * C * variance)
-                      * val * val)));
-    }
-  }
+  const float C = config_.regularization_weight;
+  update_weights2(
+      sfv, pos_label, neg_label, normal_herd_update(margin, variance, C));
   touch(pos_label);
 }
 
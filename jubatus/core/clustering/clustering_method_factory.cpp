@@ -22,6 +22,7 @@
 #include "clustering_method.hpp"
 #include "kmeans_clustering_method.hpp"
 #include "dbscan_clustering_method.hpp"
+#include "util.hpp"
 #ifdef JUBATUS_USE_EIGEN
 #include "gmm_clustering_method.hpp"
 #endif
@@ -33,7 +34,6 @@ using jubatus::core::common::jsonconfig::config_cast_check;
 namespace jubatus {
 namespace core {
 namespace clustering {
-
 shared_ptr<clustering_method> clustering_method_factory::create(
     const std::string& method,
     const std::string& distance,
@@ -42,16 +42,20 @@ shared_ptr<clustering_method> clustering_method_factory::create(
   if (method == "kmeans") {
     kmeans_clustering_method::config conf =
       config_cast_check<kmeans_clustering_method::config>(config);
-      return shared_ptr<clustering_method>(
+    shared_ptr<kmeans_clustering_method> kmeans(
         new kmeans_clustering_method(conf.k, conf.seed, distance));
+    kmeans->set_threads(read_threads_config(conf.threads));
+    return kmeans;
   } else if (method == "dbscan") {
     dbscan_clustering_method::config conf =
       config_cast_check<dbscan_clustering_method::config>(config);
-      return shared_ptr<clustering_method>(
+    shared_ptr<dbscan_clustering_method> dbscan(
         new dbscan_clustering_method(
             conf.eps,
             conf.min_core_point,
             distance));
+    dbscan->set_threads(read_threads_config(conf.threads));
+    return dbscan;
 #ifdef JUBATUS_USE_EIGEN
   } else if (method == "gmm") {
     gmm_clustering_method::config conf =
@@ -70,13 +74,17 @@ shared_ptr<clustering_method> clustering_method_factory::create(
   if (method == "kmeans") {
     kmeans_clustering_method::config conf =
       config_cast_check<kmeans_clustering_method::config>(config);
-      return shared_ptr<clustering_method>(
+    shared_ptr<kmeans_clustering_method> kmeans(
         new kmeans_clustering_method(conf.k, conf.seed));
+    kmeans->set_threads(read_threads_config(conf.threads));
+    return kmeans;
   } else if (method == "dbscan") {
     dbscan_clustering_method::config conf =
       config_cast_check<dbscan_clustering_method::config>(config);
-    return shared_ptr<clustering_method>(
-      new dbscan_clustering_method(conf.eps, conf.min_core_point));
+    shared_ptr<dbscan_clustering_method> dbscan(
+        new dbscan_clustering_method(conf.eps, conf.min_core_point));
+    dbscan->set_threads(read_threads_config(conf.threads));
+    return dbscan;
 
 #ifdef JUBATUS_USE_EIGEN
   } else if (method == "gmm") {
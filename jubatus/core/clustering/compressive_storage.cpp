@@ -106,6 +106,14 @@ wplist compressive_storage::get_mine() const {
   return ret;
 }
 
+size_t compressive_storage::get_mine_size() const {
+  size_t size = 0;
+  for (size_t i = 0; i < mine_.size(); ++i) {
+    size += mine_[i].size();
+  }
+  return size;
+}
+
 void compressive_storage::forget_weight(wplist& points) {
   double factor = std::exp(-forgetting_factor_);
   typedef wplist::iterator iter;
@@ -135,7 +143,7 @@ void compressive_storage::carry_up(size_t r) {
   forget_weight(mine_[r]);
   if (!is_next_bucket_full(r)) {
     if (!reach_forgetting_threshold(r + 1) ||
-        mine_[r].size() == get_mine().size()) {
+        mine_[r].size() == get_mine_size()) {
       concat(mine_[r], mine_[r + 1]);
       mine_[r].clear();
     } else {
@@ -143,11 +151,10 @@ void compressive_storage::carry_up(size_t r) {
       mine_[r].clear();
     }
   } else {
-    wplist cr = mine_[r];
-    wplist crr = mine_[r + 1];
+    wplist crr;
+    crr.swap(mine_[r + 1]);
+    concat(mine_[r], crr);
     mine_[r].clear();
-    mine_[r + 1].clear();
-    concat(cr, crr);
     size_t dstsize = (r == 0) ? compressed_bucket_size_ :
         2 * r * r * compressed_bucket_size_;
     compressor_->compress(crr, bicriteria_base_size_,
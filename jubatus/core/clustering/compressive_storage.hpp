@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 #include <msgpack.hpp>
+#include "jubatus/util/data/optional.h"
 #include "storage.hpp"
 
 namespace jubatus {
@@ -47,6 +48,8 @@ class compressive_storage : public storage {
     double forgetting_factor;
     double forgetting_threshold;
     int seed;
+    // number of threads used to compress buckets
+    jubatus::util::data::optional<int32_t> threads;
 
     MSGPACK_DEFINE(bucket_size,
                    bucket_length,
@@ -64,7 +67,8 @@ class compressive_storage : public storage {
         & JUBA_MEMBER(bicriteria_base_size)
         & JUBA_MEMBER(forgetting_factor)
         & JUBA_MEMBER(forgetting_threshold)
-        & JUBA_MEMBER(seed);
+        & JUBA_MEMBER(seed)
+        & JUBA_MEMBER(threads);
     }
   };
 
@@ -84,6 +88,7 @@ class compressive_storage : public storage {
 
  private:
   void carry_up(size_t r);
+  size_t get_mine_size() const;
   bool is_next_bucket_full(size_t bucket_number);
   bool reach_forgetting_threshold(size_t bucket_number);
   void forget_weight(wplist& points);
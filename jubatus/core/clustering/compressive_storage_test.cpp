@@ -14,11 +14,16 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <string>
 #include <gtest/gtest.h>
 
+#include "jubatus/util/lang/cast.h"
+#include "jubatus/util/math/random.h"
 #include "compressive_storage.hpp"
 #include "compressor.hpp"
+#include "kmeans_compressor.hpp"
 
+using jubatus::util::lang::lexical_cast;
 using jubatus::util::lang::shared_ptr;
 
 namespace jubatus {
@@ -106,6 +111,65 @@ TEST(compressive_storage, carry_up) {
   }
 }
 
+TEST(compressive_storage, kmeans_compressor_threads) {
+  compressive_storage serial("", 100, 2, 20, 5, 0.0, 0.0);
+  compressive_storage parallel("", 100, 2, 20, 5, 0.0, 0.0);
+  serial.set_compressor(shared_ptr<compressor::compressor>(
+      new compressor::kmeans_compressor(0)));
+  shared_ptr<compressor::kmeans_compressor> c(
+      new compressor::kmeans_compressor(0));
+  c->set_threads(4);
+  parallel.set_compressor(c);
+
+  jubatus::util::math::random::mtrand rand(0);
+  for (size_t i = 0; i < 1000; ++i) {
+    weighted_point p;
+    p.id = lexical_cast<std::string>(i);
+    p.weight = 1.0;
+    p.data.push_back(std::make_pair("x", rand.next_double() + i % 3));
+    p.data.push_back(std::make_pair("y", rand.next_double()));
+    serial.add(p);
+    parallel.add(p);
+  }
+
+  wplist expected = serial.get_mine();
+  wplist actual = parallel.get_mine();
+  ASSERT_EQ(expected.size(), actual.size());
+  EXPECT_GT(1000u, actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].id, actual[i].id);
+    EXPECT_EQ(expected[i].weight, actual[i].weight);
+  }
+}
+
+// ids and weights are those given by the compressor working on wplist
+TEST(compressive_storage, kmeans_compressor_fixed_seed) {
+  jubatus::util::math::random::mtrand rand(0);
+  wplist points;
+  for (size_t i = 0; i < 40; ++i) {
+    weighted_point p;
+    p.id = lexical_cast<std::string>(i);
+    p.weight = 1 + i % 3;
+    p.data.push_back(std::make_pair("x", rand.next_double() + i % 3));
+    p.data.push_back(std::make_pair("y", rand.next_double()));
+    points.push_back(p);
+  }
+
+  const char* ids[] = {"29", "6", "15", "31", "35", "11", "21", "8"};
+  const double weights[] = {137. / 3, 8, 3, 22, 9, 0, 7, 12};
+  for (uint32_t threads = 0; threads <= 4; threads += 4) {
+    compressor::kmeans_compressor c(0);
+    c.set_threads(threads);
+    wplist compressed;
+    c.compress(points, 3, 8, compressed);
+    ASSERT_EQ(8u, compressed.size());
+    for (size_t i = 0; i < compressed.size(); ++i) {
+      EXPECT_EQ(ids[i], compressed[i].id);
+      EXPECT_DOUBLE_EQ(weights[i], compressed[i].weight);
+    }
+  }
+}
+
 }  // namespace clustering
 }  // namespace core
 }  // namespace jubatus
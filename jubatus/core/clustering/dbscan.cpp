@@ -16,13 +16,19 @@
 
 #include "dbscan.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <utility>
 #include <vector>
 #include <string>
 #include "clustering.hpp"
 #include "util.hpp"
+#include "jubatus/util/lang/bind.h"
 #include "jubatus/util/lang/cast.h"
 #include "../common/exception.hpp"
+#include "../common/thread_pool.hpp"
 
+using std::pair;
 using std::vector;
 using std::string;
 using jubatus::util::lang::lexical_cast;
@@ -32,13 +38,26 @@ namespace jubatus {
 namespace core {
 namespace clustering {
 
+namespace {
+
+// region queries scanning fewer points run on the calling thread
+const size_t PARALLEL_SCAN_MIN = 1024;
+
+void append(vector<size_t>& ret, const vector<size_t>& found) {
+  ret.insert(ret.end(), found.begin(), found.end());
+}
+
+}  // namespace
+
 const int dbscan::UNCLASSIFIED = 0;
 const int dbscan::CLASSIFIED = 1;
 const int dbscan::NOISE = -1;
 
 dbscan::dbscan(double eps, size_t min_core_point, const string& distance)
     : eps_(eps),
-      min_core_point_(min_core_point) {
+      min_core_point_(min_core_point),
+      cosine_(distance == "cosine"),
+      threads_(0) {
   if (distance == "euclidean") {
     sfv_dist_ = sfv_euclid_dist;
     point_dist_ = point_euclid_dist;
@@ -55,17 +74,21 @@ dbscan::dbscan(double eps, size_t min_core_point, const string& distance)
 void dbscan::batch(const wplist& points) {
   clusters_.clear();
   point_states_.assign(lexical_cast<int>(points.size()), dbscan::UNCLASSIFIED);
+  const point_matrix matrix(points);
+  order_by_norm(matrix);
 
   for (size_t size = points.size(), i = 0; i < size; ++i) {
     if (point_states_[i] != dbscan::UNCLASSIFIED) {
       continue;
     }
-    wplist cluster = dbscan::expand_cluster(i, points);
+    wplist cluster = dbscan::expand_cluster(i, points, matrix);
 
     if (cluster.size() >= min_core_point_) {
       clusters_.push_back(cluster);
     }
   }
+  std::vector<std::pair<double, size_t> >().swap(norm_order_);
+  std::vector<size_t>().swap(positions_);
 }
 
 std::vector<int> dbscan::get_point_states() const {
@@ -81,15 +104,20 @@ void dbscan::set_eps(double eps) {
 }
 
 // return cluster as wplist
-wplist dbscan::expand_cluster(const size_t idx, const wplist& points) {
+wplist dbscan::expand_cluster(
+    const size_t idx,
+    const wplist& points,
+    const point_matrix& matrix) {
   wplist cluster;
-  vector<size_t> core = region_query(idx, points);
+  vector<size_t> core;
+  region_query(matrix, idx, core);
 
   if (core.size() < min_core_point_) {
     point_states_[idx] = NOISE;
   } else {
     point_states_[idx] = CLASSIFIED;
     cluster.push_back(points[idx]);
+    vector<size_t> expand_core;
     do {
       std::vector<size_t> added_core;
       for (vector<size_t>::iterator it = core.begin(); it != core.end(); ++it) {
@@ -99,8 +127,8 @@ wplist dbscan::expand_cluster(const size_t idx, const wplist& points) {
         point_states_[*it] = CLASSIFIED;
         cluster.push_back(points[*it]);
 
-        vector<size_t> expand_core = region_query((*it), points);
-        for (vector<size_t>::iterator expand_it = expand_core.begin();
+        region_query(matrix, *it, expand_core);
+        for (vector<size_t>::const_iterator expand_it = expand_core.begin();
             expand_it != expand_core.end(); ++expand_it) {
           if (expand_core.size() >= min_core_point_) {
             if (point_states_[*expand_it] == CLASSIFIED) {
@@ -122,15 +150,86 @@ wplist dbscan::expand_cluster(const size_t idx, const wplist& points) {
   return cluster;
 }
 
-std::vector<size_t> dbscan::region_query(
-    const size_t idx, const wplist& points) const {
-  std::vector<size_t> region;
-  for (wplist::const_iterator it = points.begin(); it != points.end(); ++it) {
-    if (sfv_dist_((*it).data, points[idx].data) < eps_) {
-      region.push_back(std::distance(points.begin(), it));
+/**
+ * Orders the points by norm.  For euclidean distance only the points whose
+ * norm differs by less than eps from that of a point can be within eps of
+ * it, so region_query compares only those.
+ */
+void dbscan::order_by_norm(const point_matrix& points) {
+  const size_t size = points.rows();
+  norm_order_.resize(size);
+  positions_.resize(size);
+  for (size_t i = 0; i < size; ++i) {
+    norm_order_[i] = std::make_pair(std::sqrt(points.squared_norm(i)), i);
+  }
+  std::sort(norm_order_.begin(), norm_order_.end());
+  for (size_t i = 0; i < size; ++i) {
+    positions_[norm_order_[i].second] = i;
+  }
+}
+
+/**
+ * Finds the points within eps of the point idx, in ascending order.  Each
+ * point is queried at most once per batch, so the neighbors are found on
+ * demand rather than kept for all points; large scans are split among the
+ * threads.
+ */
+void dbscan::region_query(
+    const point_matrix& points,
+    const size_t idx,
+    std::vector<size_t>& region) const {
+  size_t begin = 0;
+  size_t end = points.rows();
+  if (!cosine_) {
+    const size_t pos = positions_[idx];
+    const double norm = norm_order_[pos].first;
+    // allow for rounding errors of the norms
+    begin = pos;
+    while (begin > 0 && norm - norm_order_[begin - 1].first <=
+           eps_ + 1e-12 * (norm + norm_order_[begin - 1].first)) {
+      --begin;
+    }
+    end = pos + 1;
+    while (end < points.rows() && norm_order_[end].first - norm <=
+           eps_ + 1e-12 * (norm + norm_order_[end].first)) {
+      ++end;
+    }
+  }
+
+  region.clear();
+  if (threads_ > 1 && end - begin >= PARALLEL_SCAN_MIN) {
+    common::default_thread_pool::parallel_reduce<vector<size_t> >(
+        begin, end, threads_,
+        jubatus::util::lang::bind(
+            &dbscan::scan, this, &points, idx,
+            jubatus::util::lang::_1, jubatus::util::lang::_2),
+        &append, region);
+  } else {
+    region = scan(&points, idx, begin, end);
+  }
+  std::sort(region.begin(), region.end());
+}
+
+// points within eps of the point idx among [begin, end) of the scan order
+vector<size_t> dbscan::scan(
+    const point_matrix* points,
+    size_t idx,
+    size_t begin,
+    size_t end) const {
+  vector<size_t> found;
+  for (size_t p = begin; p < end; ++p) {
+    if (cosine_) {
+      if (points->cosine_dist(p, idx) < eps_) {
+        found.push_back(p);
+      }
+    } else {
+      const size_t j = norm_order_[p].second;
+      if (points->euclid_dist(j, idx) < eps_) {
+        found.push_back(j);
+      }
     }
   }
-  return region;
+  return found;
 }
 
 }  // namespace clustering
@@ -17,9 +17,11 @@
 #ifndef JUBATUS_CORE_CLUSTERING_DBSCAN_HPP_
 #define JUBATUS_CORE_CLUSTERING_DBSCAN_HPP_
 
-#include <vector>
 #include <string>
+#include <utility>
+#include <vector>
 #include "types.hpp"
+#include "point_matrix.hpp"
 
 namespace jubatus {
 namespace core {
@@ -38,15 +40,38 @@ class dbscan {
   std::vector<wplist> get_clusters() const;
   void set_eps(double eps);
 
+  // number of threads used to find the neighbors of a point in batch
+  void set_threads(uint32_t threads) {
+    threads_ = threads;
+  }
+
  private:
-  wplist expand_cluster(const size_t idx, const wplist& points);
-  std::vector<size_t> region_query(
-      const size_t idx, const wplist& points) const;
+  wplist expand_cluster(
+      const size_t idx,
+      const wplist& points,
+      const point_matrix& matrix);
+  void order_by_norm(const point_matrix& points);
+  void region_query(
+      const point_matrix& points,
+      const size_t idx,
+      std::vector<size_t>& region) const;
+  std::vector<size_t> scan(
+      const point_matrix* points,
+      size_t idx,
+      size_t begin,
+      size_t end) const;
 
   double eps_;
   size_t min_core_point_;
+  bool cosine_;
+  uint32_t threads_;
   std::vector<int> point_states_;
   std::vector<wplist> clusters_;
+
+  // (norm, point) sorted by norm, and the position of each point in it;
+  // kept only during batch
+  std::vector<std::pair<double, size_t> > norm_order_;
+  std::vector<size_t> positions_;
   util::lang::function<
     double (const common::sfv_t&, const common::sfv_t&)> sfv_dist_;  // NOLINT
   util::lang::function<
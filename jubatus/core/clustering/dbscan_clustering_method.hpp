@@ -37,6 +37,8 @@ class dbscan_clustering_method : public clustering_method {
     double eps;
     int min_core_point;
     jubatus::util::data::optional<std::string> distance;
+    // number of threads used to find neighbors of points
+    jubatus::util::data::optional<int32_t> threads;
 
     MSGPACK_DEFINE(
         eps,
@@ -46,7 +48,8 @@ class dbscan_clustering_method : public clustering_method {
     void serialize(Ar& ar) {
       ar & JUBA_MEMBER(eps)
         & JUBA_MEMBER(min_core_point)
-        & JUBA_MEMBER(distance);
+        & JUBA_MEMBER(distance)
+        & JUBA_MEMBER(threads);
     }
   };
 
@@ -57,6 +60,10 @@ class dbscan_clustering_method : public clustering_method {
       const std::string& distance);
   ~dbscan_clustering_method();
 
+  void set_threads(uint32_t threads) {
+    dbscan_.set_threads(threads);
+  }
+
   void batch_update(wplist points);
   void online_update(wplist points);
   std::vector<common::sfv_t> get_k_center() const;
@@ -26,11 +26,13 @@
 #include "dbscan_clustering_method.hpp"
 #include "../common/type.hpp"
 #include "types.hpp"
+#include "util.hpp"
 #include "jubatus/util/lang/cast.h"
 #include "../common/exception.hpp"
 
 using std::map;
 using std::string;
+using std::vector;
 using jubatus::util::lang::lexical_cast;
 using jubatus::util::lang::scoped_ptr;
 
@@ -234,6 +236,122 @@ INSTANTIATE_TEST_CASE_P(
   dbscan_param_test,
   ::testing::ValuesIn(test_cases));
 
+namespace {
+
+// DBSCAN comparing every pair of points by sfv_t distances
+class reference_dbscan {
+ public:
+  reference_dbscan(double eps, size_t min_core_point, bool cosine)
+      : eps_(eps), min_core_point_(min_core_point), cosine_(cosine) {
+  }
+
+  void batch(const wplist& points) {
+    states_.assign(points.size(), 0);
+    for (size_t i = 0; i < points.size(); ++i) {
+      if (states_[i] != 0) {
+        continue;
+      }
+      wplist cluster;
+      vector<size_t> core = region_query(i, points);
+      if (core.size() < min_core_point_) {
+        states_[i] = -1;
+        continue;
+      }
+      states_[i] = 1;
+      cluster.push_back(points[i]);
+      while (!core.empty()) {
+        vector<size_t> added_core;
+        for (size_t j = 0; j < core.size(); ++j) {
+          if (states_[core[j]] == 1) {
+            continue;
+          }
+          states_[core[j]] = 1;
+          cluster.push_back(points[core[j]]);
+          const vector<size_t> expand_core = region_query(core[j], points);
+          if (expand_core.size() < min_core_point_) {
+            continue;
+          }
+          for (size_t k = 0; k < expand_core.size(); ++k) {
+            if (states_[expand_core[k]] == 0) {
+              added_core.push_back(expand_core[k]);
+            } else if (states_[expand_core[k]] == -1) {
+              cluster.push_back(points[expand_core[k]]);
+              states_[expand_core[k]] = 1;
+            }
+          }
+        }
+        core.swap(added_core);
+      }
+      if (cluster.size() >= min_core_point_) {
+        clusters_.push_back(cluster);
+      }
+    }
+  }
+
+  vector<int> states_;
+  vector<wplist> clusters_;
+
+ private:
+  vector<size_t> region_query(size_t idx, const wplist& points) const {
+    vector<size_t> region;
+    for (size_t i = 0; i < points.size(); ++i) {
+      const double dist = cosine_ ?
+          sfv_cosine_dist(points[i].data, points[idx].data) :
+          sfv_euclid_dist(points[i].data, points[idx].data);
+      if (dist < eps_) {
+        region.push_back(i);
+      }
+    }
+    return region;
+  }
+
+  double eps_;
+  size_t min_core_point_;
+  bool cosine_;
+};
+
+}  // namespace
+
+TEST(dbscan, same_as_sfv_region_query) {
+  jubatus::util::math::random::mtrand r(0);
+  wplist points;
+  for (size_t i = 0; i < 1200; ++i) {
+    weighted_point p;
+    p.id = lexical_cast<string>(i);
+    p.weight = 1 + r.next_int(3);
+    for (int j = 0; j < 6; ++j) {
+      if (r.next_int(3)) {
+        p.data.push_back(std::make_pair("f" + lexical_cast<string>(j),
+                                        3.0 * (i % 4) + r.next_double()));
+      }
+    }
+    points.push_back(p);
+  }
+
+  const char* distances[] = {"euclidean", "cosine"};
+  const double eps[] = {1.2, 0.06};
+  for (size_t d = 0; d < 2; ++d) {
+    reference_dbscan expected(eps[d], 3, d == 1);
+    expected.batch(points);
+    // scans of 1024 points or more are split among threads
+    for (uint32_t threads = 1; threads <= 3; threads += 2) {
+      dbscan actual(eps[d], 3, distances[d]);
+      actual.set_threads(threads);
+      actual.batch(points);
+
+      EXPECT_EQ(expected.states_, actual.get_point_states());
+      const vector<wplist> clusters = actual.get_clusters();
+      ASSERT_EQ(expected.clusters_.size(), clusters.size());
+      for (size_t i = 0; i < clusters.size(); ++i) {
+        ASSERT_EQ(expected.clusters_[i].size(), clusters[i].size());
+        for (size_t j = 0; j < clusters[i].size(); ++j) {
+          EXPECT_EQ(expected.clusters_[i][j].id, clusters[i][j].id);
+        }
+      }
+    }
+  }
+}
+
 }  // namespace clustering
 }  // namespace core
 }  // namespace jubatus
@@ -16,10 +16,15 @@
 
 #include "kmeans_clustering_method.hpp"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <utility>
 #include <vector>
 #include <string>
+#include "jubatus/util/lang/bind.h"
 #include "../common/exception.hpp"
+#include "../common/thread_pool.hpp"
 #include "clustering.hpp"
 #include "util.hpp"
 
@@ -33,6 +38,8 @@ namespace clustering {
 kmeans_clustering_method::kmeans_clustering_method(size_t k, uint32_t seed)
     : k_(k),
       seed_(seed),
+      cosine_(false),
+      threads_(0),
       rand_(seed) {
   if (!(1 <= k)) {
     throw JUBATUS_EXCEPTION(
@@ -48,6 +55,8 @@ kmeans_clustering_method::kmeans_clustering_method(
     const std::string& distance)
     : k_(k),
       seed_(seed),
+      cosine_(distance == "cosine"),
+      threads_(0),
       rand_(seed) {
   if (!(1 <= k)) {
     throw JUBATUS_EXCEPTION(
@@ -74,54 +83,182 @@ void kmeans_clustering_method::batch_update(wplist points) {
     kcenters_.clear();
     return;
   }
-  initialize_centers(points);
-  do_batch_update(points);
-}
-
-void kmeans_clustering_method::initialize_centers(wplist& points) {
   if (points.size() < k_) {
     return;
   }
+  point_matrix matrix(points);
+  initialize_centers(matrix);
+  do_batch_update(matrix);
+
+  const size_t d = matrix.columns();
   kcenters_.clear();
-  kcenters_.push_back(points[0].data);
-  vector<double> weights;
-  while (kcenters_.size() < k_) {
-    weights.clear();
-    for (wplist::iterator it = points.begin(); it != points.end(); ++it) {
-      pair<int64_t, double> m = min_dist((*it).data, kcenters_, sfv_dist_);
-      weights.push_back(m.second * it->weight);
+  for (size_t c = 0; c < k_; ++c) {
+    kcenters_.push_back(matrix.to_sfv(&centers_[c * d]));
+  }
+  std::vector<double>().swap(centers_);
+  std::vector<double>().swap(center_norms_);
+}
+
+void kmeans_clustering_method::initialize_centers(
+    const point_matrix& points) {
+  centers_.assign(k_ * points.columns(), 0);
+  center_norms_.assign(k_, 0);
+  set_center(points, 0, 0);
+
+  vector<double> min_dists(points.rows(), DBL_MAX);
+  vector<double> weights(points.rows());
+  for (size_t c = 1; c < k_; ++c) {
+    // only the distances to the last chosen center can lower the minimum
+    update_min_dists(points, c - 1, min_dists);
+    for (size_t i = 0; i < points.rows(); ++i) {
+      weights[i] = min_dists[i] * points.weight(i);
     }
     discrete_distribution d(weights.begin(), weights.end(), rand_.next_int());
-    kcenters_.push_back(points[d()].data);
+    set_center(points, c, d());
   }
 }
 
-void kmeans_clustering_method::do_batch_update(wplist& points) {
+void kmeans_clustering_method::do_batch_update(const point_matrix& points) {
+  const size_t d = points.columns();
+  vector<size_t> assign(points.rows());
+  vector<double> centers_new(k_ * d);
+  vector<double> center_count(k_);
   bool terminated = false;
-  if (points.size() < k_) {
-    return;
-  }
   while (!terminated) {
-    vector<common::sfv_t> kcenters_new(k_);
-    vector<double> center_count(k_, 0);
-    for (wplist::iterator it = points.begin(); it != points.end(); ++it) {
-      pair<int64_t, double> m = min_dist((*it).data, kcenters_, sfv_dist_);
-      scalar_mul_and_add(it->data, it->weight, kcenters_new[m.first]);
-      center_count[m.first] += it->weight;
+    assign_points(points, assign);
+    std::fill(centers_new.begin(), centers_new.end(), 0);
+    std::fill(center_count.begin(), center_count.end(), 0);
+    for (size_t i = 0; i < points.rows(); ++i) {
+      points.add_row(i, points.weight(i), &centers_new[assign[i] * d]);
+      center_count[assign[i]] += points.weight(i);
     }
     terminated = true;
-    for (size_t i = 0; i < k_; ++i) {
-      if (center_count[i] == 0) {
-        kcenters_new[i] = kcenters_[i];
+    for (size_t c = 0; c < k_; ++c) {
+      double* center = &centers_new[c * d];
+      const double* old_center = &centers_[c * d];
+      if (center_count[c] == 0) {
+        std::copy(old_center, old_center + d, center);
         continue;
       }
-      kcenters_new[i] = scalar_dot(kcenters_new[i], 1.0 / center_count[i]);
-      double d = sfv_dist_(kcenters_new[i], kcenters_[i]);
-      if (d > 1e-9) {
+      const double s = 1.0 / center_count[c];
+      for (size_t j = 0; j < d; ++j) {
+        center[j] *= s;
+      }
+      if (centers_dist(center, old_center, d) > 1e-9) {
         terminated = false;
       }
     }
-    kcenters_ = kcenters_new;
+    centers_.swap(centers_new);
+    for (size_t c = 0; c < k_; ++c) {
+      center_norms_[c] = dense_squared_norm(&centers_[c * d], d);
+    }
+  }
+}
+
+void kmeans_clustering_method::set_center(
+    const point_matrix& points,
+    size_t center,
+    size_t row) {
+  points.row_to_dense(row, &centers_[center * points.columns()]);
+  center_norms_[center] = points.squared_norm(row);
+}
+
+double kmeans_clustering_method::center_dist(
+    const point_matrix& points,
+    size_t row,
+    size_t center) const {
+  const double* c = &centers_[center * points.columns()];
+  if (cosine_) {
+    return dense_cosine_dist(points, row, c, center_norms_[center]);
+  }
+  return dense_euclid_dist(points, row, c, center_norms_[center]);
+}
+
+double kmeans_clustering_method::centers_dist(
+    const double* c1,
+    const double* c2,
+    size_t size) const {
+  if (cosine_) {
+    double norm1 = std::sqrt(dense_squared_norm(c1, size));
+    double norm2 = std::sqrt(dense_squared_norm(c2, size));
+    if (norm1 == 0.f || norm2 == 0.f) {
+      return 1.f;
+    }
+    double dot = 0;
+    for (size_t i = 0; i < size; ++i) {
+      dot += c1[i] * c2[i];
+    }
+    double similarity = dot / norm1 / norm2;
+    return 1. - std::min(std::max(-1., similarity), 1.);
+  }
+  double ret = 0;
+  for (size_t i = 0; i < size; ++i) {
+    ret += (c1[i] - c2[i]) * (c1[i] - c2[i]);
+  }
+  return std::sqrt(ret);
+}
+
+void kmeans_clustering_method::update_min_dists(
+    const point_matrix& points,
+    size_t center,
+    vector<double>& min_dists) const {
+  if (threads_ > 1 && points.rows() > 1) {
+    common::default_thread_pool::parallel_for(
+        0, points.rows(), threads_,
+        jubatus::util::lang::bind(
+            &kmeans_clustering_method::update_min_dists_range,
+            this, &points, center, &min_dists,
+            jubatus::util::lang::_1, jubatus::util::lang::_2));
+  } else {
+    update_min_dists_range(&points, center, &min_dists, 0, points.rows());
+  }
+}
+
+void kmeans_clustering_method::update_min_dists_range(
+    const point_matrix* points,
+    size_t center,
+    vector<double>* min_dists,
+    size_t begin,
+    size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    double d = center_dist(*points, i, center);
+    if ((*min_dists)[i] > d) {
+      (*min_dists)[i] = d;
+    }
+  }
+}
+
+void kmeans_clustering_method::assign_points(
+    const point_matrix& points,
+    vector<size_t>& assign) const {
+  if (threads_ > 1 && points.rows() > 1) {
+    common::default_thread_pool::parallel_for(
+        0, points.rows(), threads_,
+        jubatus::util::lang::bind(
+            &kmeans_clustering_method::assign_points_range,
+            this, &points, &assign,
+            jubatus::util::lang::_1, jubatus::util::lang::_2));
+  } else {
+    assign_points_range(&points, &assign, 0, points.rows());
+  }
+}
+
+void kmeans_clustering_method::assign_points_range(
+    const point_matrix* points,
+    vector<size_t>* assign,
+    size_t begin,
+    size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    size_t idx = 0;
+    double mindist = DBL_MAX;
+    for (size_t c = 0; c < k_; ++c) {
+      double d = center_dist(*points, i, c);
+      if (mindist > d) {
+        idx = c;
+        mindist = d;
+      }
+    }
+    (*assign)[i] = idx;
   }
 }
 
@@ -23,6 +23,7 @@
 #include "jubatus/util/math/random.h"
 #include "clustering_method.hpp"
 #include "jubatus/util/data/optional.h"
+#include "point_matrix.hpp"
 
 namespace jubatus {
 namespace core {
@@ -36,11 +37,14 @@ class kmeans_clustering_method : public clustering_method {
     }
     int k;
     int64_t seed;
+    // number of threads used to assign points to centers
+    jubatus::util::data::optional<int32_t> threads;
 
     template<typename Ar>
     void serialize(Ar& ar) {
       ar & JUBA_MEMBER(k)
-        & JUBA_MEMBER(seed);
+        & JUBA_MEMBER(seed)
+        & JUBA_MEMBER(threads);
     }
   };
 
@@ -51,6 +55,10 @@ class kmeans_clustering_method : public clustering_method {
       const std::string& distance);
   ~kmeans_clustering_method();
 
+  void set_threads(uint32_t threads) {
+    threads_ = threads;
+  }
+
   void batch_update(wplist points);
   void online_update(wplist points);
   std::vector<common::sfv_t> get_k_center() const;
@@ -60,12 +68,43 @@ class kmeans_clustering_method : public clustering_method {
   std::vector<wplist> get_clusters(const wplist& points) const;
 
  private:
-  void initialize_centers(wplist& points);
-  void do_batch_update(wplist& points);
+  void initialize_centers(const point_matrix& points);
+  void do_batch_update(const point_matrix& points);
+
+  void set_center(const point_matrix& points, size_t center, size_t row);
+  double center_dist(
+      const point_matrix& points,
+      size_t row,
+      size_t center) const;
+  double centers_dist(const double* c1, const double* c2, size_t size) const;
+  void update_min_dists(
+      const point_matrix& points,
+      size_t center,
+      std::vector<double>& min_dists) const;
+  void update_min_dists_range(
+      const point_matrix* points,
+      size_t center,
+      std::vector<double>* min_dists,
+      size_t begin,
+      size_t end) const;
+  void assign_points(
+      const point_matrix& points,
+      std::vector<size_t>& assign) const;
+  void assign_points_range(
+      const point_matrix* points,
+      std::vector<size_t>* assign,
+      size_t begin,
+      size_t end) const;
 
   std::vector<common::sfv_t> kcenters_;
   size_t k_;
   uint32_t seed_;
+  bool cosine_;
+  uint32_t threads_;
+
+  // centers of the running batch_update, as k_ dense rows
+  std::vector<double> centers_;
+  std::vector<double> center_norms_;
 
   jubatus::util::math::random::mtrand rand_;
 };
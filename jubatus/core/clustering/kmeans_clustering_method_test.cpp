@@ -0,0 +1,108 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "jubatus/util/lang/cast.h"
+#include "kmeans_clustering_method.hpp"
+#include "types.hpp"
+
+using std::make_pair;
+using std::string;
+using std::vector;
+using jubatus::util::lang::lexical_cast;
+
+namespace jubatus {
+namespace core {
+namespace clustering {
+
+namespace {
+
+wplist make_points() {
+  const double values[][3] = {
+    {1, 1, 0}, {1.5, 2, 0}, {0.5, 1.5, 0}, {8, 8, 1},
+    {9, 8.5, 0}, {8.5, 9, 1}, {-5, 6, 0}, {-6, 5, 1},
+    {-5.5, 5.5, 0}, {1, 2, 1}, {9, 9, 0}, {-6, 6, 1}
+  };
+  wplist points;
+  for (size_t i = 0; i < 12; ++i) {
+    weighted_point p;
+    p.id = lexical_cast<string>(i);
+    p.weight = 1 + i % 3;
+    p.data.push_back(make_pair("x", values[i][0]));
+    p.data.push_back(make_pair("y", values[i][1]));
+    if (values[i][2] != 0) {
+      p.data.push_back(make_pair("z", values[i][2]));
+    }
+    points.push_back(p);
+  }
+  return points;
+}
+
+void expect_center(
+    double x, double y, double z, const common::sfv_t& center) {
+  ASSERT_EQ(3u, center.size());
+  EXPECT_EQ("x", center[0].first);
+  EXPECT_NEAR(x, center[0].second, 1e-12);
+  EXPECT_EQ("y", center[1].first);
+  EXPECT_NEAR(y, center[1].second, 1e-12);
+  EXPECT_EQ("z", center[2].first);
+  EXPECT_NEAR(z, center[2].second, 1e-12);
+}
+
+}  // namespace
+
+// the centers are those computed by the implementation on sfv_t
+TEST(kmeans_clustering_method, batch_update_euclidean) {
+  for (uint32_t threads = 1; threads <= 3; ++threads) {
+    kmeans_clustering_method kmeans(3, 1, "euclidean");
+    kmeans.set_threads(threads);
+    kmeans.batch_update(make_points());
+
+    const vector<common::sfv_t> centers = kmeans.get_k_center();
+    ASSERT_EQ(3u, centers.size());
+    expect_center(13. / 14, 23. / 14, 2. / 14, centers[0]);
+    expect_center(8.6875, 8.75, 0.5, centers[1]);
+    expect_center(-103. / 18, 101. / 18, 10. / 18, centers[2]);
+
+    common::sfv_t q;
+    q.push_back(make_pair("x", 8.0));
+    q.push_back(make_pair("y", 8.0));
+    EXPECT_EQ(1, kmeans.get_nearest_center_index(q));
+  }
+}
+
+TEST(kmeans_clustering_method, batch_update_cosine) {
+  for (uint32_t threads = 1; threads <= 3; ++threads) {
+    kmeans_clustering_method kmeans(3, 1, "cosine");
+    kmeans.set_threads(threads);
+    kmeans.batch_update(make_points());
+
+    const vector<common::sfv_t> centers = kmeans.get_k_center();
+    ASSERT_EQ(3u, centers.size());
+    expect_center(147. / 22, 150. / 22, 8. / 22, centers[0]);
+    expect_center(-103. / 18, 101. / 18, 10. / 18, centers[1]);
+    expect_center(0.625, 1.625, 0.25, centers[2]);
+  }
+}
+
+}  // namespace clustering
+}  // namespace core
+}  // namespace jubatus
@@ -25,9 +25,11 @@
 #include <stack>
 #include <string>
 
+#include "jubatus/util/lang/bind.h"
 #include "../common/assert.hpp"
 #include "../../util/lang/function.h"
 #include "../common/exception.hpp"
+#include "../common/thread_pool.hpp"
 
 using std::min;
 using std::max;
@@ -61,6 +63,7 @@ void partial_sort_by(
                     array.size(),
                     "lengths of scores and data must be same.");
 
+  using std::swap;
   std::vector<std::pair<double, T> > pairs(scores.size());
   for (size_t i = 0; i < scores.size(); ++i) {
     pairs[i].first = scores[i];
@@ -77,41 +80,12 @@ void partial_sort_by(
   }
 }
 
-void bicriteria_as_coreset(
-    const wplist& src,
-    wplist bic,
-    const size_t dstsize,
-    wplist& dst,
-    function<double (const weighted_point&,  // NOLINT
-                     const weighted_point&)> point_dist_) {
-  JUBATUS_ASSERT_GE(dstsize, dst.size(), "");
-
-  typedef wplist::const_iterator citer;
-  typedef wplist::iterator iter;
-  bic.resize(dstsize - dst.size());
-  for (iter it = bic.begin(); it != bic.end(); ++it) {
-    it->weight = 0;
-  }
-  for (citer it = dst.begin(); it != dst.end(); ++it) {
-    pair<int, double> m = min_dist(*it, bic, point_dist_);
-    bic[m.first].weight -= it->weight;
-  }
-  for (citer it = src.begin(); it != src.end(); ++it) {
-    pair<int, double> m = min_dist(*it, bic, point_dist_);
-    bic[m.first].weight += it->weight;
-  }
-  dst.insert(dst.end(), bic.begin(), bic.end());
-  for (iter it = dst.begin(); it != dst.end(); ++it) {
-    if (it->weight < 0) {
-      it->weight = 0;
-    }
-  }
-}
-
 }  // namespace
 
 kmeans_compressor::kmeans_compressor(const int seed)
-  : rand_(seed) {
+  : rand_(seed),
+    cosine_(false),
+    threads_(0) {
   sfv_dist_ = sfv_euclid_dist;
   point_dist_ = point_euclid_dist;
 }
@@ -119,7 +93,9 @@ kmeans_compressor::kmeans_compressor(const int seed)
 kmeans_compressor::kmeans_compressor(
     const int seed,
     const std::string& distance)
-  : rand_(seed) {
+  : rand_(seed),
+    cosine_(distance == "cosine"),
+    threads_(0) {
   if (distance == "euclidean") {
     sfv_dist_ = sfv_euclid_dist;
     point_dist_ = point_euclid_dist;
@@ -145,36 +121,49 @@ void kmeans_compressor::compress(
     concat(src, dst);
     return;
   }
-  wplist bicriteria;
-  get_bicriteria(src, bsize, dstsize, bicriteria);
+  const point_matrix points(src);
+  const size_t dst_begin = dst.size();
+  vector<size_t> bicriteria;
+  vector<size_t> dst_rows;
+  get_bicriteria(points, bsize, dstsize, bicriteria);
   if (bicriteria.size() < dstsize) {
-    wplist srcclone = src;
     bicriteria_to_coreset(
-        srcclone,
+        src,
+        points,
         bicriteria,
         dstsize - bicriteria.size(),
-        dst);
+        dst,
+        dst_rows);
   }
-  bicriteria_as_coreset(src, bicriteria, dstsize, dst, point_dist_);
+  bicriteria_as_coreset(
+      src, points, bicriteria, dstsize, dst_begin, dst_rows, dst);
 }
 
 void kmeans_compressor::get_bicriteria(
-    const wplist& src,
+    const point_matrix& points,
     size_t bsize,
     size_t dstsize,
-    wplist& dst) {
+    vector<size_t>& dst) {
   dst.clear();
-  wplist resid = src;
-  vector<double> weights(src.size());
+  const size_t src_size = points.rows();
+  vector<size_t> resid(src_size);
+  for (size_t i = 0; i < src_size; ++i) {
+    resid[i] = i;
+  }
+  vector<double> weights(src_size);
+  // distance from each row to the nearest point in `dst` so far
+  vector<double> min_dists(src_size, DBL_MAX);
+  vector<size_t> nearest(src_size);
+  vector<double> distances;
   double r =
-    (1 - std::exp(bsize * (std::log(bsize) - std::log(src.size())) / dstsize))
+    (1 - std::exp(bsize * (std::log(bsize) - std::log(src_size)) / dstsize))
       / 2;
   r = max(0.1, r);
   std::vector<size_t> ind(bsize);
   while (resid.size() > 1 && dst.size() < dstsize) {
     weights.resize(resid.size());
-    for (wplist::const_iterator it = resid.begin(); it != resid.end(); ++it) {
-      weights[it - resid.begin()] = it->weight;
+    for (size_t i = 0; i < resid.size(); ++i) {
+      weights[i] = points.weight(resid[i]);
     }
 
     // Sample `bsize` points and insert them to the result
@@ -184,15 +173,18 @@ void kmeans_compressor::get_bicriteria(
     std::sort(ind.begin(), ind.end());
     ind.erase(std::unique(ind.begin(), ind.end()), ind.end());
 
+    const size_t center_begin = dst.size();
     for (std::vector<size_t>::iterator it = ind.begin();
          it != ind.end(); ++it) {
       dst.push_back(resid[*it]);
     }
 
-    // Remove `r` nearest points from `resid`
-    std::vector<double> distances;
-    for (wplist::iterator itr = resid.begin(); itr != resid.end(); ++itr) {
-      distances.push_back(-min_dist(*itr, dst, point_dist_).second);
+    // Remove `r` nearest points from `resid`; only the points added above
+    // can be nearer than before
+    find_nearest(points, dst, center_begin, resid, nearest, min_dists);
+    distances.resize(resid.size());
+    for (size_t i = 0; i < resid.size(); ++i) {
+      distances[i] = -min_dists[resid[i]];
     }
     // TODO(unno): Is `r` lesser than 1.0?
     size_t size = std::min(resid.size(),
@@ -218,26 +210,33 @@ double kmeans_compressor::get_probability(
 
 void kmeans_compressor::bicriteria_to_coreset(
     const wplist& src,
-    const wplist& bicriteria,
+    const point_matrix& points,
+    const vector<size_t>& bicriteria,
     size_t dstsize,
-    wplist& dst) {
+    wplist& dst,
+    vector<size_t>& dst_rows) {
   if (bicriteria.size() == 0) {
     dst = src;
+    dst_rows.clear();
     return;
   }
+  vector<size_t> rows(src.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    rows[i] = i;
+  }
+  std::vector<size_t> nearest_indexes(src.size());
+  std::vector<double> nearest_distances(src.size(), DBL_MAX);
+  find_nearest(points, bicriteria, 0, rows,
+               nearest_indexes, nearest_distances);
+
   double weight_sum = 0;
   double squared_min_dist_sum = 0;
-  std::vector<size_t> nearest_indexes(src.size());
-  std::vector<double> nearest_distances(src.size());
   std::vector<double> bicriteria_scores(bicriteria.size());
   for (size_t i = 0; i < src.size(); ++i) {
     double weight = src[i].weight;
-    std::pair<int, double> m = min_dist(src[i], bicriteria, point_dist_);
-    nearest_indexes[i] = m.first;
-    nearest_distances[i] = m.second;
-
-    bicriteria_scores[m.first] += weight;
-    squared_min_dist_sum += m.second * m.second * weight;
+    double d = nearest_distances[i];
+    bicriteria_scores[nearest_indexes[i]] += weight;
+    squared_min_dist_sum += d * d * weight;
     weight_sum += weight;
   }
   squared_min_dist_sum = std::max(squared_min_dist_sum,
@@ -248,7 +247,7 @@ void kmeans_compressor::bicriteria_to_coreset(
     double prob = get_probability(
         src[i],
         nearest_distances[i],
-        bicriteria[nearest_indexes[i]],
+        src[bicriteria[nearest_indexes[i]]],
         bicriteria_scores[nearest_indexes[i]],
         weight_sum,
         squared_min_dist_sum);
@@ -263,10 +262,120 @@ void kmeans_compressor::bicriteria_to_coreset(
 
   for (std::vector<size_t>::iterator it = ind.begin(); it != ind.end(); ++it) {
     size_t index = *it;
-    weighted_point sample = src[index];
     double prob = weights[index] / sumw;
-    sample.weight *= 1.0 / dstsize / prob;
-    dst.push_back(sample);
+    dst.push_back(src[index]);
+    dst.back().weight *= 1.0 / dstsize / prob;
+    dst_rows.push_back(index);
+  }
+}
+
+void kmeans_compressor::bicriteria_as_coreset(
+    const wplist& src,
+    const point_matrix& points,
+    vector<size_t> bicriteria,
+    size_t dstsize,
+    size_t dst_begin,
+    const vector<size_t>& dst_rows,
+    wplist& dst) const {
+  JUBATUS_ASSERT_GE(dstsize, dst.size(), "");
+
+  bicriteria.resize(dstsize - dst.size());
+  vector<double> weights(bicriteria.size(), 0);
+
+  // points given in `dst` by the caller are not in `points`
+  for (size_t i = 0; i < dst_begin; ++i) {
+    size_t idx = 0;
+    double md = DBL_MAX;
+    for (size_t j = 0; j < bicriteria.size(); ++j) {
+      double d = point_dist_(src[bicriteria[j]], dst[i]);
+      if (md > d) {
+        idx = j;
+        md = d;
+      }
+    }
+    weights[idx] -= dst[i].weight;
+  }
+  for (size_t i = 0; i < dst_rows.size(); ++i) {
+    size_t idx = 0;
+    double md = DBL_MAX;
+    for (size_t j = 0; j < bicriteria.size(); ++j) {
+      double d = dist(points, bicriteria[j], dst_rows[i]);
+      if (md > d) {
+        idx = j;
+        md = d;
+      }
+    }
+    weights[idx] -= dst[dst_begin + i].weight;
+  }
+
+  vector<size_t> rows(src.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    rows[i] = i;
+  }
+  vector<size_t> nearest(src.size());
+  vector<double> dists(src.size(), DBL_MAX);
+  find_nearest(points, bicriteria, 0, rows, nearest, dists);
+  for (size_t i = 0; i < src.size(); ++i) {
+    weights[nearest[i]] += src[i].weight;
+  }
+
+  for (size_t j = 0; j < bicriteria.size(); ++j) {
+    dst.push_back(src[bicriteria[j]]);
+    dst.back().weight = weights[j];
+  }
+  for (wplist::iterator it = dst.begin(); it != dst.end(); ++it) {
+    if (it->weight < 0) {
+      it->weight = 0;
+    }
+  }
+}
+
+double kmeans_compressor::dist(
+    const point_matrix& points,
+    size_t row1,
+    size_t row2) const {
+  return cosine_ ?
+      points.cosine_dist(row1, row2) : points.euclid_dist(row1, row2);
+}
+
+void kmeans_compressor::find_nearest(
+    const point_matrix& points,
+    const vector<size_t>& centers,
+    size_t center_begin,
+    const vector<size_t>& rows,
+    vector<size_t>& nearest,
+    vector<double>& dists) const {
+  if (threads_ > 1 && rows.size() > 1) {
+    common::default_thread_pool::parallel_for(
+        0, rows.size(), threads_,
+        jubatus::util::lang::bind(
+            &kmeans_compressor::find_nearest_range, this, &points, &centers,
+            center_begin, &rows, &nearest, &dists,
+            jubatus::util::lang::_1, jubatus::util::lang::_2));
+  } else {
+    find_nearest_range(&points, &centers, center_begin, &rows,
+                       &nearest, &dists, 0, rows.size());
+  }
+}
+
+void kmeans_compressor::find_nearest_range(
+    const point_matrix* points,
+    const vector<size_t>* centers,
+    size_t center_begin,
+    const vector<size_t>* rows,
+    vector<size_t>* nearest,
+    vector<double>* dists,
+    size_t begin,
+    size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    const size_t row = (*rows)[i];
+    for (size_t c = center_begin; c < centers->size(); ++c) {
+      double d = dist(*points, (*centers)[c], row);
+      if ((*dists)[row] > d) {
+        (*nearest)[row] = c;
+        (*dists)[row] = d;
+      }
+    }
   }
 }
 
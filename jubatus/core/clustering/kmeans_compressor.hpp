@@ -18,7 +18,9 @@
 #define JUBATUS_CORE_CLUSTERING_KMEANS_COMPRESSOR_HPP_
 
 #include <string>
+#include <vector>
 #include "compressor.hpp"
+#include "point_matrix.hpp"
 
 namespace jubatus {
 namespace core {
@@ -33,6 +35,11 @@ class kmeans_compressor : public compressor {
 
   void compress(const wplist& src, size_t bsize, size_t dstsize, wplist& dst);
 
+  // number of threads used to find nearest bicriteria points
+  void set_threads(uint32_t threads) {
+    threads_ = threads;
+  }
+
  public:
   virtual double get_probability(
       const weighted_point& p,
@@ -44,18 +51,53 @@ class kmeans_compressor : public compressor {
 
  private:
   void get_bicriteria(
-      const wplist& src,
+      const point_matrix& points,
       size_t bsize,
       size_t dstsize,
-      wplist& dst);
+      std::vector<size_t>& dst);
 
   void bicriteria_to_coreset(
       const wplist& src,
-      const wplist& bicriteria,
+      const point_matrix& points,
+      const std::vector<size_t>& bicriteria,
       size_t dstsize,
-      wplist& dst);
+      wplist& dst,
+      std::vector<size_t>& dst_rows);
+
+  void bicriteria_as_coreset(
+      const wplist& src,
+      const point_matrix& points,
+      std::vector<size_t> bicriteria,
+      size_t dstsize,
+      size_t dst_begin,
+      const std::vector<size_t>& dst_rows,
+      wplist& dst) const;
+
+  double dist(const point_matrix& points, size_t row1, size_t row2) const;
+
+  // Lowers ``dists[row]`` to the distance from each row of ``rows`` to the
+  // nearest of ``centers[center_begin:]``, setting ``nearest[row]`` to its
+  // index.  Each row must appear in ``rows`` at most once.
+  void find_nearest(
+      const point_matrix& points,
+      const std::vector<size_t>& centers,
+      size_t center_begin,
+      const std::vector<size_t>& rows,
+      std::vector<size_t>& nearest,
+      std::vector<double>& dists) const;
+  void find_nearest_range(
+      const point_matrix* points,
+      const std::vector<size_t>* centers,
+      size_t center_begin,
+      const std::vector<size_t>* rows,
+      std::vector<size_t>* nearest,
+      std::vector<double>* dists,
+      size_t begin,
+      size_t end) const;
 
   jubatus::util::math::random::mtrand rand_;
+  bool cosine_;
+  uint32_t threads_;
 };
 
 }  // namespace compressor
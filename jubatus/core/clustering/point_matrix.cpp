@@ -0,0 +1,218 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include "point_matrix.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <utility>
+#include <vector>
+#include "jubatus/util/data/unordered_map.h"
+
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace jubatus {
+namespace core {
+namespace clustering {
+namespace {
+
+struct less_index {
+  bool operator()(
+      const pair<size_t, double>& lhs,
+      const pair<size_t, double>& rhs) const {
+    return lhs.first < rhs.first;
+  }
+};
+
+}  // namespace
+
+point_matrix::point_matrix(const wplist& points) {
+  typedef jubatus::util::data::unordered_map<string, size_t> key_map_t;
+  key_map_t key2id;
+  for (size_t i = 0; i < points.size(); ++i) {
+    const common::sfv_t& v = points[i].data;
+    for (size_t j = 0; j < v.size(); ++j) {
+      if (key2id.insert(std::make_pair(v[j].first, 0)).second) {
+        keys_.push_back(v[j].first);
+      }
+    }
+  }
+  std::sort(keys_.begin(), keys_.end());
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    key2id[keys_[i]] = i;
+  }
+
+  offsets_.reserve(points.size() + 1);
+  weights_.reserve(points.size());
+  squared_norms_.reserve(points.size());
+  offsets_.push_back(0);
+  vector<pair<size_t, double> > row;
+  for (size_t i = 0; i < points.size(); ++i) {
+    const common::sfv_t& v = points[i].data;
+    row.clear();
+    for (size_t j = 0; j < v.size(); ++j) {
+      row.push_back(std::make_pair(key2id[v[j].first], v[j].second));
+    }
+    std::stable_sort(row.begin(), row.end(), less_index());
+    double norm = 0;
+    for (size_t j = 0; j < row.size(); ++j) {
+      indices_.push_back(row[j].first);
+      values_.push_back(row[j].second);
+      norm += row[j].second * row[j].second;
+    }
+    offsets_.push_back(indices_.size());
+    weights_.push_back(points[i].weight);
+    squared_norms_.push_back(norm);
+  }
+}
+
+void point_matrix::row_to_dense(size_t row, double* dense) const {
+  std::fill(dense, dense + columns(), 0.0);
+  add_row(row, 1.0, dense);
+}
+
+void point_matrix::to_dense(const common::sfv_t& v, double* dense) const {
+  std::fill(dense, dense + columns(), 0.0);
+  for (size_t i = 0; i < v.size(); ++i) {
+    vector<string>::const_iterator it =
+        std::lower_bound(keys_.begin(), keys_.end(), v[i].first);
+    if (it != keys_.end() && *it == v[i].first) {
+      dense[it - keys_.begin()] += v[i].second;
+    }
+  }
+}
+
+common::sfv_t point_matrix::to_sfv(const double* dense) const {
+  common::sfv_t ret;
+  for (size_t i = 0; i < columns(); ++i) {
+    if (dense[i] != 0) {
+      ret.push_back(std::make_pair(keys_[i], dense[i]));
+    }
+  }
+  return ret;
+}
+
+void point_matrix::add_row(size_t row, double weight, double* dense) const {
+  const size_t end = offsets_[row + 1];
+  for (size_t i = offsets_[row]; i < end; ++i) {
+    dense[indices_[i]] += values_[i] * weight;
+  }
+}
+
+double point_matrix::dot(size_t row, const double* dense) const {
+  const size_t end = offsets_[row + 1];
+  double ret = 0;
+  for (size_t i = offsets_[row]; i < end; ++i) {
+    ret += values_[i] * dense[indices_[i]];
+  }
+  return ret;
+}
+
+double point_matrix::euclid_dist(size_t row1, size_t row2) const {
+  double ret = 0;
+  size_t i1 = offsets_[row1];
+  size_t i2 = offsets_[row2];
+  const size_t end1 = offsets_[row1 + 1];
+  const size_t end2 = offsets_[row2 + 1];
+  while (i1 < end1 && i2 < end2) {
+    if (indices_[i1] < indices_[i2]) {
+      ret += values_[i1] * values_[i1];
+      ++i1;
+    } else if (indices_[i1] > indices_[i2]) {
+      ret += values_[i2] * values_[i2];
+      ++i2;
+    } else {
+      ret += (values_[i1] - values_[i2]) * (values_[i1] - values_[i2]);
+      ++i1;
+      ++i2;
+    }
+  }
+  for (; i1 < end1; ++i1) {
+    ret += std::pow(values_[i1], 2);
+  }
+  for (; i2 < end2; ++i2) {
+    ret += std::pow(values_[i2], 2);
+  }
+  return std::sqrt(ret);
+}
+
+double point_matrix::cosine_dist(size_t row1, size_t row2) const {
+  double norm1 = std::sqrt(squared_norms_[row1]);
+  double norm2 = std::sqrt(squared_norms_[row2]);
+  if (norm1 == 0.f || norm2 == 0.f) {
+    return 1.f;
+  }
+
+  double ret = 0;
+  size_t i1 = offsets_[row1];
+  size_t i2 = offsets_[row2];
+  const size_t end1 = offsets_[row1 + 1];
+  const size_t end2 = offsets_[row2 + 1];
+  while (i1 < end1 && i2 < end2) {
+    if (indices_[i1] < indices_[i2]) {
+      ++i1;
+    } else if (indices_[i1] > indices_[i2]) {
+      ++i2;
+    } else {
+      ret += values_[i1] * values_[i2];
+      ++i1;
+      ++i2;
+    }
+  }
+
+  double similarity = ret / norm1 / norm2;
+  return 1. - std::min(std::max(-1., similarity), 1.);
+}
+
+double dense_euclid_dist(
+    const point_matrix& m,
+    size_t row,
+    const double* center,
+    double center_squared_norm) {
+  double d = m.squared_norm(row) + center_squared_norm
+      - 2 * m.dot(row, center);
+  return std::sqrt(std::max(d, 0.0));
+}
+
+double dense_cosine_dist(
+    const point_matrix& m,
+    size_t row,
+    const double* center,
+    double center_squared_norm) {
+  double norm = std::sqrt(m.squared_norm(row));
+  double center_norm = std::sqrt(center_squared_norm);
+  if (norm == 0.f || center_norm == 0.f) {
+    return 1.f;
+  }
+  double similarity = m.dot(row, center) / norm / center_norm;
+  return 1. - std::min(std::max(-1., similarity), 1.);
+}
+
+double dense_squared_norm(const double* v, size_t size) {
+  double ret = 0;
+  for (size_t i = 0; i < size; ++i) {
+    ret += v[i] * v[i];
+  }
+  return ret;
+}
+
+}  // namespace clustering
+}  // namespace core
+}  // namespace jubatus
@@ -0,0 +1,99 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef JUBATUS_CORE_CLUSTERING_POINT_MATRIX_HPP_
+#define JUBATUS_CORE_CLUSTERING_POINT_MATRIX_HPP_
+
+#include <string>
+#include <vector>
+#include "types.hpp"
+
+namespace jubatus {
+namespace core {
+namespace clustering {
+
+/**
+ * Read-only CSR view of a list of weighted points.
+ *
+ * Feature keys are interned once into column IDs assigned in key order, so
+ * each row holds its entries sorted by key like a sorted ``sfv_t`` does and
+ * distances can be computed without comparing strings.  Centers of
+ * clustering methods are kept as dense vectors of ``columns()`` elements.
+ */
+class point_matrix {
+ public:
+  explicit point_matrix(const wplist& points);
+
+  size_t rows() const {
+    return weights_.size();
+  }
+  size_t columns() const {
+    return keys_.size();
+  }
+
+  double weight(size_t row) const {
+    return weights_[row];
+  }
+  // squared L2 norm of the row
+  double squared_norm(size_t row) const {
+    return squared_norms_[row];
+  }
+
+  // dense <-> sparse conversion of centers; unknown keys are ignored
+  void row_to_dense(size_t row, double* dense) const;
+  void to_dense(const common::sfv_t& v, double* dense) const;
+  common::sfv_t to_sfv(const double* dense) const;
+
+  // adds weight * row to the dense vector
+  void add_row(size_t row, double weight, double* dense) const;
+  double dot(size_t row, const double* dense) const;
+
+  // same results as sfv_euclid_dist / sfv_cosine_dist of the points
+  double euclid_dist(size_t row1, size_t row2) const;
+  double cosine_dist(size_t row1, size_t row2) const;
+
+ private:
+  std::vector<std::string> keys_;
+  std::vector<size_t> offsets_;
+  std::vector<size_t> indices_;
+  std::vector<double> values_;
+  std::vector<double> weights_;
+  std::vector<double> squared_norms_;
+};
+
+/**
+ * Distance between a row of a point_matrix and a dense center, given the
+ * squared norm of the center.
+ */
+double dense_euclid_dist(
+    const point_matrix& m,
+    size_t row,
+    const double* center,
+    double center_squared_norm);
+double dense_cosine_dist(
+    const point_matrix& m,
+    size_t row,
+    const double* center,
+    double center_squared_norm);
+
+double dense_squared_norm(const double* v, size_t size);
+
+}  // namespace clustering
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_CLUSTERING_POINT_MATRIX_HPP_
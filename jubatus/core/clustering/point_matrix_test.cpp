@@ -0,0 +1,156 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "jubatus/util/lang/cast.h"
+#include "jubatus/util/math/random.h"
+#include "../common/type.hpp"
+#include "dbscan.hpp"
+#include "kmeans_clustering_method.hpp"
+#include "point_matrix.hpp"
+#include "util.hpp"
+
+using std::make_pair;
+using std::string;
+using std::vector;
+using jubatus::core::common::sfv_t;
+using jubatus::util::lang::lexical_cast;
+
+namespace jubatus {
+namespace core {
+namespace clustering {
+
+namespace {
+
+wplist make_points(size_t size, uint32_t seed, bool sparse) {
+  jubatus::util::math::random::mtrand rand(seed);
+  wplist points;
+  for (size_t i = 0; i < size; ++i) {
+    weighted_point p;
+    p.id = lexical_cast<string>(i);
+    p.weight = 1 + rand.next_int(3);
+    // three groups of points apart from each other
+    double offset = 10.0 * (i % 3);
+    for (size_t j = 0; j < 8; ++j) {
+      if (!sparse || rand.next_int(4) != 0) {
+        p.data.push_back(make_pair("f" + lexical_cast<string>(j),
+                                   offset + rand.next_double()));
+      }
+    }
+    points.push_back(p);
+  }
+  return points;
+}
+
+}  // namespace
+
+TEST(point_matrix, distances) {
+  wplist points = make_points(30, 0, true);
+  point_matrix m(points);
+  ASSERT_EQ(30u, m.rows());
+  EXPECT_EQ(8u, m.columns());
+
+  for (size_t i = 0; i < points.size(); ++i) {
+    EXPECT_EQ(points[i].weight, m.weight(i));
+    for (size_t j = 0; j < points.size(); ++j) {
+      EXPECT_EQ(sfv_euclid_dist(points[j].data, points[i].data),
+                m.euclid_dist(j, i));
+      EXPECT_EQ(sfv_cosine_dist(points[j].data, points[i].data),
+                m.cosine_dist(j, i));
+    }
+  }
+}
+
+TEST(point_matrix, dense) {
+  wplist points = make_points(10, 1, true);
+  point_matrix m(points);
+  vector<double> center(m.columns());
+
+  for (size_t i = 0; i < points.size(); ++i) {
+    m.row_to_dense(i, &center[0]);
+    EXPECT_EQ(points[i].data, m.to_sfv(&center[0]));
+    m.to_dense(points[i].data, &center[0]);
+    EXPECT_EQ(points[i].data, m.to_sfv(&center[0]));
+
+    double norm = dense_squared_norm(&center[0], center.size());
+    EXPECT_DOUBLE_EQ(m.squared_norm(i), norm);
+    for (size_t j = 0; j < points.size(); ++j) {
+      EXPECT_NEAR(sfv_euclid_dist(points[j].data, points[i].data),
+                  dense_euclid_dist(m, j, &center[0], norm), 1e-6);
+      EXPECT_NEAR(sfv_cosine_dist(points[j].data, points[i].data),
+                  dense_cosine_dist(m, j, &center[0], norm), 1e-9);
+    }
+  }
+
+  sfv_t unknown;
+  unknown.push_back(make_pair("unknown", 1.0));
+  m.to_dense(unknown, &center[0]);
+  EXPECT_TRUE(m.to_sfv(&center[0]).empty());
+}
+
+TEST(point_matrix, kmeans_threads) {
+  wplist points = make_points(300, 2, false);
+  kmeans_clustering_method serial(3, 0);
+  kmeans_clustering_method parallel(3, 0);
+  parallel.set_threads(4);
+  serial.batch_update(points);
+  parallel.batch_update(points);
+
+  vector<sfv_t> expected = serial.get_k_center();
+  vector<sfv_t> actual = parallel.get_k_center();
+  ASSERT_EQ(3u, actual.size());
+  EXPECT_EQ(expected, actual);
+
+  vector<wplist> clusters = parallel.get_clusters(points);
+  ASSERT_EQ(3u, clusters.size());
+  for (size_t i = 0; i < clusters.size(); ++i) {
+    EXPECT_EQ(100u, clusters[i].size());
+  }
+}
+
+TEST(point_matrix, dbscan_threads) {
+  wplist points = make_points(300, 3, false);
+  const char* distances[] = {"euclidean", "cosine"};
+  for (size_t d = 0; d < 2; ++d) {
+    dbscan serial(2.0, 3, distances[d]);
+    dbscan parallel(2.0, 3, distances[d]);
+    parallel.set_threads(4);
+    serial.batch(points);
+    parallel.batch(points);
+
+    EXPECT_EQ(serial.get_point_states(), parallel.get_point_states());
+    vector<wplist> expected = serial.get_clusters();
+    vector<wplist> actual = parallel.get_clusters();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ASSERT_EQ(expected[i].size(), actual[i].size());
+      for (size_t j = 0; j < expected[i].size(); ++j) {
+        EXPECT_EQ(expected[i][j].id, actual[i][j].id);
+      }
+    }
+  }
+
+  dbscan euclid(2.0, 3, "euclidean");
+  euclid.batch(points);
+  EXPECT_EQ(3u, euclid.get_clusters().size());
+}
+
+}  // namespace clustering
+}  // namespace core
+}  // namespace jubatus
@@ -24,6 +24,7 @@
 #include "simple_storage.hpp"
 #include "../common/jsonconfig.hpp"
 #include "storage.hpp"
+#include "util.hpp"
 
 using jubatus::core::common::jsonconfig::config;
 using jubatus::core::common::jsonconfig::config_cast_check;
@@ -58,8 +59,10 @@ jubatus::util::lang::shared_ptr<storage> storage_factory::create(
                                        conf.bicriteria_base_size,
                                        conf.forgetting_factor,
                                        conf.forgetting_threshold);
-      s->set_compressor(jubatus::util::lang::shared_ptr<compressor::compressor>(
-          new compressor::kmeans_compressor(conf.seed)));
+      jubatus::util::lang::shared_ptr<compressor::kmeans_compressor> c(
+          new compressor::kmeans_compressor(conf.seed));
+      c->set_threads(read_threads_config(conf.threads));
+      s->set_compressor(c);
       ret.reset(s);
     } else {
       throw JUBATUS_EXCEPTION(
@@ -94,8 +97,10 @@ jubatus::util::lang::shared_ptr<storage> storage_factory::create(
                                         conf.bicriteria_base_size,
                                         conf.forgetting_factor,
                                         conf.forgetting_threshold);
-      s->set_compressor(jubatus::util::lang::shared_ptr<compressor::compressor>(
-             new compressor::gmm_compressor(conf.seed)));
+      jubatus::util::lang::shared_ptr<compressor::gmm_compressor> c(
+          new compressor::gmm_compressor(conf.seed));
+      c->set_threads(read_threads_config(conf.threads));
+      s->set_compressor(c);
       ret.reset(s);
     } else {
       throw JUBATUS_EXCEPTION(
@@ -136,8 +141,10 @@ jubatus::util::lang::shared_ptr<storage> storage_factory::create(
                                        conf.bicriteria_base_size,
                                        conf.forgetting_factor,
                                        conf.forgetting_threshold);
-      s->set_compressor(jubatus::util::lang::shared_ptr<compressor::compressor>(
-          new compressor::kmeans_compressor(conf.seed, distance)));
+      jubatus::util::lang::shared_ptr<compressor::kmeans_compressor> c(
+          new compressor::kmeans_compressor(conf.seed, distance));
+      c->set_threads(read_threads_config(conf.threads));
+      s->set_compressor(c);
       ret.reset(s);
     } else {
       throw JUBATUS_EXCEPTION(
@@ -172,8 +179,10 @@ jubatus::util::lang::shared_ptr<storage> storage_factory::create(
                                         conf.bicriteria_base_size,
                                         conf.forgetting_factor,
                                         conf.forgetting_threshold);
-      s->set_compressor(jubatus::util::lang::shared_ptr<compressor::compressor>(
-             new compressor::gmm_compressor(conf.seed)));
+      jubatus::util::lang::shared_ptr<compressor::gmm_compressor> c(
+          new compressor::gmm_compressor(conf.seed));
+      c->set_threads(read_threads_config(conf.threads));
+      s->set_compressor(c);
       ret.reset(s);
     } else {
       throw JUBATUS_EXCEPTION(
@@ -24,6 +24,7 @@
 #include <algorithm>
 #include "../recommender/recommender_base.hpp"
 #include "../../util/lang/function.h"
+#include "jubatus/util/concurrent/thread.h"
 
 using std::pair;
 using std::string;
@@ -260,6 +261,17 @@ std::pair<size_t, double> min_dist(
   return std::make_pair(midx, md);
 }
 
+uint32_t read_threads_config(
+    const jubatus::util::data::optional<int32_t>& threads) {
+  if (!threads) {
+    return 0;
+  }
+  if (*threads < 0) {
+    return jubatus::util::concurrent::thread::hardware_concurrency();
+  }
+  return static_cast<uint32_t>(*threads);
+}
+
 }  // namespace clustering
 }  // namespace core
 }  // namespace jubatus
@@ -19,6 +19,7 @@
 
 #include <utility>
 #include <vector>
+#include "jubatus/util/data/optional.h"
 #include "types.hpp"
 #include "discrete_distribution.hpp"
 
@@ -59,6 +60,10 @@ std::pair<size_t, double> min_dist(
 
 void dump_wplist(const wplist& src);
 
+// number of threads from a "threads" parameter; negative means all cores
+uint32_t read_threads_config(
+    const jubatus::util::data::optional<int32_t>& threads);
+
 }  // namespace clustering
 }  // namespace core
 }  // namespace jubatus
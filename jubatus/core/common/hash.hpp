@@ -35,6 +35,116 @@ class hash_util {
     }
     return hash;
   }
+
+  // FNV-1 hash of the decimal representation of n, without building the
+  // string; same as calc_string_hash(lexical_cast<std::string>(n))
+  static uint64_t calc_decimal_hash(uint64_t n) {
+    char digits[20];
+    size_t len = 0;
+    do {
+      digits[len++] = static_cast<char>('0' + n % 10);
+      n /= 10;
+    } while (n != 0);
+
+    uint64_t hash = 14695981039346656037LLU;
+    while (len > 0) {
+      hash *= 1099511628211LLU;
+      hash ^= digits[--len];
+    }
+    return hash;
+  }
+
+  // xxHash (XXH64) with seed 0; processes 8 bytes at a time
+  static uint64_t calc_fast_hash(const std::string& s) {
+    return calc_fast_hash(s.data(), s.size());
+  }
+
+  static uint64_t calc_fast_hash(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + len;
+    uint64_t hash;
+
+    if (len >= 32) {
+      uint64_t v1 = PRIME64_1 + PRIME64_2;
+      uint64_t v2 = PRIME64_2;
+      uint64_t v3 = 0;
+      uint64_t v4 = -PRIME64_1;
+      const unsigned char* const limit = end - 32;
+      do {
+        v1 = xxh_round(v1, read64(p));
+        v2 = xxh_round(v2, read64(p + 8));
+        v3 = xxh_round(v3, read64(p + 16));
+        v4 = xxh_round(v4, read64(p + 24));
+        p += 32;
+      } while (p <= limit);
+
+      hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      hash = xxh_merge(hash, v1);
+      hash = xxh_merge(hash, v2);
+      hash = xxh_merge(hash, v3);
+      hash = xxh_merge(hash, v4);
+    } else {
+      hash = PRIME64_5;
+    }
+
+    hash += len;
+
+    for (; p + 8 <= end; p += 8) {
+      hash ^= xxh_round(0, read64(p));
+      hash = rotl(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+      hash ^= read32(p) * PRIME64_1;
+      hash = rotl(hash, 23) * PRIME64_2 + PRIME64_3;
+      p += 4;
+    }
+    for (; p < end; ++p) {
+      hash ^= *p * PRIME64_5;
+      hash = rotl(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+ private:
+  static const uint64_t PRIME64_1 = 11400714785074694791LLU;
+  static const uint64_t PRIME64_2 = 14029467366897019727LLU;
+  static const uint64_t PRIME64_3 = 1609587929392839161LLU;
+  static const uint64_t PRIME64_4 = 9650029242287828579LLU;
+  static const uint64_t PRIME64_5 = 2870177450012600261LLU;
+
+  static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  // little endian regardless of the platform
+  static uint64_t read64(const unsigned char* p) {
+    return static_cast<uint64_t>(read32(p)) |
+        (static_cast<uint64_t>(read32(p + 4)) << 32);
+  }
+
+  static uint64_t read32(const unsigned char* p) {
+    return static_cast<uint64_t>(p[0]) |
+        (static_cast<uint64_t>(p[1]) << 8) |
+        (static_cast<uint64_t>(p[2]) << 16) |
+        (static_cast<uint64_t>(p[3]) << 24);
+  }
+
+  static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl(acc, 31);
+    return acc * PRIME64_1;
+  }
+
+  static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+  }
 };
 
 }  // namespace common
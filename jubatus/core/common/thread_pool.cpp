@@ -15,9 +15,11 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "thread_pool.hpp"
+#include <deque>
 #include <vector>
 
 using jubatus::util::concurrent::scoped_lock;
+using jubatus::util::lang::bind;
 using jubatus::util::lang::function;
 using jubatus::util::lang::shared_ptr;
 
@@ -26,10 +28,14 @@ namespace core {
 namespace common {
 
 thread_pool::thread_pool(int max_threads)
-  : pool_(), queue_(), mutex_(), cond_(), shutdown_(false) {
-  if (max_threads < 0)
-    max_threads = thread::hardware_concurrency();
-  pool_.reserve(max_threads);
+  : max_threads_(max_threads < 0 ?
+                 thread::hardware_concurrency() : max_threads),
+    queues_(), pool_(), mutex_(), cond_(), pending_(0), next_queue_(0),
+    shutdown_(false), done_mutex_(), done_cond_() {
+  queues_.reserve(max_threads_);
+  for (size_t i = 0; i < max_threads_; ++i)
+    queues_.push_back(shared_ptr<worker_queue>(new worker_queue));
+  pool_.reserve(max_threads_);
 }
 
 thread_pool::~thread_pool() {
@@ -44,21 +50,166 @@ thread_pool::~thread_pool() {
   }
 }
 
-void thread_pool::worker(thread_pool *tp) {
-  while (true) {
-    function<void()> task;
+void thread_pool::parallel_for(
+    size_t begin,
+    size_t end,
+    size_t threads,
+    const function<void(size_t, size_t)>& body) {
+  if (begin >= end)
+    return;
+  const size_t block = block_size(end - begin, threads);
+  if (max_threads_ == 0 || block >= end - begin) {
+    body(begin, end);
+    return;
+  }
+
+  std::vector<queued_task> tasks;
+  size_t remaining = 0;
+  exception::exception_thrower_ptr error;
+  for (size_t off = begin + block; off < end; off += block) {
+    tasks.push_back(queued_task(
+        bind(&run_block, &body, this, &remaining, &error,
+             off, std::min(off + block, end)),
+        &remaining));
+  }
+  remaining = tasks.size();
+  submit(tasks);
+
+  try {
+    body(begin, begin + block);
+  } catch (...) {
+    keep_first_error(error);
+  }
+  // the other blocks refer to body, remaining and error until they finish
+  wait(remaining);
+  if (error) {
+    error->throw_exception();
+  }
+}
+
+void thread_pool::submit(const std::vector<queued_task>& tasks) {
+  size_t first;
+  {
+    scoped_lock lk(mutex_);
+    while (pool_.size() < max_threads_) {
+      shared_ptr<thread> th(new thread(bind(&worker, this, pool_.size())));
+      th->start();
+      pool_.push_back(th);
+    }
+    first = next_queue_;
+    next_queue_ = (next_queue_ + tasks.size()) % queues_.size();
+  }
+
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    worker_queue& q = *queues_[(first + i) % queues_.size()];
+    scoped_lock lk(q.m);
+    q.tasks.push_back(tasks[i]);
+  }
+
+  {
+    scoped_lock lk(mutex_);
+    pending_ += tasks.size();
+    cond_.notify_all();
+  }
+}
+
+bool thread_pool::try_run_one(size_t hint, const size_t* batch) {
+  const size_t n = queues_.size();
+  for (size_t k = 0; k < n; ++k) {
+    worker_queue& q = *queues_[(hint + k) % n];
+    task_t task;
     {
-      scoped_lock lk(tp->mutex_);
-      while (tp->queue_.empty()) {
-        if (tp->shutdown_)
-          return;
-        tp->cond_.wait(tp->mutex_);
+      scoped_lock lk(q.m);
+      if (q.tasks.empty())
+        continue;
+      if (batch != NULL) {
+        std::deque<queued_task>::iterator it = q.tasks.end();
+        while (it != q.tasks.begin() && (it - 1)->batch != batch)
+          --it;
+        if (it == q.tasks.begin())
+          continue;
+        --it;
+        task = it->run;
+        q.tasks.erase(it);
+      } else if (k == 0) {
+        // pop own work LIFO for locality, steal from others FIFO
+        task = q.tasks.back().run;
+        q.tasks.pop_back();
+      } else {
+        task = q.tasks.front().run;
+        q.tasks.pop_front();
       }
-      task = tp->queue_.front();
-      tp->queue_.pop();
+    }
+    {
+      scoped_lock lk(mutex_);
+      --pending_;
     }
     task();
+    return true;
+  }
+  return false;
+}
+
+void thread_pool::wait(const size_t& remaining) {
+  const size_t hint = queues_.empty() ?
+      0 : static_cast<size_t>(thread::id()) % queues_.size();
+  while (true) {
+    {
+      scoped_lock lk(done_mutex_);
+      if (remaining == 0)
+        return;
+    }
+    // help with the tasks of this batch instead of blocking; running other
+    // tasks here could take locks in an order the caller does not expect
+    if (!try_run_one(hint, &remaining))
+      break;
+  }
+
+  scoped_lock lk(done_mutex_);
+  while (remaining != 0)
+    done_cond_.wait(done_mutex_);
+}
+
+void thread_pool::count_down(size_t& remaining) {
+  scoped_lock lk(done_mutex_);
+  if (--remaining == 0)
+    done_cond_.notify_all();
+}
+
+void thread_pool::keep_first_error(exception::exception_thrower_ptr& first) {
+  exception::exception_thrower_ptr e = exception::get_current_exception();
+  scoped_lock lk(done_mutex_);
+  if (!first) {
+    first = e;
+  }
+}
+
+void thread_pool::worker(thread_pool *tp, size_t index) {
+  while (true) {
+    if (tp->try_run_one(index, NULL))
+      continue;
+    scoped_lock lk(tp->mutex_);
+    // pending_ may briefly go negative when a task is taken before
+    // submit() has counted it
+    while (tp->pending_ <= 0) {
+      if (tp->shutdown_)
+        return;
+      tp->cond_.wait(tp->mutex_);
+    }
+  }
+}
+
+void thread_pool::run_block(
+    const function<void(size_t, size_t)>* body,
+    thread_pool* tp, size_t* remaining,
+    exception::exception_thrower_ptr* error,
+    size_t begin, size_t end) {
+  try {
+    (*body)(begin, end);
+  } catch (...) {
+    tp->keep_first_error(*error);
   }
+  tp->count_down(*remaining);
 }
 
 namespace default_thread_pool {
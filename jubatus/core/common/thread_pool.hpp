@@ -17,59 +17,83 @@
 #ifndef JUBATUS_CORE_COMMON_THREAD_POOL_HPP_
 #define JUBATUS_CORE_COMMON_THREAD_POOL_HPP_
 
+#include <stdint.h>
+
 #include <jubatus/util/concurrent/condition.h>
 #include <jubatus/util/concurrent/mutex.h>
 #include <jubatus/util/concurrent/lock.h>
 #include <jubatus/util/concurrent/thread.h>
 #include <jubatus/util/lang/bind.h>
 #include <jubatus/util/lang/function.h>
+#include <jubatus/util/lang/noncopyable.h>
 #include <jubatus/util/lang/shared_ptr.h>
 
-#include <queue>
+#include <algorithm>
+#include <deque>
 #include <vector>
 
+#include "exception.hpp"
+
 namespace jubatus {
 namespace core {
 namespace common {
 
-class thread_pool {
+// Work-stealing thread pool.
+//
+// Every worker owns a task deque.  Submitted tasks are distributed over the
+// deques in round-robin; a worker pops from the back of its own deque and
+// steals from the front of the others when it runs dry.  Threads blocked in
+// future::get() or parallel_for() run the pending tasks of the batch they
+// wait for, so nested parallel sections cannot exhaust the pool.  They never
+// run unrelated tasks, which may need locks held by the waiting caller.
+class thread_pool : jubatus::util::lang::noncopyable {
   typedef jubatus::util::concurrent::mutex mutex;
   typedef jubatus::util::concurrent::condition condition;
   typedef jubatus::util::concurrent::thread thread;
   typedef jubatus::util::concurrent::scoped_lock scoped_lock;
+  typedef jubatus::util::lang::function<void()> task_t;
 
  public:
+  // max_threads < 0 means the number of hardware threads;
+  // max_threads == 0 runs every task on the calling thread.
   explicit thread_pool(int max_threads);
   ~thread_pool();
 
+  size_t max_threads() const {
+    return max_threads_;
+  }
+
   template<typename T>
   class future {
   public:
-    explicit future(const jubatus::util::lang::function<T()>& func)
-      : func_(func), ret_(), mutex_(), cond_(), finished_(false) {}
-
     const T& get() const {
-      scoped_lock lk(mutex_);
-      while (!finished_)
-        cond_.wait(mutex_);
+      pool_->wait(remaining_);
+      if (error_) {
+        error_->throw_exception();
+      }
       return ret_;
     }
 
   private:
+    future(thread_pool* pool, const jubatus::util::lang::function<T()>& func)
+      : pool_(pool), func_(func), ret_(), remaining_(1), error_() {}
+
     void execute() {
-      ret_ = func_();
-      {
-        jubatus::util::concurrent::scoped_lock lk(mutex_);
-        finished_ = true;
-        cond_.notify_all();
+      try {
+        ret_ = func_();
+      } catch (...) {
+        error_ = exception::get_current_exception();
       }
+      pool_->count_down(remaining_);
     }
 
+    thread_pool* pool_;
     const jubatus::util::lang::function<T()> func_;
     T ret_;
-    mutable mutex mutex_;
-    mutable condition cond_;
-    bool finished_;
+    // guarded by thread_pool::done_mutex_
+    size_t remaining_;
+    // set when func_ threw; get() rethrows it
+    exception::exception_thrower_ptr error_;
 
     friend class thread_pool;
 
@@ -83,20 +107,13 @@ class thread_pool {
     using jubatus::util::lang::bind;
     using jubatus::util::lang::shared_ptr;
     typedef typename Function::result_type R;
-    shared_ptr<future<R> >fut(new future<R>(f));
-    if (pool_.capacity() == 0) {
+    shared_ptr<future<R> > fut(new future<R>(this, f));
+    if (max_threads_ == 0) {
       fut->execute();
     } else {
-      scoped_lock lk(mutex_);
-      const bool empty_flag = queue_.empty();
-      queue_.push(bind(&wrapper<R>, fut.get()));
-      if (pool_.size() < pool_.capacity()) {
-        shared_ptr<thread> th(new thread(bind(&worker, this)));
-        th->start();
-        pool_.push_back(th);
-      } else if (empty_flag) {
-        cond_.notify_all();
-      }
+      std::vector<queued_task> tasks(1, queued_task(
+          bind(&wrapper<R>, fut.get()), &fut->remaining_));
+      submit(tasks);
     }
     return fut;
   }
@@ -110,46 +127,140 @@ class thread_pool {
     using jubatus::util::lang::shared_ptr;
     typedef typename Function::result_type R;
     typedef typename std::vector<Function>::const_iterator Iter;
-    typedef typename std::vector<shared_ptr<future<R> > >::iterator RIter;
 
     std::vector<shared_ptr<future<R> > > ret;
     ret.reserve(funcs.size());
-
     for (Iter it = funcs.begin(); it != funcs.end(); ++it)
-      ret.push_back(shared_ptr<future<R> >(new future<R>(*it)));
+      ret.push_back(shared_ptr<future<R> >(new future<R>(this, *it)));
 
-    if (pool_.capacity() == 0) {
-      for (RIter it = ret.begin(); it != ret.end(); ++it)
-        (*it)->execute();
+    if (max_threads_ == 0) {
+      for (size_t i = 0; i < ret.size(); ++i)
+        ret[i]->execute();
     } else {
-      scoped_lock lk(mutex_);
-      const bool empty_flag = queue_.empty();
-      for (RIter it = ret.begin(); it != ret.end(); ++it)
-        queue_.push(bind(&wrapper<R>, (*it).get()));
-      while (pool_.size() < pool_.capacity() && pool_.size() < queue_.size()) {
-        shared_ptr<thread> th(new thread(bind(&worker, this)));
-        th->start();
-        pool_.push_back(th);
-      }
-      if (empty_flag)
-        cond_.notify_all();
+      std::vector<queued_task> tasks;
+      tasks.reserve(ret.size());
+      for (size_t i = 0; i < ret.size(); ++i)
+        tasks.push_back(queued_task(bind(&wrapper<R>, ret[i].get()),
+                                    &ret[i]->remaining_));
+      submit(tasks);
     }
     return ret;
   }
 
+  // Splits [begin, end) into at most `threads` contiguous blocks and calls
+  // body(block_begin, block_end) for each of them.  The first block runs on
+  // the calling thread.  Returns when all blocks are finished; if any block
+  // threw, the first exception is rethrown after that.
+  void parallel_for(
+      size_t begin,
+      size_t end,
+      size_t threads,
+      const jubatus::util::lang::function<void(size_t, size_t)>& body);
+
+  // Evaluates map(block_begin, block_end) on blocks of [begin, end) as
+  // parallel_for does, then folds the partial results into `ret` with
+  // reduce(ret, partial) in block order, so the result does not depend on
+  // scheduling.
+  template<typename T>
+  void parallel_reduce(
+      size_t begin,
+      size_t end,
+      size_t threads,
+      const jubatus::util::lang::function<T(size_t, size_t)>& map,
+      const jubatus::util::lang::function<void(T&, const T&)>& reduce,
+      T& ret) {
+    using jubatus::util::lang::bind;
+    using jubatus::util::lang::_1;
+    using jubatus::util::lang::_2;
+    if (begin >= end) {
+      return;
+    }
+    const size_t block = block_size(end - begin, threads);
+    const size_t num_blocks = (end - begin + block - 1) / block;
+    if (num_blocks == 1) {
+      reduce(ret, map(begin, end));
+      return;
+    }
+    std::vector<T> partials(num_blocks);
+    parallel_for(0, num_blocks, num_blocks,
+                 bind(&map_blocks<T>, &map, &partials, begin, end, block,
+                      _1, _2));
+    for (size_t i = 0; i < partials.size(); ++i) {
+      reduce(ret, partials[i]);
+    }
+  }
+
+  // Size of each block when `size` items are split for `threads` threads.
+  static size_t block_size(size_t size, size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    return std::max<size_t>((size + threads - 1) / threads, 1);
+  }
+
  private:
   template<typename T>
   static void wrapper(future<T> *fut) {
     fut->execute();
   }
 
-  static void worker(thread_pool *tp);
+  template<typename T>
+  static void map_blocks(
+      const jubatus::util::lang::function<T(size_t, size_t)>* map,
+      std::vector<T>* partials,
+      size_t begin, size_t end, size_t block,
+      size_t first_block, size_t last_block) {
+    for (size_t b = first_block; b < last_block; ++b) {
+      const size_t off = begin + b * block;
+      (*partials)[b] = (*map)(off, std::min(off + block, end));
+    }
+  }
+
+  // a task and the completion counter of the batch it belongs to
+  struct queued_task {
+    queued_task()
+        : batch(NULL) {
+    }
+    queued_task(const task_t& run, const size_t* batch)
+        : run(run), batch(batch) {
+    }
+    task_t run;
+    const size_t* batch;
+  };
+
+  struct worker_queue {
+    mutex m;
+    std::deque<queued_task> tasks;
+  };
 
+  void submit(const std::vector<queued_task>& tasks);
+  // runs a queued task of `batch`, or of any batch if `batch` is NULL
+  bool try_run_one(size_t hint, const size_t* batch);
+  void wait(const size_t& remaining);
+  void count_down(size_t& remaining);
+  // keeps the exception being handled in `first` unless one is already there
+  void keep_first_error(exception::exception_thrower_ptr& first);
+
+  static void worker(thread_pool *tp, size_t index);
+  static void run_block(
+      const jubatus::util::lang::function<void(size_t, size_t)>* body,
+      thread_pool* tp, size_t* remaining,
+      exception::exception_thrower_ptr* error,
+      size_t begin, size_t end);
+
+  const size_t max_threads_;
+  std::vector<jubatus::util::lang::shared_ptr<worker_queue> > queues_;
   std::vector<jubatus::util::lang::shared_ptr<thread> > pool_;
-  std::queue<jubatus::util::lang::function<void()> > queue_;
+
+  // guards pending_, next_queue_, shutdown_ and worker start-up
   mutex mutex_;
   condition cond_;
+  int64_t pending_;
+  size_t next_queue_;
   bool shutdown_;
+
+  // guards completion counters of futures and parallel_for, and the first
+  // exception of a parallel_for batch
+  mutex done_mutex_;
+  condition done_cond_;
 };
 
 namespace default_thread_pool {
@@ -169,6 +280,25 @@ namespace default_thread_pool {
   async_all(const std::vector<Function>& funcs) {
     return instance.async_all(funcs);
   }
+
+  inline void parallel_for(
+      size_t begin,
+      size_t end,
+      size_t threads,
+      const jubatus::util::lang::function<void(size_t, size_t)>& body) {
+    instance.parallel_for(begin, end, threads, body);
+  }
+
+  template<typename T>
+  void parallel_reduce(
+      size_t begin,
+      size_t end,
+      size_t threads,
+      const jubatus::util::lang::function<T(size_t, size_t)>& map,
+      const jubatus::util::lang::function<void(T&, const T&)>& reduce,
+      T& ret) {
+    instance.parallel_reduce(begin, end, threads, map, reduce, ret);
+  }
 }
 
 }  // namespace common
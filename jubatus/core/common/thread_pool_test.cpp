@@ -0,0 +1,225 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+#include "jubatus/util/concurrent/condition.h"
+#include "jubatus/util/concurrent/lock.h"
+#include "jubatus/util/concurrent/mutex.h"
+#include "jubatus/util/lang/bind.h"
+#include "jubatus/util/lang/function.h"
+#include "jubatus/util/lang/shared_ptr.h"
+#include "thread_pool.hpp"
+
+using std::vector;
+using jubatus::util::lang::bind;
+using jubatus::util::lang::function;
+using jubatus::util::lang::shared_ptr;
+using jubatus::util::lang::_1;
+using jubatus::util::lang::_2;
+
+namespace jubatus {
+namespace core {
+namespace common {
+
+namespace {
+
+int square(int x) {
+  return x * x;
+}
+
+void fill_index(vector<int>* v, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    (*v)[i] += static_cast<int>(i);
+  }
+}
+
+size_t sum_index(size_t begin, size_t end) {
+  size_t sum = 0;
+  for (size_t i = begin; i < end; ++i) {
+    sum += i;
+  }
+  return sum;
+}
+
+// fills its block, then fails for blocks in the upper half
+void fill_then_throw(vector<int>* v, size_t begin, size_t end) {
+  fill_index(v, begin, end);
+  if (end > v->size() / 2) {
+    throw std::out_of_range("block");
+  }
+}
+
+int throw_int() {
+  throw std::out_of_range("future");
+}
+
+void add(size_t& x, const size_t& y) {
+  x += y;
+}
+
+void nested_fill(thread_pool* pool, vector<vector<int> >* rows,
+                 size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    pool->parallel_for(0, (*rows)[i].size(), 4,
+                       bind(&fill_index, &(*rows)[i], _1, _2));
+  }
+}
+
+struct gate {
+  gate()
+      : open(false) {
+  }
+  jubatus::util::concurrent::mutex m;
+  jubatus::util::concurrent::condition c;
+  bool open;
+};
+
+int wait_gate(gate* g) {
+  jubatus::util::concurrent::scoped_lock lk(g->m);
+  while (!g->open) {
+    g->c.wait(g->m);
+  }
+  return 0;
+}
+
+int mark_ran(gate* g) {
+  jubatus::util::concurrent::scoped_lock lk(g->m);
+  g->open = true;
+  return 0;
+}
+
+}  // namespace
+
+class thread_pool_test : public testing::TestWithParam<int> {
+};
+
+TEST_P(thread_pool_test, async_all) {
+  thread_pool pool(GetParam());
+  vector<function<int()> > funcs;
+  for (int i = 0; i < 100; ++i) {
+    funcs.push_back(bind(&square, i));
+  }
+  vector<shared_ptr<thread_pool::future<int> > > futures =
+      pool.async_all(funcs);
+  ASSERT_EQ(100u, futures.size());
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(i * i, futures[i]->get());
+  }
+  EXPECT_EQ(49, pool.async(bind(&square, 7))->get());
+}
+
+TEST_P(thread_pool_test, parallel_for) {
+  thread_pool pool(GetParam());
+  for (size_t threads = 0; threads <= 9; ++threads) {
+    vector<int> v(1000, 0);
+    pool.parallel_for(0, v.size(), threads, bind(&fill_index, &v, _1, _2));
+    for (size_t i = 0; i < v.size(); ++i) {
+      ASSERT_EQ(static_cast<int>(i), v[i]);
+    }
+  }
+
+  // empty range
+  vector<int> v;
+  pool.parallel_for(0, 0, 4, bind(&fill_index, &v, _1, _2));
+}
+
+TEST_P(thread_pool_test, parallel_for_nested) {
+  thread_pool pool(GetParam());
+  vector<vector<int> > rows(16, vector<int>(100, 0));
+  pool.parallel_for(0, rows.size(), 8,
+                    bind(&nested_fill, &pool, &rows, _1, _2));
+  for (size_t r = 0; r < rows.size(); ++r) {
+    for (size_t i = 0; i < rows[r].size(); ++i) {
+      ASSERT_EQ(static_cast<int>(i), rows[r][i]);
+    }
+  }
+}
+
+TEST_P(thread_pool_test, parallel_reduce) {
+  thread_pool pool(GetParam());
+  for (size_t threads = 1; threads <= 9; ++threads) {
+    size_t sum = 0;
+    pool.parallel_reduce<size_t>(
+        0, 1001, threads, &sum_index, &add, sum);
+    EXPECT_EQ(500500u, sum);
+  }
+}
+
+TEST_P(thread_pool_test, parallel_for_rethrows_after_drain) {
+  thread_pool pool(GetParam());
+  for (size_t threads = 1; threads <= 9; ++threads) {
+    vector<int> v(1000, 0);
+    EXPECT_THROW(
+        pool.parallel_for(0, v.size(), threads,
+                          bind(&fill_then_throw, &v, _1, _2)),
+        std::out_of_range);
+    // every block has run before the exception reaches the caller
+    for (size_t i = 0; i < v.size(); ++i) {
+      ASSERT_EQ(static_cast<int>(i), v[i]);
+    }
+  }
+}
+
+TEST_P(thread_pool_test, future_rethrows) {
+  thread_pool pool(GetParam());
+  shared_ptr<thread_pool::future<int> > f =
+      pool.async(function<int()>(&throw_int));
+  EXPECT_THROW(f->get(), std::out_of_range);
+  EXPECT_EQ(49, pool.async(bind(&square, 7))->get());
+}
+
+TEST(thread_pool, wait_runs_only_own_tasks) {
+  thread_pool pool(1);
+  gate g;
+  gate ran;
+  // keep the only worker busy
+  shared_ptr<thread_pool::future<int> > blocker =
+      pool.async(function<int()>(bind(&wait_gate, &g)));
+  shared_ptr<thread_pool::future<int> > other =
+      pool.async(function<int()>(bind(&mark_ran, &ran)));
+
+  // the waiting thread runs its own blocks, but not the other task
+  vector<int> v(100, 0);
+  pool.parallel_for(0, v.size(), 4, bind(&fill_index, &v, _1, _2));
+  for (size_t i = 0; i < v.size(); ++i) {
+    ASSERT_EQ(static_cast<int>(i), v[i]);
+  }
+
+  {
+    jubatus::util::concurrent::scoped_lock lk(ran.m);
+    EXPECT_FALSE(ran.open);
+  }
+
+  {
+    jubatus::util::concurrent::scoped_lock lk(g.m);
+    g.open = true;
+    g.c.notify_all();
+  }
+  blocker->get();
+  other->get();
+  jubatus::util::concurrent::scoped_lock lk(ran.m);
+  EXPECT_TRUE(ran.open);
+}
+
+INSTANTIATE_TEST_CASE_P(thread_pool_test_instance, thread_pool_test,
+                        testing::Values(0, 1, 4));
+
+}  // namespace common
+}  // namespace core
+}  // namespace jubatus
@@ -20,9 +20,12 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "jubatus/util/lang/bind.h"
+#include "jubatus/util/lang/function.h"
 
 #include "../classifier/classifier_factory.hpp"
 #include "../classifier/classifier_base.hpp"
+#include "../common/thread_pool.hpp"
 #include "../common/vector_util.hpp"
 #include "../fv_converter/datum.hpp"
 #include "../fv_converter/datum_to_fv_converter.hpp"
@@ -44,7 +47,8 @@ classifier::classifier(
     shared_ptr<fv_converter::datum_to_fv_converter> converter)
     : converter_(converter)
     , classifier_(classifier_method)
-    , wm_(mixable_weight_manager::model_ptr(new weight_manager)) {
+    , wm_(mixable_weight_manager::model_ptr(new weight_manager))
+    , convert_threads_(0) {
   vector<framework::mixable*> mixables = classifier_->get_mixables();
   for (size_t i = 0; i < mixables.size(); i++) {
     register_mixable(mixables[i]);
@@ -64,6 +68,18 @@ void classifier::train(const string& label, const fv_converter::datum& data) {
   classifier_->train(v, label);
 }
 
+void classifier::train_bulk(
+    const vector<std::pair<string, fv_converter::datum> >& data) {
+  // Reuse a single buffer so that its capacity is kept among examples.
+  common::sfv_t v;
+  for (size_t i = 0; i < data.size(); ++i) {
+    v.clear();
+    converter_->convert_and_update_weight(data[i].second, v);
+    common::sort_and_merge(v);
+    classifier_->train(v, data[i].first);
+  }
+}
+
 jubatus::core::classifier::classify_result classifier::classify(
     const fv_converter::datum& data) const {
   common::sfv_t v;
@@ -74,6 +90,35 @@ jubatus::core::classifier::classify_result classifier::classify(
   return scores;
 }
 
+namespace {
+
+void convert_range(
+    const fv_converter::datum_to_fv_converter* converter,
+    const vector<fv_converter::datum>* data,
+    vector<common::sfv_t>* fvs,
+    size_t off,
+    size_t end) {
+  for (size_t i = off; i < end; ++i) {
+    converter->convert((*data)[i], (*fvs)[i]);
+  }
+}
+
+}  // namespace
+
+vector<jubatus::core::classifier::classify_result> classifier::classify_bulk(
+    const vector<fv_converter::datum>& data) const {
+  vector<common::sfv_t> fvs(data.size());
+  common::default_thread_pool::parallel_for(
+      0, data.size(), convert_threads_,
+      jubatus::util::lang::bind(
+          &convert_range, converter_.get(), &data, &fvs,
+          jubatus::util::lang::_1, jubatus::util::lang::_2));
+
+  vector<jubatus::core::classifier::classify_result> scores;
+  classifier_->bulk_classify_with_scores(fvs, scores);
+  return scores;
+}
+
 void classifier::get_status(std::map<string, string>& status) const {
   classifier_->get_status(status);
   wm_.get_model()->get_status(status);
@@ -113,6 +158,22 @@ void classifier::unpack(msgpack::object o) {
   wm_.get_model()->unpack(o.via.array.ptr[1]);
 }
 
+void classifier::pack_chunked(framework::packer& pk, size_t chunk_rows) const {
+  classifier_->pack_chunked(pk, chunk_rows);
+  wm_.get_model()->pack(pk);
+}
+
+void classifier::unpack_chunked(framework::unpacker& unpacker) {
+  // clear before load
+  classifier_->clear();
+  converter_->clear_weights();
+  classifier_->unpack_chunked(unpacker);
+
+  msgpack::unpacked weights;
+  unpacker.next(weights);
+  wm_.get_model()->unpack(weights.get());
+}
+
 }  // namespace driver
 }  // namespace core
 }  // namespace jubatus
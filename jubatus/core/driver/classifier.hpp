@@ -17,8 +17,10 @@
 #ifndef JUBATUS_CORE_DRIVER_CLASSIFIER_HPP_
 #define JUBATUS_CORE_DRIVER_CLASSIFIER_HPP_
 
+#include <stdint.h>
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 #include "jubatus/util/lang/shared_ptr.h"
 #include "../classifier/classifier_type.hpp"
@@ -51,15 +53,29 @@ class classifier : public driver_base {
 
   void train(const std::string&, const fv_converter::datum&);
 
+  void train_bulk(
+      const std::vector<std::pair<std::string, fv_converter::datum> >& data);
+
   jubatus::core::classifier::classify_result classify(
       const fv_converter::datum& data) const;
 
+  std::vector<jubatus::core::classifier::classify_result> classify_bulk(
+      const std::vector<fv_converter::datum>& data) const;
+
+  // Number of threads used to convert datums in |classify_bulk|.
+  // 0 or 1 means the conversion is done in the calling thread.
+  void set_convert_threads(uint32_t threads) {
+    convert_threads_ = threads;
+  }
+
   void get_status(std::map<std::string, std::string>& status) const;
   bool delete_label(const std::string& name);
 
   void clear();
   void pack(framework::packer& pk) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& pk, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
 
   jubatus::core::classifier::labels_t get_labels() const;
   bool set_label(const std::string& label);
@@ -69,6 +85,7 @@ class classifier : public driver_base {
       converter_;
   jubatus::util::lang::shared_ptr<classifier_base> classifier_;
   fv_converter::mixable_weight_manager wm_;
+  uint32_t convert_threads_;
 };
 
 }  // namespace driver
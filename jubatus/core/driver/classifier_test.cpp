@@ -21,6 +21,7 @@
 #include <utility>
 #include <vector>
 #include <map>
+#include <sstream>
 
 #include <gtest/gtest.h>
 
@@ -38,6 +39,7 @@
 #include "../classifier/classifier_factory.hpp"
 #include "../classifier/classifier.hpp"
 #include "../fv_converter/datum.hpp"
+#include "../framework/stream_reader.hpp"
 #include "../framework/stream_writer.hpp"
 #include "../nearest_neighbor/nearest_neighbor_factory.hpp"
 #include "classifier.hpp"
@@ -198,6 +200,36 @@ TEST_P(classifier_test, my_test) {
   my_test();
 }
 
+TEST_P(classifier_test, bulk) {
+  jubatus::util::math::random::mtrand rand(0);
+  const size_t example_size = 200;
+
+  vector<pair<string, datum> > data;
+  make_random_data(rand, data, example_size);
+  classifier_->train_bulk(data);
+
+  vector<datum> queries;
+  for (size_t i = 0; i < data.size(); ++i) {
+    queries.push_back(data[i].second);
+  }
+
+  for (uint32_t threads = 1; threads <= 4; threads += 3) {
+    classifier_->set_convert_threads(threads);
+    vector<classify_result> results = classifier_->classify_bulk(queries);
+    ASSERT_EQ(queries.size(), results.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      classify_result expected = classifier_->classify(queries[i]);
+      ASSERT_EQ(expected.size(), results[i].size());
+      for (size_t j = 0; j < expected.size(); ++j) {
+        EXPECT_EQ(expected[j].label, results[i][j].label);
+        EXPECT_DOUBLE_EQ(expected[j].score, results[i][j].score);
+      }
+    }
+  }
+
+  EXPECT_TRUE(classifier_->classify_bulk(vector<datum>()).empty());
+}
+
 TEST_P(classifier_test, duplicated_keys) {
   jubatus::util::math::random::mtrand rand(0);
   datum d;
@@ -250,6 +282,33 @@ TEST_P(classifier_test, save_load) {
   my_test();
 }
 
+TEST_P(classifier_test, save_load_chunked) {
+  jubatus::util::math::random::mtrand rand(0);
+  const size_t example_size = 1000;
+
+  vector<pair<string, datum> > data;
+  make_random_data(rand, data, example_size);
+  for (size_t i = 0; i < example_size; i++) {
+    classifier_->train(data[i].first, data[i].second);
+  }
+
+  std::stringstream ss;
+  {
+    framework::stream_writer<std::stringstream> st(ss);
+    framework::jubatus_packer jp(st);
+    framework::packer pk(jp);
+    classifier_->pack_chunked(pk, 10);
+  }
+
+  classifier_->clear();
+
+  framework::stream_reader<std::stringstream> sr(ss);
+  framework::unpacker unpacker(sr);
+  classifier_->unpack_chunked(unpacker);
+
+  my_test();
+}
+
 TEST_P(classifier_test, save_load_2) {
   msgpack::sbuffer save_empty, save_test;
   framework::stream_writer<msgpack::sbuffer>
@@ -241,6 +241,25 @@ std::vector<storage::version> driver_base::get_versions() const {
   return holder_.get_versions();
 }
 
+void driver_base::pack_chunked(
+    framework::packer& packer, size_t chunk_rows) const {
+  pack(packer);
+}
+
+void driver_base::unpack_chunked(framework::unpacker& unpacker) {
+  msgpack::unpacked model;
+  unpacker.next(model);
+  unpack(model.get());
+}
+
+void driver_base::save_mapped(std::ostream& os) const {
+  throw JUBATUS_EXCEPTION(common::unsupported_method("save_mapped"));
+}
+
+void driver_base::load_mapped(const std::string& path) {
+  throw JUBATUS_EXCEPTION(common::unsupported_method("load_mapped"));
+}
+
 void driver_base::register_mixable(framework::mixable* mixable) {
   holder_.register_mixable(mixable);
 }
@@ -17,6 +17,7 @@
 #ifndef JUBATUS_CORE_DRIVER_DRIVER_HPP_
 #define JUBATUS_CORE_DRIVER_DRIVER_HPP_
 
+#include <iosfwd>
 #include <string>
 #include <set>
 #include <vector>
@@ -39,6 +40,26 @@ class driver_base {
 
   virtual void pack(framework::packer& packer) const = 0;
   virtual void unpack(msgpack::object o) = 0;
+
+  /**
+   * Writes the model to be read by ``unpack_chunked``, with large tables
+   * written in batches of at most ``chunk_rows`` rows so that neither
+   * saving nor loading holds the whole model as a single msgpack object.
+   * Drivers which do not support batches write the model as a single
+   * object.
+   */
+  virtual void pack_chunked(
+      framework::packer& packer, size_t chunk_rows) const;
+  virtual void unpack_chunked(framework::unpacker& unpacker);
+
+  /**
+   * Writes the model in a layout which ``load_mapped`` maps into memory
+   * and uses in place, so that large tables are loaded without parsing.
+   * Drivers which have no such layout throw unsupported_method.
+   */
+  virtual void save_mapped(std::ostream& os) const;
+  virtual void load_mapped(const std::string& path);
+
   virtual void clear() = 0;
 
  protected:
@@ -16,9 +16,14 @@
 
 #include "nearest_neighbor.hpp"
 
+#include <cstring>
+#include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
+#include "../framework/stream_writer.hpp"
+#include "../storage/column_table.hpp"
+#include "../storage/mapped_file.hpp"
 #include "../storage/row_deleter.hpp"
 #include "../fv_converter/datum_to_fv_converter.hpp"
 #include "../fv_converter/weight_manager.hpp"
@@ -33,6 +38,28 @@ using jubatus::util::lang::shared_ptr;
 using fv_converter::mixable_weight_manager;
 using fv_converter::weight_manager;
 
+namespace {
+
+/*
+ * Layout of the file written by save_mapped:
+ *
+ *   magic[8], uint32 format version, uint32 reserved (0),
+ *   uint64 size of the rest of the model, the rest of the model
+ *   (a msgpack array of the unlearner, if any, and the weights)
+ *   padded to an 8-byte boundary, then the row table in the layout
+ *   of column_table::save_mapped.
+ */
+const char mapped_magic[8] = {'J', 'U', 'B', 'A', 'N', 'N', 'M', '\0'};
+const uint32_t mapped_format_version = 1;
+const uint64_t mapped_header_size = 24;
+
+void broken_mapped_model(const std::string& path, const std::string& reason) {
+  throw JUBATUS_EXCEPTION(storage::storage_exception(
+      "broken mapped model: " + path + ": " + reason));
+}
+
+}  // namespace
+
 nearest_neighbor::nearest_neighbor(
     shared_ptr<core::nearest_neighbor::nearest_neighbor_base> nn,
     shared_ptr<fv_converter::datum_to_fv_converter> converter)
@@ -75,7 +102,7 @@ void nearest_neighbor::set_row(
   if (unlearner_) {
     unlearner_->touch(id);
   }
-  common::sfv_t v;
+  common::sfvi_t v;
   converter_->convert_and_update_weight(datum, v);
   nn_->set_row(id, v);
 }
@@ -91,7 +118,7 @@ std::vector<std::pair<std::string, double> >
 nearest_neighbor::neighbor_row_from_datum(
     const fv_converter::datum& datum,
     size_t size) {
-  common::sfv_t v;
+  common::sfvi_t v;
   converter_->convert(datum, v);
   std::vector<std::pair<std::string, double> > ret;
   nn_->neighbor_row(v, ret, size);
@@ -109,7 +136,7 @@ std::vector<std::pair<std::string, double> >
 nearest_neighbor::similar_row(
     const core::fv_converter::datum& datum,
     size_t ret_num) {
-  common::sfv_t v;
+  common::sfvi_t v;
   converter_->convert(datum, v);
   std::vector<std::pair<std::string, double> > ret;
   nn_->similar_row(v, ret, ret_num);
@@ -169,6 +196,69 @@ void nearest_neighbor::unpack(msgpack::object o) {
   wm_.get_model()->unpack(o.via.array.ptr[i+1]);
 }
 
+void nearest_neighbor::save_mapped(std::ostream& os) const {
+  msgpack::sbuffer buf;
+  framework::stream_writer<msgpack::sbuffer> st(buf);
+  framework::jubatus_packer jp(st);
+  framework::packer pk(jp);
+  if (unlearner_) {
+    pk.pack_array(2);
+    unlearner_->pack(pk);
+  } else {
+    pk.pack_array(1);
+  }
+  wm_.get_model()->pack(pk);
+
+  const uint32_t reserved = 0;
+  const uint64_t size = buf.size();
+  static const char padding[8] = {0};
+  os.write(mapped_magic, sizeof(mapped_magic));
+  os.write(reinterpret_cast<const char*>(&mapped_format_version),
+           sizeof(mapped_format_version));
+  os.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+  os.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  os.write(buf.data(), size);
+  os.write(padding, (8 - size % 8) % 8);
+  nn_->get_const_table()->save_mapped(os);  // lock acquired inside
+}
+
+void nearest_neighbor::load_mapped(const std::string& path) {
+  const shared_ptr<const storage::mapped_file> file(
+      new storage::mapped_file(path));
+  if (file->size() < mapped_header_size ||
+      std::memcmp(file->data(), mapped_magic, sizeof(mapped_magic)) != 0) {
+    broken_mapped_model(path, "not a mapped nearest_neighbor model");
+  }
+  uint32_t version;
+  std::memcpy(&version, file->data() + 8, sizeof(version));
+  if (version != mapped_format_version) {
+    broken_mapped_model(path, "unsupported format version");
+  }
+  uint64_t size;
+  std::memcpy(&size, file->data() + 16, sizeof(size));
+  if (size > file->size() - mapped_header_size) {
+    broken_mapped_model(path, "unexpected end of file");
+  }
+
+  msgpack::unpacked model;
+  msgpack::unpack(&model, file->data() + mapped_header_size, size);
+  const msgpack::object o = model.get();
+  const size_t n = unlearner_ ? 2 : 1;
+  if (o.type != msgpack::type::ARRAY || o.via.array.size != n) {
+    throw msgpack::type_error();
+  }
+
+  // clear before load
+  clear();
+
+  nn_->get_table()->load_mapped(
+      file, mapped_header_size + size + (8 - size % 8) % 8);
+  if (unlearner_) {
+    unlearner_->unpack(o.via.array.ptr[0]);
+  }
+  wm_.get_model()->unpack(o.via.array.ptr[n - 1]);
+}
+
 }  // namespace driver
 }  // namespace core
 }  // namespace jubatus
@@ -18,6 +18,7 @@
 #define JUBATUS_CORE_DRIVER_NEAREST_NEIGHBOR_HPP_
 
 #include <stdint.h>
+#include <iosfwd>
 #include <string>
 #include <utility>
 #include <vector>
@@ -81,6 +82,10 @@ class nearest_neighbor : public driver_base {
   void pack(framework::packer& pk) const;
   void unpack(msgpack::object o);
 
+  // the row table is mapped in place; see column_table::load_mapped
+  void save_mapped(std::ostream& os) const;
+  void load_mapped(const std::string& path);
+
  private:
   jubatus::util::lang::shared_ptr<fv_converter::datum_to_fv_converter>
       converter_;
@@ -15,6 +15,9 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "nearest_neighbor.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
 #include <string>
 #include <utility>
 #include <vector>
@@ -28,6 +31,7 @@
 #include "../fv_converter/datum.hpp"
 #include "../nearest_neighbor/nearest_neighbor.hpp"
 #include "../nearest_neighbor/nearest_neighbor_factory.hpp"
+#include "../storage/storage_exception.hpp"
 #include "../unlearner/unlearner.hpp"
 #include "test_util.hpp"
 
@@ -291,6 +295,53 @@ TEST_P(nearest_neighbor_test, save_load) {
   EXPECT_EQ("1", res[0].first);
 }
 
+TEST_P(nearest_neighbor_test, save_load_mapped) {
+  nn_driver_->set_row("id1", create_datum_2d(2.0, 0.0));
+  nn_driver_->set_row("id2", create_datum_2d(2.0, 1.0));
+  nn_driver_->set_row("id3", create_datum_2d(0.0, 2.0));
+  const vector<pair<string, double> > expected =
+      nn_driver_->similar_row("id1", 3);
+
+  char path[] = "/tmp/jubatus_nearest_neighbor_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  {
+    std::ofstream ofs(path, std::ios::binary);
+    nn_driver_->save_mapped(ofs);
+    ASSERT_TRUE(ofs.good());
+  }
+
+  // restart the driver
+  TearDown();
+  SetUp();
+
+  nn_driver_->load_mapped(path);
+  unlink(path);
+  EXPECT_EQ(expected, nn_driver_->similar_row("id1", 3));
+
+  // rows are copied out of the mapping on update
+  nn_driver_->set_row("id4", create_datum_2d(2.0, 0.0));
+  EXPECT_EQ(4u, nn_driver_->get_all_rows().size());
+}
+
+TEST_P(nearest_neighbor_test, load_mapped_rejects_other_files) {
+  char path[] = "/tmp/jubatus_nearest_neighbor_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_NE(-1, fd);
+  close(fd);
+  {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "not a model, but long enough for the header";
+  }
+  nn_driver_->set_row("id1", create_datum_2d(2.0, 0.0));
+  EXPECT_THROW(nn_driver_->load_mapped(path), storage::storage_exception);
+  unlink(path);
+
+  // the model is left as is
+  EXPECT_EQ(1u, nn_driver_->get_all_rows().size());
+}
+
 TEST_P(nearest_neighbor_test, get_all_rows) {
   nn_driver_->set_row("id1", create_datum_2d(2.0, 0.0));
   nn_driver_->set_row("id2", create_datum_2d(2.0, 1.0));
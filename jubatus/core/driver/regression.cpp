@@ -95,6 +95,22 @@ void regression::unpack(msgpack::object o) {
   wm_.get_model()->unpack(o.via.array.ptr[1]);
 }
 
+void regression::pack_chunked(framework::packer& pk, size_t chunk_rows) const {
+  regression_->pack_chunked(pk, chunk_rows);
+  wm_.get_model()->pack(pk);
+}
+
+void regression::unpack_chunked(framework::unpacker& unpacker) {
+  // clear before load
+  regression_->clear();
+  converter_->clear_weights();
+  regression_->unpack_chunked(unpacker);
+
+  msgpack::unpacked weights;
+  unpacker.next(weights);
+  wm_.get_model()->unpack(weights.get());
+}
+
 }  // namespace driver
 }  // namespace core
 }  // namespace jubatus
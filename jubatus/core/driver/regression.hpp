@@ -55,6 +55,8 @@ class regression : public driver_base {
 
   void pack(framework::packer& pk) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& pk, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
 
  private:
   jubatus::util::lang::shared_ptr<fv_converter::datum_to_fv_converter>
@@ -0,0 +1,551 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include "diff_codec.hpp"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../common/exception.hpp"
+
+using std::map;
+using std::string;
+using std::vector;
+using jubatus::core::storage::val3_t;
+
+namespace jubatus {
+namespace core {
+namespace framework {
+
+namespace {
+
+enum quantization_type {
+  float64_quantization = 0,
+  float16_quantization = 1,
+  int8_quantization = 2
+};
+
+const size_t component_num = 3;
+// v2 is mixed by min, so it is sent as is
+const size_t min_component = 1;
+
+int component_quantization(int quantization, size_t c) {
+  return c == min_component ? float64_quantization : quantization;
+}
+
+double& component(val3_t& v, size_t i) {
+  return i == 0 ? v.v1 : i == 1 ? v.v2 : v.v3;
+}
+
+double component(const val3_t& v, size_t i) {
+  return i == 0 ? v.v1 : i == 1 ? v.v2 : v.v3;
+}
+
+// magnitude of the components which are averaged
+double magnitude(const val3_t& v) {
+  return std::max(std::fabs(v.v1), std::fabs(v.v3));
+}
+
+void broken_diff() {
+  throw JUBATUS_EXCEPTION(
+      common::exception::runtime_error("broken compressed diff"));
+}
+
+void write_varint(string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+// bounds-checked cursor over a field of compressed_diffv
+class byte_reader {
+ public:
+  explicit byte_reader(const string& data)
+      : p_(data.data()), end_(data.data() + data.size()) {
+  }
+
+  uint64_t read_varint() {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const uint8_t b = read_byte();
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return v;
+      }
+    }
+    broken_diff();
+    return 0;
+  }
+
+  uint8_t read_byte() {
+    if (p_ == end_) {
+      broken_diff();
+    }
+    return static_cast<uint8_t>(*p_++);
+  }
+
+  const char* read(uint64_t size) {
+    if (size > static_cast<uint64_t>(end_ - p_)) {
+      broken_diff();
+    }
+    const char* p = p_;
+    p_ += size;
+    return p;
+  }
+
+  bool end() const {
+    return p_ == end_;
+  }
+
+ private:
+  const char* p_;
+  const char* end_;
+};
+
+void write_uint(string& out, uint64_t v, size_t bytes) {
+  for (size_t i = 0; i < bytes; ++i) {
+    out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+uint64_t read_uint(byte_reader& in, size_t bytes) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < bytes; ++i) {
+    v |= static_cast<uint64_t>(in.read_byte()) << (8 * i);
+  }
+  return v;
+}
+
+// IEEE 754 binary16, rounded to nearest even; overflows saturate to the
+// largest finite value so that a MIX never puts infinities into the model
+uint16_t to_half(double d) {
+  const float f = static_cast<float>(d);
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const int32_t exp = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mant = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff) {
+    return sign | (mant ? 0x7e00 : 0x7bff);
+  }
+  if (exp <= 0) {
+    if (exp < -10) {
+      return sign;
+    }
+    mant |= 0x800000;
+    const uint32_t shift = 14 - exp;
+    uint32_t half = mant >> shift;
+    const uint32_t rem = mant & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if (rem > halfway || (rem == halfway && (half & 1))) {
+      ++half;
+    }
+    return sign | half;
+  }
+  if (exp >= 31) {
+    return sign | 0x7bff;
+  }
+  uint32_t half = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+  const uint32_t rem = mant & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | std::min<uint32_t>(half, 0x7bff);
+}
+
+double from_half(uint16_t h) {
+  const uint32_t exp = (h >> 10) & 0x1f;
+  const uint32_t mant = h & 0x3ff;
+  double v;
+  if (exp == 0) {
+    v = std::ldexp(static_cast<double>(mant), -24);
+  } else if (exp == 31) {
+    broken_diff();
+    v = 0;
+  } else {
+    v = std::ldexp(static_cast<double>(mant | 0x400),
+                   static_cast<int>(exp) - 25);
+  }
+  return (h & 0x8000) ? -v : v;
+}
+
+// writes ``v`` and returns the value the receiver will decode
+double write_value(string& out, int quantization, double scale, double v) {
+  if (quantization == float16_quantization) {
+    const uint16_t h = to_half(v);
+    write_uint(out, h, 2);
+    return from_half(h);
+  } else if (quantization == int8_quantization) {
+    const double q = std::max(-127.0, std::min(127.0, std::floor(
+        v / scale + 0.5)));
+    out.push_back(static_cast<char>(static_cast<int8_t>(q)));
+    return q * scale;
+  } else {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof(bits));
+    write_uint(out, bits, 8);
+    return v;
+  }
+}
+
+double read_value(byte_reader& in, int quantization, double scale) {
+  if (quantization == float16_quantization) {
+    return from_half(static_cast<uint16_t>(read_uint(in, 2)));
+  } else if (quantization == int8_quantization) {
+    return static_cast<int8_t>(in.read_byte()) * scale;
+  } else {
+    const uint64_t bits = read_uint(in, 8);
+    double v;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+  }
+}
+
+}  // namespace
+
+diff_codec::diff_codec(const diff_codec_config& conf)
+    : quantization_(float64_quantization),
+      threshold_(conf.threshold),
+      top_k_(conf.top_k),
+      peer_format_(plain_format),
+      diff_started_(false) {
+  if (conf.quantization) {
+    if (*conf.quantization == "float16") {
+      quantization_ = float16_quantization;
+    } else if (*conf.quantization == "int8") {
+      quantization_ = int8_quantization;
+    } else {
+      throw JUBATUS_EXCEPTION(common::invalid_parameter(
+          "quantization must be float16 or int8"));
+    }
+  }
+  if (conf.threshold && !(0 <= *conf.threshold)) {
+    throw JUBATUS_EXCEPTION(common::invalid_parameter("0 <= threshold"));
+  }
+  if (conf.top_k && !(1 <= *conf.top_k)) {
+    throw JUBATUS_EXCEPTION(common::invalid_parameter("1 <= top_k"));
+  }
+}
+
+void diff_codec::encode(
+    const diffv& diff, compressed_diffv& out, bool feedback) {
+  table_t table;
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  if (feedback) {
+    table = residual_;
+  }
+  for (size_t i = 0; i < diff.v.diff.size(); ++i) {
+    map<string, val3_t>& row = table[diff.v.diff[i].first];
+    const storage::feature_val3_t& labels = diff.v.diff[i].second;
+    for (size_t j = 0; j < labels.size(); ++j) {
+      row[labels[j].first] += labels[j].second;
+    }
+  }
+
+  table_t residual;
+  encode_table(diff.count, diff.v.expect_version, table, feedback,
+               feedback ? quantization_ : float64_quantization, out,
+               residual);
+  if (feedback) {
+    pending_residual_.swap(residual);
+  }
+}
+
+void diff_codec::encode_table(
+    int count,
+    const storage::version& expect_version,
+    table_t& table,
+    bool feedback,
+    int quantization,
+    compressed_diffv& out,
+    table_t& residual) const {
+  vector<double> magnitudes;
+  vector<bool> updates_min;
+  for (table_t::const_iterator it = table.begin(); it != table.end(); ++it) {
+    for (map<string, val3_t>::const_iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2) {
+      magnitudes.push_back(magnitude(it2->second));
+      updates_min.push_back(component(it2->second, min_component) != 0);
+    }
+  }
+
+  // sparsify only diffs with error feedback; others would lose the updates.
+  // updates of v2 cannot be fed back, so they are always sent.
+  vector<bool> keep(magnitudes.size(), true);
+  if (feedback && threshold_) {
+    for (size_t i = 0; i < magnitudes.size(); ++i) {
+      keep[i] = updates_min[i] || magnitudes[i] > *threshold_;
+    }
+  }
+  if (feedback && top_k_) {
+    vector<std::pair<double, size_t> > kept;
+    for (size_t i = 0; i < magnitudes.size(); ++i) {
+      if (keep[i] && !updates_min[i]) {
+        kept.push_back(std::make_pair(magnitudes[i], i));
+      }
+    }
+    const size_t k = *top_k_;
+    if (kept.size() > k) {
+      std::nth_element(kept.begin(), kept.begin() + k, kept.end(),
+                       std::greater<std::pair<double, size_t> >());
+      for (size_t i = k; i < kept.size(); ++i) {
+        keep[kept[i].second] = false;
+      }
+    }
+  }
+
+  out = compressed_diffv();
+  out.count = count;
+  out.expect_version = expect_version;
+  out.quantization = quantization;
+
+  double max_abs[component_num] = {0, 0, 0};
+  size_t i = 0;
+  for (table_t::iterator it = table.begin(); it != table.end(); ++it) {
+    for (map<string, val3_t>::iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2, ++i) {
+      if (keep[i]) {
+        for (size_t c = 0; c < component_num; ++c) {
+          max_abs[c] = std::max(max_abs[c],
+                                std::fabs(component(it2->second, c)));
+        }
+      }
+    }
+  }
+  double scales[component_num] = {0, 0, 0};
+  for (size_t c = 0; c < component_num; ++c) {
+    if (max_abs[c] > 0) {
+      out.components |= 1 << c;
+      scales[c] = max_abs[c] / 127;
+      if (component_quantization(quantization, c) == int8_quantization) {
+        out.scales.push_back(scales[c]);
+      }
+    }
+  }
+
+  map<string, uint64_t> label_ids;
+  string last_key;
+  i = 0;
+  for (table_t::iterator it = table.begin(); it != table.end(); ++it) {
+    string labels;
+    uint64_t label_num = 0;
+    for (map<string, val3_t>::iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2, ++i) {
+      const val3_t& v = it2->second;
+      if (!keep[i]) {
+        if (!(v == val3_t())) {
+          residual[it->first][it2->first] = v;
+        }
+        continue;
+      }
+
+      const std::pair<map<string, uint64_t>::iterator, bool> label =
+          label_ids.insert(std::make_pair(it2->first, out.labels.size()));
+      if (label.second) {
+        out.labels.push_back(it2->first);
+      }
+      write_varint(labels, label.first->second);
+      ++label_num;
+
+      val3_t error(v);
+      for (size_t c = 0; c < component_num; ++c) {
+        if (out.components & (1 << c)) {
+          component(error, c) -= write_value(
+              out.values, component_quantization(quantization, c),
+              scales[c], component(v, c));
+        }
+      }
+      if (feedback && !(error == val3_t())) {
+        residual[it->first][it2->first] = error;
+      }
+    }
+    if (label_num == 0) {
+      continue;
+    }
+
+    const string& key = it->first;
+    const size_t limit = std::min(last_key.size(), key.size());
+    size_t prefix = 0;
+    while (prefix < limit && last_key[prefix] == key[prefix]) {
+      ++prefix;
+    }
+    write_varint(out.features, prefix);
+    write_varint(out.features, key.size() - prefix);
+    out.features.append(key, prefix, string::npos);
+    last_key = key;
+
+    write_varint(out.entries, label_num);
+    out.entries += labels;
+  }
+}
+
+void diff_codec::decode(const compressed_diffv& in, diffv& out) {
+  if (in.quantization < float64_quantization ||
+      in.quantization > int8_quantization) {
+    broken_diff();
+  }
+  double scales[component_num] = {0, 0, 0};
+  size_t scale_num = 0;
+  for (size_t c = 0; c < component_num; ++c) {
+    if ((in.components & (1 << c)) &&
+        component_quantization(in.quantization, c) == int8_quantization) {
+      if (scale_num == in.scales.size()) {
+        broken_diff();
+      }
+      scales[c] = in.scales[scale_num++];
+    }
+  }
+  if (scale_num != in.scales.size()) {
+    broken_diff();
+  }
+
+  out.count = in.count;
+  out.v.expect_version = in.expect_version;
+  out.v.diff.clear();
+
+  byte_reader features(in.features);
+  byte_reader entries(in.entries);
+  byte_reader values(in.values);
+  string key;
+  while (!features.end()) {
+    const uint64_t prefix = features.read_varint();
+    if (prefix > key.size()) {
+      broken_diff();
+    }
+    const uint64_t suffix = features.read_varint();
+    key.erase(prefix);
+    key.append(features.read(suffix), suffix);
+
+    const uint64_t label_num = entries.read_varint();
+    if (label_num > in.labels.size()) {
+      broken_diff();
+    }
+    out.v.diff.push_back(std::make_pair(key, storage::feature_val3_t()));
+    storage::feature_val3_t& row = out.v.diff.back().second;
+    row.reserve(label_num);
+    for (uint64_t j = 0; j < label_num; ++j) {
+      const uint64_t label = entries.read_varint();
+      if (label >= in.labels.size()) {
+        broken_diff();
+      }
+      val3_t v;
+      for (size_t c = 0; c < component_num; ++c) {
+        if (in.components & (1 << c)) {
+          component(v, c) = read_value(
+              values, component_quantization(in.quantization, c), scales[c]);
+        }
+      }
+      row.push_back(std::make_pair(in.labels[label], v));
+    }
+  }
+  if (!entries.end() || !values.end()) {
+    broken_diff();
+  }
+}
+
+void diff_codec::add_residual(diffv& diff) {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  // the residual is sent in full, so nothing is held back
+  table_t().swap(pending_residual_);
+  if (residual_.empty()) {
+    return;
+  }
+
+  table_t table(residual_);
+  for (size_t i = 0; i < diff.v.diff.size(); ++i) {
+    map<string, val3_t>& row = table[diff.v.diff[i].first];
+    const storage::feature_val3_t& labels = diff.v.diff[i].second;
+    for (size_t j = 0; j < labels.size(); ++j) {
+      row[labels[j].first] += labels[j].second;
+    }
+  }
+
+  storage::features3_t features(table.size());
+  size_t i = 0;
+  for (table_t::const_iterator it = table.begin(); it != table.end();
+       ++it, ++i) {
+    features[i].first = it->first;
+    features[i].second.assign(it->second.begin(), it->second.end());
+  }
+  diff.v.diff.swap(features);
+}
+
+int diff_codec::convert(const msgpack::object& obj, diffv& out) {
+  if (obj.type == msgpack::type::ARRAY && obj.via.array.size == 9) {
+    compressed_diffv compressed;
+    obj.convert(&compressed);
+    decode(compressed, out);
+    // compressed diffs are sent only to servers which can read them
+    return compressed_format;
+  }
+
+  // a diffv of older releases is read with plain_format
+  plain_diffv plain;
+  obj.convert(&plain);
+  out.count = plain.count;
+  out.v.diff.swap(plain.v.diff);
+  out.v.expect_version = plain.v.expect_version;
+  return std::max(static_cast<int>(plain_format),
+                  std::min(plain.format, static_cast<int>(compressed_format)));
+}
+
+bool diff_codec::start_diff() {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  if (diff_started_) {
+    // the last MIX did not put its mixed diff; it may have failed to read the
+    // diff of this server
+    peer_format_ = plain_format;
+  }
+  diff_started_ = true;
+  return peer_format_ >= compressed_format;
+}
+
+void diff_codec::finish_diff(int mixed_format) {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  peer_format_ = mixed_format;
+  diff_started_ = false;
+}
+
+void diff_codec::commit_residual() {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  residual_.swap(pending_residual_);
+  table_t().swap(pending_residual_);
+}
+
+void diff_codec::discard_residual() {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  table_t().swap(pending_residual_);
+}
+
+void diff_codec::clear_residual() {
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  table_t().swap(residual_);
+  table_t().swap(pending_residual_);
+}
+
+}  // namespace framework
+}  // namespace core
+}  // namespace jubatus
@@ -0,0 +1,187 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef JUBATUS_CORE_FRAMEWORK_DIFF_CODEC_HPP_
+#define JUBATUS_CORE_FRAMEWORK_DIFF_CODEC_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <msgpack.hpp>
+#include "jubatus/util/concurrent/mutex.h"
+#include "jubatus/util/data/optional.h"
+#include "jubatus/util/data/serialization.h"
+#include "../common/version.hpp"
+#include "../storage/storage_type.hpp"
+#include "diffv.hpp"
+
+namespace jubatus {
+namespace core {
+namespace framework {
+
+struct diff_codec_config {
+  // "float16" or "int8" for v1 and v3 of the diffs sent by servers; values
+  // are sent as doubles when not set
+  jubatus::util::data::optional<std::string> quantization;
+  // entries whose largest absolute value is not above this are not sent
+  jubatus::util::data::optional<double> threshold;
+  // number of entries with the largest absolute values to send; entries
+  // updating v2 are always sent in addition
+  jubatus::util::data::optional<int32_t> top_k;
+
+  template<typename Ar>
+  void serialize(Ar& ar) {
+    ar & JUBA_MEMBER(quantization) & JUBA_MEMBER(threshold)
+        & JUBA_MEMBER(top_k);
+  }
+};
+
+/**
+ * Formats of MIX diffs a node can read.  Releases before diff compression
+ * read ``plain_format`` only.
+ */
+enum diff_format {
+  plain_format = 1,
+  compressed_format = 2
+};
+
+/**
+ * ``diffv`` with the newest format its sender can read.  Releases before diff
+ * compression send ``diffv`` (an array of 2 elements), which is read as
+ * ``plain_format``, and ignore ``format`` when they read this.  Diffs of
+ * servers carry the format of the server; mixed diffs carry the newest format
+ * every server of the MIX can read.
+ */
+struct plain_diffv {
+  plain_diffv()
+      : count(0), format(plain_format) {
+  }
+
+  int count;
+  storage::diff_t v;
+  int format;
+
+  MSGPACK_DEFINE(count, v, format);
+};
+
+/**
+ * Compressed form of ``diffv``.  Labels are replaced with indexes of
+ * ``labels``, feature keys are sorted and front-coded, and v1 and v3 are
+ * quantized as ``quantization``.  v2 is always sent as a double.  It is packed
+ * as an array of 9 elements, so that receivers can tell it from a plain
+ * ``diffv`` (an array of 2 or 3 elements).  It is sent only when every server
+ * of the last MIX could read ``compressed_format``.
+ */
+struct compressed_diffv {
+  compressed_diffv()
+      : count(0), quantization(0), components(0) {
+  }
+
+  int count;
+  storage::version expect_version;
+  int quantization;
+  std::vector<std::string> labels;
+  // for each feature: varint shared prefix length, varint suffix length,
+  // suffix
+  std::string features;
+  // for each feature: varint number of labels, varint label indexes
+  std::string entries;
+  // bit i is set if the (i + 1)-th value of val3_t is sent
+  int components;
+  // int8 scale of each sent and quantized value
+  std::vector<double> scales;
+  std::string values;
+
+  MSGPACK_DEFINE(count, expect_version, quantization, labels, features,
+      entries, components, scales, values);
+};
+
+/**
+ * Encodes MIX diffs of linear models.
+ *
+ * Diffs of servers are encoded with ``feedback``: entries dropped by
+ * sparsification and the quantization errors of v1 and v3 are kept as a
+ * residual, and added to the next diff encoded with ``feedback`` (error
+ * feedback), so that no update is lost in total.  The residual of an encoded
+ * diff is pending until ``commit_residual`` is called when the MIX put the
+ * average into the model; if the MIX failed, the model keeps its diff, so the
+ * pending residual is dropped by ``discard_residual``.
+ *
+ * v2 is mixed by taking the minimum rather than the average, so it is neither
+ * quantized nor fed back, and entries updating v2 are never dropped.  The
+ * mixed diff (encoded without ``feedback``) is sent at full precision, as its
+ * errors could not be fed back.
+ *
+ * Servers send compressed diffs only once a MIX has completed with every
+ * server reading ``compressed_format``, so that MIX with older releases keeps
+ * working.  A MIX that failed after ``start_diff`` may have failed to read the
+ * compressed diff, so diffs are sent plain again until a MIX completes.
+ */
+class diff_codec {
+ public:
+  explicit diff_codec(const diff_codec_config& conf);
+
+  void encode(const diffv& diff, compressed_diffv& out, bool feedback);
+  static void decode(const compressed_diffv& in, diffv& out);
+
+  // adds the residual to a diff sent plain; the residual is then pending as
+  // if the diff was encoded with ``feedback``
+  void add_residual(diffv& diff);
+
+  // decodes either a plain or a compressed diff, and returns the format its
+  // sender can read
+  static int convert(const msgpack::object& obj, diffv& out);
+
+  // returns whether the diff of this server is sent compressed
+  bool start_diff();
+  // records the format every server of the MIX can read, i.e. that of the
+  // mixed diff
+  void finish_diff(int mixed_format);
+
+  void commit_residual();
+  void discard_residual();
+  void clear_residual();
+
+ private:
+  typedef std::map<std::string, std::map<std::string, storage::val3_t> >
+      table_t;
+
+  void encode_table(
+      int count,
+      const storage::version& expect_version,
+      table_t& table,
+      bool feedback,
+      int quantization,
+      compressed_diffv& out,
+      table_t& residual) const;
+
+  int quantization_;
+  jubatus::util::data::optional<double> threshold_;
+  jubatus::util::data::optional<int32_t> top_k_;
+
+  table_t residual_;
+  table_t pending_residual_;
+  int peer_format_;
+  bool diff_started_;
+  jubatus::util::concurrent::mutex mutex_;
+};
+
+}  // namespace framework
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_FRAMEWORK_DIFF_CODEC_HPP_
@@ -0,0 +1,383 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "jubatus/util/lang/cast.h"
+#include "jubatus/util/math/random.h"
+#include "../common/exception.hpp"
+#include "diff_codec.hpp"
+
+using std::make_pair;
+using std::string;
+using std::vector;
+using jubatus::core::storage::feature_val3_t;
+using jubatus::core::storage::features3_t;
+using jubatus::core::storage::val3_t;
+using jubatus::util::lang::lexical_cast;
+
+namespace jubatus {
+namespace core {
+namespace framework {
+
+namespace {
+
+diffv make_diff(const features3_t& features) {
+  diffv diff;
+  diff.count = 1;
+  diff.v.diff = features;
+  diff.v.expect_version.increment();
+  return diff;
+}
+
+// (feature, label) -> value
+typedef std::map<std::pair<string, string>, val3_t> flat_t;
+
+void add_to(const diffv& diff, flat_t& sum) {
+  for (size_t i = 0; i < diff.v.diff.size(); ++i) {
+    const feature_val3_t& row = diff.v.diff[i].second;
+    for (size_t j = 0; j < row.size(); ++j) {
+      sum[make_pair(diff.v.diff[i].first, row[j].first)] += row[j].second;
+    }
+  }
+}
+
+features3_t random_features(jubatus::util::math::random::mtrand& rand) {
+  features3_t features;
+  for (int i = 0; i < 50; ++i) {
+    feature_val3_t row;
+    for (int j = 0; j < 3; ++j) {
+      if (rand.next_int(2)) {
+        row.push_back(make_pair(
+            "label" + lexical_cast<string>(j),
+            val3_t(rand.next_gaussian(), 0, rand.next_double() * 0.01)));
+      }
+    }
+    features.push_back(make_pair(
+        "message$word" + lexical_cast<string>(i) + "@space#bin/bin", row));
+  }
+  return features;
+}
+
+}  // namespace
+
+TEST(diff_codec, lossless) {
+  jubatus::util::math::random::mtrand rand(0);
+  const diffv diff = make_diff(random_features(rand));
+
+  diff_codec codec((diff_codec_config()));
+  compressed_diffv compressed;
+  codec.encode(diff, compressed, true);
+  EXPECT_EQ(3u, compressed.labels.size());
+  // v2 is never sent
+  EXPECT_EQ(5, compressed.components);
+
+  diffv decoded;
+  diff_codec::decode(compressed, decoded);
+  EXPECT_EQ(diff.count, decoded.count);
+  EXPECT_EQ(diff.v.expect_version, decoded.v.expect_version);
+
+  flat_t expected, actual;
+  add_to(diff, expected);
+  add_to(decoded, actual);
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(diff_codec, quantization) {
+  jubatus::util::math::random::mtrand rand(0);
+  const diffv diff = make_diff(random_features(rand));
+  flat_t expected;
+  add_to(diff, expected);
+
+  const char* types[] = {"float16", "int8"};
+  for (size_t t = 0; t < 2; ++t) {
+    diff_codec_config conf;
+    conf.quantization = string(types[t]);
+    diff_codec codec(conf);
+    compressed_diffv compressed;
+    codec.encode(diff, compressed, true);
+
+    diffv decoded;
+    diff_codec::decode(compressed, decoded);
+    flat_t actual;
+    add_to(decoded, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (flat_t::const_iterator it = expected.begin(), it2 = actual.begin();
+         it != expected.end(); ++it, ++it2) {
+      ASSERT_EQ(it->first, it2->first);
+      EXPECT_NEAR(it->second.v1, it2->second.v1,
+                  t == 0 ? std::fabs(it->second.v1) * 1e-3 + 1e-7 : 0.05);
+      EXPECT_EQ(0.0, it2->second.v2);
+      EXPECT_NEAR(it->second.v3, it2->second.v3, t == 0 ? 1e-5 : 1e-4);
+    }
+  }
+}
+
+TEST(diff_codec, mixed_diff_is_not_quantized) {
+  jubatus::util::math::random::mtrand rand(0);
+  const diffv diff = make_diff(random_features(rand));
+
+  diff_codec_config conf;
+  conf.quantization = string("int8");
+  conf.top_k = 1;
+  diff_codec codec(conf);
+  compressed_diffv compressed;
+  codec.encode(diff, compressed, false);
+
+  diffv decoded;
+  diff_codec::decode(compressed, decoded);
+  flat_t expected, actual;
+  add_to(diff, expected);
+  add_to(decoded, actual);
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(diff_codec, min_component_is_sent_as_is) {
+  jubatus::util::math::random::mtrand rand(0);
+  features3_t features = random_features(rand);
+  for (size_t i = 0; i < features.size(); i += 2) {
+    for (size_t j = 0; j < features[i].second.size(); ++j) {
+      features[i].second[j].second.v2 = -rand.next_double() / 3;
+    }
+  }
+  const diffv diff = make_diff(features);
+  flat_t expected;
+  add_to(diff, expected);
+
+  diff_codec_config conf;
+  conf.quantization = string("int8");
+  conf.threshold = 0.1;
+  conf.top_k = 1;
+  diff_codec codec(conf);
+  compressed_diffv compressed;
+  codec.encode(diff, compressed, true);
+  // scales are sent only for v1 and v3
+  EXPECT_EQ(7, compressed.components);
+  EXPECT_EQ(2u, compressed.scales.size());
+
+  diffv decoded;
+  diff_codec::decode(compressed, decoded);
+  flat_t actual;
+  add_to(decoded, actual);
+  for (flat_t::const_iterator it = expected.begin(); it != expected.end();
+       ++it) {
+    if (it->second.v2 != 0) {
+      // never dropped, and not rounded
+      ASSERT_EQ(1u, actual.count(it->first));
+      EXPECT_EQ(it->second.v2, actual[it->first].v2);
+    }
+  }
+
+  // only errors of v1 and v3 are fed back
+  codec.commit_residual();
+  codec.encode(make_diff(features3_t()), compressed, true);
+  diff_codec::decode(compressed, decoded);
+  for (size_t i = 0; i < decoded.v.diff.size(); ++i) {
+    const feature_val3_t& row = decoded.v.diff[i].second;
+    for (size_t j = 0; j < row.size(); ++j) {
+      EXPECT_EQ(0.0, row[j].second.v2);
+    }
+  }
+}
+
+TEST(diff_codec, error_feedback) {
+  jubatus::util::math::random::mtrand rand(0);
+  diff_codec_config conf;
+  conf.quantization = string("int8");
+  conf.threshold = 0.1;
+  conf.top_k = 20;
+  diff_codec codec(conf);
+
+  flat_t sent, received;
+  for (int round = 0; round < 3; ++round) {
+    const diffv diff = make_diff(random_features(rand));
+    add_to(diff, sent);
+    compressed_diffv compressed;
+    codec.encode(diff, compressed, true);
+    codec.commit_residual();
+    diffv decoded;
+    diff_codec::decode(compressed, decoded);
+    size_t entries = 0;
+    for (size_t i = 0; i < decoded.v.diff.size(); ++i) {
+      entries += decoded.v.diff[i].second.size();
+    }
+    EXPECT_GE(20u, entries);
+    add_to(decoded, received);
+  }
+
+  // updates held back are sent in later rounds
+  for (int round = 0; round < 100; ++round) {
+    compressed_diffv compressed;
+    codec.encode(make_diff(features3_t()), compressed, true);
+    codec.commit_residual();
+    diffv decoded;
+    diff_codec::decode(compressed, decoded);
+    add_to(decoded, received);
+  }
+  for (flat_t::const_iterator it = sent.begin(); it != sent.end(); ++it) {
+    const val3_t& v = received[it->first];
+    EXPECT_NEAR(it->second.v1, v.v1, 0.1);
+    EXPECT_NEAR(it->second.v3, v.v3, 0.1);
+  }
+
+  codec.clear_residual();
+  compressed_diffv compressed;
+  codec.encode(make_diff(features3_t()), compressed, true);
+  EXPECT_TRUE(compressed.features.empty());
+}
+
+TEST(diff_codec, discard_residual) {
+  jubatus::util::math::random::mtrand rand(0);
+  diff_codec_config conf;
+  conf.top_k = 1;
+  diff_codec codec(conf);
+  const diffv diff = make_diff(random_features(rand));
+  const diffv empty = make_diff(features3_t());
+
+  // a failed MIX keeps the diff in the model, so nothing is held back
+  compressed_diffv compressed;
+  codec.encode(diff, compressed, true);
+  codec.discard_residual();
+  codec.encode(empty, compressed, true);
+  EXPECT_TRUE(compressed.features.empty());
+
+  // a diff encoded again after the failure is sent in full in total
+  flat_t expected, received;
+  add_to(diff, expected);
+  codec.encode(diff, compressed, true);
+  codec.commit_residual();
+  diffv decoded;
+  diff_codec::decode(compressed, decoded);
+  add_to(decoded, received);
+  for (size_t i = 1; i < expected.size(); ++i) {
+    codec.encode(empty, compressed, true);
+    codec.commit_residual();
+    diff_codec::decode(compressed, decoded);
+    add_to(decoded, received);
+  }
+  EXPECT_EQ(expected, received);
+}
+
+TEST(diff_codec, add_residual) {
+  jubatus::util::math::random::mtrand rand(0);
+  diff_codec_config conf;
+  conf.top_k = 1;
+  diff_codec codec(conf);
+  const diffv diff = make_diff(random_features(rand));
+
+  // a diff sent plain carries the residual in full
+  flat_t expected, received;
+  add_to(diff, expected);
+  compressed_diffv compressed;
+  codec.encode(diff, compressed, true);
+  codec.commit_residual();
+  diffv decoded;
+  diff_codec::decode(compressed, decoded);
+  add_to(decoded, received);
+
+  diffv plain = make_diff(features3_t());
+  codec.add_residual(plain);
+  add_to(plain, received);
+  for (flat_t::iterator it = received.begin(); it != received.end(); ++it) {
+    EXPECT_DOUBLE_EQ(expected[it->first].v1, it->second.v1);
+    EXPECT_DOUBLE_EQ(expected[it->first].v3, it->second.v3);
+  }
+  EXPECT_EQ(expected.size(), received.size());
+
+  // the residual is kept until the MIX succeeds
+  codec.discard_residual();
+  diffv again = make_diff(features3_t());
+  codec.add_residual(again);
+  EXPECT_EQ(plain.v.diff.size(), again.v.diff.size());
+  codec.commit_residual();
+  codec.encode(make_diff(features3_t()), compressed, true);
+  EXPECT_TRUE(compressed.features.empty());
+}
+
+TEST(diff_codec, negotiation) {
+  diff_codec codec((diff_codec_config()));
+
+  // diffs are plain until a MIX has shown every server reads compressed
+  // diffs
+  EXPECT_FALSE(codec.start_diff());
+  codec.finish_diff(compressed_format);
+  EXPECT_TRUE(codec.start_diff());
+  codec.finish_diff(compressed_format);
+  EXPECT_TRUE(codec.start_diff());
+
+  // the last MIX did not complete
+  EXPECT_FALSE(codec.start_diff());
+  codec.finish_diff(compressed_format);
+
+  // an older release joined
+  EXPECT_TRUE(codec.start_diff());
+  codec.finish_diff(plain_format);
+  EXPECT_FALSE(codec.start_diff());
+}
+
+TEST(diff_codec, broken) {
+  jubatus::util::math::random::mtrand rand(0);
+  diff_codec codec((diff_codec_config()));
+  compressed_diffv compressed;
+  codec.encode(make_diff(random_features(rand)), compressed, true);
+  diffv decoded;
+
+  compressed_diffv truncated(compressed);
+  truncated.values.resize(truncated.values.size() - 1);
+  EXPECT_THROW(diff_codec::decode(truncated, decoded),
+               common::exception::runtime_error);
+
+  truncated = compressed;
+  truncated.labels.pop_back();
+  EXPECT_THROW(diff_codec::decode(truncated, decoded),
+               common::exception::runtime_error);
+
+  truncated = compressed;
+  truncated.quantization = 3;
+  EXPECT_THROW(diff_codec::decode(truncated, decoded),
+               common::exception::runtime_error);
+}
+
+TEST(diff_codec, config_validation) {
+  diff_codec_config conf;
+  conf.quantization = string("float8");
+  EXPECT_THROW(diff_codec c(conf), common::invalid_parameter);
+  conf.quantization = string("float16");
+  EXPECT_NO_THROW(diff_codec c(conf));
+
+  // 0 <= threshold
+  conf.threshold = -1.0;
+  EXPECT_THROW(diff_codec c(conf), common::invalid_parameter);
+  conf.threshold = 0.0;
+  EXPECT_NO_THROW(diff_codec c(conf));
+
+  // 1 <= top_k
+  conf.top_k = 0;
+  EXPECT_THROW(diff_codec c(conf), common::invalid_parameter);
+  conf.top_k = 1;
+  EXPECT_NO_THROW(diff_codec c(conf));
+}
+
+}  // namespace framework
+}  // namespace core
+}  // namespace jubatus
@@ -54,12 +54,35 @@ feature_val3_t mix_feature(
   return ret;
 }
 
+// packs ``diff`` as a plain_diffv
+void pack_plain(packer& pk, const diffv& diff, int format) {
+  pk.pack_array(3);
+  pk.pack(diff.count);
+  pk.pack(diff.v);
+  pk.pack(format);
+}
+
 struct internal_diff_object : diff_object_raw {
+  internal_diff_object()
+      : format_(compressed_format) {
+  }
+
   void convert_binary(packer& pk) const {
-    pk.pack(diff_);
+    if (codec_ && format_ >= compressed_format) {
+      // the mixed diff is sent at full precision; residuals are kept only
+      // by servers
+      compressed_diffv compressed;
+      codec_->encode(diff_, compressed, false);
+      pk.pack(compressed);
+    } else {
+      pack_plain(pk, diff_, format_);
+    }
   }
 
   diffv diff_;
+  // the newest format every server of the MIX can read
+  int format_;
+  jubatus::util::lang::shared_ptr<diff_codec> codec_;
 };
 
 }  // namespace
@@ -124,7 +147,8 @@ diff_object linear_function_mixer::convert_diff_object(
     const msgpack::object& obj) const {
   internal_diff_object* diff = new internal_diff_object;
   diff_object diff_obj(diff);
-  obj.convert(&diff->diff_);
+  diff->format_ = diff_codec::convert(obj, diff->diff_);
+  diff->codec_ = codec_;
   return diff_obj;
 }
 
@@ -138,14 +162,25 @@ void linear_function_mixer::mix(
     throw JUBATUS_EXCEPTION(
         core::common::exception::runtime_error("bad diff_object"));
   }
-  obj.convert(&diff);
+  const int format = diff_codec::convert(obj, diff);
+  diff_obj->format_ = std::min(diff_obj->format_, format);
   mix(diff, diff_obj->diff_);
 }
 
 void linear_function_mixer::get_diff(packer& pk) const {
   diffv diff;
   get_diff(diff);
-  pk.pack(diff);
+  if (codec_ && codec_->start_diff()) {
+    compressed_diffv compressed;
+    codec_->encode(diff, compressed, true);
+    pk.pack(compressed);
+    return;
+  }
+  if (codec_) {
+    codec_->add_residual(diff);
+  }
+  // this release reads compressed diffs with or without a codec
+  pack_plain(pk, diff, compressed_format);
 }
 
 bool linear_function_mixer::put_diff(const diff_object& ptr) {
@@ -155,7 +190,18 @@ bool linear_function_mixer::put_diff(const diff_object& ptr) {
     throw JUBATUS_EXCEPTION(
         core::common::exception::runtime_error("bad diff_object"));
   }
-  return put_diff(diff_obj->diff_);
+  const bool success = put_diff(diff_obj->diff_);
+  if (codec_) {
+    // the residual of get_diff is kept only if the model has dropped the
+    // diff it was taken from
+    if (success) {
+      codec_->commit_residual();
+    } else {
+      codec_->discard_residual();
+    }
+    codec_->finish_diff(diff_obj->format_);
+  }
+  return success;
 }
 
 }  // namespace framework
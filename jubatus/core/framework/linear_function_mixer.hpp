@@ -24,6 +24,7 @@
 #include "../unlearner/unlearner_base.hpp"
 
 #include "linear_mixable.hpp"
+#include "diff_codec.hpp"
 #include "diffv.hpp"
 
 namespace jubatus {
@@ -52,6 +53,24 @@ class linear_function_mixer : public linear_mixable {
     return model_;
   }
 
+  /**
+   * Sends diffs compressed by ``codec``, both from servers and from the
+   * mixer.  Compressed and plain diffs are accepted regardless of this
+   * setting, so servers can switch to compression one by one.  Diffs are
+   * compressed only while every server of the MIX can read them; see
+   * ``diff_codec``.
+   */
+  void set_diff_codec(jubatus::util::lang::shared_ptr<diff_codec> codec) {
+    codec_ = codec;
+  }
+
+  // drops updates held back by the codec, e.g. when the model is cleared
+  void clear_diff_residual() {
+    if (codec_) {
+      codec_->clear_residual();
+    }
+  }
+
   void mix(const diffv& lhs, diffv& mixed) const;
   void get_diff(diffv&) const;
   bool put_diff(const diffv& v);
@@ -70,6 +89,7 @@ class linear_function_mixer : public linear_mixable {
  private:
   model_ptr model_;
   jubatus::util::lang::shared_ptr<unlearner::unlearner_base> label_unlearner_;
+  jubatus::util::lang::shared_ptr<diff_codec> codec_;
 };
 
 }  // namespace framework
@@ -23,6 +23,7 @@
 
 #include "jubatus/util/concurrent/rwmutex.h"
 #include "linear_function_mixer.hpp"
+#include "stream_writer.hpp"
 #include "../storage/storage_base.hpp"
 
 using std::string;
@@ -50,6 +51,8 @@ class storage_mock_base : public storage::storage_base {
 
   void inp(const common::sfv_t& sfv, map_feature_val1_t& ret) const {
   }
+  void inp_nolock(const common::sfv_t& sfv, map_feature_val1_t& ret) const {
+  }
 
   void set(
       const std::string& feature,
@@ -199,6 +202,117 @@ TEST(linear_function_mixer, mix) {
   EXPECT_EQ(27./8., d.v.diff[0].second[0].second.v3);
 }
 
+namespace {
+
+void get_diff_to(
+    const linear_function_mixer& m,
+    msgpack::sbuffer& sbuf,
+    msgpack::unpacked& msg) {
+  stream_writer<msgpack::sbuffer> st(sbuf);
+  jubatus_packer jp(st);
+  packer pk(jp);
+  m.get_diff(pk);
+  msgpack::unpack(&msg, sbuf.data(), sbuf.size());
+}
+
+void convert_binary_to(
+    const diff_object& diff,
+    msgpack::sbuffer& sbuf,
+    msgpack::unpacked& msg) {
+  stream_writer<msgpack::sbuffer> st(sbuf);
+  jubatus_packer jp(st);
+  packer pk(jp);
+  diff->convert_binary(pk);
+  msgpack::unpack(&msg, sbuf.data(), sbuf.size());
+}
+
+size_t array_size(const msgpack::unpacked& msg) {
+  return msg.get().via.array.size;
+}
+
+void set_codec(linear_function_mixer& m) {
+  m.set_diff_codec(jubatus::util::lang::shared_ptr<diff_codec>(
+      new diff_codec(diff_codec_config())));
+}
+
+}  // namespace
+
+TEST(linear_function_mixer, old_release_reads_diffs) {
+  linear_function_mixer m(
+      linear_function_mixer::model_ptr(new storage::storage_mock_1));
+  set_codec(m);
+
+  // releases before diff compression read diffs as diffv
+  msgpack::sbuffer sbuf;
+  msgpack::unpacked msg;
+  get_diff_to(m, sbuf, msg);
+  diffv d;
+  msg.get().convert(&d);
+  EXPECT_EQ(1, d.count);
+  ASSERT_EQ(1u, d.v.diff.size());
+  EXPECT_EQ("f1", d.v.diff[0].first);
+
+  // a diff of an older release keeps the mixed diff plain
+  diff_object mixed = m.convert_diff_object(msg.get());
+  msgpack::sbuffer old_sbuf;
+  {
+    stream_writer<msgpack::sbuffer> st(old_sbuf);
+    jubatus_packer jp(st);
+    packer pk(jp);
+    pk.pack(d);
+  }
+  msgpack::unpacked old_msg;
+  msgpack::unpack(&old_msg, old_sbuf.data(), old_sbuf.size());
+  m.mix(old_msg.get(), mixed);
+
+  msgpack::sbuffer mixed_sbuf;
+  msgpack::unpacked mixed_msg;
+  convert_binary_to(mixed, mixed_sbuf, mixed_msg);
+  diffv mixed_diff;
+  mixed_msg.get().convert(&mixed_diff);
+  EXPECT_EQ(2, mixed_diff.count);
+  EXPECT_TRUE(m.put_diff(mixed));
+
+  // so are the next diffs of servers
+  msgpack::sbuffer next_sbuf;
+  msgpack::unpacked next_msg;
+  get_diff_to(m, next_sbuf, next_msg);
+  EXPECT_EQ(3u, array_size(next_msg));
+}
+
+TEST(linear_function_mixer, compress_after_negotiation) {
+  linear_function_mixer m(
+      linear_function_mixer::model_ptr(new storage::storage_mock_1));
+  set_codec(m);
+
+  // diffs are plain until every server has advertised compressed_format
+  msgpack::sbuffer sbuf;
+  msgpack::unpacked msg;
+  get_diff_to(m, sbuf, msg);
+  EXPECT_EQ(3u, array_size(msg));
+  diff_object mixed = m.convert_diff_object(msg.get());
+
+  msgpack::sbuffer mixed_sbuf;
+  msgpack::unpacked mixed_msg;
+  convert_binary_to(mixed, mixed_sbuf, mixed_msg);
+  EXPECT_EQ(9u, array_size(mixed_msg));
+  EXPECT_TRUE(m.put_diff(m.convert_diff_object(mixed_msg.get())));
+
+  msgpack::sbuffer next_sbuf;
+  msgpack::unpacked next_msg;
+  get_diff_to(m, next_sbuf, next_msg);
+  EXPECT_EQ(9u, array_size(next_msg));
+  diffv d;
+  EXPECT_EQ(compressed_format, diff_codec::convert(next_msg.get(), d));
+  EXPECT_EQ(1u, d.v.diff.size());
+
+  // a MIX which did not put the mixed diff may have failed to read it
+  msgpack::sbuffer failed_sbuf;
+  msgpack::unpacked failed_msg;
+  get_diff_to(m, failed_sbuf, failed_msg);
+  EXPECT_EQ(3u, array_size(failed_msg));
+}
+
 }  // namespace framework
 }  // namespace core
 }  // namespace jubatus
@@ -160,24 +160,13 @@ void mixable_versioned_table::pull_impl(
     const version_clock& vc, framework::packer& pk) const {
 
   model_ptr table = get_model();
-  const uint64_t table_size = table->size();
-
-  size_t pack_size = 0;
-  for (uint64_t i = 0; i < table_size; ++i) {
-    const version_t version = table->get_version(i);
-    version_clock::const_iterator it = vc.find(version.first);
-    if (it == vc.end() || it->second < version.second) {
-      pack_size++;
-    }
-  }
-  pk.pack_array(pack_size);
-
-  for (uint64_t i = 0; i < table_size; ++i) {
-    const version_t version = table->get_version(i);
-    version_clock::const_iterator it = vc.find(version.first);
-    if (it == vc.end() || it->second < version.second) {
-      table->get_row(i, pk);
-    }
+  util::concurrent::scoped_rlock lk(table->get_mutex());
+
+  vector<uint64_t> ids;
+  table->get_rows_newer_than_nolock(vc, ids);
+  pk.pack_array(ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    table->get_row_nolock(ids[i], pk);
   }
 }
 
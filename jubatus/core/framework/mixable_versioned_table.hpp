@@ -59,6 +59,10 @@ class mixable_versioned_table : public core::framework::push_mixable,
 
   void set_model(model_ptr m) {
     model_ = m;
+    if (model_) {
+      // pulls visit only rows newer than the clock of the peer
+      model_->enable_version_index();
+    }
   }
 
   model_ptr get_model() const {
@@ -17,6 +17,9 @@
 #ifndef JUBATUS_CORE_FRAMEWORK_PACKER_HPP_
 #define JUBATUS_CORE_FRAMEWORK_PACKER_HPP_
 
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
 #include <msgpack.hpp>
 
 namespace jubatus {
@@ -42,6 +45,85 @@ class jubatus_packer {
 
 typedef msgpack::packer<jubatus_packer> packer;
 
+/**
+ * Writes ``map`` as a sequence of msgpack maps of at most ``chunk_size``
+ * entries each, to be read by ``unpacker::next_map_chunk``.  An empty map
+ * is written as no chunks.
+ */
+template <class Map>
+void pack_map_chunks(packer& pk, const Map& map, size_t chunk_size) {
+  chunk_size = std::max<size_t>(chunk_size, 1);
+  typename Map::const_iterator it = map.begin();
+  for (size_t remaining = map.size(); remaining > 0;) {
+    const size_t n = std::min(remaining, chunk_size);
+    pk.pack_map(n);
+    for (size_t i = 0; i < n; ++i, ++it) {
+      pk.pack(it->first);
+      pk.pack(it->second);
+    }
+    remaining -= n;
+  }
+}
+
+class jubatus_reader {
+ public:
+  virtual ~jubatus_reader() {}
+  // returns the number of bytes read, or 0 at the end of the stream
+  virtual size_t read(char* buf, size_t len) = 0;
+};
+
+/**
+ * Reads msgpack objects one by one from a jubatus_reader.  Each object gets
+ * its own zone, so memory use is bounded by the largest object instead of
+ * the whole stream.
+ */
+class unpacker {
+ public:
+  explicit unpacker(jubatus_reader& r) : reader_(r) {
+  }
+
+  // throws msgpack::type_error if the stream ends before an object
+  void next(msgpack::unpacked& result) {
+    while (!unpacker_.next(&result)) {
+      unpacker_.reserve_buffer(read_size);
+      const size_t len =
+          reader_.read(unpacker_.buffer(), unpacker_.buffer_capacity());
+      if (len == 0) {
+        throw msgpack::type_error();
+      }
+      unpacker_.buffer_consumed(len);
+    }
+  }
+
+  /**
+   * Reads a chunk written by ``pack_map_chunks`` and adds its entries to
+   * ``map``.  ``remaining`` is the number of entries not read yet, and is
+   * decreased by the size of the chunk.
+   */
+  template <class Map>
+  void next_map_chunk(uint64_t& remaining, Map& map) {
+    msgpack::unpacked chunk;
+    next(chunk);
+    const msgpack::object o = chunk.get();
+    if (o.type != msgpack::type::MAP || o.via.map.size == 0 ||
+        o.via.map.size > remaining) {
+      throw msgpack::type_error();
+    }
+    for (uint32_t i = 0; i < o.via.map.size; ++i) {
+      typename Map::key_type key;
+      o.via.map.ptr[i].key.convert(&key);
+      o.via.map.ptr[i].val.convert(&map[key]);
+    }
+    remaining -= o.via.map.size;
+  }
+
+ private:
+  static const size_t read_size = 64 * 1024;
+
+  jubatus_reader& reader_;
+  msgpack::unpacker unpacker_;
+};
+
 }  // namespace framework
 }  // namespace core
 }  // namespace jubatus
@@ -0,0 +1,49 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef JUBATUS_CORE_FRAMEWORK_STREAM_READER_HPP_
+#define JUBATUS_CORE_FRAMEWORK_STREAM_READER_HPP_
+
+#include "model.hpp"
+
+namespace jubatus {
+namespace core {
+namespace framework {
+
+template <class T>
+class stream_reader : public core::framework::jubatus_reader {
+ public:
+  explicit stream_reader(T& stream)
+    : stream_(stream) {
+  }
+
+  size_t read(char* buf, size_t len) {
+    stream_.read(buf, len);
+    return stream_.gcount();
+  }
+
+  T& stream() {
+    return stream_;
+  }
+ private:
+  T& stream_;
+};
+
+}  // namespace framework
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_FRAMEWORK_STREAM_READER_HPP_
@@ -32,6 +32,7 @@
 #include "datum_to_fv_converter.hpp"
 #include "exception.hpp"
 #include "factory.hpp"
+#include "feature_hasher.hpp"
 #include "key_matcher.hpp"
 #include "key_matcher_factory.hpp"
 #include "num_feature.hpp"
@@ -357,7 +358,19 @@ void init_combination_rules(
                               "] in combination_rules"));
     }
 
-    conv.register_combination_rule(rule.type, m_left, m_right, it->second);
+    size_t max_pairs = 0;
+    if (rule.max_pairs.bool_test()) {
+      if (*rule.max_pairs.get() <= 0) {
+        stringstream msg;
+        msg << "max_pairs must be positive, but is "
+            << *rule.max_pairs.get() << " in combination_rules";
+        throw JUBATUS_EXCEPTION(converter_exception(msg.str()));
+      }
+      max_pairs = *rule.max_pairs.get();
+    }
+
+    conv.register_combination_rule(
+        rule.type, m_left, m_right, it->second, max_pairs);
   }
 }
 
@@ -378,6 +391,17 @@ void initialize_converter(
     throw JUBATUS_EXCEPTION(converter_exception(msg.str()));
   }
 
+  feature_hash_version hash_version = FEATURE_HASH_FNV1;
+  if (config.hash_version.bool_test()) {
+    const int64_t v = *config.hash_version.get();
+    if (v != FEATURE_HASH_FNV1 && v != FEATURE_HASH_XXH64) {
+      stringstream msg;
+      msg << "hash_version must be 1 or 2, but is " << v;
+      throw JUBATUS_EXCEPTION(converter_exception(msg.str()));
+    }
+    hash_version = static_cast<feature_hash_version>(v);
+  }
+
   map<string, string_filter_ptr> string_filters;
   if (config.string_filter_types) {
     string_filter_factory::create_function f;
@@ -458,7 +482,7 @@ void initialize_converter(
   }
 
   if (config.hash_max_size.bool_test()) {
-    conv.set_hash_max_size(*config.hash_max_size.get());
+    conv.set_hash_max_size(*config.hash_max_size.get(), hash_version);
   }
 }
 
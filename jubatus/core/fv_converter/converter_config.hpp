@@ -97,6 +97,8 @@ struct combination_rule {
   jubatus::util::data::optional<std::string> except_left;
   jubatus::util::data::optional<std::string> except_right;
   std::string type;
+  // limit of the number of combined features per datum
+  jubatus::util::data::optional<int64_t> max_pairs;
 
   friend class jubatus::util::data::serialization::access;
   template<class Archive>
@@ -106,7 +108,8 @@ struct combination_rule {
       & JUBA_MEMBER(key_right)
       & JUBA_MEMBER(except_left)
       & JUBA_MEMBER(except_right)
-      & JUBA_MEMBER(type);
+      & JUBA_MEMBER(type)
+      & JUBA_MEMBER(max_pairs);
   }
 };
 
@@ -135,6 +138,8 @@ struct converter_config {
 
 
   jubatus::util::data::optional<int64_t> hash_max_size;
+  // 1: FNV-1 (default), 2: xxHash
+  jubatus::util::data::optional<int64_t> hash_version;
 
   friend class jubatus::util::data::serialization::access;
   template<class Archive>
@@ -152,7 +157,8 @@ struct converter_config {
         & JUBA_MEMBER(binary_rules)
         & JUBA_MEMBER(combination_types)
         & JUBA_MEMBER(combination_rules)
-        & JUBA_MEMBER(hash_max_size);
+        & JUBA_MEMBER(hash_max_size)
+        & JUBA_MEMBER(hash_version);
   }
 };
 
@@ -107,6 +107,31 @@ TEST(converter_config, hash_negative) {
   EXPECT_THROW(initialize_converter(config, conv), converter_exception);
 }
 
+TEST(converter_config, hash_version) {
+  converter_config config;
+  num_rule r = {"*", optional<string>(), "num"};
+  config.num_rules = std::vector<num_rule>();
+  config.num_rules->push_back(r);
+  config.hash_max_size = 16;
+  config.hash_version = 2;
+
+  datum_to_fv_converter conv;
+  initialize_converter(config, conv);
+
+  datum d;
+  d.num_values_.push_back(std::make_pair("age", 10));
+
+  common::sfvi_t f;
+  conv.convert(d, f);
+  ASSERT_EQ(1u, f.size());
+  EXPECT_GT(16u, f[0].first);
+
+  config.hash_version = 0;
+  EXPECT_THROW(initialize_converter(config, conv), converter_exception);
+  config.hash_version = 3;
+  EXPECT_THROW(initialize_converter(config, conv), converter_exception);
+}
+
 TEST(converter_config, combination) {
   converter_config config;
 
@@ -147,6 +172,42 @@ TEST(converter_config, combination) {
   ASSERT_EQ(4u, f.size());
 }
 
+TEST(converter_config, combination_max_pairs) {
+  converter_config config;
+
+  num_rule nr = {"*", optional<string>(), "num"};
+  config.num_rules = std::vector<num_rule>();
+  config.num_rules->push_back(nr);
+
+  combination_rule cr = {
+      "*@num",
+      "*@num",
+      optional<string>(),
+      optional<string>(),
+      "add",
+      optional<int64_t>(2)
+  };
+  config.combination_rules = std::vector<combination_rule>();
+  config.combination_rules->push_back(cr);
+
+  datum_to_fv_converter conv;
+  initialize_converter(config, conv);
+
+  datum d;
+  d.num_values_.push_back(std::make_pair("a1", 1.0));
+  d.num_values_.push_back(std::make_pair("a2", 2.0));
+  d.num_values_.push_back(std::make_pair("b", 300.0));
+
+  common::sfv_t f;
+  conv.convert(d, f);
+  ASSERT_EQ(5u, f.size());
+  EXPECT_EQ("a1@num&a2@num/add", f[3].first);
+  EXPECT_EQ("a1@num&b@num/add", f[4].first);
+
+  config.combination_rules->front().max_pairs = 0;
+  EXPECT_THROW(initialize_converter(config, conv), converter_exception);
+}
+
 TEST(make_fv_converter, empty_config) {
   jubatus::util::text::json::json
     js(new jubatus::util::text::json::json_object);
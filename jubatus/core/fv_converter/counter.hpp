@@ -19,6 +19,7 @@
 
 #include <ostream>
 #include <sstream>
+#include <utility>
 
 #include "jubatus/util/data/unordered_map.h"
 #include "../common/unordered_map.hpp"
@@ -82,6 +83,17 @@ class counter {
     }
   }
 
+  // adds ``scale`` times ``counts``; entries which become zero are removed
+  void add(const counter<T>& counts, double scale) {
+    for (const_iterator it = counts.begin(); it != counts.end(); ++it) {
+      iterator p = data_.insert(std::make_pair(it->first, 0.0)).first;
+      p->second += scale * it->second;
+      if (p->second == 0) {
+        data_.erase(p);
+      }
+    }
+  }
+
   size_t size() const {
     return data_.size();
   }
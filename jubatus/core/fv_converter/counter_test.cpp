@@ -49,6 +49,21 @@ TEST(counter, add) {
   EXPECT_EQ(5u, x["foo"]);
 }
 
+TEST(counter, add_scaled) {
+  counter<std::string> x, y;
+  x["hoge"] = 4;
+  x["fuga"] = 2;
+
+  y["hoge"] = 1;
+  y["fuga"] = 2;
+
+  x.add(y, -1);
+
+  EXPECT_EQ(3u, x["hoge"]);
+  EXPECT_FALSE(x.contains("fuga"));
+  EXPECT_EQ(1u, x.size());
+}
+
 }  // namespace fv_converter
 }  // namespace core
 }  // namespace jubatus
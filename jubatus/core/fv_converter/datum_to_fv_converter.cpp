@@ -21,8 +21,12 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include "jubatus/util/concurrent/lock.h"
+#include "jubatus/util/concurrent/rwmutex.h"
 #include "jubatus/util/data/optional.h"
+#include "jubatus/util/data/unordered_map.h"
 #include "jubatus/util/lang/shared_ptr.h"
+#include "../common/hash.hpp"
 #include "binary_feature.hpp"
 #include "combination_feature.hpp"
 #include "counter.hpp"
@@ -53,35 +57,12 @@ class datum_to_fv_converter_impl {
     jubatus::util::lang::shared_ptr<key_matcher> matcher_;
     jubatus::util::lang::shared_ptr<string_filter> filter_;
     std::string suffix_;
-
-    void filter(const datum::sv_t& string_values, datum::sv_t& filtered) const {
-      for (size_t i = 0; i < string_values.size(); ++i) {
-        const std::pair<std::string, std::string>& value = string_values[i];
-        if (matcher_->match(value.first)) {
-          std::string out;
-          filter_->filter(value.second, out);
-          std::string dest = value.first + suffix_;
-          filtered.push_back(std::make_pair(dest, out));
-        }
-      }
-    }
   };
 
   struct num_filter_rule {
     jubatus::util::lang::shared_ptr<key_matcher> matcher_;
     jubatus::util::lang::shared_ptr<num_filter> filter_;
     std::string suffix_;
-
-    void filter(const datum::nv_t& num_values, datum::nv_t& filtered) const {
-      for (size_t i = 0; i < num_values.size(); ++i) {
-        const std::pair<std::string, double>& value = num_values[i];
-        if (matcher_->match(value.first)) {
-          double out = filter_->filter(value.second);
-          std::string dest = value.first + suffix_;
-          filtered.push_back(std::make_pair(dest, out));
-        }
-      }
-    }
   };
 
   struct string_feature_rule {
@@ -89,6 +70,8 @@ class datum_to_fv_converter_impl {
     jubatus::util::lang::shared_ptr<key_matcher> matcher_;
     jubatus::util::lang::shared_ptr<string_feature> splitter_;
     std::vector<splitter_weight_type> weights_;
+    // "@<name>#<sample weight>/<global weight>" for each of weights_
+    std::vector<std::string> feature_suffixes_;
 
     string_feature_rule(
         const std::string& name,
@@ -99,6 +82,12 @@ class datum_to_fv_converter_impl {
           matcher_(matcher),
           splitter_(splitter),
           weights_(weights) {
+      for (size_t i = 0; i < weights.size(); ++i) {
+        feature_suffixes_.push_back(
+            "@" + name + "#" +
+            get_sample_weight_name(weights[i].freq_weight_type_) + "/" +
+            get_global_weight_name(weights[i].term_weight_type_));
+      }
     }
   };
 
@@ -137,19 +126,102 @@ class datum_to_fv_converter_impl {
     jubatus::util::lang::shared_ptr<key_matcher> matcher_left_;
     jubatus::util::lang::shared_ptr<key_matcher> matcher_right_;
     jubatus::util::lang::shared_ptr<combination_feature> feature_func_;
+    // maximum number of pairs combined in a datum, or 0 for no limit
+    size_t max_pairs_;
+    // "/<name>"
+    std::string feature_suffix_;
 
     combination_feature_rule(
         const std::string& name,
         jubatus::util::lang::shared_ptr<key_matcher> matcher_left,
         jubatus::util::lang::shared_ptr<key_matcher> matcher_right,
-        jubatus::util::lang::shared_ptr<combination_feature> feature_func)
+        jubatus::util::lang::shared_ptr<combination_feature> feature_func,
+        size_t max_pairs)
         : name_(name),
           matcher_left_(matcher_left),
           matcher_right_(matcher_right),
-          feature_func_(feature_func) {
+          feature_func_(feature_func),
+          max_pairs_(max_pairs),
+          feature_suffix_("/" + name) {
     }
   };
 
+  /**
+   * Plans record which rules and filters apply to a key of a datum, and
+   * the feature names built from it.  They are made on the first sight of
+   * a key, so that key matchers are not evaluated for each datum.
+   */
+  struct string_key_plan {
+    bool valid_key;
+    // "<key>$"
+    std::string feature_prefix;
+    // whether string_rules_[i] matches the key
+    std::vector<bool> rules;
+    // index of string_filter_rules_ and the key of the filtered value
+    std::vector<std::pair<size_t, std::string> > filters;
+  };
+
+  struct num_key_plan {
+    bool valid_key;
+    // index of num_rules_ and "<key>@<name>"
+    std::vector<std::pair<size_t, std::string> > rules;
+    // index of num_filter_rules_ and the key of the filtered value
+    std::vector<std::pair<size_t, std::string> > filters;
+  };
+
+  struct binary_key_plan {
+    bool valid_key;
+    // "<key>@<name>" for each of binary_rules_, or empty if not matched
+    std::vector<std::string> rules;
+  };
+
+  template <typename Plan>
+  class plan_cache {
+   public:
+    typedef jubatus::util::lang::shared_ptr<const Plan> plan_ptr;
+
+    plan_ptr find(const std::string& key) const {
+      jubatus::util::concurrent::scoped_rlock lk(mutex_);
+      typename plan_map::const_iterator it = plans_.find(key);
+      return it == plans_.end() ? plan_ptr() : it->second;
+    }
+
+    plan_ptr insert(const std::string& key, const plan_ptr& plan) {
+      jubatus::util::concurrent::scoped_wlock lk(mutex_);
+      if (plans_.size() >= max_size) {
+        // keys are not bounded when a datum has arbitrary keys
+        plans_.clear();
+      }
+      return plans_.insert(std::make_pair(key, plan)).first->second;
+    }
+
+    void clear() {
+      jubatus::util::concurrent::scoped_wlock lk(mutex_);
+      plans_.clear();
+    }
+
+   private:
+    typedef jubatus::util::data::unordered_map<std::string, plan_ptr>
+        plan_map;
+    static const size_t max_size = 65536;
+
+    plan_map plans_;
+    mutable jubatus::util::concurrent::rw_mutex mutex_;
+  };
+
+  typedef std::vector<plan_cache<string_key_plan>::plan_ptr> string_plans_t;
+  typedef std::vector<plan_cache<num_key_plan>::plan_ptr> num_plans_t;
+
+  // features of a datum matched by the matchers of a combination rule
+  struct combination_buckets {
+    std::vector<size_t> left;
+    std::vector<size_t> right;
+    // matched by either of them
+    std::vector<size_t> both;
+    std::vector<bool> is_left;
+    std::vector<bool> is_right;
+  };
+
   // binarys
   std::vector<binary_feature_rule> binary_rules_;
   std::vector<combination_feature_rule> combination_rules_;
@@ -165,6 +237,10 @@ class datum_to_fv_converter_impl {
 
   jubatus::util::data::optional<feature_hasher> hasher_;
 
+  mutable plan_cache<string_key_plan> string_plans_;
+  mutable plan_cache<num_key_plan> num_plans_;
+  mutable plan_cache<binary_key_plan> binary_plans_;
+
  public:
   datum_to_fv_converter_impl()
     : contains_idf_(false),
@@ -186,6 +262,7 @@ class datum_to_fv_converter_impl {
     num_rules_.clear();
     binary_rules_.clear();
     combination_rules_.clear();
+    clear_plans();
   }
 
   void register_string_filter(
@@ -194,6 +271,7 @@ class datum_to_fv_converter_impl {
       const std::string& suffix) {
     string_filter_rule rule = { matcher, filter, suffix };
     string_filter_rules_.push_back(rule);
+    clear_plans();
   }
 
   void register_num_filter(
@@ -202,6 +280,7 @@ class datum_to_fv_converter_impl {
       const std::string& suffix) {
     num_filter_rule rule = { matcher, filter, suffix };
     num_filter_rules_.push_back(rule);
+    clear_plans();
   }
 
   void register_string_rule(
@@ -214,6 +293,7 @@ class datum_to_fv_converter_impl {
     contains_bm25_ |= contains_term_weight_type(weights, BM25);
     string_rules_.push_back(
         string_feature_rule(name, matcher, splitter, weights));
+    clear_plans();
   }
 
   void register_num_rule(
@@ -221,6 +301,7 @@ class datum_to_fv_converter_impl {
       jubatus::util::lang::shared_ptr<key_matcher> matcher,
       jubatus::util::lang::shared_ptr<num_feature> feature_func) {
     num_rules_.push_back(num_feature_rule(name, matcher, feature_func));
+    clear_plans();
   }
 
   void register_binary_rule(
@@ -228,19 +309,22 @@ class datum_to_fv_converter_impl {
       jubatus::util::lang::shared_ptr<key_matcher> matcher,
       jubatus::util::lang::shared_ptr<binary_feature> feature_func) {
     binary_rules_.push_back(binary_feature_rule(name, matcher, feature_func));
+    clear_plans();
   }
 
   void register_combination_rule(
       const std::string& name,
       jubatus::util::lang::shared_ptr<key_matcher> matcher_left,
       jubatus::util::lang::shared_ptr<key_matcher> matcher_right,
-      jubatus::util::lang::shared_ptr<combination_feature> feature_func) {
+      jubatus::util::lang::shared_ptr<combination_feature> feature_func,
+      size_t max_pairs) {
     combination_rules_.push_back(
         combination_feature_rule(
             name,
             matcher_left,
             matcher_right,
-            feature_func));
+            feature_func,
+            max_pairs));
   }
 
   void add_weight(const std::string& key, double weight) {
@@ -253,61 +337,64 @@ class datum_to_fv_converter_impl {
 
   void convert(const datum& datum, common::sfv_t& ret_fv) const {
     common::sfv_t fv;
-    convert_unweighted(datum, fv);
-    jubatus::util::lang::shared_ptr<weight_manager> weights =
-        mixable_weights_->get_model();
-    if (weights) {
-      weights->get_weight(fv);
-    }
-
-    convert_combinations(fv);
-
+    convert_unhashed(datum, fv);
     if (hasher_) {
       hasher_->hash_feature_keys(fv);
     }
-
     fv.swap(ret_fv);
   }
 
   void convert_and_update_weight(const datum& datum, common::sfv_t& ret_fv) {
     common::sfv_t fv;
-    convert_unweighted(datum, fv);
-    jubatus::util::lang::shared_ptr<weight_manager> weights =
-        mixable_weights_->get_model();
-    if (weights) {
-      weights->update_weight(fv, contains_idf_, contains_bm25_);
-      weights->get_weight(fv);
-    }
-
-    convert_combinations(fv);
-
+    convert_and_update_weight_unhashed(datum, fv);
     if (hasher_) {
       hasher_->hash_feature_keys(fv);
     }
-
     fv.swap(ret_fv);
   }
 
-  void convert_unweighted(const datum& datum, common::sfv_t& ret_fv) const {
+  void convert(const datum& datum, common::sfvi_t& ret_fv) const {
     common::sfv_t fv;
+    convert_unhashed(datum, fv);
+    make_feature_ids(fv, ret_fv);
+  }
 
-    std::vector<std::pair<std::string, std::string> > filtered_strings;
-    filter_strings(datum.string_values_, filtered_strings);
-    convert_strings(datum.string_values_, fv);
-    convert_strings(filtered_strings, fv);
+  void convert_and_update_weight(const datum& datum, common::sfvi_t& ret_fv) {
+    common::sfv_t fv;
+    convert_and_update_weight_unhashed(datum, fv);
+    make_feature_ids(fv, ret_fv);
+  }
 
-    std::vector<std::pair<std::string, double> > filtered_nums;
-    filter_nums(datum.num_values_, filtered_nums);
-    convert_nums(datum.num_values_, fv);
-    convert_nums(filtered_nums, fv);
+  void convert_unweighted(const datum& datum, common::sfv_t& ret_fv) const {
+    common::sfv_t fv;
+
+    string_plans_t string_plans;
+    get_string_plans(datum.string_values_, string_plans);
+    datum::sv_t filtered_strings;
+    string_plans_t filtered_string_plans;
+    filter_strings(datum.string_values_, string_plans,
+                   filtered_strings, filtered_string_plans);
+    convert_strings(datum.string_values_, string_plans, fv);
+    convert_strings(filtered_strings, filtered_string_plans, fv);
+
+    num_plans_t num_plans;
+    get_num_plans(datum.num_values_, num_plans);
+    datum::nv_t filtered_nums;
+    num_plans_t filtered_num_plans;
+    filter_nums(datum.num_values_, num_plans,
+                filtered_nums, filtered_num_plans);
+    convert_nums(datum.num_values_, num_plans, fv);
+    convert_nums(filtered_nums, filtered_num_plans, fv);
 
     convert_binaries(datum.binary_values_, fv);
 
     fv.swap(ret_fv);
   }
 
-  void set_hash_max_size(uint64_t hash_max_size) {
-    hasher_ = feature_hasher(hash_max_size);
+  void set_hash_max_size(
+      uint64_t hash_max_size,
+      feature_hash_version version) {
+    hasher_ = feature_hasher(hash_max_size, version);
   }
 
   void set_weight_manager(jubatus::util::lang::shared_ptr<weight_manager> wm) {
@@ -323,52 +410,244 @@ class datum_to_fv_converter_impl {
   }
 
  private:
+  void clear_plans() {
+    string_plans_.clear();
+    num_plans_.clear();
+    binary_plans_.clear();
+  }
+
+  plan_cache<string_key_plan>::plan_ptr get_string_plan(
+      const std::string& key) const {
+    plan_cache<string_key_plan>::plan_ptr plan = string_plans_.find(key);
+    if (plan) {
+      return plan;
+    }
+
+    jubatus::util::lang::shared_ptr<string_key_plan> p(new string_key_plan);
+    p->valid_key = is_valid_key(key);
+    p->feature_prefix = key + "$";
+    p->rules.resize(string_rules_.size());
+    for (size_t i = 0; i < string_rules_.size(); ++i) {
+      p->rules[i] = string_rules_[i].matcher_->match(key);
+    }
+    for (size_t i = 0; i < string_filter_rules_.size(); ++i) {
+      const string_filter_rule& r = string_filter_rules_[i];
+      if (r.matcher_->match(key)) {
+        p->filters.push_back(std::make_pair(i, key + r.suffix_));
+      }
+    }
+    return string_plans_.insert(key, p);
+  }
+
+  plan_cache<num_key_plan>::plan_ptr get_num_plan(
+      const std::string& key) const {
+    plan_cache<num_key_plan>::plan_ptr plan = num_plans_.find(key);
+    if (plan) {
+      return plan;
+    }
+
+    jubatus::util::lang::shared_ptr<num_key_plan> p(new num_key_plan);
+    p->valid_key = is_valid_key(key);
+    for (size_t i = 0; i < num_rules_.size(); ++i) {
+      const num_feature_rule& r = num_rules_[i];
+      if (r.matcher_->match(key)) {
+        p->rules.push_back(std::make_pair(i, key + "@" + r.name_));
+      }
+    }
+    for (size_t i = 0; i < num_filter_rules_.size(); ++i) {
+      const num_filter_rule& r = num_filter_rules_[i];
+      if (r.matcher_->match(key)) {
+        p->filters.push_back(std::make_pair(i, key + r.suffix_));
+      }
+    }
+    return num_plans_.insert(key, p);
+  }
+
+  plan_cache<binary_key_plan>::plan_ptr get_binary_plan(
+      const std::string& key) const {
+    plan_cache<binary_key_plan>::plan_ptr plan = binary_plans_.find(key);
+    if (plan) {
+      return plan;
+    }
+
+    jubatus::util::lang::shared_ptr<binary_key_plan> p(new binary_key_plan);
+    p->valid_key = is_valid_key(key);
+    p->rules.resize(binary_rules_.size());
+    for (size_t i = 0; i < binary_rules_.size(); ++i) {
+      const binary_feature_rule& r = binary_rules_[i];
+      if (r.matcher_->match(key)) {
+        p->rules[i] = key + "@" + r.name_;
+      }
+    }
+    return binary_plans_.insert(key, p);
+  }
+
+  void get_string_plans(
+      const datum::sv_t& string_values,
+      string_plans_t& plans) const {
+    plans.reserve(string_values.size());
+    for (size_t i = 0; i < string_values.size(); ++i) {
+      plans.push_back(get_string_plan(string_values[i].first));
+    }
+  }
+
+  void get_num_plans(
+      const datum::nv_t& num_values,
+      num_plans_t& plans) const {
+    plans.reserve(num_values.size());
+    for (size_t i = 0; i < num_values.size(); ++i) {
+      plans.push_back(get_num_plan(num_values[i].first));
+    }
+  }
+
+  template <typename Plan>
+  static const std::string* find_filter(const Plan& plan, size_t rule) {
+    for (size_t i = 0; i < plan.filters.size(); ++i) {
+      if (plan.filters[i].first == rule) {
+        return &plan.filters[i].second;
+      }
+    }
+    return NULL;
+  }
+
+  // Each filter is applied to the original values and then to the values
+  // made by the preceding filters.
   void filter_strings(
       const datum::sv_t& string_values,
-      datum::sv_t& filtered_values) const {
+      const string_plans_t& plans,
+      datum::sv_t& filtered_values,
+      string_plans_t& filtered_plans) const {
     for (size_t i = 0; i < string_filter_rules_.size(); ++i) {
-      datum::sv_t update;
-      string_filter_rules_[i].filter(string_values, update);
-      string_filter_rules_[i].filter(filtered_values, update);
+      const size_t filtered_size = filtered_values.size();
+      filter_strings(i, string_values, plans, string_values.size(),
+                     filtered_values, filtered_plans);
+      filter_strings(i, filtered_values, filtered_plans, filtered_size,
+                     filtered_values, filtered_plans);
+    }
+  }
 
-      filtered_values.insert(filtered_values.end(), update.begin(),
-                             update.end());
+  // string_values may be filtered_values itself; only the first size
+  // values are filtered.
+  void filter_strings(
+      size_t rule,
+      const datum::sv_t& string_values,
+      const string_plans_t& plans,
+      size_t size,
+      datum::sv_t& filtered_values,
+      string_plans_t& filtered_plans) const {
+    const string_filter_rule& r = string_filter_rules_[rule];
+    for (size_t j = 0; j < size; ++j) {
+      plan_cache<string_key_plan>::plan_ptr plan = plans[j];
+      const std::string* dest = find_filter(*plan, rule);
+      if (dest) {
+        std::string out;
+        r.filter_->filter(string_values[j].second, out);
+        filtered_values.push_back(std::make_pair(*dest, out));
+        filtered_plans.push_back(get_string_plan(*dest));
+      }
     }
   }
 
   void filter_nums(
       const datum::nv_t& num_values,
-      datum::nv_t& filtered_values) const {
+      const num_plans_t& plans,
+      datum::nv_t& filtered_values,
+      num_plans_t& filtered_plans) const {
     for (size_t i = 0; i < num_filter_rules_.size(); ++i) {
-      datum::nv_t update;
-      num_filter_rules_[i].filter(num_values, update);
-      num_filter_rules_[i].filter(filtered_values, update);
+      const size_t filtered_size = filtered_values.size();
+      filter_nums(i, num_values, plans, num_values.size(),
+                  filtered_values, filtered_plans);
+      filter_nums(i, filtered_values, filtered_plans, filtered_size,
+                  filtered_values, filtered_plans);
+    }
+  }
 
-      filtered_values.insert(
-          filtered_values.end(), update.begin(), update.end());
+  void filter_nums(
+      size_t rule,
+      const datum::nv_t& num_values,
+      const num_plans_t& plans,
+      size_t size,
+      datum::nv_t& filtered_values,
+      num_plans_t& filtered_plans) const {
+    const num_filter_rule& r = num_filter_rules_[rule];
+    for (size_t j = 0; j < size; ++j) {
+      plan_cache<num_key_plan>::plan_ptr plan = plans[j];
+      const std::string* dest = find_filter(*plan, rule);
+      if (dest) {
+        double out = r.filter_->filter(num_values[j].second);
+        filtered_values.push_back(std::make_pair(*dest, out));
+        filtered_plans.push_back(get_num_plan(*dest));
+      }
     }
   }
 
-  void convert_strings(
-      const datum::sv_t& string_values,
-      common::sfv_t& ret_fv) const {
-    for (size_t i = 0; i < string_rules_.size(); ++i) {
-      convert_strings(string_rules_[i], string_values, ret_fv);
+  void convert_unhashed(const datum& datum, common::sfv_t& ret_fv) const {
+    common::sfv_t fv;
+    convert_unweighted(datum, fv);
+    jubatus::util::lang::shared_ptr<weight_manager> weights =
+        mixable_weights_->get_model();
+    if (weights) {
+      weights->get_weight(fv);
+    }
+
+    convert_combinations(fv);
+
+    fv.swap(ret_fv);
+  }
+
+  void convert_and_update_weight_unhashed(
+      const datum& datum,
+      common::sfv_t& ret_fv) {
+    common::sfv_t fv;
+    convert_unweighted(datum, fv);
+    jubatus::util::lang::shared_ptr<weight_manager> weights =
+        mixable_weights_->get_model();
+    if (weights) {
+      weights->update_weight(fv, contains_idf_, contains_bm25_);
+      weights->get_weight(fv);
+    }
+
+    convert_combinations(fv);
+
+    fv.swap(ret_fv);
+  }
+
+  // A feature ID is the FNV-1 hash of the feature key, i.e. the value that
+  // LSH and minhash compute from the key, so IDs need no synchronization
+  // among processes.  With feature hashing, IDs are made from the hashed
+  // indices without building their decimal keys.
+  void make_feature_ids(
+      const common::sfv_t& fv,
+      common::sfvi_t& ret_fv) const {
+    if (hasher_) {
+      hasher_->hash_feature_ids(fv, ret_fv);
+      return;
+    }
+    ret_fv.resize(fv.size());
+    for (size_t i = 0; i < fv.size(); ++i) {
+      ret_fv[i].first = common::hash_util::calc_string_hash(fv[i].first);
+      ret_fv[i].second = fv[i].second;
     }
   }
 
   void convert_strings(
-      const string_feature_rule& splitter,
       const datum::sv_t& string_values,
+      const string_plans_t& plans,
       common::sfv_t& ret_fv) const {
-    for (size_t j = 0; j < string_values.size(); ++j) {
-      const std::string& key = string_values[j].first;
-      const std::string& value = string_values[j].second;
-      counter<std::string> counter;
-      count_words(splitter, key, value, counter);
-      for (size_t i = 0; i < splitter.weights_.size(); ++i) {
-        make_string_features(
-            key, splitter.name_, splitter.weights_[i], counter, ret_fv);
+    for (size_t i = 0; i < string_rules_.size(); ++i) {
+      const string_feature_rule& splitter = string_rules_[i];
+      for (size_t j = 0; j < string_values.size(); ++j) {
+        const string_key_plan& plan = *plans[j];
+        if (!plan.rules[i]) {
+          continue;
+        }
+        counter<std::string> counter;
+        count_words(splitter, string_values[j].second, counter);
+        for (size_t k = 0; k < splitter.weights_.size(); ++k) {
+          make_string_features(
+              string_values[j].first, plan, splitter.weights_[k],
+              splitter.feature_suffixes_[k], counter, ret_fv);
+        }
       }
     }
   }
@@ -376,47 +655,37 @@ class datum_to_fv_converter_impl {
   void convert_binaries(
       const datum::sv_t& binary_values,
       common::sfv_t& ret_fv) const {
-    for (size_t i = 0; i < binary_rules_.size(); ++i) {
-      convert_binaries(binary_rules_[i], binary_values, ret_fv);
+    if (binary_rules_.empty()) {
+      return;
     }
-  }
 
-  void convert_binaries(
-      const binary_feature_rule& feature,
-      const datum::sv_t& binary_values,
-      common::sfv_t& ret_fv) const {
+    std::vector<plan_cache<binary_key_plan>::plan_ptr> plans;
+    plans.reserve(binary_values.size());
     for (size_t j = 0; j < binary_values.size(); ++j) {
-      const std::string& key = binary_values[j].first;
-      const std::string& value = binary_values[j].second;
-      if (feature.matcher_->match(key)) {
-        check_key(key);
-        std::string k = key + "@" + feature.name_;
-        feature.feature_func_->add_feature(k, value, ret_fv);
-      }
+      plans.push_back(get_binary_plan(binary_values[j].first));
     }
-  }
 
-  static std::string make_feature(
-      const std::string& key,
-      const std::string& value,
-      const std::string& splitter,
-      const std::string& sample_weight,
-      const std::string& global_weight) {
-    check_key(key);
-    return key + "$" + value + "@" + splitter + "#" + sample_weight + "/" +
-        global_weight;
+    for (size_t i = 0; i < binary_rules_.size(); ++i) {
+      const binary_feature_rule& feature = binary_rules_[i];
+      for (size_t j = 0; j < binary_values.size(); ++j) {
+        const binary_key_plan& plan = *plans[j];
+        if (!plan.rules[i].empty()) {
+          if (!plan.valid_key) {
+            check_key(binary_values[j].first);
+          }
+          feature.feature_func_->add_feature(
+              plan.rules[i], binary_values[j].second, ret_fv);
+        }
+      }
+    }
   }
 
-  static std::string make_feature_key(
-      const std::string& key,
-      const std::string& value,
-      const std::string& splitter) {
-    check_key(key);
-    return key + "$" + value + "@" + splitter;
+  static bool is_valid_key(const std::string& key) {
+    return key.find('$') == std::string::npos;
   }
 
   static void check_key(const std::string& key) {
-    if (key.find('$') != std::string::npos) {
+    if (!is_valid_key(key)) {
       throw JUBATUS_EXCEPTION(
           converter_exception("feature key cannot contain '$': " + key));
     }
@@ -424,34 +693,25 @@ class datum_to_fv_converter_impl {
 
   void count_words(
       const string_feature_rule& splitter,
-      const std::string& key,
       const std::string& value,
       counter<std::string>& counter) const {
-    if (splitter.matcher_->match(key)) {
-      std::vector<string_feature_element> elements;
-      splitter.splitter_->extract(value, elements);
+    std::vector<string_feature_element> elements;
+    splitter.splitter_->extract(value, elements);
 
-      for (size_t i = 0; i < elements.size(); i++) {
-        counter[elements[i].value] += elements[i].score;
-      }
+    for (size_t i = 0; i < elements.size(); i++) {
+      counter[elements[i].value] += elements[i].score;
     }
   }
 
-  double get_sample_weight(
-      frequency_weight_type type,
-      double tf,
-      std::string& name) const {
+  static double get_sample_weight(frequency_weight_type type, double tf) {
     switch (type) {
       case FREQ_BINARY:
-        name = "bin";
         return 1.0;
 
       case TERM_FREQUENCY:
-        name = "tf";
         return tf;
 
       case LOG_TERM_FREQUENCY:
-        name = "log_tf";
         return std::log(1. + tf);
 
       default:
@@ -459,7 +719,20 @@ class datum_to_fv_converter_impl {
     }
   }
 
-  std::string get_global_weight_name(term_weight_type type) const {
+  static std::string get_sample_weight_name(frequency_weight_type type) {
+    switch (type) {
+      case FREQ_BINARY:
+        return "bin";
+      case TERM_FREQUENCY:
+        return "tf";
+      case LOG_TERM_FREQUENCY:
+        return "log_tf";
+      default:
+        return "";
+    }
+  }
+
+  static std::string get_global_weight_name(term_weight_type type) {
     switch (type) {
       case TERM_BINARY:
         return "bin";
@@ -491,23 +764,25 @@ class datum_to_fv_converter_impl {
 
   void make_string_features(
       const std::string& key,
-      const std::string& splitter_name,
+      const string_key_plan& plan,
       const splitter_weight_type& weight_type,
+      const std::string& feature_suffix,
       const counter<std::string>& count,
       common::sfv_t& ret_fv) const {
     for (counter<std::string>::const_iterator it = count.begin();
          it != count.end(); ++it) {
-      std::string sample_weight_name;
       double sample_weight = get_sample_weight(
-          weight_type.freq_weight_type_, it->second, sample_weight_name);
-
-      std::string global_weight_name = get_global_weight_name(
-          weight_type.term_weight_type_);
+          weight_type.freq_weight_type_, it->second);
 
       if (sample_weight != 0.0) {
-        std::string f = make_feature(
-            key, it->first, splitter_name, sample_weight_name,
-            global_weight_name);
+        if (!plan.valid_key) {
+          check_key(key);
+        }
+        std::string f;
+        f.reserve(plan.feature_prefix.size() + it->first.size() +
+                  feature_suffix.size());
+        f.append(plan.feature_prefix).append(it->first).append(
+            feature_suffix);
         ret_fv.push_back(std::make_pair(f, sample_weight));
       }
     }
@@ -515,22 +790,16 @@ class datum_to_fv_converter_impl {
 
   void convert_nums(
       const datum::nv_t& num_values,
+      const num_plans_t& plans,
       common::sfv_t& ret_fv) const {
     for (size_t i = 0; i < num_values.size(); ++i) {
-      convert_num(num_values[i].first, num_values[i].second, ret_fv);
-    }
-  }
-
-  void convert_num(
-      const std::string& key,
-      double value,
-      common::sfv_t& ret_fv) const {
-    for (size_t i = 0; i < num_rules_.size(); ++i) {
-      const num_feature_rule& r = num_rules_[i];
-      if (r.matcher_->match(key)) {
-        check_key(key);
-        std::string k = key + "@" + r.name_;
-        r.feature_func_->add_feature(k, value, ret_fv);
+      const num_key_plan& plan = *plans[i];
+      for (size_t j = 0; j < plan.rules.size(); ++j) {
+        if (!plan.valid_key) {
+          check_key(num_values[i].first);
+        }
+        num_rules_[plan.rules[j].first].feature_func_->add_feature(
+            plan.rules[j].second, num_values[i].second, ret_fv);
       }
     }
   }
@@ -543,42 +812,104 @@ class datum_to_fv_converter_impl {
       return;
     }
 
+    combination_buckets buckets;
+    buckets.is_left.resize(original_size);
+    buckets.is_right.resize(original_size);
     for (size_t i = 0; i < combination_rules_.size(); ++i) {
       const combination_feature_rule& r = combination_rules_[i];
-      if (r.feature_func_->is_commutative()) {
-        for (size_t j = 0 ; j < original_size - 1; ++j) {
-          for (size_t m = j + 1; m < original_size; ++m) {
-            if ((r.matcher_left_->match(ret_fv[j].first)
-                  && r.matcher_right_->match(ret_fv[m].first)) ||
-                (r.matcher_right_->match(ret_fv[j].first)
-                  && r.matcher_left_->match(ret_fv[m].first))) {
-              r.feature_func_->add_feature(
-                  ret_fv[j].first + "&" + ret_fv[m].first + "/" + r.name_,
-                  ret_fv[j].second,
-                  ret_fv[m].second,
-                  ret_fv);
-            }
-          }
+
+      // Split the features into buckets once; only pairs across the
+      // buckets are enumerated below.
+      buckets.left.clear();
+      buckets.right.clear();
+      buckets.both.clear();
+      for (size_t j = 0; j < original_size; ++j) {
+        const bool left = r.matcher_left_->match(ret_fv[j].first);
+        const bool right = r.matcher_right_->match(ret_fv[j].first);
+        buckets.is_left[j] = left;
+        buckets.is_right[j] = right;
+        if (left) {
+          buckets.left.push_back(j);
         }
+        if (right) {
+          buckets.right.push_back(j);
+        }
+        if (left || right) {
+          buckets.both.push_back(j);
+        }
+      }
+      if (buckets.left.empty() || buckets.right.empty()) {
+        continue;
+      }
+
+      if (r.feature_func_->is_commutative()) {
+        convert_commutative_combinations(r, buckets, ret_fv);
       } else {
-        for (size_t j = 0 ; j < original_size; ++j) {
-          for (size_t m = 0; m < original_size; ++m) {
-            if (j == m) {
-              continue;
-            }
-            if (r.matcher_left_->match(ret_fv[j].first)
-                  && r.matcher_right_->match(ret_fv[m].first)) {
-              r.feature_func_->add_feature(
-                  ret_fv[j].first + "&" + ret_fv[m].first + "/" + r.name_,
-                  ret_fv[j].second,
-                  ret_fv[m].second,
-                  ret_fv);
-            }
+        convert_ordered_combinations(r, buckets, ret_fv);
+      }
+    }
+  }
+
+  // Pairs (j, m) with j < m, where either of them matches left and the
+  // other matches right.
+  void convert_commutative_combinations(
+      const combination_feature_rule& r,
+      const combination_buckets& buckets,
+      common::sfv_t& ret_fv) const {
+    const std::vector<size_t>& both = buckets.both;
+    const std::vector<bool>& is_left = buckets.is_left;
+    const std::vector<bool>& is_right = buckets.is_right;
+    size_t pairs = 0;
+    for (size_t a = 0; a < both.size(); ++a) {
+      const size_t j = both[a];
+      for (size_t b = a + 1; b < both.size(); ++b) {
+        const size_t m = both[b];
+        if ((is_left[j] && is_right[m]) || (is_right[j] && is_left[m])) {
+          if (r.max_pairs_ != 0 && pairs == r.max_pairs_) {
+            return;
           }
+          add_combination(r, j, m, ret_fv);
+          ++pairs;
+        }
+      }
+    }
+  }
+
+  void convert_ordered_combinations(
+      const combination_feature_rule& r,
+      const combination_buckets& buckets,
+      common::sfv_t& ret_fv) const {
+    const std::vector<size_t>& left = buckets.left;
+    const std::vector<size_t>& right = buckets.right;
+    size_t pairs = 0;
+    for (size_t a = 0; a < left.size(); ++a) {
+      for (size_t b = 0; b < right.size(); ++b) {
+        if (left[a] == right[b]) {
+          continue;
         }
+        if (r.max_pairs_ != 0 && pairs == r.max_pairs_) {
+          return;
+        }
+        add_combination(r, left[a], right[b], ret_fv);
+        ++pairs;
       }
     }
   }
+
+  void add_combination(
+      const combination_feature_rule& r,
+      size_t left,
+      size_t right,
+      common::sfv_t& ret_fv) const {
+    std::string key;
+    key.reserve(ret_fv[left].first.size() + ret_fv[right].first.size() +
+                1 + r.feature_suffix_.size());
+    key.append(ret_fv[left].first).append("&").append(
+        ret_fv[right].first).append(r.feature_suffix_);
+    const double value_left = ret_fv[left].second;
+    const double value_right = ret_fv[right].second;
+    r.feature_func_->add_feature(key, value_left, value_right, ret_fv);
+  }
 };
 
 datum_to_fv_converter::datum_to_fv_converter()
@@ -600,6 +931,18 @@ void datum_to_fv_converter::convert_and_update_weight(
   pimpl_->convert_and_update_weight(datum, ret_fv);
 }
 
+void datum_to_fv_converter::convert(
+    const datum& datum,
+    common::sfvi_t& ret_fv) const {
+  pimpl_->convert(datum, ret_fv);
+}
+
+void datum_to_fv_converter::convert_and_update_weight(
+    const datum& datum,
+    common::sfvi_t& ret_fv) {
+  pimpl_->convert_and_update_weight(datum, ret_fv);
+}
+
 void datum_to_fv_converter::clear_rules() {
   pimpl_->clear_rules();
 }
@@ -644,20 +987,24 @@ void datum_to_fv_converter::register_combination_rule(
     const std::string& name,
     jubatus::util::lang::shared_ptr<key_matcher> matcher_left,
     jubatus::util::lang::shared_ptr<key_matcher> matcher_right,
-    jubatus::util::lang::shared_ptr<combination_feature> feature_func) {
+    jubatus::util::lang::shared_ptr<combination_feature> feature_func,
+    size_t max_pairs) {
   pimpl_->register_combination_rule(
       name,
       matcher_left,
       matcher_right,
-      feature_func);
+      feature_func,
+      max_pairs);
 }
 
 void datum_to_fv_converter::add_weight(const std::string& key, double weight) {
   pimpl_->add_weight(key, weight);
 }
 
-void datum_to_fv_converter::set_hash_max_size(uint64_t hash_max_size) {
-  pimpl_->set_hash_max_size(hash_max_size);
+void datum_to_fv_converter::set_hash_max_size(
+    uint64_t hash_max_size,
+    feature_hash_version version) {
+  pimpl_->set_hash_max_size(hash_max_size, version);
 }
 
 void datum_to_fv_converter::set_weight_manager(
@@ -25,6 +25,7 @@
 #include "jubatus/util/lang/scoped_ptr.h"
 #include "../common/type.hpp"
 #include "../framework/mixable.hpp"
+#include "feature_hasher.hpp"
 
 namespace jubatus {
 namespace core {
@@ -77,6 +78,11 @@ class datum_to_fv_converter {
 
   void convert_and_update_weight(const datum& datum, common::sfv_t& ret_fv);
 
+  // Feature ID mode: same as above, but each feature key is replaced by
+  // a 64-bit feature ID, the FNV-1 hash of the key.
+  void convert(const datum& datum, common::sfvi_t& ret_fv) const;
+  void convert_and_update_weight(const datum& datum, common::sfvi_t& ret_fv);
+
   void clear_rules();
 
   void register_string_filter(
@@ -105,17 +111,25 @@ class datum_to_fv_converter {
       jubatus::util::lang::shared_ptr<key_matcher> matcher,
       jubatus::util::lang::shared_ptr<binary_feature> feature_func);
 
+  // At most max_pairs combined features are made by the rule for each
+  // datum; 0 means no limit.
   void register_combination_rule(
       const std::string& name,
       jubatus::util::lang::shared_ptr<key_matcher> matcher_left,
       jubatus::util::lang::shared_ptr<key_matcher> matcher_right,
-      jubatus::util::lang::shared_ptr<combination_feature> feature_func);
+      jubatus::util::lang::shared_ptr<combination_feature> feature_func,
+      size_t max_pairs = 0);
 
   void add_weight(const std::string& key, double weight);
 
-  void set_hash_max_size(uint64_t hash_max_size);
+  // Hashes feature keys into hash_max_size indices.  In feature ID mode,
+  // IDs are made from the indices without building decimal key strings.
+  void set_hash_max_size(
+      uint64_t hash_max_size,
+      feature_hash_version version = FEATURE_HASH_FNV1);
 
   void set_weight_manager(jubatus::util::lang::shared_ptr<weight_manager> wm);
+
   void clear_weights();
 
  private:
@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 #include "jubatus/util/lang/shared_ptr.h"
 #include "jubatus/util/text/json.h"
+#include "../common/hash.hpp"
 #include "binary_feature.hpp"
 #include "combination_feature_impl.hpp"
 #include "character_ngram.hpp"
@@ -393,6 +394,58 @@ TEST(datum_to_fv_converter, recursive_filter) {
   EXPECT_EQ("/age+5+2@str$27", feature[3].first);
 }
 
+TEST(datum_to_fv_converter, same_keys) {
+  datum_to_fv_converter conv;
+
+  std::vector<splitter_weight_type> p;
+  p.push_back(splitter_weight_type(FREQ_BINARY, TERM_BINARY));
+  p.push_back(splitter_weight_type(TERM_FREQUENCY, TERM_BINARY));
+  conv.register_string_rule("str",
+      shared_ptr<key_matcher>(new prefix_match("/a")),
+      shared_ptr<word_splitter>(new space_splitter()),
+      p);
+  conv.register_num_rule("num",
+      shared_ptr<key_matcher>(new prefix_match("/a")),
+      shared_ptr<num_feature>(new num_value_feature()));
+  conv.register_num_filter(
+      shared_ptr<key_matcher>(new exact_match("/age")),
+      shared_ptr<num_filter>(new add_filter(5)),
+      "+5");
+
+  for (int i = 0; i < 3; ++i) {
+    datum datum;
+    datum.string_values_.push_back(std::make_pair("/abc", "x y x"));
+    datum.string_values_.push_back(std::make_pair("/b", "x"));
+    datum.num_values_.push_back(std::make_pair("/age", i + 1));
+
+    std::vector<std::pair<std::string, double> > feature;
+    conv.convert(datum, feature);
+
+    std::vector<std::pair<std::string, double> > exp;
+    exp.push_back(std::make_pair("/abc$x@str#bin/bin", 1.));
+    exp.push_back(std::make_pair("/abc$y@str#bin/bin", 1.));
+    exp.push_back(std::make_pair("/abc$x@str#tf/bin", 2.));
+    exp.push_back(std::make_pair("/abc$y@str#tf/bin", 1.));
+    exp.push_back(std::make_pair("/age@num", i + 1));
+    exp.push_back(std::make_pair("/age+5@num", i + 6));
+
+    std::sort(feature.begin(), feature.end());
+    std::sort(exp.begin(), exp.end());
+    ASSERT_EQ(exp, feature);
+  }
+
+  conv.clear_rules();
+  {
+    datum datum;
+    datum.string_values_.push_back(std::make_pair("/abc", "x y x"));
+    datum.num_values_.push_back(std::make_pair("/age", 1));
+
+    std::vector<std::pair<std::string, double> > feature;
+    conv.convert(datum, feature);
+    EXPECT_TRUE(feature.empty());
+  }
+}
+
 TEST(datum_to_fv_converter, hasher) {
   datum_to_fv_converter conv;
   conv.set_hash_max_size(1);
@@ -410,6 +463,65 @@ TEST(datum_to_fv_converter, hasher) {
   EXPECT_EQ("0", feature[i].first);
 }
 
+TEST(datum_to_fv_converter, feature_id) {
+  datum_to_fv_converter conv;
+  conv.register_num_rule("num",
+      shared_ptr<key_matcher>(new match_all()),
+      shared_ptr<num_feature>(new num_value_feature()));
+  datum d;
+  d.num_values_.push_back(std::make_pair("age", 10));
+  d.num_values_.push_back(std::make_pair("height", 170));
+
+  common::sfv_t expected;
+  conv.convert(d, expected);
+
+  common::sfvi_t ids;
+  conv.convert(d, ids);
+  ASSERT_EQ(expected.size(), ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(common::hash_util::calc_string_hash(expected[i].first),
+              ids[i].first);
+    EXPECT_EQ(expected[i].second, ids[i].second);
+  }
+
+  common::sfvi_t updated;
+  conv.convert_and_update_weight(d, updated);
+  EXPECT_EQ(ids, updated);
+}
+
+TEST(datum_to_fv_converter, hashed_feature_id) {
+  datum_to_fv_converter conv;
+  conv.register_num_rule("num",
+      shared_ptr<key_matcher>(new match_all()),
+      shared_ptr<num_feature>(new num_value_feature()));
+  conv.set_hash_max_size(100);
+  datum d;
+  d.num_values_.push_back(std::make_pair("age", 10));
+  d.num_values_.push_back(std::make_pair("height", 170));
+
+  common::sfv_t expected;
+  conv.convert(d, expected);
+
+  // same IDs as hashed from the decimal keys of the indices
+  common::sfvi_t ids;
+  conv.convert(d, ids);
+  ASSERT_EQ(expected.size(), ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(common::hash_util::calc_string_hash(expected[i].first),
+              ids[i].first);
+    EXPECT_EQ(expected[i].second, ids[i].second);
+  }
+
+  conv.set_hash_max_size(100, FEATURE_HASH_XXH64);
+  conv.convert(d, expected);
+  conv.convert(d, ids);
+  ASSERT_EQ(expected.size(), ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(lexical_cast<std::string>(ids[i].first), expected[i].first);
+    EXPECT_EQ(expected[i].second, ids[i].second);
+  }
+}
+
 TEST(datum_to_fv_converter, check_datum_key_in_string) {
   datum_to_fv_converter conv;
 
@@ -550,6 +662,51 @@ TEST(datum_to_fv_converter, combination_feature_num_non_commutative) {
   ASSERT_EQ(expected, feature);
 }
 
+TEST(datum_to_fv_converter, combination_feature_max_pairs) {
+  datum d;
+  d.num_values_.push_back(std::make_pair("a1", 1.0));
+  d.num_values_.push_back(std::make_pair("b1", 2.0));
+  d.num_values_.push_back(std::make_pair("a2", 3.0));
+  d.num_values_.push_back(std::make_pair("b2", 4.0));
+
+  datum_to_fv_converter conv;
+  typedef shared_ptr<combination_feature> combination_feature_t;
+  typedef shared_ptr<num_feature> num_feature_t;
+
+  conv.register_num_rule(
+      "num",
+      shared_ptr<key_matcher>(new match_all()),
+      num_feature_t(new num_value_feature()));
+  conv.register_combination_rule(
+      "add",
+      shared_ptr<key_matcher>(new prefix_match("a")),
+      shared_ptr<key_matcher>(new prefix_match("b")),
+      combination_feature_t(new combination_add_feature()));
+  conv.register_combination_rule(
+      "div",
+      shared_ptr<key_matcher>(new prefix_match("a")),
+      shared_ptr<key_matcher>(new prefix_match("b")),
+      combination_feature_t(new combination_div_feature()),
+      3);
+  std::vector<std::pair<std::string, double> > feature;
+  conv.convert(d, feature);
+
+  std::vector<std::pair<std::string, double> > expected;
+  expected.push_back(std::make_pair("a1@num", 1.0));
+  expected.push_back(std::make_pair("b1@num", 2.0));
+  expected.push_back(std::make_pair("a2@num", 3.0));
+  expected.push_back(std::make_pair("b2@num", 4.0));
+  expected.push_back(std::make_pair("a1@num&b1@num/add", 3.0));
+  expected.push_back(std::make_pair("a1@num&b2@num/add", 5.0));
+  expected.push_back(std::make_pair("b1@num&a2@num/add", 5.0));
+  expected.push_back(std::make_pair("a2@num&b2@num/add", 7.0));
+  expected.push_back(std::make_pair("a1@num&b1@num/div", 0.5));
+  expected.push_back(std::make_pair("a1@num&b2@num/div", 0.25));
+  expected.push_back(std::make_pair("a2@num&b1@num/div", 1.5));
+
+  ASSERT_EQ(expected, feature);
+}
+
 TEST(datum_to_fv_converter, combination_feature_string) {
   datum datum;
   datum.string_values_.push_back(std::make_pair("name", "abc xyz"));
@@ -27,21 +27,45 @@ namespace jubatus {
 namespace core {
 namespace fv_converter {
 
-feature_hasher::feature_hasher(uint64_t max)
-    : max_size_(max) {
+feature_hasher::feature_hasher(uint64_t max, feature_hash_version version)
+    : max_size_(max),
+      version_(version) {
   if (max == 0) {
     throw JUBATUS_EXCEPTION(
         converter_exception("feature max size must be positive"));
   }
+  if (version != FEATURE_HASH_FNV1 && version != FEATURE_HASH_XXH64) {
+    throw JUBATUS_EXCEPTION(
+        converter_exception("unknown feature hash version"));
+  }
+}
+
+uint64_t feature_hasher::hash_index(const std::string& key) const {
+  if (version_ == FEATURE_HASH_XXH64) {
+    return common::hash_util::calc_fast_hash(key) % max_size_;
+  }
+  return common::hash_util::calc_string_hash(key) % max_size_;
 }
 
 void feature_hasher::hash_feature_keys(common::sfv_t& fv) const {
   for (size_t i = 0, size = fv.size(); i < size; ++i) {
-    uint64_t id = common::hash_util::calc_string_hash(fv[i].first) % max_size_;
+    uint64_t id = hash_index(fv[i].first);
     fv[i].first = jubatus::util::lang::lexical_cast<std::string>(id);
   }
 }
 
+void feature_hasher::hash_feature_ids(
+    const common::sfv_t& fv,
+    common::sfvi_t& ret) const {
+  ret.resize(fv.size());
+  for (size_t i = 0, size = fv.size(); i < size; ++i) {
+    const uint64_t index = hash_index(fv[i].first);
+    ret[i].first = version_ == FEATURE_HASH_XXH64 ?
+        index : common::hash_util::calc_decimal_hash(index);
+    ret[i].second = fv[i].second;
+  }
+}
+
 }  // namespace fv_converter
 }  // namespace core
 }  // namespace jubatus
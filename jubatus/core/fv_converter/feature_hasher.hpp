@@ -18,20 +18,43 @@
 #define JUBATUS_CORE_FV_CONVERTER_FEATURE_HASHER_HPP_
 
 #include <stdint.h>
+#include <string>
 #include "../common/type.hpp"
 
 namespace jubatus {
 namespace core {
 namespace fv_converter {
 
+enum feature_hash_version {
+  // FNV-1; compatible with models made by older versions
+  FEATURE_HASH_FNV1 = 1,
+  // xxHash (XXH64); feature IDs are the hashed indices themselves
+  FEATURE_HASH_XXH64 = 2
+};
+
 class feature_hasher {
  public:
-  explicit feature_hasher(uint64_t max);
+  explicit feature_hasher(
+      uint64_t max,
+      feature_hash_version version = FEATURE_HASH_FNV1);
 
+  // Replaces keys with the decimal string of hashed indices.
   void hash_feature_keys(common::sfv_t& fv) const;
 
+  // Makes feature IDs of hashed indices without building decimal strings.
+  // With FEATURE_HASH_FNV1, the IDs are the same as those interned from
+  // the keys made by hash_feature_keys.
+  void hash_feature_ids(const common::sfv_t& fv, common::sfvi_t& ret) const;
+
+  feature_hash_version get_version() const {
+    return version_;
+  }
+
  private:
+  uint64_t hash_index(const std::string& key) const;
+
   uint64_t max_size_;
+  feature_hash_version version_;
 };
 
 }  // namespace fv_converter
@@ -14,8 +14,11 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <string>
 #include <gtest/gtest.h>
 
+#include "jubatus/util/lang/cast.h"
+#include "../common/hash.hpp"
 #include "feature_hasher.hpp"
 #include "exception.hpp"
 
@@ -42,6 +45,67 @@ TEST(feature_hasher, zero) {
   EXPECT_THROW(feature_hasher(0), converter_exception);
 }
 
+TEST(feature_hasher, unknown_version) {
+  EXPECT_THROW(feature_hasher(100, static_cast<feature_hash_version>(3)),
+               converter_exception);
+}
+
+TEST(feature_hasher, fast_hash) {
+  // test vectors of XXH64
+  EXPECT_EQ(0xef46db3751d8e999LLU, common::hash_util::calc_fast_hash(""));
+  EXPECT_EQ(0x44bc2cf5ad770999LLU, common::hash_util::calc_fast_hash("abc"));
+}
+
+TEST(feature_hasher, decimal_hash) {
+  const uint64_t values[] = { 0, 9, 10, 12345, 18446744073709551615LLU };
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    EXPECT_EQ(
+        common::hash_util::calc_string_hash(
+            jubatus::util::lang::lexical_cast<std::string>(values[i])),
+        common::hash_util::calc_decimal_hash(values[i]));
+  }
+}
+
+TEST(feature_hasher, feature_ids) {
+  common::sfv_t fv;
+  fv.push_back(std::make_pair("f1", 1.0));
+  fv.push_back(std::make_pair("f2", 2.0));
+  fv.push_back(std::make_pair(std::string(100, 'f'), 3.0));
+
+  {
+    // IDs of FNV-1 are compatible with the hashed keys
+    feature_hasher h(1000);
+    common::sfvi_t ids;
+    h.hash_feature_ids(fv, ids);
+
+    common::sfv_t keys = fv;
+    h.hash_feature_keys(keys);
+    ASSERT_EQ(3u, ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+      EXPECT_EQ(common::hash_util::calc_string_hash(keys[i].first),
+                ids[i].first);
+      EXPECT_EQ(fv[i].second, ids[i].second);
+    }
+  }
+
+  {
+    // IDs of XXH64 are the hashed indices
+    feature_hasher h(1000, FEATURE_HASH_XXH64);
+    common::sfvi_t ids;
+    h.hash_feature_ids(fv, ids);
+
+    common::sfv_t keys = fv;
+    h.hash_feature_keys(keys);
+    ASSERT_EQ(3u, ids.size());
+    for (size_t i = 0; i < ids.size(); ++i) {
+      EXPECT_GT(1000u, ids[i].first);
+      EXPECT_EQ(jubatus::util::lang::lexical_cast<std::string>(ids[i].first),
+                keys[i].first);
+      EXPECT_EQ(fv[i].second, ids[i].second);
+    }
+  }
+}
+
 }  // namespace fv_converter
 }  // namespace core
 }  // namespace jubatus
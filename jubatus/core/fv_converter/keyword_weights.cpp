@@ -94,6 +94,17 @@ void keyword_weights::merge(const keyword_weights& w) {
   weights_.swap(weights);
 }
 
+void keyword_weights::add_counts(const keyword_weights& w, int sign) {
+  if (sign < 0) {
+    document_count_ -= w.document_count_;
+  } else {
+    document_count_ += w.document_count_;
+  }
+  document_frequencies_.add(w.document_frequencies_, sign);
+  group_frequencies_.add(w.group_frequencies_, sign);
+  group_total_lengths_.add(w.group_total_lengths_, sign);
+}
+
 void keyword_weights::clear() {
   document_count_ = 0;
   document_frequencies_.clear();
@@ -60,6 +60,12 @@ class keyword_weights {
 
   void merge(const keyword_weights& w);
 
+  /**
+   * Adds (``sign`` = 1) or subtracts (``sign`` = -1) the document counts
+   * of ``w``.  Unlike merge, user weights are left unchanged.
+   */
+  void add_counts(const keyword_weights& w, int sign);
+
   void clear();
 
   MSGPACK_DEFINE(
@@ -16,6 +16,7 @@
 
 #include "weight_manager.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <string>
 #include <utility>
@@ -23,9 +24,11 @@
 #include "../common/type.hpp"
 #include "datum_to_fv_converter.hpp"
 #include "jubatus/util/concurrent/lock.h"
+#include "jubatus/util/concurrent/thread.h"
 #include "key_name_utils.hpp"
 
-using jubatus::util::concurrent::scoped_lock;
+using jubatus::util::concurrent::scoped_rlock;
+using jubatus::util::concurrent::scoped_wlock;
 
 namespace jubatus {
 namespace core {
@@ -65,23 +68,72 @@ versioned_weight_diff::merge(const versioned_weight_diff& target) {
   return *this;
 }
 
+const size_t weight_manager::PENDING_TABLE_NUM;
+const uint64_t weight_manager::PENDING_DOCUMENT_LIMIT;
+
 weight_manager::weight_manager()
     : diff_weights_(),
-      master_weights_() {
+      weights_(),
+      pending_in_use_(0) {
+}
+
+/**
+ * Returns the pending table of the calling thread.  Thread IDs are
+ * mostly consecutive, so up to PENDING_TABLE_NUM threads usually update
+ * distinct tables; threads sharing a table are still correct, as every
+ * table has its own lock.
+ */
+size_t weight_manager::pending_slot() const {
+  return static_cast<size_t>(jubatus::util::concurrent::thread::id()) %
+      PENDING_TABLE_NUM;
 }
 
 void weight_manager::update_weight(
     const common::sfv_t& fv,
     bool contains_idf,
     bool contains_bm25) {
-  scoped_lock lk(mutex_);
-  if (contains_idf || contains_bm25) {
-    diff_weights_.update_document_frequency(fv, contains_bm25);
+  if (!(contains_idf || contains_bm25)) {
+    return;
+  }
+  const size_t slot = pending_slot();
+  pending_weights& pending = pending_[slot];
+  bool counted = false;
+  bool full = false;
+  {
+    scoped_rlock lk(mutex_);
+    if (slot < pending_in_use_) {
+      full = count_pending(pending, fv, contains_bm25);
+      counted = true;
+    }
+  }
+  if (!counted) {
+    // first update from this slot; readers start looking at it
+    scoped_wlock lk(mutex_);
+    pending_in_use_ = std::max(pending_in_use_, slot + 1);
+    full = count_pending(pending, fv, contains_bm25);
+  }
+  if (full) {
+    scoped_wlock lk(mutex_);
+    flush_pending(pending);
   }
 }
 
+/**
+ * Count ``fv`` in the pending table; callers must hold the lock of the
+ * weight manager.  Returns true when the table should be flushed.
+ */
+bool weight_manager::count_pending(
+    pending_weights& pending,
+    const common::sfv_t& fv,
+    bool contains_bm25) {
+  scoped_wlock lk(pending.mutex);
+  pending.weights.update_document_frequency(fv, contains_bm25);
+  return pending.weights.get_document_count() >= PENDING_DOCUMENT_LIMIT;
+}
+
 void weight_manager::get_weight(common::sfv_t& fv) const {
-  scoped_lock lk(mutex_);
+  scoped_rlock lk(mutex_);
+  pending_lock pending_lk(*this);
   counter<std::string> group_lengths;
   for (common::sfv_t::iterator it = fv.begin(); it != fv.end(); ++it) {
     double weight = it->second;
@@ -162,18 +214,71 @@ double weight_manager::get_global_weight_user(
 }
 
 void weight_manager::add_weight(const std::string& key, double weight) {
-  scoped_lock lk(mutex_);
+  scoped_wlock lk(mutex_);
   diff_weights_.add_weight(key, weight);
 }
 
 void weight_manager::get_status(
     std::map<std::string, std::string>& status) const {
-  scoped_lock lk(mutex_);
+  scoped_rlock lk(mutex_);
+  keyword_weights diff_weights(diff_weights_);
+  merge_pending(diff_weights);
   status["weight_manager_version"] =
     jubatus::util::lang::lexical_cast<std::string>(
         version_.get_number());
-  diff_weights_.get_status(status, "diff");
-  master_weights_.get_status(status, "master");
+  diff_weights.get_status(status, "diff");
+  get_master_weights().get_status(status, "master");
+}
+
+weight_manager::pending_lock::pending_lock(const weight_manager& m)
+    : m_(m) {
+  for (size_t i = 0; i < m_.pending_in_use_; ++i) {
+    m_.pending_[i].mutex.read_lock();
+  }
+}
+
+weight_manager::pending_lock::~pending_lock() {
+  for (size_t i = m_.pending_in_use_; i > 0; --i) {
+    m_.pending_[i - 1].mutex.unlock();
+  }
+}
+
+/**
+ * Add counts of pending tables to ``weights``.
+ */
+void weight_manager::merge_pending(keyword_weights& weights) const {
+  for (size_t i = 0; i < pending_in_use_; ++i) {
+    scoped_rlock lk(pending_[i].mutex);
+    weights.merge(pending_[i].weights);
+  }
+}
+
+/**
+ * Move counts of the pending table to the diff table; callers must hold
+ * the write lock of the weight manager.
+ */
+void weight_manager::flush_pending(pending_weights& pending) {
+  scoped_wlock lk(pending.mutex);
+  diff_weights_.merge(pending.weights);
+  weights_.add_counts(pending.weights, 1);
+  pending.weights.clear();
+}
+
+void weight_manager::clear_pending() {
+  for (size_t i = 0; i < pending_in_use_; ++i) {
+    scoped_wlock lk(pending_[i].mutex);
+    pending_[i].weights.clear();
+  }
+}
+
+/**
+ * Returns the master table, which is weights_ without the counts of the
+ * diff table; callers must hold the lock of the weight manager.
+ */
+keyword_weights weight_manager::get_master_weights() const {
+  keyword_weights master(weights_);
+  master.add_counts(diff_weights_, -1);
+  return master;
 }
 
 }  // namespace fv_converter
@@ -24,8 +24,9 @@
 #include <map>
 #include <msgpack.hpp>
 #include "jubatus/util/data/unordered_map.h"
-#include "jubatus/util/concurrent/mutex.h"
 #include "jubatus/util/concurrent/lock.h"
+#include "jubatus/util/concurrent/mutex.h"
+#include "jubatus/util/concurrent/rwmutex.h"
 #include "../framework/model.hpp"
 #include "../common/type.hpp"
 #include "../common/version.hpp"
@@ -51,8 +52,23 @@ struct versioned_weight_diff {
   storage::version version_;
 };
 
+/**
+ * Document frequencies are first counted in one of the pending tables, so
+ * that training threads do not serialize on a single lock.  Threads are
+ * mapped to pending tables by their thread IDs.  Pending counts are
+ * added on the fly when weights are calculated, and are merged into the
+ * diff table once a pending table has seen PENDING_DOCUMENT_LIMIT
+ * documents.
+ *
+ * Counts of the master and diff tables are kept summed up in weights_, so
+ * that calculating a weight looks up one table besides the pending tables
+ * in use.
+ */
 class weight_manager : public framework::model {
  public:
+  static const size_t PENDING_TABLE_NUM = 8;
+  static const uint64_t PENDING_DOCUMENT_LIMIT = 256;
+
   weight_manager();
 
   void update_weight(
@@ -64,15 +80,20 @@ class weight_manager : public framework::model {
   void add_weight(const std::string& key, double weight);
 
   void get_diff(versioned_weight_diff& diff) const {
-    util::concurrent::scoped_lock lk(mutex_);
-    diff = versioned_weight_diff(diff_weights_, version_);
+    util::concurrent::scoped_rlock lk(mutex_);
+    keyword_weights weights(diff_weights_);
+    merge_pending(weights);
+    diff = versioned_weight_diff(weights, version_);
   }
 
   bool put_diff(const versioned_weight_diff& diff) {
-    util::concurrent::scoped_lock lk(mutex_);
+    util::concurrent::scoped_wlock lk(mutex_);
     if (diff.version_ == version_) {
-      master_weights_.merge(diff.weights_);
+      // weights_ becomes the new master table
+      weights_.add_counts(diff_weights_, -1);
+      weights_.merge(diff.weights_);
       diff_weights_.clear();
+      clear_pending();
       version_.increment();
       return true;
     } else {
@@ -91,63 +112,126 @@ class weight_manager : public framework::model {
   }
 
   void clear() {
-    util::concurrent::scoped_lock lk(mutex_);
+    util::concurrent::scoped_wlock lk(mutex_);
     diff_weights_.clear();
-    master_weights_.clear();
+    weights_.clear();
+    clear_pending();
   }
 
   storage::version get_version() const {
     return version_;
   }
 
-  MSGPACK_DEFINE(version_, diff_weights_, master_weights_);
+  template <class Packer>
+  void msgpack_pack(Packer& packer) const {
+    // pending tables are packed as a part of the diff table
+    keyword_weights diff_weights(diff_weights_);
+    merge_pending(diff_weights);
+    packer.pack_array(3);
+    packer.pack(version_);
+    packer.pack(diff_weights);
+    packer.pack(get_master_weights());
+  }
+
+  void msgpack_unpack(msgpack::object o) {
+    if (o.type != msgpack::type::ARRAY || o.via.array.size != 3) {
+      throw msgpack::type_error();
+    }
+    o.via.array.ptr[0].convert(&version_);
+    o.via.array.ptr[1].convert(&diff_weights_);
+    o.via.array.ptr[2].convert(&weights_);
+    weights_.add_counts(diff_weights_, 1);
+    clear_pending();
+  }
 
   void pack(framework::packer& pk) const {
-    util::concurrent::scoped_lock lk(mutex_);
+    util::concurrent::scoped_rlock lk(mutex_);
     pk.pack(*this);
   }
 
   void unpack(msgpack::object o) {
-    util::concurrent::scoped_lock lk(mutex_);
+    util::concurrent::scoped_wlock lk(mutex_);
     o.convert(this);
   }
 
   std::string to_string() const {
-    util::concurrent::scoped_lock lk(mutex_);
+    util::concurrent::scoped_rlock lk(mutex_);
+    keyword_weights diff_weights(diff_weights_);
+    merge_pending(diff_weights);
     std::stringstream ss;
     ss << "version:" << version_
-       << " diff_weights:" << diff_weights_.to_string()
-       << " master_weights:" << master_weights_.to_string();
+       << " diff_weights:" << diff_weights.to_string()
+       << " master_weights:" << get_master_weights().to_string();
     return ss.str();
   }
 
   void get_status(std::map<std::string, std::string>& status) const;
 
  private:
+  struct pending_weights {
+    mutable util::concurrent::rw_mutex mutex;
+    keyword_weights weights;
+  };
+
+  // holds read locks of the pending tables in use
+  class pending_lock {
+   public:
+    explicit pending_lock(const weight_manager& m);
+    ~pending_lock();
+
+   private:
+    const weight_manager& m_;
+  };
+
+  size_t pending_slot() const;
+  bool count_pending(
+      pending_weights& pending,
+      const common::sfv_t& fv,
+      bool contains_bm25);
+  void merge_pending(keyword_weights& weights) const;
+  void flush_pending(pending_weights& pending);
+  void clear_pending();
+  keyword_weights get_master_weights() const;
+
+  // NOTE: callers must hold the read lock of pending tables.
   uint64_t get_document_count() const {
-    return diff_weights_.get_document_count() +
-        master_weights_.get_document_count();
+    uint64_t count = weights_.get_document_count();
+    for (size_t i = 0; i < pending_in_use_; ++i) {
+      count += pending_[i].weights.get_document_count();
+    }
+    return count;
   }
 
   size_t get_document_frequency(const std::string& key) const {
-    return diff_weights_.get_document_frequency(key) +
-        master_weights_.get_document_frequency(key);
+    size_t freq = weights_.get_document_frequency(key);
+    for (size_t i = 0; i < pending_in_use_; ++i) {
+      if (pending_[i].weights.get_document_count() > 0) {
+        freq += pending_[i].weights.get_document_frequency(key);
+      }
+    }
+    return freq;
   }
 
   double get_user_weight(const std::string& key) const {
+    // user weights of weights_ are those of the master table
     return diff_weights_.get_user_weight(key) +
-        master_weights_.get_user_weight(key);
+        weights_.get_user_weight(key);
   }
 
   double get_average_group_length(const std::string& group_key) const {
-    double freq = diff_weights_.get_group_frequency(group_key) +
-                  master_weights_.get_group_frequency(group_key);
+    double freq = weights_.get_group_frequency(group_key);
+    double length = weights_.get_group_total_length(group_key);
+    for (size_t i = 0; i < pending_in_use_; ++i) {
+      if (pending_[i].weights.get_document_count() > 0) {
+        freq += pending_[i].weights.get_group_frequency(group_key);
+        length += pending_[i].weights.get_group_total_length(group_key);
+      }
+    }
     if (freq == 0) {
       return 0;
     }
 
-    return (diff_weights_.get_group_total_length(group_key) +
-            master_weights_.get_group_total_length(group_key)) / freq;
+    return length / freq;
   }
 
   double get_global_weight_idf(
@@ -164,10 +248,14 @@ class weight_manager : public framework::model {
       const std::string& key,
       double sample_weight) const;
 
-  mutable util::concurrent::mutex mutex_;
+  mutable util::concurrent::rw_mutex mutex_;
   storage::version version_;
   keyword_weights diff_weights_;
-  keyword_weights master_weights_;
+  // counts of the master and diff tables, and user weights of the master
+  keyword_weights weights_;
+  pending_weights pending_[PENDING_TABLE_NUM];
+  // pending tables at or after this index have never been used
+  size_t pending_in_use_;
 };
 
 }  // namespace fv_converter
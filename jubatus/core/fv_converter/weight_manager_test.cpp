@@ -16,8 +16,15 @@
 
 #include <iostream>
 #include <cmath>
+#include <map>
+#include <string>
 #include <utility>
+#include <vector>
 #include <gtest/gtest.h>
+#include "jubatus/util/concurrent/thread.h"
+#include "jubatus/util/lang/bind.h"
+#include "jubatus/util/lang/cast.h"
+#include "jubatus/util/lang/shared_ptr.h"
 #include "../common/type.hpp"
 #include "weight_manager.hpp"
 
@@ -25,6 +32,8 @@ namespace jubatus {
 namespace core {
 namespace fv_converter {
 
+using jubatus::util::concurrent::thread;
+
 TEST(weight_manager, trivial) {
   weight_manager m;
 
@@ -108,6 +117,85 @@ TEST(weight_manager, trivial) {
   }
 }
 
+TEST(weight_manager, status_after_flush) {
+  weight_manager m;
+  common::sfv_t fv;
+  fv.push_back(std::make_pair("/title$this@space#bin/idf", 1.0));
+  for (uint64_t i = 0; i < weight_manager::PENDING_DOCUMENT_LIMIT + 1; ++i) {
+    m.update_weight(fv, true, false);
+  }
+
+  std::map<std::string, std::string> status;
+  m.get_status(status);
+  EXPECT_EQ("257", status["diff_document_count"]);
+  EXPECT_EQ("0", status["master_document_count"]);
+
+  versioned_weight_diff w;
+  m.get_diff(w);
+  ASSERT_TRUE(m.put_diff(w));
+  m.update_weight(fv, true, false);
+  m.get_status(status);
+  EXPECT_EQ("1", status["diff_document_count"]);
+  EXPECT_EQ("257", status["master_document_count"]);
+
+  common::sfv_t fv2;
+  fv2.push_back(std::make_pair("/title$that@space#bin/idf", 1.0));
+  m.get_weight(fv2);
+  ASSERT_EQ(1u, fv2.size());
+  EXPECT_DOUBLE_EQ(std::log((258.0 + 1) / (0.0 + 1)), fv2[0].second);
+}
+
+namespace {
+
+void update_weights(weight_manager* m, int offset, int num) {
+  for (int i = offset; i < offset + num; ++i) {
+    common::sfv_t fv;
+    fv.push_back(std::make_pair(
+        "/title$" + jubatus::util::lang::lexical_cast<std::string>(i % 7) +
+        "@space#bin/idf", 1.0));
+    fv.push_back(std::make_pair(
+        "/body$" + jubatus::util::lang::lexical_cast<std::string>(i % 3) +
+        "@space#tf/bm25", 1.0 + i % 5));
+    m->update_weight(fv, true, true);
+  }
+}
+
+}  // namespace
+
+TEST(weight_manager, concurrent_update) {
+  const int thread_num = 4;
+  const int doc_num = 1000;  // per thread; exceeds PENDING_DOCUMENT_LIMIT
+
+  weight_manager expected;
+  update_weights(&expected, 0, thread_num * doc_num);
+
+  weight_manager m;
+  std::vector<jubatus::util::lang::shared_ptr<thread> > threads;
+  for (int i = 0; i < thread_num; ++i) {
+    threads.push_back(jubatus::util::lang::shared_ptr<thread>(new thread(
+        jubatus::util::lang::bind(&update_weights, &m, i * doc_num, doc_num))));
+    threads.back()->start();
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i]->join();
+  }
+
+  versioned_weight_diff w;
+  m.get_diff(w);
+  EXPECT_EQ(4000u, w.weights_.get_document_count());
+  EXPECT_EQ(572u, w.weights_.get_document_frequency("/title$0@space#bin/idf"));
+
+  common::sfv_t fv, expected_fv;
+  fv.push_back(std::make_pair("/title$3@space#bin/idf", 1.0));
+  fv.push_back(std::make_pair("/body$1@space#tf/bm25", 2.0));
+  expected_fv = fv;
+  m.get_weight(fv);
+  expected.get_weight(expected_fv);
+  ASSERT_EQ(2u, fv.size());
+  EXPECT_EQ(expected_fv[0].second, fv[0].second);
+  EXPECT_DOUBLE_EQ(expected_fv[1].second, fv[1].second);
+}
+
 }  // namespace fv_converter
 }  // namespace core
 }  // namespace jubatus
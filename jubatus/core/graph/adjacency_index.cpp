@@ -0,0 +1,673 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include "adjacency_index.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <utility>
+#include <vector>
+
+#include "jubatus/util/data/unordered_set.h"
+#include "jubatus/util/lang/bind.h"
+
+#include "../common/thread_pool.hpp"
+
+using std::vector;
+using jubatus::util::concurrent::mutex;
+using jubatus::util::concurrent::scoped_lock;
+
+namespace jubatus {
+namespace core {
+namespace graph {
+
+namespace {
+
+bool is_matched_to_query(
+    const vector<std::pair<std::string, std::string> >& query,
+    const property& prop) {
+  for (size_t i = 0; i < query.size(); ++i) {
+    property::const_iterator it = prop.find(query[i].first);
+    if (it == prop.end() || it->second != query[i].second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// same as graph_wo_index::remove_by_swap to keep the order of edges
+void remove_by_swap(vector<uint32_t>& edges, uint32_t slot) {
+  for (size_t i = 0; i < edges.size(); ++i) {
+    if (edges[i] == slot) {
+      if (i + 1 < edges.size()) {
+        std::swap(edges[i], edges.back());
+      }
+      edges.resize(edges.size() - 1);
+      return;
+    }
+  }
+}
+
+const uint32_t NOT_VISITED = ~uint32_t();
+
+int64_t find_distance(const spt_edges& se, node_id_t id) {
+  spt_edges::const_iterator it = se.find(id);
+  return it == se.end() ? -1 : static_cast<int64_t>(it->second.first);
+}
+
+/**
+ * Lower bound of the distance between a node and the end point of a search,
+ * derived from the distances to / from the landmarks by the triangle
+ * inequality.  Trees of the landmarks are not always exact, so the bound is
+ * a heuristic one.
+ */
+class landmark_bound {
+ public:
+  // ``forward`` is true when the bound is for the distance from a node to
+  // ``end``, false for the distance from ``end`` to a node.
+  landmark_bound(const spt_diff& landmarks, node_id_t end, bool forward)
+      : landmarks_(&landmarks),
+        forward_(forward) {
+    for (size_t i = 0; i < landmarks.size(); ++i) {
+      root_to_end_.push_back(find_distance(landmarks[i].from_root, end));
+      end_to_root_.push_back(find_distance(landmarks[i].to_root, end));
+    }
+  }
+
+  uint64_t operator()(node_id_t id) const {
+    int64_t bound = 0;
+    for (size_t i = 0; i < landmarks_->size(); ++i) {
+      const shortest_path_tree& spt = (*landmarks_)[i];
+      if (spt.landmark == LLONG_MAX) {
+        continue;
+      }
+      const int64_t root_to_node = find_distance(spt.from_root, id);
+      const int64_t node_to_root = find_distance(spt.to_root, id);
+      if (root_to_end_[i] >= 0 && root_to_node >= 0) {
+        const int64_t d = root_to_end_[i] - root_to_node;
+        bound = std::max(bound, forward_ ? d : -d);
+      }
+      if (end_to_root_[i] >= 0 && node_to_root >= 0) {
+        const int64_t d = node_to_root - end_to_root_[i];
+        bound = std::max(bound, forward_ ? d : -d);
+      }
+    }
+    return bound;
+  }
+
+ private:
+  const spt_diff* landmarks_;
+  bool forward_;
+  vector<int64_t> root_to_end_;
+  vector<int64_t> end_to_root_;
+};
+
+}  // namespace
+
+struct adjacency_index::bfs_side {
+  bfs_side(size_t node_num, uint32_t start, const landmark_bound& b)
+      : dist(node_num, NOT_VISITED),
+        parent(node_num, NOT_VISITED),
+        depth(0),
+        bound(b) {
+    dist[start] = 0;
+    frontier.push_back(start);
+  }
+
+  vector<uint32_t> dist;
+  vector<uint32_t> parent;
+  vector<uint32_t> frontier;
+  uint64_t depth;
+  landmark_bound bound;
+};
+
+adjacency_index::adjacency_index()
+    : dirty_(true),
+      snapshot_mutex_(new mutex) {
+}
+
+void adjacency_index::clear() {
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>().swap(node_slots_);
+  vector<node_id_t>().swap(node_ids_);
+  vector<uint32_t>().swap(node_refs_);
+  vector<uint8_t>().swap(node_local_);
+  vector<vector<uint32_t> >().swap(in_edges_);
+  vector<vector<uint32_t> >().swap(out_edges_);
+  vector<uint32_t>().swap(free_nodes_);
+
+  jubatus::util::data::unordered_map<edge_id_t, uint32_t>().swap(edge_slots_);
+  vector<uint32_t>().swap(edge_src_);
+  vector<uint32_t>().swap(edge_tgt_);
+  vector<uint8_t>().swap(edge_live_);
+  vector<uint32_t>().swap(free_edges_);
+
+  query_flags_map().swap(queries_);
+  dirty_ = true;
+}
+
+/**
+ * Rebuild the index from the tables of graph_wo_index.  Queries are removed.
+ */
+void adjacency_index::rebuild(
+    const node_info_map& nodes,
+    const edge_info_map& edges) {
+  clear();
+  for (node_info_map::const_iterator it = nodes.begin();
+       it != nodes.end(); ++it) {
+    create_node(it->first, it->second.property);
+  }
+  for (edge_info_map::const_iterator it = edges.begin();
+       it != edges.end(); ++it) {
+    // in / out edges are filled below in the order of node_info
+    create_edge(it->first, it->second.src, it->second.tgt, false, false);
+  }
+  for (node_info_map::const_iterator it = nodes.begin();
+       it != nodes.end(); ++it) {
+    const uint32_t slot = node_slots_[it->first];
+    for (size_t i = 0; i < it->second.in_edges.size(); ++i) {
+      jubatus::util::data::unordered_map<edge_id_t, uint32_t>::const_iterator
+          e = edge_slots_.find(it->second.in_edges[i]);
+      if (e != edge_slots_.end()) {
+        in_edges_[slot].push_back(e->second);
+      }
+    }
+    for (size_t i = 0; i < it->second.out_edges.size(); ++i) {
+      jubatus::util::data::unordered_map<edge_id_t, uint32_t>::const_iterator
+          e = edge_slots_.find(it->second.out_edges[i]);
+      if (e != edge_slots_.end()) {
+        out_edges_[slot].push_back(e->second);
+      }
+    }
+  }
+}
+
+void adjacency_index::create_node(node_id_t id, const property& p) {
+  const uint32_t slot = acquire_node(id);
+  node_local_[slot] = 1;
+  set_node_flags(slot, p);
+  dirty_ = true;
+}
+
+void adjacency_index::update_node(node_id_t id, const property& p) {
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator it =
+      node_slots_.find(id);
+  if (it != node_slots_.end()) {
+    set_node_flags(it->second, p);
+  }
+}
+
+void adjacency_index::remove_node(node_id_t id) {
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator it =
+      node_slots_.find(id);
+  if (it == node_slots_.end()) {
+    return;
+  }
+  const uint32_t slot = it->second;
+  node_local_[slot] = 0;
+  for (query_flags_map::iterator q = queries_.begin();
+       q != queries_.end(); ++q) {
+    q->second.node_unmatched[slot] = 0;
+  }
+  release_node(slot);
+  dirty_ = true;
+}
+
+void adjacency_index::create_edge(
+    edge_id_t eid,
+    node_id_t src,
+    node_id_t tgt,
+    bool src_local,
+    bool tgt_local) {
+  uint32_t slot;
+  if (free_edges_.empty()) {
+    slot = edge_src_.size();
+    edge_src_.push_back(0);
+    edge_tgt_.push_back(0);
+    edge_live_.push_back(0);
+    for (query_flags_map::iterator q = queries_.begin();
+         q != queries_.end(); ++q) {
+      resize_flags(q->second);
+    }
+  } else {
+    slot = free_edges_.back();
+    free_edges_.pop_back();
+  }
+  edge_slots_[eid] = slot;
+  edge_src_[slot] = acquire_node(src);
+  edge_tgt_[slot] = acquire_node(tgt);
+  edge_live_[slot] = 1;
+  if (src_local) {
+    out_edges_[edge_src_[slot]].push_back(slot);
+  }
+  if (tgt_local) {
+    in_edges_[edge_tgt_[slot]].push_back(slot);
+  }
+  set_edge_flags(slot, property());
+  dirty_ = true;
+}
+
+void adjacency_index::update_edge(edge_id_t eid, const property& p) {
+  jubatus::util::data::unordered_map<edge_id_t, uint32_t>::const_iterator it =
+      edge_slots_.find(eid);
+  if (it != edge_slots_.end()) {
+    set_edge_flags(it->second, p);
+  }
+}
+
+void adjacency_index::remove_edge(edge_id_t eid) {
+  jubatus::util::data::unordered_map<edge_id_t, uint32_t>::iterator it =
+      edge_slots_.find(eid);
+  if (it == edge_slots_.end()) {
+    return;
+  }
+  const uint32_t slot = it->second;
+  edge_slots_.erase(it);
+  remove_by_swap(out_edges_[edge_src_[slot]], slot);
+  remove_by_swap(in_edges_[edge_tgt_[slot]], slot);
+  release_node(edge_src_[slot]);
+  release_node(edge_tgt_[slot]);
+  edge_live_[slot] = 0;
+  free_edges_.push_back(slot);
+  dirty_ = true;
+}
+
+void adjacency_index::add_query(
+    const preset_query& query,
+    const node_info_map& nodes,
+    const edge_info_map& edges) {
+  if (queries_.count(query) == 0) {
+    build_flags(query, nodes, edges, queries_[query]);
+  }
+}
+
+void adjacency_index::remove_query(const preset_query& query) {
+  queries_.erase(query);
+}
+
+void adjacency_index::sync_queries(
+    const vector<preset_query>& queries,
+    const node_info_map& nodes,
+    const edge_info_map& edges) {
+  for (size_t i = 0; i < queries.size(); ++i) {
+    add_query(queries[i], nodes, edges);
+  }
+  if (queries_.size() == queries.size()) {
+    return;
+  }
+  const jubatus::util::data::unordered_set<preset_query> keep(
+      queries.begin(), queries.end());
+  vector<preset_query> removed;
+  for (query_flags_map::const_iterator it = queries_.begin();
+       it != queries_.end(); ++it) {
+    if (keep.count(it->first) == 0) {
+      removed.push_back(it->first);
+    }
+  }
+  for (size_t i = 0; i < removed.size(); ++i) {
+    queries_.erase(removed[i]);
+  }
+}
+
+void adjacency_index::calc_eigen_scores(
+    const preset_query& query,
+    const eigen_vector_diff& model,
+    double damping_factor,
+    uint32_t threads,
+    eigen_vector_diff& diff) const {
+  query_flags_map::const_iterator flags_it = queries_.find(query);
+  if (flags_it == queries_.end()) {
+    throw JUBATUS_EXCEPTION(unknown_query(query));
+  }
+  const query_flags& flags = flags_it->second;
+  update_snapshot();
+
+  double dist = 0;
+  for (eigen_vector_diff::const_iterator it = model.begin();
+       it != model.end(); ++it) {
+    if (it->second.out_degree_num == 0) {
+      dist += it->second.score;
+    }
+  }
+  uint64_t new_node_num = 0;
+  for (size_t i = 0; i < targets_.size(); ++i) {
+    const uint32_t slot = targets_[i];
+    if (!flags.node_unmatched[slot] && model.count(node_ids_[slot]) == 0) {
+      ++new_node_num;
+    }
+  }
+  dist += new_node_num;
+  if (model.size() + new_node_num > 0) {
+    dist /= (model.size() + new_node_num);
+  }
+
+  score_context ctx;
+  ctx.flags = &flags;
+  ctx.model = &model;
+  ctx.contributions.resize(node_ids_.size());
+  ctx.scores.resize(targets_.size());
+  ctx.out_degrees.resize(targets_.size());
+  if (threads > 1) {
+    using jubatus::util::lang::bind;
+    using jubatus::util::lang::_1;
+    using jubatus::util::lang::_2;
+    common::default_thread_pool::parallel_for(
+        0, node_ids_.size(), threads,
+        bind(&adjacency_index::calc_contributions, this, &ctx, _1, _2));
+    common::default_thread_pool::parallel_for(
+        0, targets_.size(), threads,
+        bind(&adjacency_index::calc_target_scores, this, &ctx, _1, _2));
+  } else {
+    calc_contributions(&ctx, 0, node_ids_.size());
+    calc_target_scores(&ctx, 0, targets_.size());
+  }
+
+  diff.clear();
+  for (size_t i = 0; i < targets_.size(); ++i) {
+    const uint32_t slot = targets_[i];
+    if (flags.node_unmatched[slot]) {
+      continue;
+    }
+    eigen_vector_info ei;
+    ei.score = damping_factor * ctx.scores[i] + 1 - damping_factor
+        + damping_factor * dist;
+    ei.out_degree_num = ctx.out_degrees[i];
+    diff[node_ids_[slot]] = ei;
+  }
+}
+
+void adjacency_index::find_shortest_path(
+    const preset_query& query,
+    node_id_t src,
+    node_id_t tgt,
+    uint64_t max_hop,
+    const spt_diff& landmarks,
+    vector<node_id_t>& path) const {
+  path.clear();
+  query_flags_map::const_iterator flags_it = queries_.find(query);
+  if (flags_it == queries_.end()) {
+    throw JUBATUS_EXCEPTION(unknown_query(query));
+  }
+  const query_flags& flags = flags_it->second;
+
+  if (src == tgt) {
+    path.push_back(src);
+    return;
+  }
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator
+      src_it = node_slots_.find(src);
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator
+      tgt_it = node_slots_.find(tgt);
+  if (max_hop == 0 || src_it == node_slots_.end()
+      || tgt_it == node_slots_.end()
+      || flags.node_unmatched[src_it->second]
+      || flags.node_unmatched[tgt_it->second]) {
+    return;
+  }
+  update_snapshot();
+
+  // expand the side with the smaller frontier level by level, until no
+  // path shorter than the best one can be found
+  bfs_side fwd(node_ids_.size(), src_it->second,
+               landmark_bound(landmarks, tgt, true));
+  bfs_side bwd(node_ids_.size(), tgt_it->second,
+               landmark_bound(landmarks, src, false));
+  // no shortest path is longer than the number of nodes
+  uint64_t best = std::min<uint64_t>(max_hop, node_ids_.size()) + 1;
+  uint32_t meet = NOT_VISITED;
+  while (!fwd.frontier.empty() && !bwd.frontier.empty()
+         && fwd.depth + bwd.depth + 1 < best) {
+    if (fwd.frontier.size() <= bwd.frontier.size()) {
+      expand_level(flags, true, fwd, bwd, best, meet);
+    } else {
+      expand_level(flags, false, bwd, fwd, best, meet);
+    }
+  }
+  if (meet == NOT_VISITED) {
+    return;
+  }
+
+  for (uint32_t v = meet; v != NOT_VISITED; v = fwd.parent[v]) {
+    path.push_back(node_ids_[v]);
+  }
+  std::reverse(path.begin(), path.end());
+  for (uint32_t v = bwd.parent[meet]; v != NOT_VISITED; v = bwd.parent[v]) {
+    path.push_back(node_ids_[v]);
+  }
+}
+
+void adjacency_index::expand_level(
+    const query_flags& flags,
+    bool forward,
+    bfs_side& side,
+    const bfs_side& other,
+    uint64_t& best,
+    uint32_t& meet) const {
+  const vector<size_t>& offsets = forward ? fwd_offsets_ : bwd_offsets_;
+  const vector<uint32_t>& edges = forward ? fwd_edge_slots_ : bwd_edge_slots_;
+  const vector<uint32_t>& ends = forward ? edge_tgt_ : edge_src_;
+  const uint64_t depth = side.depth + 1;
+
+  vector<uint32_t> next;
+  for (size_t i = 0; i < side.frontier.size(); ++i) {
+    const uint32_t u = side.frontier[i];
+    for (size_t k = offsets[u]; k < offsets[u + 1]; ++k) {
+      const uint32_t e = edges[k];
+      if (!flags.edge_matched[e]) {
+        continue;
+      }
+      const uint32_t v = ends[e];
+      if (side.dist[v] != NOT_VISITED || flags.node_unmatched[v]) {
+        continue;
+      }
+      side.dist[v] = depth;
+      side.parent[v] = u;
+      if (other.dist[v] != NOT_VISITED && depth + other.dist[v] < best) {
+        best = depth + other.dist[v];
+        meet = v;
+      }
+      if (depth + side.bound(node_ids_[v]) < best) {
+        next.push_back(v);
+      }
+    }
+  }
+  side.frontier.swap(next);
+  side.depth = depth;
+}
+
+uint32_t adjacency_index::acquire_node(node_id_t id) {
+  jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator it =
+      node_slots_.find(id);
+  if (it != node_slots_.end()) {
+    ++node_refs_[it->second];
+    return it->second;
+  }
+
+  uint32_t slot;
+  if (free_nodes_.empty()) {
+    slot = node_ids_.size();
+    node_ids_.push_back(id);
+    node_refs_.push_back(0);
+    node_local_.push_back(0);
+    in_edges_.push_back(vector<uint32_t>());
+    out_edges_.push_back(vector<uint32_t>());
+    for (query_flags_map::iterator q = queries_.begin();
+         q != queries_.end(); ++q) {
+      resize_flags(q->second);
+    }
+  } else {
+    slot = free_nodes_.back();
+    free_nodes_.pop_back();
+    node_ids_[slot] = id;
+  }
+  node_slots_[id] = slot;
+  node_refs_[slot] = 1;
+  return slot;
+}
+
+void adjacency_index::release_node(uint32_t slot) {
+  if (--node_refs_[slot] > 0) {
+    return;
+  }
+  node_slots_.erase(node_ids_[slot]);
+  vector<uint32_t>().swap(in_edges_[slot]);
+  vector<uint32_t>().swap(out_edges_[slot]);
+  free_nodes_.push_back(slot);
+}
+
+void adjacency_index::set_node_flags(uint32_t slot, const property& p) {
+  for (query_flags_map::iterator q = queries_.begin();
+       q != queries_.end(); ++q) {
+    q->second.node_unmatched[slot] =
+        !is_matched_to_query(q->first.node_query, p);
+  }
+}
+
+void adjacency_index::set_edge_flags(uint32_t slot, const property& p) {
+  for (query_flags_map::iterator q = queries_.begin();
+       q != queries_.end(); ++q) {
+    q->second.edge_matched[slot] = is_matched_to_query(q->first.edge_query, p);
+  }
+}
+
+void adjacency_index::resize_flags(query_flags& flags) const {
+  flags.node_unmatched.resize(node_ids_.size());
+  flags.edge_matched.resize(edge_src_.size());
+}
+
+void adjacency_index::build_flags(
+    const preset_query& query,
+    const node_info_map& nodes,
+    const edge_info_map& edges,
+    query_flags& flags) const {
+  flags.node_unmatched.assign(node_ids_.size(), 0);
+  flags.edge_matched.assign(edge_src_.size(), 0);
+  for (node_info_map::const_iterator it = nodes.begin();
+       it != nodes.end(); ++it) {
+    jubatus::util::data::unordered_map<node_id_t, uint32_t>::const_iterator
+        slot = node_slots_.find(it->first);
+    if (slot != node_slots_.end()) {
+      flags.node_unmatched[slot->second] =
+          !is_matched_to_query(query.node_query, it->second.property);
+    }
+  }
+  for (edge_info_map::const_iterator it = edges.begin();
+       it != edges.end(); ++it) {
+    jubatus::util::data::unordered_map<edge_id_t, uint32_t>::const_iterator
+        slot = edge_slots_.find(it->first);
+    if (slot != edge_slots_.end()) {
+      flags.edge_matched[slot->second] =
+          is_matched_to_query(query.edge_query, it->second.p);
+    }
+  }
+}
+
+void adjacency_index::update_snapshot() const {
+  scoped_lock lk(*snapshot_mutex_);
+  if (!dirty_) {
+    return;
+  }
+  targets_.clear();
+  in_offsets_.assign(1, 0);
+  in_edge_slots_.clear();
+  out_offsets_.assign(1, 0);
+  out_edge_slots_.clear();
+  for (uint32_t slot = 0; slot < node_ids_.size(); ++slot) {
+    if (!node_local_[slot]) {
+      continue;
+    }
+    targets_.push_back(slot);
+    in_edge_slots_.insert(in_edge_slots_.end(),
+                          in_edges_[slot].begin(), in_edges_[slot].end());
+    in_offsets_.push_back(in_edge_slots_.size());
+    out_edge_slots_.insert(out_edge_slots_.end(),
+                           out_edges_[slot].begin(), out_edges_[slot].end());
+    out_offsets_.push_back(out_edge_slots_.size());
+  }
+
+  // counting sort of live edges by src / tgt slot
+  fwd_offsets_.assign(node_ids_.size() + 1, 0);
+  bwd_offsets_.assign(node_ids_.size() + 1, 0);
+  for (uint32_t e = 0; e < edge_live_.size(); ++e) {
+    if (edge_live_[e]) {
+      ++fwd_offsets_[edge_src_[e] + 1];
+      ++bwd_offsets_[edge_tgt_[e] + 1];
+    }
+  }
+  for (size_t i = 0; i < node_ids_.size(); ++i) {
+    fwd_offsets_[i + 1] += fwd_offsets_[i];
+    bwd_offsets_[i + 1] += bwd_offsets_[i];
+  }
+  fwd_edge_slots_.resize(fwd_offsets_.back());
+  bwd_edge_slots_.resize(bwd_offsets_.back());
+  vector<size_t> fwd_pos(fwd_offsets_.begin(), fwd_offsets_.end() - 1);
+  vector<size_t> bwd_pos(bwd_offsets_.begin(), bwd_offsets_.end() - 1);
+  for (uint32_t e = 0; e < edge_live_.size(); ++e) {
+    if (edge_live_[e]) {
+      fwd_edge_slots_[fwd_pos[edge_src_[e]]++] = e;
+      bwd_edge_slots_[bwd_pos[edge_tgt_[e]]++] = e;
+    }
+  }
+  dirty_ = false;
+}
+
+void adjacency_index::calc_contributions(
+    score_context* ctx, size_t begin, size_t end) const {
+  for (size_t slot = begin; slot < end; ++slot) {
+    double c = 0;
+    if (node_refs_[slot] > 0) {
+      eigen_vector_diff::const_iterator it = ctx->model->find(node_ids_[slot]);
+      if (it != ctx->model->end() && it->second.out_degree_num != 0) {
+        // TODO(beam2d) it->second.score > 0 should indicate
+        // it->second.out_degree_num
+        c = it->second.score / it->second.out_degree_num;
+      }
+    }
+    ctx->contributions[slot] = c;
+  }
+}
+
+void adjacency_index::calc_target_scores(
+    score_context* ctx, size_t begin, size_t end) const {
+  const vector<uint8_t>& node_unmatched = ctx->flags->node_unmatched;
+  const vector<uint8_t>& edge_matched = ctx->flags->edge_matched;
+  for (size_t i = begin; i < end; ++i) {
+    if (node_unmatched[targets_[i]]) {
+      continue;
+    }
+    double score = 0;
+    for (size_t k = in_offsets_[i]; k < in_offsets_[i + 1]; ++k) {
+      const uint32_t e = in_edge_slots_[k];
+      if (edge_matched[e] && !node_unmatched[edge_src_[e]]) {
+        score += ctx->contributions[edge_src_[e]];
+      }
+    }
+    ctx->scores[i] = score;
+
+    uint64_t out_degree = 0;
+    for (size_t k = out_offsets_[i]; k < out_offsets_[i + 1]; ++k) {
+      const uint32_t e = out_edge_slots_[k];
+      if (edge_matched[e] && !node_unmatched[edge_tgt_[e]]) {
+        ++out_degree;
+      }
+    }
+    ctx->out_degrees[i] = out_degree;
+  }
+}
+
+}  // namespace graph
+}  // namespace core
+}  // namespace jubatus
@@ -0,0 +1,192 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef JUBATUS_CORE_GRAPH_ADJACENCY_INDEX_HPP_
+#define JUBATUS_CORE_GRAPH_ADJACENCY_INDEX_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+#include "jubatus/util/concurrent/mutex.h"
+#include "jubatus/util/data/unordered_map.h"
+#include "jubatus/util/lang/shared_ptr.h"
+
+#include "graph_type.hpp"
+
+namespace jubatus {
+namespace core {
+namespace graph {
+
+/**
+ * Dense mirror of the local adjacency of graph_wo_index, used to calculate
+ * eigen scores without hash lookups and property matching per edge.
+ *
+ * Nodes (local nodes and the remote endpoints of local edges) and edges are
+ * assigned dense slots.  For each centrality query, the index keeps flags of
+ * local nodes not matched to the node query and of edges matched to the edge
+ * query; they are updated incrementally as nodes and edges change.  In and
+ * out edges of each local node are kept in the same order as ``in_edges``
+ * and ``out_edges`` of node_info, and are flattened into CSR arrays when
+ * scores are calculated after the structure changed.  All local edges are
+ * also flattened by src and tgt slots for path search.
+ *
+ * Queries are registered for both of centrality and shortest path queries.
+ */
+class adjacency_index {
+ public:
+  typedef jubatus::util::data::unordered_map<node_id_t, node_info>
+      node_info_map;
+  typedef jubatus::util::data::unordered_map<edge_id_t, edge_info>
+      edge_info_map;
+
+  adjacency_index();
+
+  void clear();
+  void rebuild(const node_info_map& nodes, const edge_info_map& edges);
+
+  void create_node(node_id_t id, const property& p);
+  void update_node(node_id_t id, const property& p);
+  void remove_node(node_id_t id);
+
+  void create_edge(
+      edge_id_t eid,
+      node_id_t src,
+      node_id_t tgt,
+      bool src_local,
+      bool tgt_local);
+  void update_edge(edge_id_t eid, const property& p);
+  void remove_edge(edge_id_t eid);
+
+  void add_query(
+      const preset_query& query,
+      const node_info_map& nodes,
+      const edge_info_map& edges);
+  void remove_query(const preset_query& query);
+  // makes the set of queries the same as ``queries``
+  void sync_queries(
+      const std::vector<preset_query>& queries,
+      const node_info_map& nodes,
+      const edge_info_map& edges);
+
+  /**
+   * Calculate one power iteration of eigen scores of local nodes matched to
+   * the query, from the scores of the last MIX (``model``).
+   */
+  void calc_eigen_scores(
+      const preset_query& query,
+      const eigen_vector_diff& model,
+      double damping_factor,
+      uint32_t threads,
+      eigen_vector_diff& diff) const;
+
+  /**
+   * Find a shortest path from ``src`` to ``tgt`` with at most ``max_hop``
+   * local edges matched to the query, by bidirectional BFS.  Nodes whose
+   * distance lower bound, estimated from the landmark trees, exceeds the
+   * best path found so far are not expanded.  ``path`` is left empty when
+   * no path is found.
+   */
+  void find_shortest_path(
+      const preset_query& query,
+      node_id_t src,
+      node_id_t tgt,
+      uint64_t max_hop,
+      const spt_diff& landmarks,
+      std::vector<node_id_t>& path) const;
+
+ private:
+  struct query_flags {
+    std::vector<uint8_t> node_unmatched;  // local node not matched
+    std::vector<uint8_t> edge_matched;
+  };
+  typedef jubatus::util::data::unordered_map<preset_query, query_flags>
+      query_flags_map;
+
+  struct score_context {
+    const query_flags* flags;
+    const eigen_vector_diff* model;
+    std::vector<double> contributions;  // score / out degree by node slot
+    std::vector<double> scores;  // by position in targets_
+    std::vector<uint64_t> out_degrees;  // by position in targets_
+  };
+
+  uint32_t acquire_node(node_id_t id);
+  void release_node(uint32_t slot);
+  void set_node_flags(uint32_t slot, const property& p);
+  void set_edge_flags(uint32_t slot, const property& p);
+  void resize_flags(query_flags& flags) const;
+  void build_flags(
+      const preset_query& query,
+      const node_info_map& nodes,
+      const edge_info_map& edges,
+      query_flags& flags) const;
+  void update_snapshot() const;
+
+  void calc_contributions(
+      score_context* ctx, size_t begin, size_t end) const;
+  void calc_target_scores(
+      score_context* ctx, size_t begin, size_t end) const;
+
+  struct bfs_side;
+  void expand_level(
+      const query_flags& flags,
+      bool forward,
+      bfs_side& side,
+      const bfs_side& other,
+      uint64_t& best,
+      uint32_t& meet) const;
+
+  // node slots
+  jubatus::util::data::unordered_map<node_id_t, uint32_t> node_slots_;
+  std::vector<node_id_t> node_ids_;
+  std::vector<uint32_t> node_refs_;  // local node + referring edges
+  std::vector<uint8_t> node_local_;
+  std::vector<std::vector<uint32_t> > in_edges_;
+  std::vector<std::vector<uint32_t> > out_edges_;
+  std::vector<uint32_t> free_nodes_;
+
+  // edge slots
+  jubatus::util::data::unordered_map<edge_id_t, uint32_t> edge_slots_;
+  std::vector<uint32_t> edge_src_;
+  std::vector<uint32_t> edge_tgt_;
+  std::vector<uint8_t> edge_live_;
+  std::vector<uint32_t> free_edges_;
+
+  query_flags_map queries_;
+
+  // CSR snapshot of in_edges_ / out_edges_ of local nodes
+  mutable bool dirty_;
+  mutable std::vector<uint32_t> targets_;  // local node slots
+  mutable std::vector<size_t> in_offsets_;
+  mutable std::vector<uint32_t> in_edge_slots_;
+  mutable std::vector<size_t> out_offsets_;
+  mutable std::vector<uint32_t> out_edge_slots_;
+  // all live edges by src / tgt node slot
+  mutable std::vector<size_t> fwd_offsets_;
+  mutable std::vector<uint32_t> fwd_edge_slots_;
+  mutable std::vector<size_t> bwd_offsets_;
+  mutable std::vector<uint32_t> bwd_edge_slots_;
+  // the snapshot is updated by const methods which may run concurrently
+  jubatus::util::lang::shared_ptr<jubatus::util::concurrent::mutex>
+      snapshot_mutex_;
+};
+
+}  // namespace graph
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_GRAPH_ADJACENCY_INDEX_HPP_
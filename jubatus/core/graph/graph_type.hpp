@@ -80,6 +80,19 @@ struct preset_query {
   MSGPACK_DEFINE(edge_query, node_query);
 };
 
+// arguments of shortest_path, used as a key of cached paths
+struct shortest_path_key {
+  node_id_t src;
+  node_id_t tgt;
+  uint64_t max_hop;
+  preset_query query;
+
+  bool operator==(const shortest_path_key& r) const {
+    return src == r.src && tgt == r.tgt && max_hop == r.max_hop
+        && query == r.query;
+  }
+};
+
 typedef jubatus::util::data::unordered_map<
   node_id_t, std::pair<uint64_t, node_id_t> > spt_edges;
 
@@ -207,6 +220,16 @@ template<> struct hash<jubatus::core::graph::preset_query> {
   }
 };
 
+template<> struct hash<jubatus::core::graph::shortest_path_key> {
+  uint64_t operator()(
+      const jubatus::core::graph::shortest_path_key& k) const {
+    uint64_t h = hash<jubatus::core::graph::preset_query>()(k.query);
+    h = (h ^ k.src) * 1099511628211LLU;
+    h = (h ^ k.tgt) * 1099511628211LLU;
+    return (h ^ k.max_hop) * 1099511628211LLU;
+  }
+};
+
 }  // namespace data
 }  // namespace util
 }  // namespace jubatus
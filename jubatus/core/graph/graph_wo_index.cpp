@@ -21,9 +21,9 @@
 #include <utility>
 #include <vector>
 
-#include "jubatus/util/data/unordered_set.h"
 #include "jubatus/util/lang/cast.h"
 
+#include "../nearest_neighbor/bit_vector_ranking.hpp"
 #include "graph_wo_index.hpp"
 
 using std::endl;
@@ -33,7 +33,6 @@ using std::string;
 using std::swap;
 using std::vector;
 using jubatus::util::lang::lexical_cast;
-using jubatus::util::data::unordered_set;
 
 namespace jubatus {
 namespace core {
@@ -41,10 +40,6 @@ namespace graph {
 
 namespace {
 
-bool is_empty_query(const preset_query& query) {
-  return query.node_query.empty() && query.edge_query.empty();
-}
-
 bool is_matched_to_query(
     const vector<pair<string, string> >& query,
     const property& prop) {
@@ -71,7 +66,12 @@ void normalize(eigen_vector_diff& v) {
 }  // namespace
 
 graph_wo_index::graph_wo_index(const config& config)
-    : config_(config) {
+    : config_(config),
+      threads_(nearest_neighbor::read_threads_config(config.threads)),
+      centrality_iterations_(1),
+      bidirectional_search_(
+          config.bidirectional_search && *config.bidirectional_search),
+      path_cache_(0) {
 
   if (!(0.0 < config.damping_factor && config.damping_factor < 1.0)) {
     throw JUBATUS_EXCEPTION(
@@ -83,10 +83,30 @@ graph_wo_index::graph_wo_index(const config& config)
         common::invalid_parameter("0 <= landmark_num"));
   }
 
+  if (config.centrality_iterations) {
+    if (!(1 <= *config.centrality_iterations)) {
+      throw JUBATUS_EXCEPTION(
+          common::invalid_parameter("1 <= centrality_iterations"));
+    }
+    centrality_iterations_ = *config.centrality_iterations;
+  }
+
+  if (config.shortest_path_cache_size) {
+    if (!(0 <= *config.shortest_path_cache_size)) {
+      throw JUBATUS_EXCEPTION(
+          common::invalid_parameter("0 <= shortest_path_cache_size"));
+    }
+    path_cache_ = path_cache(*config.shortest_path_cache_size);
+  }
+
   clear();
 }
 
-graph_wo_index::graph_wo_index() {
+graph_wo_index::graph_wo_index()
+    : threads_(0),
+      centrality_iterations_(1),
+      bidirectional_search_(false),
+      path_cache_(0) {
   clear();
 }
 
@@ -102,7 +122,9 @@ void graph_wo_index::clear() {
   local_edges_.clear();
   global_nodes_.clear();
   eigen_scores_.clear();
+  index_.clear();
   spts_.clear();
+  path_cache_.clear();
 }
 
 void graph_wo_index::create_node(node_id_t id) {
@@ -110,6 +132,8 @@ void graph_wo_index::create_node(node_id_t id) {
     throw JUBATUS_EXCEPTION(local_node_exists(id));
   }
   local_nodes_[id] = node_info();
+  index_.create_node(id, property());
+  path_cache_.clear();
   may_set_landmark(id);
 }
 
@@ -149,6 +173,8 @@ void graph_wo_index::update_node(node_id_t id, const property& p) {
     throw JUBATUS_EXCEPTION(unknown_id("update_node", id));
   }
   it->second.property = p;
+  index_.update_node(id, p);
+  path_cache_.clear();
   may_set_landmark(id);
 }
 
@@ -166,6 +192,8 @@ void graph_wo_index::remove_node(node_id_t id) {
         string(" cannot be removed because it has edges")));
   }
   local_nodes_.erase(id);
+  index_.remove_node(id);
+  path_cache_.clear();
 }
 
 void graph_wo_index::create_edge(edge_id_t eid, node_id_t src, node_id_t tgt) {
@@ -192,6 +220,10 @@ void graph_wo_index::create_edge(edge_id_t eid, node_id_t src, node_id_t tgt) {
   if (local_nodes_.count(tgt) > 0) {
     local_nodes_[tgt].in_edges.push_back(eid);
   }
+  index_.create_edge(eid, src, tgt,
+                     local_nodes_.count(src) > 0,
+                     local_nodes_.count(tgt) > 0);
+  path_cache_.clear();
 }
 
 void graph_wo_index::update_edge(edge_id_t eid, const property& p) {
@@ -200,6 +232,8 @@ void graph_wo_index::update_edge(edge_id_t eid, const property& p) {
     throw JUBATUS_EXCEPTION(unknown_id("update_edge:eid", eid));
   }
   it->second.p = p;
+  index_.update_edge(eid, p);
+  path_cache_.clear();
 }
 
 void graph_wo_index::remove_edge(edge_id_t eid) {
@@ -218,22 +252,29 @@ void graph_wo_index::remove_edge(edge_id_t eid) {
   }
 
   local_edges_.erase(it);
+  index_.remove_edge(eid);
+  path_cache_.clear();
 }
 
 void graph_wo_index::add_centrality_query(const preset_query& query) {
   eigen_scores_.insert(make_pair(query, eigen_vector_diff()));
+  index_.add_query(query, local_nodes_, local_edges_);
 }
 
 void graph_wo_index::add_shortest_path_query(const preset_query& query) {
   spts_.insert(make_pair(query, spt_diff()));
+  index_.add_query(query, local_nodes_, local_edges_);
 }
 
 void graph_wo_index::remove_centrality_query(const preset_query& query) {
   eigen_scores_.erase(query);
+  sync_index_queries();
 }
 
 void graph_wo_index::remove_shortest_path_query(const preset_query& query) {
   spts_.erase(query);
+  sync_index_queries();
+  path_cache_.clear();
 }
 
 double graph_wo_index::centrality(
@@ -272,7 +313,39 @@ void graph_wo_index::shortest_path(
   if (model_it == spts_.end()) {
     throw JUBATUS_EXCEPTION(unknown_query(query));
   }
-  const spt_diff& mixed = model_it->second;
+
+  shortest_path_key key;
+  key.src = src;
+  key.tgt = tgt;
+  key.max_hop = max_hop;
+  key.query = query;
+  if (path_cache_.get(key, ret)) {
+    return;
+  }
+
+  shortest_path_via_landmark(src, tgt, max_hop, model_it->second, ret);
+  if (bidirectional_search_ && !(ret.size() == 1 && src == tgt)) {
+    // search for paths with fewer hops than the complete landmark path
+    uint64_t hop = max_hop;
+    if (ret.size() >= 2 && ret.back() == tgt) {
+      hop = std::min<uint64_t>(hop, ret.size() - 2);
+    }
+    vector<node_id_t> path;
+    index_.find_shortest_path(
+        query, src, tgt, hop, model_it->second, path);
+    if (!path.empty()) {
+      ret.swap(path);
+    }
+  }
+  path_cache_.set(key, ret);
+}
+
+void graph_wo_index::shortest_path_via_landmark(
+    node_id_t src,
+    node_id_t tgt,
+    uint64_t max_hop,
+    const spt_diff& mixed,
+    std::vector<node_id_t>& ret) const {
   ret.clear();
   uint64_t min_score = ~uint64_t();
   uint64_t ind = ~uint64_t();
@@ -361,6 +434,9 @@ void graph_wo_index::pack(framework::packer& packer) const {
 
 void graph_wo_index::unpack(msgpack::object o) {
   o.convert(this);
+  index_.rebuild(local_nodes_, local_edges_);
+  sync_index_queries();
+  path_cache_.clear();
 }
 
 void graph_wo_index::update_index() {
@@ -368,6 +444,12 @@ void graph_wo_index::update_index() {
   diff_type diff;
   get_diff(diff);
   put_diff(diff);
+
+  // further power iterations only refine eigen scores
+  for (uint32_t i = 1; i < centrality_iterations_; ++i) {
+    get_diff_eigen_score(diff.eigen_vector_query);
+    put_diff_eigen_score(diff.eigen_vector_query);
+  }
 }
 
 void graph_wo_index::get_diff_eigen_score(eigen_vector_query_diff& diff) const {
@@ -376,115 +458,16 @@ void graph_wo_index::get_diff_eigen_score(eigen_vector_query_diff& diff) const {
   for (eigen_vector_query_diff::const_iterator query_it
            = eigen_scores_.begin();
        query_it != eigen_scores_.end(); ++query_it) {
-    const preset_query& query = query_it->first;
-    const eigen_vector_diff& model = query_it->second;
-
-    double dist = 0;
-    for (eigen_vector_diff::const_iterator it = model.begin();
-         it != model.end(); ++it) {
-      if (it->second.out_degree_num == 0) {
-        dist += it->second.score;
-      }
-    }
-
-    unordered_set<node_id_t> unmatched_nodes;
-
-    uint64_t new_node_num = 0;
-    double dist_from_new_node = 0;
-    for (node_info_map::const_iterator node_it = local_nodes_.begin();
-         node_it != local_nodes_.end(); ++node_it) {
-      if (model.count(node_it->first) == 0) {
-        if (!is_matched_to_query(query.node_query, node_it->second.property)) {
-          unmatched_nodes.insert(node_it->first);
-          continue;
-        }
-        dist_from_new_node += 1.0;
-        ++new_node_num;
-      }
-    }
-    dist += dist_from_new_node;
-
-    if (model.size() + new_node_num > 0) {
-      dist /= (model.size() + new_node_num);
-    }
-
-    eigen_vector_diff& qdiff = diff[query];
-
-    for (node_info_map::const_iterator node_it = local_nodes_.begin();
-         node_it != local_nodes_.end(); ++node_it) {
-      if (unmatched_nodes.count(node_it->first)) {
-        continue;
-      }
-      if (!is_matched_to_query(query.node_query, node_it->second.property)) {
-        unmatched_nodes.insert(node_it->first);
-        continue;
-      }
-
-      const std::vector<edge_id_t>& in_edges = node_it->second.in_edges;
-      double score = 0;
-      for (size_t i = 0; i < in_edges.size(); ++i) {
-        if (unmatched_nodes.count(in_edges[i])) {
-          continue;
-        }
-        edge_info_map::const_iterator edge_it = local_edges_.find(in_edges[i]);
-        if (edge_it == local_edges_.end()) {
-          continue;
-        }
-
-        const node_id_t src = edge_it->second.src;
-        if (unmatched_nodes.count(src)) {
-          continue;
-        }
-        if (!is_matched_to_query(query.edge_query, edge_it->second.p)) {
-          continue;
-        }
-
-        eigen_vector_diff::const_iterator it = model.find(edge_it->second.src);
-        if (it == model.end()) {
-          continue;
-        }
-        if (it->second.out_degree_num != 0) {
-          // TODO(beam2d) it->second.score > 0 should indicate
-          // it->second.out_degree_num
-          score += it->second.score / it->second.out_degree_num;
-        }
-      }
-
-      eigen_vector_info ei;
-      ei.score = config_.damping_factor * score + 1 - config_.damping_factor
-          + config_.damping_factor * dist;
-
-      if (is_empty_query(query)) {
-        ei.out_degree_num = node_it->second.out_edges.size();
-      } else {
-        uint64_t out_degree = 0;
-        for (size_t i = 0; i < node_it->second.out_edges.size(); ++i) {
-          const edge_info_map::const_iterator edge_it
-              = local_edges_.find(node_it->second.out_edges[i]);
-          const edge_info& edge = edge_it->second;
-          if (unmatched_nodes.count(edge.tgt)) {
-            continue;
-          }
-          if (!is_node_matched_to_query(query, edge.tgt)) {
-            unmatched_nodes.insert(edge.tgt);
-            continue;
-          }
-          if (!is_matched_to_query(query.edge_query, edge.p)) {
-            continue;
-          }
-          ++out_degree;
-        }
-        ei.out_degree_num = out_degree;
-      }
-
-      qdiff[node_it->first] = ei;
-    }
+    index_.calc_eigen_scores(
+        query_it->first, query_it->second, config_.damping_factor, threads_,
+        diff[query_it->first]);
   }
 }
 
 void graph_wo_index::put_diff_eigen_score(
     const eigen_vector_query_diff& mixed) {
   eigen_scores_ = mixed;
+  sync_index_queries();
   if (eigen_scores_.size() == 0) {
     return;
   }
@@ -555,6 +538,7 @@ bool graph_wo_index::is_node_matched_to_query(
 }
 
 void graph_wo_index::update_spt() {
+  path_cache_.clear();
   for (spt_query_diff::iterator it = spts_.begin(); it != spts_.end(); ++it) {
     spt_diff& mixed = it->second;
     for (size_t i = 0; i < mixed.size(); ++i) {
@@ -603,6 +587,8 @@ void graph_wo_index::get_diff_shortest_path_tree(
 void graph_wo_index::put_diff_shortest_path_tree(
     const spt_query_diff& mixed) {
   spts_ = mixed;
+  sync_index_queries();
+  path_cache_.clear();
 }
 
 void graph_wo_index::get_diff(diff_type& diff) const {
@@ -707,6 +693,77 @@ void graph_wo_index::remove_by_swap(
   }
 }
 
+void graph_wo_index::sync_index_queries() {
+  vector<preset_query> queries;
+  for (eigen_vector_query_diff::const_iterator it = eigen_scores_.begin();
+       it != eigen_scores_.end(); ++it) {
+    queries.push_back(it->first);
+  }
+  for (spt_query_diff::const_iterator it = spts_.begin();
+       it != spts_.end(); ++it) {
+    if (eigen_scores_.count(it->first) == 0) {
+      queries.push_back(it->first);
+    }
+  }
+  index_.sync_queries(queries, local_nodes_, local_edges_);
+}
+
+graph_wo_index::path_cache::path_cache(int size)
+    : size_(size) {
+  if (size_ > 0) {
+    lru_.reset(new lru_t(size_));
+  }
+}
+
+graph_wo_index::path_cache::path_cache(const path_cache& other)
+    : size_(other.size_) {
+  if (size_ > 0) {
+    lru_.reset(new lru_t(size_));
+  }
+}
+
+graph_wo_index::path_cache& graph_wo_index::path_cache::operator=(
+    const path_cache& other) {
+  if (this != &other) {
+    jubatus::util::concurrent::scoped_lock lk(mutex_);
+    size_ = other.size_;
+    lru_.reset(size_ > 0 ? new lru_t(size_) : NULL);
+  }
+  return *this;
+}
+
+bool graph_wo_index::path_cache::get(
+    const shortest_path_key& key,
+    std::vector<node_id_t>& path) const {
+  if (!lru_) {
+    return false;
+  }
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  if (!lru_->has(key)) {
+    return false;
+  }
+  path = lru_->get(key);
+  return true;
+}
+
+void graph_wo_index::path_cache::set(
+    const shortest_path_key& key,
+    const std::vector<node_id_t>& path) const {
+  if (!lru_) {
+    return;
+  }
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  lru_->set(key, path);
+}
+
+void graph_wo_index::path_cache::clear() {
+  if (!lru_) {
+    return;
+  }
+  jubatus::util::concurrent::scoped_lock lk(mutex_);
+  lru_->clear();
+}
+
 uint64_t graph_wo_index::find_max_int_id() const {
   uint64_t max_id = 0;
 
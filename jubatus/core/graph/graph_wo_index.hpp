@@ -23,12 +23,17 @@
 
 #include "jubatus/util/data/unordered_map.h"
 #include "jubatus/util/data/unordered_set.h"
+#include "jubatus/util/data/optional.h"
 #include "jubatus/util/data/serialization.h"
+#include "jubatus/util/concurrent/mutex.h"
 #include "jubatus/util/lang/enable_shared_from_this.h"
+#include "jubatus/util/lang/scoped_ptr.h"
 #include "jubatus/util/lang/shared_ptr.h"
 
+#include "../common/lru.hpp"
 #include "../common/unordered_map.hpp"
 #include "../framework/mixable_helper.hpp"
+#include "adjacency_index.hpp"
 #include "graph_type.hpp"
 
 namespace jubatus {
@@ -53,17 +58,33 @@ class graph_wo_index
   struct config {
     config()
         : damping_factor(0.9),
-          landmark_num(5) {
+          landmark_num(5),
+          threads(),
+          centrality_iterations(),
+          bidirectional_search(),
+          shortest_path_cache_size() {
     }
 
     double damping_factor;
     int landmark_num;
+    // number of threads used to calculate eigen scores
+    jubatus::util::data::optional<int32_t> threads;
+    // number of power iterations of eigen scores run by update_index
+    jubatus::util::data::optional<int32_t> centrality_iterations;
+    // search local edges for paths shorter than the one via landmarks
+    jubatus::util::data::optional<bool> bidirectional_search;
+    // number of shortest_path results cached; disabled when not set or 0
+    jubatus::util::data::optional<int32_t> shortest_path_cache_size;
 
     template<typename Ar>
     void serialize(Ar& ar) {
       ar
           & JUBA_NAMED_MEMBER("damping_factor", damping_factor)
-          & JUBA_MEMBER(landmark_num);
+          & JUBA_MEMBER(landmark_num)
+          & JUBA_MEMBER(threads)
+          & JUBA_MEMBER(centrality_iterations)
+          & JUBA_MEMBER(bidirectional_search)
+          & JUBA_MEMBER(shortest_path_cache_size);
     }
   };
 
@@ -135,6 +156,30 @@ class graph_wo_index
 
   static void remove_by_swap(std::vector<edge_id_t>& edges, edge_id_t eid);
 
+  // LRU cache of shortest_path results, shared by concurrent readers;
+  // copies of the cache are empty
+  class path_cache {
+   public:
+    explicit path_cache(int size);
+    path_cache(const path_cache& other);
+    path_cache& operator=(const path_cache& other);
+
+    bool get(const shortest_path_key& key, std::vector<node_id_t>& path) const;
+    void set(
+        const shortest_path_key& key,
+        const std::vector<node_id_t>& path) const;
+    void clear();
+
+   private:
+    typedef common::lru<shortest_path_key, std::vector<node_id_t> > lru_t;
+
+    int size_;
+    jubatus::util::lang::scoped_ptr<lru_t> lru_;
+    mutable jubatus::util::concurrent::mutex mutex_;
+  };
+
+  void sync_index_queries();
+
   node_info_map local_nodes_;
   edge_info_map local_edges_;
 
@@ -152,6 +197,9 @@ class graph_wo_index
 
   eigen_vector_query_diff eigen_scores_;
 
+  // not serialized; rebuilt from local_nodes_ / local_edges_ on unpack
+  adjacency_index index_;
+
   // shortest pathes
   static void mix_spt(
       const shortest_path_tree& diff,
@@ -170,6 +218,13 @@ class graph_wo_index
 
   void update_spt();
 
+  void shortest_path_via_landmark(
+      node_id_t src,
+      node_id_t tgt,
+      uint64_t max_hop,
+      const spt_diff& mixed,
+      std::vector<node_id_t>& ret) const;
+
   void update_spt_edges(
       const preset_query& query,
       spt_edges& se,
@@ -187,6 +242,10 @@ class graph_wo_index
   spt_query_diff spts_;
 
   config config_;
+  uint32_t threads_;
+  uint32_t centrality_iterations_;
+  bool bidirectional_search_;
+  path_cache path_cache_;
 };
 
 typedef framework::linear_mixable_helper
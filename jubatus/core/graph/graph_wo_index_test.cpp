@@ -14,6 +14,7 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <algorithm>
 #include <limits>
 #include <map>
 #include <set>
@@ -622,6 +623,129 @@ TEST(graph, shortest_path_node_query_failure_at_non_landmark_point) {
   }
 }
 
+TEST(graph, shortest_path_bidirectional_search) {
+  // V = { 1, ..., 6 },
+  // E = { (1, 2), (2, 3), (3, 4), (4, 5), (5, 6), (6, 1), (5, 3) }.
+  // Node 1 is the landmark; the path from 5 to 3 via the landmark is
+  // 5-6-1-2-3.
+  graph_wo_index::config c;
+  c.landmark_num = 1;
+  graph_wo_index g0(c);
+  c.bidirectional_search = true;
+  c.shortest_path_cache_size = 16;
+  graph_wo_index g1(c);
+  graph_wo_index* gs[] = { &g0, &g1 };
+
+  for (size_t i = 0; i < 2; ++i) {
+    graph_wo_index& g = *gs[i];
+    g.add_shortest_path_query(preset_query());
+    for (node_id_t j = 1; j <= 6u; ++j) {
+      g.create_global_node(j);
+      g.create_node(j);
+    }
+    for (node_id_t j = 1; j <= 6u; ++j) {
+      g.create_edge(10 * j + j % 6 + 1, j, j % 6 + 1);
+    }
+    g.create_edge(53, 5, 3);
+    mix_graph(6, g);
+  }
+
+  vector<node_id_t> landmark_path;
+  g0.shortest_path(5, 3, 10, landmark_path, preset_query());
+  ASSERT_EQ(5u, landmark_path.size());
+  EXPECT_EQ(5u, landmark_path.front());
+  EXPECT_EQ(1u, landmark_path[2]);
+  EXPECT_EQ(3u, landmark_path.back());
+
+  vector<node_id_t> expect;
+  expect.push_back(5);
+  expect.push_back(3);
+  vector<node_id_t> actual;
+  g1.shortest_path(5, 3, 10, actual, preset_query());
+  EXPECT_EQ(expect, actual);
+  g1.shortest_path(5, 3, 10, actual, preset_query());  // cached
+  EXPECT_EQ(expect, actual);
+
+  // paths longer than max_hop are not searched
+  vector<node_id_t> path;
+  g1.shortest_path(3, 5, 1, path, preset_query());
+  EXPECT_NE(3u, path.size());
+  g1.shortest_path(3, 5, 2, path, preset_query());
+  expect.clear();
+  expect.push_back(3);
+  expect.push_back(4);
+  expect.push_back(5);
+  EXPECT_EQ(expect, path);
+
+  // cached paths are dropped on updates
+  g1.remove_edge(53);
+  g1.shortest_path(5, 3, 10, actual, preset_query());
+  EXPECT_EQ(landmark_path, actual);
+}
+
+TEST(graph, shortest_path_bidirectional_search_random) {
+  // without landmarks, the search of local edges finds the shortest paths
+  graph_wo_index::config c;
+  c.landmark_num = 0;
+  c.bidirectional_search = true;
+  graph_wo_index g(c);
+  preset_query query;
+  query.edge_query.push_back(make_pair("type", "road"));
+  g.add_shortest_path_query(query);
+  map<string, string> road;
+  road["type"] = "road";
+
+  const uint64_t node_num = 100;
+  for (node_id_t i = 0; i < node_num; ++i) {
+    g.create_global_node(i);
+    g.create_node(i);
+  }
+  vector<vector<node_id_t> > adj(node_num);
+  for (edge_id_t i = 0; i < 250; ++i) {
+    const node_id_t src = rand() % node_num;
+    const node_id_t tgt = rand() % node_num;
+    g.create_edge(node_num + i, src, tgt);
+    if (rand() % 4 != 0) {
+      g.update_edge(node_num + i, road);
+      adj[src].push_back(tgt);
+    }
+  }
+  mix_graph(1, g);
+
+  for (int i = 0; i < 100; ++i) {
+    const node_id_t src = rand() % node_num;
+    const node_id_t tgt = rand() % node_num;
+
+    // BFS from src
+    vector<uint64_t> dist(node_num, node_num);
+    vector<node_id_t> queue(1, src);
+    dist[src] = 0;
+    for (size_t j = 0; j < queue.size(); ++j) {
+      const node_id_t u = queue[j];
+      for (size_t k = 0; k < adj[u].size(); ++k) {
+        if (dist[adj[u][k]] == node_num) {
+          dist[adj[u][k]] = dist[u] + 1;
+          queue.push_back(adj[u][k]);
+        }
+      }
+    }
+
+    vector<node_id_t> path;
+    g.shortest_path(src, tgt, node_num, path, query);
+    if (dist[tgt] == node_num) {
+      EXPECT_TRUE(path.empty());
+      continue;
+    }
+    ASSERT_EQ(dist[tgt] + 1, path.size());
+    EXPECT_EQ(src, path.front());
+    EXPECT_EQ(tgt, path.back());
+    for (size_t j = 0; j + 1 < path.size(); ++j) {
+      EXPECT_EQ(1, std::count(
+          adj[path[j]].begin(), adj[path[j]].end(), path[j + 1]) > 0);
+    }
+  }
+}
+
 TEST(graph, eigen_value_cycle_graph) {
   // V = { 1, 2, 3, 4 }, E = { (1, 2), (2, 3), (3, 4), (4, 1) }
 
@@ -843,6 +967,127 @@ TEST(graph, eigen_value_edge_query_failure) {
   }
 }
 
+TEST(graph, eigen_value_parallel) {
+  // the same random graph is updated in both of serial and parallel modes
+  graph_wo_index::config c;
+  c.threads = 4;
+  vector<graph_wo_index> gs;
+  gs.push_back(graph_wo_index());
+  gs.push_back(graph_wo_index(c));
+
+  preset_query all, node_query, edge_query;
+  node_query.node_query.push_back(make_pair("color", "red"));
+  edge_query.edge_query.push_back(make_pair("weight", "heavy"));
+  for (size_t i = 0; i < gs.size(); ++i) {
+    gs[i].add_centrality_query(all);
+    gs[i].add_centrality_query(node_query);
+  }
+
+  const uint64_t node_num = 200;
+  set<uint64_t> local_ids;
+  vector<edge_id_t> edges;
+  map<string, string> red, heavy;
+  red["color"] = "red";
+  heavy["weight"] = "heavy";
+  for (uint64_t i = 0; i < node_num; ++i) {
+    if ((rand() % 2) == 0) {
+      continue;
+    }
+    local_ids.insert(i);
+    for (size_t j = 0; j < gs.size(); ++j) {
+      gs[j].create_node(i);
+      if (i % 3 == 0) {
+        gs[j].update_node(i, red);
+      }
+    }
+  }
+
+  for (int round = 0; round < 5; ++round) {
+    for (uint64_t i = 0; i < 1000; ++i) {
+      const edge_id_t eid = node_num + round * 1000 + i;
+      const uint64_t src = rand() % node_num;
+      const uint64_t tgt = rand() % node_num;
+      if (src == tgt ||
+          (local_ids.count(src) == 0 && local_ids.count(tgt) == 0)) {
+        continue;
+      }
+      const bool is_heavy = (rand() % 2) == 0;
+      for (size_t j = 0; j < gs.size(); ++j) {
+        gs[j].create_edge(eid, src, tgt);
+        if (is_heavy) {
+          gs[j].update_edge(eid, heavy);
+        }
+      }
+      edges.push_back(eid);
+    }
+    for (size_t i = 0; i < edges.size() / 4; ++i) {
+      const size_t k = rand() % edges.size();
+      for (size_t j = 0; j < gs.size(); ++j) {
+        gs[j].remove_edge(edges[k]);
+      }
+      edges[k] = edges.back();
+      edges.pop_back();
+    }
+    if (round == 2) {
+      for (size_t j = 0; j < gs.size(); ++j) {
+        gs[j].add_centrality_query(edge_query);
+        gs[j].remove_centrality_query(node_query);
+      }
+    }
+
+    for (size_t j = 0; j < gs.size(); ++j) {
+      mix_graph(1, gs[j]);
+    }
+    for (set<uint64_t>::const_iterator it = local_ids.begin();
+         it != local_ids.end(); ++it) {
+      EXPECT_EQ(gs[0].centrality(*it, EIGENSCORE, all),
+                gs[1].centrality(*it, EIGENSCORE, all));
+      if (round < 2) {
+        if (*it % 3 != 0) {
+          EXPECT_THROW(gs[1].centrality(*it, EIGENSCORE, node_query),
+                       common::exception::runtime_error);
+          continue;
+        }
+        EXPECT_EQ(gs[0].centrality(*it, EIGENSCORE, node_query),
+                  gs[1].centrality(*it, EIGENSCORE, node_query));
+      } else {
+        EXPECT_EQ(gs[0].centrality(*it, EIGENSCORE, edge_query),
+                  gs[1].centrality(*it, EIGENSCORE, edge_query));
+      }
+    }
+  }
+}
+
+TEST(graph, eigen_value_iterations) {
+  graph_wo_index::config c;
+  c.centrality_iterations = 3;
+  graph_wo_index g1;
+  graph_wo_index g3(c);
+
+  for (node_id_t i = 1; i <= 4; ++i) {
+    g1.create_node(i);
+    g3.create_node(i);
+  }
+  const node_id_t edges[][2] = { {1, 2}, {2, 3}, {3, 1}, {3, 4}, {4, 1} };
+  for (edge_id_t i = 0; i < 5; ++i) {
+    g1.create_edge(10 + i, edges[i][0], edges[i][1]);
+    g3.create_edge(10 + i, edges[i][0], edges[i][1]);
+  }
+  g1.add_centrality_query(preset_query());
+  g3.add_centrality_query(preset_query());
+
+  for (int i = 0; i < 2; ++i) {
+    g1.update_index();
+    g1.update_index();
+    g1.update_index();
+    g3.update_index();
+    for (node_id_t j = 1; j <= 4; ++j) {
+      EXPECT_EQ(g1.centrality(j, EIGENSCORE, preset_query()),
+                g3.centrality(j, EIGENSCORE, preset_query()));
+    }
+  }
+}
+
 TEST(graph_wo_index, config_validation) {
   shared_ptr<graph_wo_index> g;
   graph_wo_index::config c;
@@ -868,6 +1113,22 @@ TEST(graph_wo_index, config_validation) {
   ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
   c.landmark_num = 1;
   ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
+
+  // 1 <= centrality_iterations
+  c.centrality_iterations = 0;
+  ASSERT_THROW(g.reset(new graph_wo_index(c)), common::invalid_parameter);
+  c.centrality_iterations = 1;
+  ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
+  c.centrality_iterations = 3;
+  ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
+
+  // 0 <= shortest_path_cache_size
+  c.shortest_path_cache_size = -1;
+  ASSERT_THROW(g.reset(new graph_wo_index(c)), common::invalid_parameter);
+  c.shortest_path_cache_size = 0;
+  ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
+  c.shortest_path_cache_size = 100;
+  ASSERT_NO_THROW(g.reset(new graph_wo_index(c)));
 }
 
 TEST(graph_wo_index, find_max_int_id) {
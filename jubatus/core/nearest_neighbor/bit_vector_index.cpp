@@ -0,0 +1,268 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "bit_vector_index.hpp"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../common/exception.hpp"
+#include "../storage/column_table.hpp"
+
+using std::pair;
+using std::string;
+using std::vector;
+using jubatus::core::storage::column_table;
+using jubatus::core::storage::const_bit_vector_column;
+
+namespace jubatus {
+namespace core {
+namespace nearest_neighbor {
+
+namespace {
+
+const uint32_t MAX_PROBE_DEPTH = 3;
+
+void collect_bucket(
+    const jubatus::util::data::unordered_map<uint64_t, vector<uint64_t> >& b,
+    uint64_t key,
+    vector<uint64_t>& ids) {
+  jubatus::util::data::unordered_map<uint64_t, vector<uint64_t> >::
+      const_iterator it = b.find(key);
+  if (it != b.end()) {
+    ids.insert(ids.end(), it->second.begin(), it->second.end());
+  }
+}
+
+// visits all the buckets whose key differs from ``key`` in up to ``depth``
+// bits at or above ``from``
+void probe(
+    const jubatus::util::data::unordered_map<uint64_t, vector<uint64_t> >& b,
+    uint64_t key,
+    uint32_t from,
+    uint32_t band_bits,
+    uint32_t depth,
+    vector<uint64_t>& ids) {
+  if (depth == 0) {
+    return;
+  }
+  for (uint32_t i = from; i < band_bits; ++i) {
+    const uint64_t flipped = key ^ (1LLU << i);
+    collect_bucket(b, flipped, ids);
+    probe(b, flipped, i + 1, band_bits, depth - 1, ids);
+  }
+}
+
+}  // namespace
+
+bit_vector_index::bit_vector_index(
+    uint32_t bitnum,
+    uint32_t tables,
+    uint32_t probe_depth)
+    : bitnum_(bitnum),
+      tables_(tables),
+      band_bits_(std::min<uint32_t>(bitnum / tables, 64)),
+      probe_depth_(probe_depth) {
+  buckets_.buckets.resize(tables);
+}
+
+void bit_vector_index::attach(column_table& table) const {
+  table.enable_change_log();
+}
+
+void bit_vector_index::get_candidates(
+    const column_table& table,
+    size_t column_id,
+    const storage::bit_vector& query,
+    vector<uint64_t>& rows) const {
+  if (!is_synced(table)) {
+    sync(table, column_id);
+  }
+
+  // an unset bit_vector has no storage and means all zero
+  vector<uint64_t> zero;
+  const uint64_t* bits = query.raw_data_unsafe();
+  if (bits == NULL) {
+    zero.resize(storage::bit_vector::memory_size(bitnum_) / sizeof(uint64_t));
+    bits = &zero[0];
+  }
+
+  jubatus::util::concurrent::scoped_rlock lk(mutex_);
+  vector<uint64_t> ids;
+  for (uint32_t t = 0; t < tables_; ++t) {
+    const uint64_t key = band(bits, t);
+    collect_bucket(buckets_.buckets[t], key, ids);
+    probe(buckets_.buckets[t], key, 0, band_bits_, probe_depth_, ids);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  rows.reserve(rows.size() + ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const pair<bool, uint64_t> row =
+        table.exact_match_nolock(buckets_.id2key[ids[i]]);
+    if (row.first) {
+      rows.push_back(row.second);
+    }
+  }
+}
+
+size_t bit_vector_index::size() const {
+  jubatus::util::concurrent::scoped_rlock lk(mutex_);
+  return buckets_.key2id.size();
+}
+
+bool bit_vector_index::is_synced(const column_table& table) const {
+  jubatus::util::concurrent::scoped_rlock lk(mutex_);
+  return synced_ == table.get_change_log_end_nolock();
+}
+
+void bit_vector_index::sync(
+    const column_table& table,
+    size_t column_id) const {
+  jubatus::util::concurrent::scoped_lock sync_lk(sync_mutex_);
+  if (is_synced(table)) {
+    // another query has caught up while we were waiting
+    return;
+  }
+  const const_bit_vector_column& column =
+      table.get_bit_vector_column(column_id);
+
+  // synced_ is only written with sync_mutex_ held
+  column_table::change_log_position pos = synced_;
+  vector<string> keys;
+  if (table.read_changed_keys_nolock(pos, keys)) {
+    vector<change_t> changes;
+    changes.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      const pair<bool, uint64_t> row = table.exact_match_nolock(keys[i]);
+      changes.push_back(std::make_pair(
+          keys[i],
+          row.first ? column.get_data_at_unsafe(row.second) : NULL));
+    }
+
+    jubatus::util::concurrent::scoped_wlock lk(mutex_);
+    for (size_t i = 0; i < changes.size(); ++i) {
+      remove(buckets_, changes[i].first);
+      if (changes[i].second) {
+        insert(buckets_, changes[i].first, changes[i].second);
+      }
+    }
+    synced_ = pos;
+    return;
+  }
+
+  // rebuild everything aside, so that queries can still probe the old one
+  buckets_t rebuilt;
+  rebuilt.buckets.resize(tables_);
+  const uint64_t size = table.size_nolock();
+  for (uint64_t i = 0; i < size; ++i) {
+    insert(rebuilt, table.get_key_nolock(i), column.get_data_at_unsafe(i));
+  }
+  {
+    jubatus::util::concurrent::scoped_wlock lk(mutex_);
+    buckets_.swap(rebuilt);
+    synced_ = pos;
+  }
+}
+
+void bit_vector_index::insert(
+    buckets_t& b,
+    const string& key,
+    const uint64_t* bits) const {
+  uint64_t id;
+  if (b.free_ids.empty()) {
+    id = b.id2key.size();
+    b.id2key.push_back(key);
+    b.bands.resize(b.bands.size() + tables_);
+  } else {
+    id = b.free_ids.back();
+    b.free_ids.pop_back();
+    b.id2key[id] = key;
+  }
+  b.key2id[key] = id;
+
+  for (uint32_t t = 0; t < tables_; ++t) {
+    const uint64_t value = band(bits, t);
+    b.bands[id * tables_ + t] = value;
+    b.buckets[t][value].push_back(id);
+  }
+}
+
+void bit_vector_index::remove(buckets_t& b, const string& key) const {
+  jubatus::util::data::unordered_map<string, uint64_t>::iterator it =
+      b.key2id.find(key);
+  if (it == b.key2id.end()) {
+    return;
+  }
+  const uint64_t id = it->second;
+  b.key2id.erase(it);
+
+  for (uint32_t t = 0; t < tables_; ++t) {
+    bucket_t::iterator bucket = b.buckets[t].find(b.bands[id * tables_ + t]);
+    vector<uint64_t>& ids = bucket->second;
+    vector<uint64_t>::iterator pos = std::find(ids.begin(), ids.end(), id);
+    *pos = ids.back();
+    ids.pop_back();
+    if (ids.empty()) {
+      b.buckets[t].erase(bucket);
+    }
+  }
+  b.id2key[id].clear();
+  b.free_ids.push_back(id);
+}
+
+uint64_t bit_vector_index::band(const uint64_t* bits, uint32_t table) const {
+  const size_t start = static_cast<size_t>(table) * band_bits_;
+  const size_t word = start / 64;
+  const size_t offset = start % 64;
+  uint64_t value = bits[word] >> offset;
+  if (offset != 0 && offset + band_bits_ > 64) {
+    value |= bits[word + 1] << (64 - offset);
+  }
+  if (band_bits_ < 64) {
+    value &= (1LLU << band_bits_) - 1;
+  }
+  return value;
+}
+
+bit_vector_index* create_bit_vector_index(
+    uint32_t bitnum,
+    const jubatus::util::data::optional<int32_t>& tables,
+    const jubatus::util::data::optional<int32_t>& probe_depth) {
+  if (!tables) {
+    if (probe_depth) {
+      throw JUBATUS_EXCEPTION(common::invalid_parameter(
+          "index_probe_depth is set but index_tables is not found"));
+    }
+    return NULL;
+  }
+  if (!(1 <= *tables && static_cast<uint32_t>(*tables) <= bitnum)) {
+    throw JUBATUS_EXCEPTION(
+        common::invalid_parameter("1 <= index_tables <= hash_num"));
+  }
+  const int32_t depth = probe_depth ? *probe_depth : 0;
+  if (!(0 <= depth && static_cast<uint32_t>(depth) <= MAX_PROBE_DEPTH)) {
+    throw JUBATUS_EXCEPTION(
+        common::invalid_parameter("0 <= index_probe_depth <= 3"));
+  }
+  return new bit_vector_index(bitnum, *tables, depth);
+}
+
+}  // namespace nearest_neighbor
+}  // namespace core
+}  // namespace jubatus
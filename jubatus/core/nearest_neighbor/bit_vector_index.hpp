@@ -0,0 +1,135 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef JUBATUS_CORE_NEAREST_NEIGHBOR_BIT_VECTOR_INDEX_HPP_
+#define JUBATUS_CORE_NEAREST_NEIGHBOR_BIT_VECTOR_INDEX_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "jubatus/util/concurrent/mutex.h"
+#include "jubatus/util/concurrent/rwmutex.h"
+#include "jubatus/util/data/optional.h"
+#include "jubatus/util/data/unordered_map.h"
+#include "../storage/bit_vector.hpp"
+#include "../storage/column_table.hpp"
+
+namespace jubatus {
+namespace core {
+namespace nearest_neighbor {
+
+/**
+ * Multi-table LSH index over a bit_vector column of a column_table.
+ *
+ * The bit vector is split into ``tables`` bands of consecutive bits, and
+ * each row is put into one bucket per band.  A query collects the rows in
+ * its own buckets and, with ``probe_depth`` > 0, in the buckets whose band
+ * differs from the query in up to ``probe_depth`` bits.  The candidates are
+ * expected to be re-ranked exactly by the caller.
+ *
+ * The index follows the table through its change log, so rows added or
+ * removed by MIX or by other engines sharing the table are also indexed.
+ * Queries probe the buckets under a shared lock; a query which finds the
+ * index behind the table applies the changes under a separate lock, and
+ * only takes the exclusive lock to install them.
+ */
+class bit_vector_index {
+ public:
+  bit_vector_index(uint32_t bitnum, uint32_t tables, uint32_t probe_depth);
+
+  /**
+   * Enables the change log of ``table``; call once before the first
+   * get_candidates.
+   */
+  void attach(storage::column_table& table) const;
+
+  /**
+   * Appends row indexes of the candidates of ``query`` to ``rows``.
+   * Must be called with the table read lock held.
+   */
+  void get_candidates(
+      const storage::column_table& table,
+      size_t column_id,
+      const storage::bit_vector& query,
+      std::vector<uint64_t>& rows) const;
+
+  size_t size() const;
+
+ private:
+  typedef jubatus::util::data::unordered_map<uint64_t, std::vector<uint64_t> >
+      bucket_t;
+
+  struct buckets_t {
+    // Rows are identified by an internal ID, since row indexes of the table
+    // change when a row is deleted.
+    jubatus::util::data::unordered_map<std::string, uint64_t> key2id;
+    std::vector<std::string> id2key;
+    std::vector<uint64_t> free_ids;
+    // band value of row ``id`` on table ``t`` is at ``id * tables + t``
+    std::vector<uint64_t> bands;
+    std::vector<bucket_t> buckets;
+
+    void swap(buckets_t& other) {
+      key2id.swap(other.key2id);
+      id2key.swap(other.id2key);
+      free_ids.swap(other.free_ids);
+      bands.swap(other.bands);
+      buckets.swap(other.buckets);
+    }
+  };
+
+  // a row to (re-)index, or to remove when bits is NULL
+  typedef std::pair<std::string, const uint64_t*> change_t;
+
+  bool is_synced(const storage::column_table& table) const;
+  void sync(const storage::column_table& table, size_t column_id) const;
+  void insert(
+      buckets_t& b,
+      const std::string& key,
+      const uint64_t* bits) const;
+  void remove(buckets_t& b, const std::string& key) const;
+  uint64_t band(const uint64_t* bits, uint32_t table) const;
+
+  const uint32_t bitnum_;
+  const uint32_t tables_;
+  const uint32_t band_bits_;
+  const uint32_t probe_depth_;
+
+  // held while probing (shared) or installing changes (exclusive)
+  mutable jubatus::util::concurrent::rw_mutex mutex_;
+  // serializes reading the change log and preparing changes;
+  // must be acquired before mutex_
+  mutable jubatus::util::concurrent::mutex sync_mutex_;
+
+  mutable buckets_t buckets_;
+  // position of the table change log reflected in buckets_
+  mutable storage::column_table::change_log_position synced_;
+};
+
+// Creates an index from the ``index_tables`` and ``index_probe_depth``
+// config parameters of nearest_neighbor engines; returns NULL when
+// ``index_tables`` is not set.
+bit_vector_index* create_bit_vector_index(
+    uint32_t bitnum,
+    const jubatus::util::data::optional<int32_t>& tables,
+    const jubatus::util::data::optional<int32_t>& probe_depth);
+
+}  // namespace nearest_neighbor
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_NEAREST_NEIGHBOR_BIT_VECTOR_INDEX_HPP_
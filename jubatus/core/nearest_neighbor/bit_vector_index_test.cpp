@@ -0,0 +1,163 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "bit_vector_index.hpp"
+#include "../storage/column_table.hpp"
+
+using std::string;
+using std::vector;
+using jubatus::core::storage::bit_vector;
+using jubatus::core::storage::column_table;
+using jubatus::core::storage::column_type;
+using jubatus::core::storage::owner;
+
+namespace jubatus {
+namespace core {
+namespace nearest_neighbor {
+namespace {
+
+bit_vector make_bv(const string& in_str) {
+  bit_vector bv(in_str.size());
+  for (size_t i = 0; i < in_str.size(); ++i) {
+    if (in_str[i] == '1') {
+      bv.set_bit(i);
+    }
+  }
+  return bv;
+}
+
+vector<string> candidates(
+    const bit_vector_index& index,
+    const column_table& table,
+    const string& query) {
+  vector<uint64_t> rows;
+  index.get_candidates(table, 0, make_bv(query), rows);
+  vector<string> keys;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    keys.push_back(table.get_key_nolock(rows[i]));
+  }
+  std::sort(keys.begin(), keys.end());
+  return keys;
+}
+
+class bit_vector_index_test : public testing::Test {
+ protected:
+  void SetUp() {
+    vector<column_type> schema;
+    schema.push_back(column_type(column_type::bit_vector_type, 8));
+    table_.init(schema);
+  }
+
+  column_table table_;
+};
+
+}  // namespace
+
+TEST_F(bit_vector_index_test, buckets) {
+  // two tables of 4 bits each, no probing
+  bit_vector_index index(8, 2, 0);
+  index.attach(table_);
+
+  table_.add("a", owner("local"), make_bv("11110000"));
+  table_.add("b", owner("local"), make_bv("11111111"));
+  table_.add("c", owner("local"), make_bv("00001111"));
+
+  vector<string> expect;
+  expect.push_back("a");
+  expect.push_back("b");
+  EXPECT_EQ(expect, candidates(index, table_, "11110000"));
+  EXPECT_EQ(3u, index.size());
+
+  expect.clear();
+  EXPECT_EQ(expect, candidates(index, table_, "01010101"));
+}
+
+TEST_F(bit_vector_index_test, probe) {
+  bit_vector_index index(8, 2, 1);
+  index.attach(table_);
+
+  table_.add("a", owner("local"), make_bv("11110000"));
+  table_.add("b", owner("local"), make_bv("01110111"));
+  table_.add("c", owner("local"), make_bv("00110011"));
+
+  vector<string> expect;
+  expect.push_back("a");
+  expect.push_back("b");
+  // "b" differs from the query in one bit of the first band
+  EXPECT_EQ(expect, candidates(index, table_, "11110000"));
+}
+
+TEST_F(bit_vector_index_test, follow_table_changes) {
+  bit_vector_index index(8, 2, 0);
+  index.attach(table_);
+
+  table_.add("a", owner("local"), make_bv("11110000"));
+  table_.add("b", owner("local"), make_bv("11110000"));
+  table_.add("c", owner("local"), make_bv("11110000"));
+  EXPECT_EQ(3u, candidates(index, table_, "11110000").size());
+
+  // deleting a row moves the last row into its place
+  table_.delete_row("a");
+  vector<string> expect;
+  expect.push_back("b");
+  expect.push_back("c");
+  EXPECT_EQ(expect, candidates(index, table_, "11110000"));
+
+  // overwrite
+  table_.add("b", owner("local"), make_bv("00001111"));
+  expect.clear();
+  expect.push_back("c");
+  EXPECT_EQ(expect, candidates(index, table_, "11110000"));
+  expect.clear();
+  expect.push_back("b");
+  EXPECT_EQ(expect, candidates(index, table_, "00001111"));
+  EXPECT_EQ(2u, index.size());
+
+  table_.clear();
+  EXPECT_TRUE(candidates(index, table_, "11110000").empty());
+  EXPECT_EQ(0u, index.size());
+}
+
+TEST_F(bit_vector_index_test, shared_change_log) {
+  // both indexes follow the same log with their own positions
+  bit_vector_index index1(8, 2, 0);
+  bit_vector_index index2(8, 2, 0);
+  index1.attach(table_);
+  index2.attach(table_);
+
+  table_.add("a", owner("local"), make_bv("11110000"));
+  EXPECT_EQ(1u, candidates(index1, table_, "11110000").size());
+  EXPECT_EQ(1u, candidates(index2, table_, "11110000").size());
+
+  table_.add("b", owner("local"), make_bv("11110000"));
+  EXPECT_EQ(2u, candidates(index1, table_, "11110000").size());
+  table_.delete_row("a");
+  vector<string> expect;
+  expect.push_back("b");
+  EXPECT_EQ(expect, candidates(index2, table_, "11110000"));
+  EXPECT_EQ(expect, candidates(index1, table_, "11110000"));
+  EXPECT_EQ(1u, index1.size());
+  EXPECT_EQ(1u, index2.size());
+}
+
+}  // namespace nearest_neighbor
+}  // namespace core
+}  // namespace jubatus
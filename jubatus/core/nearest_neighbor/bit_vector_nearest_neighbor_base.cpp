@@ -66,6 +66,12 @@ void bit_vector_nearest_neighbor_base::set_row(
   get_table()->add(id, owner(my_id_), hash(sfv));
 }
 
+void bit_vector_nearest_neighbor_base::set_row(
+    const string& id,
+    const common::sfvi_t& sfv) {
+  get_table()->add(id, owner(my_id_), hash(sfv));
+}
+
 void bit_vector_nearest_neighbor_base::neighbor_row(
     const common::sfv_t& query,
     vector<pair<string, double> >& ids,
@@ -78,6 +84,18 @@ void bit_vector_nearest_neighbor_base::neighbor_row(
   neighbor_row_from_hash(query_hash, ids, ret_num);
 }
 
+void bit_vector_nearest_neighbor_base::neighbor_row(
+    const common::sfvi_t& query,
+    vector<pair<string, double> >& ids,
+    uint64_t ret_num) const {
+  const bit_vector query_hash = hash(query);
+  util::concurrent::scoped_rlock lk(get_const_table()->get_mutex());
+
+  /* table lock acquired; all subsequent table operations must be nolock */
+
+  neighbor_row_from_hash(query_hash, ids, ret_num);
+}
+
 void bit_vector_nearest_neighbor_base::neighbor_row(
     const string& query_id,
     vector<pair<string, double> >& ids,
@@ -97,6 +115,13 @@ void bit_vector_nearest_neighbor_base::neighbor_row(
   neighbor_row_from_hash(col[maybe_index.second], ids, ret_num);
 }
 
+void bit_vector_nearest_neighbor_base::set_index(bit_vector_index* index) {
+  index_.reset(index);
+  if (index_) {
+    index_->attach(*get_table());
+  }
+}
+
 void bit_vector_nearest_neighbor_base::fill_schema(
     vector<column_type>& schema) {
   bit_vector_column_id_ = schema.size();
@@ -116,8 +141,19 @@ void bit_vector_nearest_neighbor_base::neighbor_row_from_hash(
   // take lock out of this function
   vector<pair<uint64_t, double> > scores;
 
-  ranking_hamming_bit_vectors(
-    query, bit_vector_column(), scores, ret_num, threads_);
+  vector<uint64_t> candidates;
+  if (index_) {
+    index_->get_candidates(
+        *get_const_table(), bit_vector_column_id_, query, candidates);
+  }
+  if (index_ && candidates.size() >= ret_num) {
+    ranking_hamming_bit_vectors(
+      query, bit_vector_column(), candidates, scores, ret_num);
+  } else {
+    // too few candidates in the buckets; fall back to scanning all rows
+    ranking_hamming_bit_vectors(
+      query, bit_vector_column(), scores, ret_num, threads_);
+  }
 
   jubatus::util::lang::shared_ptr<const column_table> table = get_const_table();
   ids.clear();
@@ -22,6 +22,7 @@
 #include <utility>
 #include <vector>
 #include "jubatus/util/lang/shared_ptr.h"
+#include "bit_vector_index.hpp"
 #include "nearest_neighbor_base.hpp"
 
 namespace jubatus {
@@ -46,10 +47,15 @@ class bit_vector_nearest_neighbor_base : public nearest_neighbor_base {
   uint32_t bitnum() const { return bitnum_; }
 
   virtual void set_row(const std::string& id, const common::sfv_t& sfv);
+  virtual void set_row(const std::string& id, const common::sfvi_t& sfv);
   virtual void neighbor_row(
       const common::sfv_t& query,
       std::vector<std::pair<std::string, double> >& ids,
       uint64_t ret_num) const;
+  virtual void neighbor_row(
+      const common::sfvi_t& query,
+      std::vector<std::pair<std::string, double> >& ids,
+      uint64_t ret_num) const;
   virtual void neighbor_row(
       const std::string& query_id,
       std::vector<std::pair<std::string, double> >& ids,
@@ -57,6 +63,7 @@ class bit_vector_nearest_neighbor_base : public nearest_neighbor_base {
 
  private:
   virtual storage::bit_vector hash(const common::sfv_t& sfv) const = 0;
+  virtual storage::bit_vector hash(const common::sfvi_t& sfv) const = 0;
 
   void fill_schema(std::vector<storage::column_type>& schema);
   storage::const_bit_vector_column& bit_vector_column() const;
@@ -70,7 +77,13 @@ class bit_vector_nearest_neighbor_base : public nearest_neighbor_base {
   uint32_t bitnum_;
 
  protected:
+  // takes ownership of ``index``; NULL disables the index
+  void set_index(bit_vector_index* index);
+
   uint32_t threads_;
+
+ private:
+  jubatus::util::lang::shared_ptr<bit_vector_index> index_;
 };
 
 }  // namespace nearest_neighbor
@@ -81,6 +81,10 @@ class bit_vector_nearest_neighbor_mock
     return hash_value_;
   }
 
+  virtual bit_vector hash(const common::sfvi_t&) const {
+    return hash_value_;
+  }
+
  private:
   bit_vector hash_value_;
 };
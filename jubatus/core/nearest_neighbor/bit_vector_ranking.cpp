@@ -14,6 +14,7 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <algorithm>
 #include <functional>
 #include <utility>
 #include <vector>
@@ -38,10 +39,14 @@ static heap_t ranking_hamming_bit_vectors_worker(
     const bit_vector *query, const_bit_vector_column *bvs,
     uint64_t ret_num, size_t off, size_t end) {
   heap_t heap(ret_num);
-  for (uint64_t i = off; i < end; ++i) {
-    const size_t dist = query->calc_hamming_distance_unsafe(
-      bvs->get_data_at_unsafe(i));
-    heap.push(make_pair(dist, i));
+  uint32_t dists[HAMMING_BATCH_SIZE];
+  for (uint64_t i = off; i < end; i += HAMMING_BATCH_SIZE) {
+    const size_t n = std::min<size_t>(HAMMING_BATCH_SIZE, end - i);
+    query->calc_hamming_distances_unsafe(
+      bvs->get_data_at_unsafe(i), bvs->blocks_per_value(), n, dists);
+    for (size_t j = 0; j < n; ++j) {
+      heap.push(make_pair(dists[j], i + j));
+    }
   }
   return heap;
 }
@@ -71,6 +76,29 @@ void ranking_hamming_bit_vectors(
   }
 }
 
+void ranking_hamming_bit_vectors(
+    const bit_vector& query,
+    const const_bit_vector_column& bvs,
+    const vector<uint64_t>& candidates,
+    vector<pair<uint64_t, double> >& ret,
+    uint64_t ret_num) {
+  ret.clear();
+  heap_t heap(ret_num);
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    const uint64_t row = candidates[i];
+    heap.push(make_pair(
+        query.calc_hamming_distance_unsafe(bvs.get_data_at_unsafe(row)), row));
+  }
+
+  vector<pair<uint32_t, uint64_t> > sorted;
+  heap.get_sorted(sorted);
+
+  const double denom = query.bit_num();
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    ret.push_back(make_pair(sorted[i].second, sorted[i].first / denom));
+  }
+}
+
 }  // namespace nearest_neighbor
 }  // namespace core
 }  // namespace jubatus
@@ -38,35 +38,36 @@ typedef const bit_vector_column const_bit_vector_column;
 }
 namespace nearest_neighbor {
 
+// number of rows whose distances are computed at once by the batch
+// Hamming kernel
+const size_t HAMMING_BATCH_SIZE = 256;
+
 void ranking_hamming_bit_vectors(
     const storage::bit_vector& query,
     const storage::const_bit_vector_column& bvs,
     std::vector<std::pair<uint64_t, double> >& ret,
     uint64_t ret_num, uint32_t threads);
 
+// ranks only the rows listed in ``candidates``
+void ranking_hamming_bit_vectors(
+    const storage::bit_vector& query,
+    const storage::const_bit_vector_column& bvs,
+    const std::vector<uint64_t>& candidates,
+    std::vector<std::pair<uint64_t, double> >& ret,
+    uint64_t ret_num);
+
+template <typename THeap>
+void merge_heap(THeap& heap, const THeap& other) {
+  heap.merge(other);
+}
+
 template <typename Function, typename THeap>
 void ranking_hamming_bit_vectors_internal(
     Function& f, size_t size, uint32_t threads, THeap& heap) {
-  typedef std::vector<
-    jubatus::util::lang::shared_ptr<
-      jubatus::core::common::thread_pool::future<THeap> > > future_list_t;
   assert(size > 0);
   if (threads > 1) {
-    size_t block_size = static_cast<size_t>(
-      std::ceil(size / static_cast<float>(threads)));
-    std::vector<jubatus::util::lang::function<THeap()> > funcs;
-    funcs.reserve(size / block_size + 1);
-    for (size_t t = 0, end = 0; t < threads && end < size ; ++t) {
-      size_t off = end;
-      end += std::min(block_size, size - off);
-      funcs.push_back(jubatus::util::lang::bind(f, off, end));
-    }
-    future_list_t futures =
-      jubatus::core::common::default_thread_pool::async_all(funcs);
-    for (typename future_list_t::iterator it = futures.begin();
-         it != futures.end(); ++it) {
-      heap.merge((*it)->get());
-    }
+    jubatus::core::common::default_thread_pool::parallel_reduce<THeap>(
+        0, size, threads, f, &merge_heap<THeap>, heap);
   } else {
     heap.merge(f(0, size));
   }
@@ -16,6 +16,7 @@
 
 #include "euclid_lsh.hpp"
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -47,7 +48,8 @@ namespace core {
 namespace nearest_neighbor {
 namespace {
 
-double squared_l2norm(const common::sfv_t& sfv) {
+template <typename FV>
+double squared_l2norm(const FV& sfv) {
   double sqnorm = 0;
   for (size_t i = 0; i < sfv.size(); ++i) {
     sqnorm += sfv[i].second * sfv[i].second;
@@ -55,10 +57,20 @@ double squared_l2norm(const common::sfv_t& sfv) {
   return sqnorm;
 }
 
-double l2norm(const common::sfv_t& sfv) {
+template <typename FV>
+double l2norm(const FV& sfv) {
   return std::sqrt(squared_l2norm(sfv));
 }
 
+double calc_score(size_t hamm_dist, double denom, double norm, double norm_i) {
+  if (hamm_dist == 0) {
+    return std::fabs(norm - norm_i);
+  }
+  const double theta = hamm_dist * M_PI / denom;
+  return std::sqrt(
+      norm * norm + norm_i * norm_i - 2 * norm * norm_i * std::cos(theta));
+}
+
 }  // namespace
 
 euclid_lsh::euclid_lsh(
@@ -125,6 +137,26 @@ void euclid_lsh::neighbor_row(
   neighbor_row_from_hash(bv, norm, ids, ret_num);
 }
 
+void euclid_lsh::set_row(const string& id, const common::sfvi_t& sfv) {
+  get_table()->add(id, owner(my_id_),
+                   cosine_lsh(sfv, hash_num_, threads_, cache_), l2norm(sfv));
+}
+
+void euclid_lsh::neighbor_row(
+    const common::sfvi_t& query,
+    vector<pair<string, double> >& ids,
+    uint64_t ret_num) const {
+  util::concurrent::scoped_rlock lk(get_const_table()->get_mutex());
+
+  /* table lock acquired; all subsequent table operations must be nolock */
+
+  neighbor_row_from_hash(
+      cosine_lsh(query, hash_num_, threads_, cache_),
+      l2norm(query),
+      ids,
+      ret_num);
+}
+
 void euclid_lsh::set_config(const config& conf) {
   if (!(1 <= conf.hash_num)) {
     throw JUBATUS_EXCEPTION(
@@ -133,6 +165,11 @@ void euclid_lsh::set_config(const config& conf) {
   hash_num_ = conf.hash_num;
   threads_ = read_threads_config(conf.threads);
   init_cache_from_config(cache_, conf.cache_size);
+  index_.reset(create_bit_vector_index(
+      conf.hash_num, conf.index_tables, conf.index_probe_depth));
+  if (index_) {
+    index_->attach(*get_table());
+  }
 }
 
 void euclid_lsh::fill_schema(vector<column_type>& schema) {
@@ -154,19 +191,15 @@ static heap_t ranking_hamming_bit_vectors_worker(
     const_double_column *norm_col, double denom, double norm,
     uint64_t ret_num, size_t off, size_t end) {
   heap_t heap(ret_num);
-  for (size_t i = off; i < end; ++i) {
-    const size_t hamm_dist =
-      bv->calc_hamming_distance_unsafe(bv_col->get_data_at_unsafe(i));
-    const double norm_i = (*norm_col)[i];
-    double score;
-    if (hamm_dist == 0) {
-      score = std::fabs(norm - norm_i);
-    } else {
-      const double theta = hamm_dist * M_PI / denom;
-      score = std::sqrt(
-          norm * norm + norm_i * norm_i - 2 * norm * norm_i * std::cos(theta));
+  uint32_t dists[HAMMING_BATCH_SIZE];
+  for (size_t i = off; i < end; i += HAMMING_BATCH_SIZE) {
+    const size_t n = std::min<size_t>(HAMMING_BATCH_SIZE, end - i);
+    bv->calc_hamming_distances_unsafe(
+      bv_col->get_data_at_unsafe(i), bv_col->blocks_per_value(), n, dists);
+    for (size_t j = 0; j < n; ++j) {
+      heap.push(make_pair(
+          calc_score(dists[j], denom, norm, (*norm_col)[i + j]), i + j));
     }
-    heap.push(make_pair(score, i));
   }
   return heap;
 }
@@ -188,13 +221,30 @@ void euclid_lsh::neighbor_row_from_hash(
   const_double_column& norm_col = norm_column();
   const double denom = bv.bit_num();
   heap_t heap(ret_num);
-  jubatus::util::lang::function<heap_t(size_t, size_t)> f =
-    jubatus::util::lang::bind(
-      &ranking_hamming_bit_vectors_worker, &bv, &bv_col, &norm_col,
-      denom, norm, ret_num,
-      jubatus::util::lang::_1, jubatus::util::lang::_2);
-  ranking_hamming_bit_vectors_internal(
-      f, table->size_nolock(), threads_, heap);
+
+  vector<uint64_t> candidates;
+  if (index_) {
+    index_->get_candidates(*table, first_column_id_, bv, candidates);
+  }
+  if (index_ && candidates.size() >= ret_num) {
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      const uint64_t row = candidates[i];
+      heap.push(make_pair(
+          calc_score(
+              bv.calc_hamming_distance_unsafe(bv_col.get_data_at_unsafe(row)),
+              denom, norm, norm_col[row]),
+          row));
+    }
+  } else {
+    // too few candidates in the buckets; fall back to scanning all rows
+    jubatus::util::lang::function<heap_t(size_t, size_t)> f =
+      jubatus::util::lang::bind(
+        &ranking_hamming_bit_vectors_worker, &bv, &bv_col, &norm_col,
+        denom, norm, ret_num,
+        jubatus::util::lang::_1, jubatus::util::lang::_2);
+    ranking_hamming_bit_vectors_internal(
+        f, table->size_nolock(), threads_, heap);
+  }
 
   vector<pair<double, size_t> > sorted;
   heap.get_sorted(sorted);
@@ -25,6 +25,7 @@
 #include "jubatus/util/data/optional.h"
 #include "jubatus/util/lang/shared_ptr.h"
 #include "nearest_neighbor_base.hpp"
+#include "bit_vector_index.hpp"
 #include "lsh_function.hpp"
 
 namespace jubatus {
@@ -38,18 +39,25 @@ class euclid_lsh : public nearest_neighbor_base {
  public:
   struct config {
     config()
-        : hash_num(64u), threads(), cache_size() {
+        : hash_num(64u), threads(), cache_size(),
+          index_tables(), index_probe_depth() {
     }
 
     // TODO(beam2d): make it uint32_t (by modifying pficommon)
     int32_t hash_num;
     jubatus::util::data::optional<int32_t> threads;
     jubatus::util::data::optional<int32_t> cache_size;
+    // number of hash tables (bands) of the bucket index; the index is
+    // disabled and all rows are scanned when not set
+    jubatus::util::data::optional<int32_t> index_tables;
+    // number of bits to flip in a band when probing neighboring buckets
+    jubatus::util::data::optional<int32_t> index_probe_depth;
 
     template <typename Ar>
     void serialize(Ar& ar) {
       ar & JUBA_MEMBER(hash_num) & JUBA_MEMBER(threads)
-        & JUBA_MEMBER(cache_size);
+        & JUBA_MEMBER(cache_size) & JUBA_MEMBER(index_tables)
+        & JUBA_MEMBER(index_probe_depth);
     }
   };
 
@@ -77,6 +85,12 @@ class euclid_lsh : public nearest_neighbor_base {
       std::vector<std::pair<std::string, double> >& ids,
       uint64_t ret_num) const;
 
+  virtual void set_row(const std::string& id, const common::sfvi_t& sfv);
+  virtual void neighbor_row(
+      const common::sfvi_t& query,
+      std::vector<std::pair<std::string, double> >& ids,
+      uint64_t ret_num) const;
+
   virtual double calc_similarity(double distance) const {
     return -distance;
   }
@@ -97,6 +111,7 @@ class euclid_lsh : public nearest_neighbor_base {
   uint32_t hash_num_;
   uint32_t threads_;
   mutable cache_t cache_;
+  jubatus::util::lang::shared_ptr<bit_vector_index> index_;
 };
 
 }  // namespace nearest_neighbor_base
@@ -49,6 +49,10 @@ storage::bit_vector lsh::hash(const common::sfv_t& sfv) const {
   return cosine_lsh(sfv, bitnum(), threads_, cache_);
 }
 
+storage::bit_vector lsh::hash(const common::sfvi_t& sfv) const {
+  return cosine_lsh(sfv, bitnum(), threads_, cache_);
+}
+
 void lsh::set_config(const config& conf) {
   if (!(1 <= conf.hash_num)) {
     throw JUBATUS_EXCEPTION(
@@ -56,6 +60,8 @@ void lsh::set_config(const config& conf) {
   }
   threads_ = read_threads_config(conf.threads);
   init_cache_from_config(cache_, conf.cache_size);
+  set_index(create_bit_vector_index(
+      conf.hash_num, conf.index_tables, conf.index_probe_depth));
 }
 
 }  // namespace nearest_neighbor
@@ -36,17 +36,25 @@ namespace nearest_neighbor {
 class lsh : public bit_vector_nearest_neighbor_base {
  public:
   struct config {
-    config() : hash_num(64u), threads(), cache_size() {
+    config()
+        : hash_num(64u), threads(), cache_size(),
+          index_tables(), index_probe_depth() {
     }
 
     int32_t hash_num;
     jubatus::util::data::optional<int32_t> threads;
     jubatus::util::data::optional<int32_t> cache_size;
+    // number of hash tables (bands) of the bucket index; the index is
+    // disabled and all rows are scanned when not set
+    jubatus::util::data::optional<int32_t> index_tables;
+    // number of bits to flip in a band when probing neighboring buckets
+    jubatus::util::data::optional<int32_t> index_probe_depth;
 
     template <typename Ar>
     void serialize(Ar& ar) {
       ar & JUBA_MEMBER(hash_num) & JUBA_MEMBER(threads)
-        & JUBA_MEMBER(cache_size);
+        & JUBA_MEMBER(cache_size) & JUBA_MEMBER(index_tables)
+        & JUBA_MEMBER(index_probe_depth);
     }
   };
   lsh(const config& conf,
@@ -61,6 +69,7 @@ class lsh : public bit_vector_nearest_neighbor_base {
 
  private:
   virtual storage::bit_vector hash(const common::sfv_t& sfv) const;
+  virtual storage::bit_vector hash(const common::sfvi_t& sfv) const;
   void set_config(const config& conf);
 
   mutable cache_t cache_;
@@ -17,6 +17,7 @@
 #include "lsh_function.hpp"
 
 #include <algorithm>
+#include <utility>
 #include <vector>
 #include "../common/hash.hpp"
 #include "../common/thread_pool.hpp"
@@ -35,8 +36,11 @@ namespace core {
 namespace nearest_neighbor {
 namespace {
 
+// Pairs of a random seed of the feature and its value.
+typedef std::vector<std::pair<uint32_t, float> > seeded_fv_t;
+
 std::vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -50,7 +54,7 @@ inline void next_gaussian_float8(RND& g, float* out);
 #ifdef JUBATUS_USE_FMV
 __attribute__((target("default")))
 std::vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -58,7 +62,7 @@ std::vector<float> random_projection_internal(
 
 __attribute__((target("sse2")))
 std::vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -66,7 +70,7 @@ std::vector<float> random_projection_internal(
 
 __attribute__((target("avx2")))
 std::vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -77,14 +81,19 @@ inline void next_gaussian_float16(RND& g, float* out);
 #endif
 
 std::vector<float> random_projection_dispatcher(
-    const common::sfv_t* sfv,
+    const seeded_fv_t* sfv,
     uint32_t hash_num,
+    cache_t* cache,
     size_t start,
-    size_t end,
-    cache_t* cache) {
+    size_t end) {
   return random_projection_internal(*sfv, hash_num, start, end, *cache);
 }
 
+void add_projection(std::vector<float>& proj, const std::vector<float>& pj) {
+  for (size_t i = 0; i < proj.size(); ++i)
+    proj[i] += pj[i];
+}
+
 inline static void init_cache(
     uint32_t hash_num,
     vector<float>& proj,
@@ -104,42 +113,56 @@ inline static void lru_set_cache_if_enabled(
     uint32_t seed,
     vector<float>& grnd_cache);
 
-}  // namespace
-
-vector<float> random_projection(
-    const common::sfv_t& sfv,
+vector<float> random_projection_seeded(
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     uint32_t threads,
     cache_t& cache) {
-  typedef std::vector<
-    jubatus::util::lang::shared_ptr<
-      common::thread_pool::future<std::vector<float> > > > future_list_t;
   if (threads > 1 && sfv.size() > 0) {
-    size_t block_size =
-      static_cast<size_t>(std::ceil(sfv.size() / static_cast<float>(threads)));
     vector<float> proj(hash_num);
-    std::vector<jubatus::util::lang::function<std::vector<float>()> > funcs;
-    funcs.reserve(sfv.size() / block_size + 1);
-    for (size_t t = 0, end = 0; t < threads && end < sfv.size() ; ++t) {
-      size_t off = end;
-      end += std::min(block_size, sfv.size() - off);
-      funcs.push_back(jubatus::util::lang::bind(
-        &random_projection_dispatcher, &sfv, hash_num, off, end, &cache));
-    }
-    future_list_t futures =
-      jubatus::core::common::default_thread_pool::async_all(funcs);
-    for (future_list_t::iterator it = futures.begin();
-         it != futures.end(); ++it) {
-      const std::vector<float>& pj = (*it)->get();
-      for (size_t i = 0; i < proj.size(); ++i)
-        proj[i] += pj[i];
-    }
+    jubatus::core::common::default_thread_pool::parallel_reduce<
+        std::vector<float> >(
+        0, sfv.size(), threads,
+        jubatus::util::lang::bind(
+            &random_projection_dispatcher, &sfv, hash_num, &cache,
+            jubatus::util::lang::_1, jubatus::util::lang::_2),
+        &add_projection, proj);
     return proj;
   } else {
     return random_projection_internal(sfv, hash_num, 0, sfv.size(), cache);
   }
 }
 
+}  // namespace
+
+vector<float> random_projection(
+    const common::sfv_t& sfv,
+    uint32_t hash_num,
+    uint32_t threads,
+    cache_t& cache) {
+  seeded_fv_t seeded(sfv.size());
+  for (size_t i = 0; i < sfv.size(); ++i) {
+    seeded[i].first = common::hash_util::calc_string_hash(sfv[i].first);
+    seeded[i].second = sfv[i].second;
+  }
+  return random_projection_seeded(seeded, hash_num, threads, cache);
+}
+
+vector<float> random_projection(
+    const common::sfvi_t& sfv,
+    uint32_t hash_num,
+    uint32_t threads,
+    cache_t& cache) {
+  // Feature IDs are the hash values of feature keys, so the projection
+  // is the same as the one of the original string vector.
+  seeded_fv_t seeded(sfv.size());
+  for (size_t i = 0; i < sfv.size(); ++i) {
+    seeded[i].first = sfv[i].first;
+    seeded[i].second = sfv[i].second;
+  }
+  return random_projection_seeded(seeded, hash_num, threads, cache);
+}
+
 bit_vector binarize(const vector<float>& proj) {
   bit_vector bv(proj.size());
   for (size_t i = 0; i < proj.size(); ++i) {
@@ -158,6 +181,14 @@ bit_vector cosine_lsh(
   return binarize(random_projection(sfv, hash_num, threads, cache));
 }
 
+bit_vector cosine_lsh(
+    const common::sfvi_t& sfv,
+    uint32_t hash_num,
+    uint32_t threads,
+    cache_t& cache) {
+  return binarize(random_projection(sfv, hash_num, threads, cache));
+}
+
 namespace {
 
 #if !defined(__SSE2__) || defined(JUBATUS_USE_FMV)
@@ -165,7 +196,7 @@ namespace {
 __attribute__((target("default")))
 #endif
 vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -174,7 +205,7 @@ vector<float> random_projection_internal(
   std::vector<float> grnd_cache;
   init_cache(hash_num, grnd_cache, cache);
   for (size_t i = start; i < end; ++i) {
-    const uint32_t seed = common::hash_util::calc_string_hash(sfv[i].first);
+    const uint32_t seed = sfv[i].first;
     const float v = sfv[i].second;
     if (check_cache(cache, seed, proj, v)) {
       continue;
@@ -196,7 +227,7 @@ vector<float> random_projection_internal(
 __attribute__((target("sse2")))
 #endif
 vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -208,7 +239,7 @@ vector<float> random_projection_internal(
   std::vector<float> grnd_cache;
   init_cache(hash_num, grnd_cache, cache);
   for (size_t i = start; i < end; ++i) {
-    const uint32_t seed = common::hash_util::calc_string_hash(sfv[i].first);
+    const uint32_t seed = sfv[i].first;
     const float v = sfv[i].second;
     if (check_cache(cache, seed, proj, v)) {
       continue;
@@ -273,7 +304,7 @@ inline void next_gaussian_float8(RND& g, float *out) {
 #ifdef JUBATUS_USE_FMV
 __attribute__((target("avx2")))
 vector<float> random_projection_internal(
-    const common::sfv_t& sfv,
+    const seeded_fv_t& sfv,
     uint32_t hash_num,
     size_t start,
     size_t end,
@@ -285,7 +316,7 @@ vector<float> random_projection_internal(
   std::vector<float> grnd_cache;
   init_cache(hash_num, grnd_cache, cache);
   for (size_t i = start; i < end; ++i) {
-    const uint32_t seed = common::hash_util::calc_string_hash(sfv[i].first);
+    const uint32_t seed = sfv[i].first;
     const float v = sfv[i].second;
     if (check_cache(cache, seed, proj, v)) {
       continue;
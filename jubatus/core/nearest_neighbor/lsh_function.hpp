@@ -43,12 +43,22 @@ std::vector<float> random_projection(
     uint32_t hash_num,
     uint32_t threads,
     cache_t& cache);
+std::vector<float> random_projection(
+    const common::sfvi_t& sfv,
+    uint32_t hash_num,
+    uint32_t threads,
+    cache_t& cache);
 storage::bit_vector binarize(const std::vector<float>& proj);
 storage::bit_vector cosine_lsh(
     const common::sfv_t& sfv,
     uint32_t hash_num,
     uint32_t threads,
     cache_t& cache);
+storage::bit_vector cosine_lsh(
+    const common::sfvi_t& sfv,
+    uint32_t hash_num,
+    uint32_t threads,
+    cache_t& cache);
 
 template<typename T>
 void init_cache_from_config(cache_t& cache, const T& config) {
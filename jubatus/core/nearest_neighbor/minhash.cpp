@@ -21,6 +21,7 @@
 #include <string>
 #include <vector>
 #include "../common/hash.hpp"
+#include "../common/thread_pool.hpp"
 #include "bit_vector_ranking.hpp"
 
 using std::string;
@@ -98,6 +99,55 @@ float calc_hash(uint64_t a, uint64_t b, float val) {
   return - std::log(r) / val;
 }
 
+inline uint64_t feature_hash(const std::string& key) {
+  return common::hash_util::calc_string_hash(key);
+}
+
+// Feature IDs are the hash values of feature keys.
+inline uint64_t feature_hash(uint64_t id) {
+  return id;
+}
+
+// Computes the minimum-hash features of bits [begin, end).
+template <typename FV>
+void min_hash_range(
+    const FV* sfv,
+    vector<uint64_t>* hash_buffer,
+    size_t begin,
+    size_t end) {
+  vector<float> min_values_buffer(end - begin, FLT_MAX);
+  for (size_t i = 0; i < sfv->size(); ++i) {
+    uint64_t key_hash = feature_hash((*sfv)[i].first);
+    float val = (*sfv)[i].second;
+    for (size_t j = begin; j < end; ++j) {
+      float hashval = calc_hash(key_hash, j, val);
+      if (hashval < min_values_buffer[j - begin]) {
+        min_values_buffer[j - begin] = hashval;
+        (*hash_buffer)[j] = key_hash;
+      }
+    }
+  }
+}
+
+template <typename FV>
+bit_vector min_hash(const FV& sfv, size_t bitnum, size_t threads) {
+  vector<uint64_t> hash_buffer(bitnum);
+  common::default_thread_pool::parallel_for(
+      0, bitnum, threads,
+      jubatus::util::lang::bind(
+          &min_hash_range<FV>, &sfv, &hash_buffer,
+          jubatus::util::lang::_1, jubatus::util::lang::_2));
+
+  bit_vector bv(bitnum);
+  for (size_t i = 0; i < hash_buffer.size(); ++i) {
+    if ((hash_buffer[i] & 1LLU) == 1) {
+      bv.set_bit(i);
+    }
+  }
+
+  return bv;
+}
+
 }  // namespace
 
 minhash::minhash(
@@ -120,28 +170,11 @@ minhash::minhash(
 }
 
 bit_vector minhash::hash(const common::sfv_t& sfv) const {
-  vector<float> min_values_buffer(bitnum(), FLT_MAX);
-  vector<uint64_t> hash_buffer(bitnum());
-  for (size_t i = 0; i < sfv.size(); ++i) {
-    uint64_t key_hash = common::hash_util::calc_string_hash(sfv[i].first);
-    float val = sfv[i].second;
-    for (uint32_t j = 0; j < bitnum(); ++j) {
-      float hashval = calc_hash(key_hash, j, val);
-      if (hashval < min_values_buffer[j]) {
-        min_values_buffer[j] = hashval;
-        hash_buffer[j] = key_hash;
-      }
-    }
-  }
-
-  bit_vector bv(bitnum());
-  for (size_t i = 0; i < hash_buffer.size(); ++i) {
-    if ((hash_buffer[i] & 1LLU) == 1) {
-      bv.set_bit(i);
-    }
-  }
+  return min_hash(sfv, bitnum(), threads_);
+}
 
-  return bv;
+bit_vector minhash::hash(const common::sfvi_t& sfv) const {
+  return min_hash(sfv, bitnum(), threads_);
 }
 
 void minhash::set_config(const config& conf) {
@@ -150,6 +183,8 @@ void minhash::set_config(const config& conf) {
         common::invalid_parameter("1 <= hash_num"));
   }
   threads_ = read_threads_config(conf.threads);
+  set_index(create_bit_vector_index(
+      conf.hash_num, conf.index_tables, conf.index_probe_depth));
 }
 
 }  // namespace nearest_neighbor
@@ -40,15 +40,21 @@ class minhash : public bit_vector_nearest_neighbor_base {
  public:
   struct config {
     config()
-      : hash_num(64u), threads() {
+      : hash_num(64u), threads(), index_tables(), index_probe_depth() {
     }
 
     int32_t hash_num;
     jubatus::util::data::optional<int32_t> threads;
+    // number of hash tables (bands) of the bucket index; the index is
+    // disabled and all rows are scanned when not set
+    jubatus::util::data::optional<int32_t> index_tables;
+    // number of bits to flip in a band when probing neighboring buckets
+    jubatus::util::data::optional<int32_t> index_probe_depth;
 
     template <typename Ar>
     void serialize(Ar& ar) {
-      ar & JUBA_MEMBER(hash_num) & JUBA_MEMBER(threads);
+      ar & JUBA_MEMBER(hash_num) & JUBA_MEMBER(threads)
+        & JUBA_MEMBER(index_tables) & JUBA_MEMBER(index_probe_depth);
     }
   };
 
@@ -68,6 +74,7 @@ class minhash : public bit_vector_nearest_neighbor_base {
 
  private:
   virtual storage::bit_vector hash(const common::sfv_t& sfv) const;
+  virtual storage::bit_vector hash(const common::sfvi_t& sfv) const;
   void set_config(const config& conf);
 };
 
@@ -68,6 +68,20 @@ void nearest_neighbor_base::clear() {
   mixable_table_->get_model()->clear();  // lock acquired inside
 }
 
+void nearest_neighbor_base::set_row(
+    const string& id,
+    const common::sfvi_t& sfv) {
+  throw JUBATUS_EXCEPTION(common::unsupported_method(type() + "::set_row"));
+}
+
+void nearest_neighbor_base::neighbor_row(
+    const common::sfvi_t& query,
+    vector<pair<string, double> >& ids,
+    uint64_t ret_num) const {
+  throw JUBATUS_EXCEPTION(
+      common::unsupported_method(type() + "::neighbor_row"));
+}
+
 void nearest_neighbor_base::similar_row(
     const common::sfv_t& query,
     vector<pair<string, double> >& ids,
@@ -88,6 +102,16 @@ void nearest_neighbor_base::similar_row(
   }
 }
 
+void nearest_neighbor_base::similar_row(
+    const common::sfvi_t& query,
+    vector<pair<string, double> >& ids,
+    uint64_t ret_num) const {
+  neighbor_row(query, ids, ret_num);  // lock acquired inside
+  for (size_t i = 0; i < ids.size(); ++i) {
+    ids[i].second = calc_similarity(ids[i].second);
+  }
+}
+
 void nearest_neighbor_base::pack(framework::packer& packer) const {
   get_const_table()->pack(packer);  // lock acquired inside
 }
@@ -69,6 +69,15 @@ class nearest_neighbor_base {
     return 1 - distance;
   }
 
+  // Feature ID versions of set_row / neighbor_row.  Feature IDs are the
+  // FNV-1 hashes of feature keys, as made by datum_to_fv_converter.
+  // Engines that do not support feature IDs throw unsupported_method.
+  virtual void set_row(const std::string& id, const common::sfvi_t& sfv);
+  virtual void neighbor_row(
+      const common::sfvi_t& query,
+      std::vector<std::pair<std::string, double> >& ids,
+      uint64_t ret_num) const;
+
   virtual void similar_row(
       const common::sfv_t& query,
       std::vector<std::pair<std::string, double> >& ids,
@@ -77,6 +86,10 @@ class nearest_neighbor_base {
       const std::string& query_id,
       std::vector<std::pair<std::string, double> >& ids,
       uint64_t ret_num) const;
+  virtual void similar_row(
+      const common::sfvi_t& query,
+      std::vector<std::pair<std::string, double> >& ids,
+      uint64_t ret_num) const;
 
   void pack(framework::packer& packer) const;
   void unpack(msgpack::object o);
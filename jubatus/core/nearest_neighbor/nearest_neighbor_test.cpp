@@ -22,6 +22,7 @@
 #include <gtest/gtest.h>
 #include "jubatus/util/lang/shared_ptr.h"
 #include "jubatus/util/lang/cast.h"
+#include "../common/hash.hpp"
 #include "../common/jsonconfig.hpp"
 #include "nearest_neighbor.hpp"
 #include "nearest_neighbor_base.hpp"
@@ -165,6 +166,65 @@ TEST_P(nearest_neighbor_test, empty_neighbor_row) {
   EXPECT_TRUE(ids.empty());
 }
 
+TEST_P(nearest_neighbor_test, feature_id) {
+  nearest_neighbor_base* nn = get_nn();
+
+  common::sfv_t sfv;
+  sfv.push_back(std::make_pair("a", 1.0));
+  sfv.push_back(std::make_pair("b", 2.0));
+  sfv.push_back(std::make_pair("c", -1.0));
+
+  common::sfvi_t sfvi;
+  for (size_t i = 0; i < sfv.size(); ++i) {
+    sfvi.push_back(std::make_pair(
+        common::hash_util::calc_string_hash(sfv[i].first), sfv[i].second));
+  }
+
+  common::sfv_t other;
+  other.push_back(std::make_pair("a", -1.0));
+  other.push_back(std::make_pair("d", 3.0));
+
+  nn->set_row("by_key", sfv);
+  nn->set_row("by_id", sfvi);
+  nn->set_row("other", other);
+
+  // Feature IDs must produce the same hash as the original keys.
+  vector<std::pair<string, double> > expected, actual;
+  nn->neighbor_row(sfv, expected, 3);
+  nn->neighbor_row(sfvi, actual, 3);
+  ASSERT_EQ(3u, actual.size());
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(actual[0].second, actual[1].second);
+
+  nn->similar_row(sfv, expected, 3);
+  nn->similar_row(sfvi, actual, 3);
+  EXPECT_EQ(expected, actual);
+}
+
+TEST_P(nearest_neighbor_test, neighbor_row_finds_same_hash) {
+  nearest_neighbor_base* nn = get_nn();
+
+  const size_t num = 50;
+  for (size_t i = 0; i < num; ++i) {
+    common::sfv_t sfv;
+    sfv.push_back(std::make_pair(
+        "f" + jubatus::util::lang::lexical_cast<string>(i), 1.0 + i));
+    sfv.push_back(std::make_pair(
+        "g" + jubatus::util::lang::lexical_cast<string>(i % 7), 2.0));
+    nn->set_row(jubatus::util::lang::lexical_cast<string>(i), sfv);
+
+    // rows added after the previous query must be found as well
+    vector<std::pair<string, double> > ids;
+    for (size_t j = 0; j <= i; ++j) {
+      const string id = jubatus::util::lang::lexical_cast<string>(j);
+      nn->neighbor_row(id, ids, 1);
+      ASSERT_EQ(1u, ids.size());
+      // the row itself or another row with the same hash
+      EXPECT_EQ(0.0, ids[0].second);
+    }
+  }
+}
+
 // TODO(beam2d): Write approximated test of neighbor_row().
 
 const map<string, string> configs[] = {
@@ -181,6 +241,20 @@ const map<string, string> configs[] = {
       "nearest_neighbor:name", "euclid_lsh")(
       "hash_num", "64")(
       "threads", "2")(),
+  make_config(
+      "nearest_neighbor:name", "lsh")(
+      "hash_num", "64")(
+      "index_tables", "4")(
+      "index_probe_depth", "1")(),
+  make_config(
+      "nearest_neighbor:name", "minhash")(
+      "hash_num", "64")(
+      "index_tables", "8")(),
+  make_config(
+      "nearest_neighbor:name", "euclid_lsh")(
+      "hash_num", "64")(
+      "index_tables", "4")(
+      "index_probe_depth", "2")(),
 };
 
 INSTANTIATE_TEST_CASE_P(
@@ -229,6 +303,43 @@ TYPED_TEST_P(nearest_neighbor_config_test, config_validation) {
                   shared_ptr<storage::column_table>(new storage::column_table),
                   schema,
                   id));
+
+  // 1 <= index_tables <= hash_num
+  c.index_tables = 0;
+  ASSERT_THROW(TypeParam n(c,
+      shared_ptr<storage::column_table>(new storage::column_table), id),
+      common::invalid_parameter);
+  c.index_tables = 3;
+  ASSERT_THROW(TypeParam n(c,
+      shared_ptr<storage::column_table>(new storage::column_table), id),
+      common::invalid_parameter);
+  c.index_tables = 2;
+  ASSERT_NO_THROW(
+      TypeParam n(c,
+                  shared_ptr<storage::column_table>(new storage::column_table),
+                  id));
+
+  // 0 <= index_probe_depth <= 3
+  c.hash_num = 64;
+  c.index_probe_depth = -1;
+  ASSERT_THROW(TypeParam n(c,
+      shared_ptr<storage::column_table>(new storage::column_table), id),
+      common::invalid_parameter);
+  c.index_probe_depth = 4;
+  ASSERT_THROW(TypeParam n(c,
+      shared_ptr<storage::column_table>(new storage::column_table), id),
+      common::invalid_parameter);
+  c.index_probe_depth = 3;
+  ASSERT_NO_THROW(
+      TypeParam n(c,
+                  shared_ptr<storage::column_table>(new storage::column_table),
+                  id));
+
+  // index_probe_depth requires index_tables
+  c.index_tables = jubatus::util::data::optional<int32_t>();
+  ASSERT_THROW(TypeParam n(c,
+      shared_ptr<storage::column_table>(new storage::column_table), id),
+      common::invalid_parameter);
 }
 
 REGISTER_TYPED_TEST_CASE_P(
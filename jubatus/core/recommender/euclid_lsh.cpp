@@ -131,6 +131,7 @@ euclid_lsh::euclid_lsh(const config& config)
   typedef storage::lsh_index_storage li_storage;
 
   model_ptr p(new li_storage(config.hash_num, config.table_num, config.seed));
+  p->set_threads(threads_);
   mixable_storage_.reset(new mli_storage(p));
 
   if (config.unlearner) {
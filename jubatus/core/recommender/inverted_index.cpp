@@ -84,6 +84,18 @@ void inverted_index::neighbor_row(
   }
 }
 
+void inverted_index::set_threads(uint32_t threads) {
+  mixable_storage_->get_model()->set_threads(threads);
+}
+
+void inverted_index::set_compact_postings(bool compact) {
+  mixable_storage_->get_model()->set_compact_postings(compact);
+}
+
+void inverted_index::set_topk_pruning(bool pruning) {
+  mixable_storage_->get_model()->set_topk_pruning(pruning);
+}
+
 void inverted_index::clear() {
   orig_.clear();
   mixable_storage_->get_model()->clear();
@@ -59,6 +59,15 @@ class inverted_index : public recommender_base {
   void get_all_row_ids(std::vector<std::string>& ids) const;
   std::string type() const;
 
+  // number of threads used to rank rows in similar_row
+  void set_threads(uint32_t threads);
+
+  // keep the master inverted index as compact posting lists
+  void set_compact_postings(bool compact);
+
+  // prune columns that cannot enter the top-k results while ranking
+  void set_topk_pruning(bool pruning);
+
   framework::mixable* get_mixable() const;
 
   void pack(framework::packer& packer) const;
@@ -43,6 +43,9 @@ inverted_index_euclid::inverted_index_euclid(const config& config) {
   } else {
     ignore_orthogonal_ = false;
   }
+  if (config.topk_pruning) {
+    set_topk_pruning(*config.topk_pruning);
+  }
 
   if (config.unlearner) {
     if (!config.unlearner_parameter) {
@@ -33,6 +33,7 @@ class inverted_index_euclid : public inverted_index {
  public:
   struct config {
     jubatus::util::data::optional<bool> ignore_orthogonal;
+    jubatus::util::data::optional<bool> topk_pruning;
     jubatus::util::data::optional<std::string> unlearner;
     jubatus::util::data::optional<core::common::jsonconfig::config>
         unlearner_parameter;
@@ -41,6 +42,7 @@ class inverted_index_euclid : public inverted_index {
     void serialize(Ar& ar) {
       ar
         & JUBA_MEMBER(ignore_orthogonal)
+        & JUBA_MEMBER(topk_pruning)
         & JUBA_MEMBER(unlearner)
         & JUBA_MEMBER(unlearner_parameter);
     }
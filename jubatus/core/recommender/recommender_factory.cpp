@@ -20,6 +20,7 @@
 #include "jubatus/util/text/json.h"
 #include "../common/exception.hpp"
 #include "../common/jsonconfig.hpp"
+#include "../nearest_neighbor/bit_vector_ranking.hpp"
 #include "../nearest_neighbor/nearest_neighbor_factory.hpp"
 #include "../storage/column_table.hpp"
 #include "../unlearner/unlearner_factory.hpp"
@@ -41,10 +42,15 @@ namespace {
 struct inverted_index_config {
   jubatus::util::data::optional<std::string> unlearner;
   jubatus::util::data::optional<config> unlearner_parameter;
+  jubatus::util::data::optional<int32_t> threads;
+  jubatus::util::data::optional<bool> compact_postings;
+  jubatus::util::data::optional<bool> topk_pruning;
 
   template<typename Ar>
   void serialize(Ar& ar) {
-    ar & JUBA_MEMBER(unlearner) & JUBA_MEMBER(unlearner_parameter);
+    ar & JUBA_MEMBER(unlearner) & JUBA_MEMBER(unlearner_parameter)
+        & JUBA_MEMBER(threads) & JUBA_MEMBER(compact_postings)
+        & JUBA_MEMBER(topk_pruning);
   }
 };
 
@@ -68,28 +74,39 @@ shared_ptr<recommender_base> recommender_factory::create_recommender(
     const config& param,
     const string& id) {
   if (name == "inverted_index") {
-    if (!param.is_null()) {
-      inverted_index_config conf =
-          config_cast_check<inverted_index_config>(param);
-      if (conf.unlearner) {
-        if (!conf.unlearner_parameter) {
-          throw JUBATUS_EXCEPTION(
-              common::config_exception() << common::exception::error_message(
-                  "unlearner is set but unlearner_parameter is not found"));
-        }
-        return shared_ptr<recommender_base>(
-            new inverted_index(unlearner::create_unlearner(
-                *conf.unlearner, common::jsonconfig::config(
-                    *conf.unlearner_parameter))));
-      } else {
-        if (conf.unlearner_parameter) {
-          throw JUBATUS_EXCEPTION(
-              common::config_exception() << common::exception::error_message(
-                  "unlearner_parameter is set but unlearner is not found"));
-        }
+    if (param.is_null()) {
+      return shared_ptr<recommender_base>(new inverted_index);
+    }
+    inverted_index_config conf =
+        config_cast_check<inverted_index_config>(param);
+    shared_ptr<inverted_index> recommender;
+    if (conf.unlearner) {
+      if (!conf.unlearner_parameter) {
+        throw JUBATUS_EXCEPTION(
+            common::config_exception() << common::exception::error_message(
+                "unlearner is set but unlearner_parameter is not found"));
       }
+      recommender.reset(
+          new inverted_index(unlearner::create_unlearner(
+              *conf.unlearner, common::jsonconfig::config(
+                  *conf.unlearner_parameter))));
+    } else {
+      if (conf.unlearner_parameter) {
+        throw JUBATUS_EXCEPTION(
+            common::config_exception() << common::exception::error_message(
+                "unlearner_parameter is set but unlearner is not found"));
+      }
+      recommender.reset(new inverted_index);
+    }
+    recommender->set_threads(
+        nearest_neighbor::read_threads_config(conf.threads));
+    if (conf.compact_postings) {
+      recommender->set_compact_postings(*conf.compact_postings);
+    }
+    if (conf.topk_pruning) {
+      recommender->set_topk_pruning(*conf.topk_pruning);
     }
-    return shared_ptr<recommender_base>(new inverted_index);
+    return recommender;
   } else if (name == "inverted_index_euclid") {
     if (!param.is_null()) {
       return shared_ptr<recommender_base>(
@@ -44,6 +44,9 @@ double euclidean_distance_regression::estimate(
         fv, ids, config_.nearest_neighbor_num);
   }
   if (ids.size() > 0) {
+    // read through the const table, which does not copy mapped columns
+    shared_ptr<const storage::column_table> table = values_->get_model();
+    const storage::const_double_column& values = table->get_double_column(0);
     double sum = 0.0;
     if (config_.weight && *config_.weight == "distance") {
       double sum_w = 0.0;
@@ -55,8 +58,8 @@ double euclidean_distance_regression::estimate(
             break;
           }
           const std::pair<bool, uint64_t> index =
-              values_->get_model()->exact_match(it->first);
-          sum += values_->get_model()->get_double_column(0)[index.second];
+              table->exact_match(it->first);
+          sum += values[index.second];
           sum_w += 1.0;
         }
       } else {
@@ -64,8 +67,8 @@ double euclidean_distance_regression::estimate(
                it = ids.begin(); it != ids.end(); ++it) {
           double w = 1.0 / (-1.0 * it->second);
           const std::pair<bool, uint64_t> index =
-              values_->get_model()->exact_match(it->first);
-          sum += w * values_->get_model()->get_double_column(0)[index.second];
+              table->exact_match(it->first);
+          sum += w * values[index.second];
           sum_w += w;
         }
       }
@@ -74,8 +77,8 @@ double euclidean_distance_regression::estimate(
       for (std::vector<std::pair<std::string, double> >:: const_iterator
              it = ids.begin(); it != ids.end(); ++it) {
         const std::pair<bool, uint64_t> index =
-            values_->get_model()->exact_match(it->first);
-        sum += values_->get_model()->get_double_column(0)[index.second];
+            table->exact_match(it->first);
+        sum += values[index.second];
       }
       return sum / ids.size();
     }
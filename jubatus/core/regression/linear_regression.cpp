@@ -82,6 +82,15 @@ void linear_regression::unpack(msgpack::object o) {
   mixable_storage_.get_model()->unpack(o.via.array.ptr[0]);
 }
 
+void linear_regression::pack_chunked(
+    framework::packer& pk, size_t chunk_rows) const {
+  mixable_storage_.get_model()->pack_chunked(pk, chunk_rows);
+}
+
+void linear_regression::unpack_chunked(framework::unpacker& unpacker) {
+  mixable_storage_.get_model()->unpack_chunked(unpacker);
+}
+
 std::vector<framework::mixable*> linear_regression::get_mixables() {
   std::vector<framework::mixable*> mixables;
   mixables.push_back(&mixable_storage_);
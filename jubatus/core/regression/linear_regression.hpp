@@ -51,6 +51,8 @@ class linear_regression : public regression_base {
 
   void pack(framework::packer& pk) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& pk, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
 
  protected:
   void update(const common::sfv_t& fv, double coeff);
@@ -120,6 +120,9 @@ double nearest_neighbor_regression::estimate(
   nearest_neighbor_engine_->neighbor_row(fv, ids, config_.nearest_neighbor_num);
 
   if (ids.size() > 0) {
+    // read through the const table, which does not copy mapped columns
+    shared_ptr<const storage::column_table> table = values_->get_model();
+    const storage::const_double_column& values = table->get_double_column(0);
     double sum = 0.0;
     if (config_.weight && *config_.weight == "distance") {
       double sum_w = 0.0;
@@ -131,8 +134,8 @@ double nearest_neighbor_regression::estimate(
             break;
           }
           const std::pair<bool, uint64_t> index =
-              values_->get_model()->exact_match(it->first);
-          sum += values_->get_model()->get_double_column(0)[index.second];
+              table->exact_match(it->first);
+          sum += values[index.second];
           sum_w += 1.0;
         }
       } else {
@@ -140,8 +143,8 @@ double nearest_neighbor_regression::estimate(
                  it = ids.begin(); it != ids.end(); ++it) {
           double w = 1.0 / it->second;
           const std::pair<bool, uint64_t> index =
-              values_->get_model()->exact_match(it->first);
-          sum += w * values_->get_model()->get_double_column(0)[index.second];
+              table->exact_match(it->first);
+          sum += w * values[index.second];
           sum_w += w;
         }
       }
@@ -150,8 +153,8 @@ double nearest_neighbor_regression::estimate(
       for (std::vector<std::pair<std::string, double> >:: const_iterator
                it = ids.begin(); it != ids.end(); ++it) {
         const std::pair<bool, uint64_t> index =
-            values_->get_model()->exact_match(it->first);
-        sum += values_->get_model()->get_double_column(0)[index.second];
+            table->exact_match(it->first);
+        sum += values[index.second];
     }
       return sum / ids.size();
     }
@@ -22,6 +22,7 @@
 #include <vector>
 #include "jubatus/util/lang/shared_ptr.h"
 #include "../common/type.hpp"
+#include "../framework/packer.hpp"
 #include "../framework/linear_function_mixer.hpp"
 
 namespace jubatus {
@@ -55,6 +56,18 @@ class regression_base {
   virtual void pack(framework::packer& pk) const = 0;
   virtual void unpack(msgpack::object o) = 0;
 
+  // Writes the model to be read by |unpack_chunked|.  Regressions whose
+  // storage can be written in batches of at most |chunk_rows| rows override
+  // these; the default writes the model as a single object.
+  virtual void pack_chunked(framework::packer& pk, size_t chunk_rows) const {
+    pack(pk);
+  }
+  virtual void unpack_chunked(framework::unpacker& unpacker) {
+    msgpack::unpacked model;
+    unpacker.next(model);
+    unpack(model.get());
+  }
+
   virtual std::vector<framework::mixable*> get_mixables() = 0;
   // Currently only nearest neighbor regression uses unlearner.
   virtual void set_unlearner(
@@ -19,18 +19,19 @@
 #include <cmath>
 #include <string>
 #include <utility>
-#include "jubatus/util/system/time_util.h"
 
 using std::string;
-using jubatus::util::system::time::clock_time;
-using jubatus::util::system::time::get_clock_time;
 
 namespace jubatus {
 namespace core {
 namespace stat {
 
+const int stat::DEFAULT_MOMENT_ORDER = 2;
+
 stat::stat(size_t window_size)
     : window_size_(window_size),
+      moment_order_(DEFAULT_MOMENT_ORDER),
+      seq_(0),
       e_(0),
       n_(0) {
   if (!(1 <= window_size)) {
@@ -39,6 +40,22 @@ stat::stat(size_t window_size)
   }
 }
 
+stat::stat(size_t window_size, int moment_order)
+    : window_size_(window_size),
+      moment_order_(moment_order),
+      seq_(0),
+      e_(0),
+      n_(0) {
+  if (!(1 <= window_size)) {
+    throw JUBATUS_EXCEPTION(
+        common::invalid_parameter("1 <= window_size"));
+  }
+  if (!(2 <= moment_order)) {
+    throw JUBATUS_EXCEPTION(
+        common::invalid_parameter("2 <= moment_order"));
+  }
+}
+
 stat::~stat() {
 }
 
@@ -68,30 +85,44 @@ void stat::mix(
 }
 
 void stat::push(const std::string& key, double val) {
+  const uint64_t current = period();
   {
-    clock_time ct = get_clock_time();
-    window_.push_back(make_pair((uint64_t) ct, make_pair(key, val)));
-    stats_[key].add(val);
+    window_entry entry;
+    entry.seq = seq_++;
+    entry.val = val;
+    get_stat_val(key, entry.stat).add(entry.seq, val, current);
+    window_.push_back(entry);
   }
   while (window_.size() > window_size_) {
-    string key = window_.front().second.first;
-    double val = window_.front().second.second;
-    stat_val& st = stats_[key];
+    const window_entry entry = window_.front();
+    stat_val& st = entry.stat->second;
     window_.pop_front();
-    st.rem(val, key, *this);
+    st.rem(entry.seq, entry.val, current);
     if (st.n_ == 0) {
-      stats_.erase(key);
+      stats_.erase(stats_.find(entry.stat->first));
     }
   }
 }
 
+stat::stat_val& stat::get_stat_val(
+    const std::string& key,
+    stats_t::value_type*& elem) {
+  std::pair<stats_t::iterator, bool> r =
+      stats_.insert(std::make_pair(key, stat_val()));
+  if (r.second) {
+    r.first->second.resize_powers(moment_order_ - 2);
+  }
+  elem = &*r.first;
+  return r.first->second;
+}
+
 double stat::sum(const std::string& key) const {
   jubatus::util::data::unordered_map<std::string, stat_val>::const_iterator p =
       stats_.find(key);
   if (p == stats_.end()) {
     throw JUBATUS_EXCEPTION(stat_error("sum: key " + key + " not found"));
   }
-  return p->second.sum_;
+  return p->second.power_sum(1, period());
 }
 
 double stat::stddev(const std::string& key) const {
@@ -101,7 +132,7 @@ double stat::stddev(const std::string& key) const {
     throw JUBATUS_EXCEPTION(stat_error("stddev: key " + key + " not found"));
   }
   const stat_val& st = p->second;
-  return std::sqrt(moment(key, 2, st.sum_ / st.n_));
+  return std::sqrt(moment(key, 2, st.power_sum(1, period()) / st.n_));
 }
 
 double stat::max(const std::string& key) const {
@@ -127,11 +158,8 @@ double stat::min(const std::string& key) const {
 double stat::entropy() const {
   if (n_ == 0) {
     // not MIXed ever yet
-    size_t total = 0;
-    for (jubatus::util::data::unordered_map<std::string, stat_val>::
-        const_iterator p = stats_.begin(); p != stats_.end(); ++p) {
-      total += p->second.n_;
-    }
+    // each value in the window is counted in one of stats_
+    const size_t total = window_.size();
     double ret = 0;
     for (jubatus::util::data::unordered_map<std::string, stat_val>::
         const_iterator p = stats_.begin(); p != stats_.end(); ++p) {
@@ -154,26 +182,40 @@ double stat::moment(const std::string& key, int n, double c) const {
     throw JUBATUS_EXCEPTION(stat_error("moment: key " + key + " not found"));
   }
   const stat_val& st = p->second;
+  const uint64_t current = period();
 
   if (n == 0) {
     return 1;
   }
 
   if (n == 1) {
-    return (st.sum_ - c * st.n_) / st.n_;
+    return (st.power_sum(1, current) - c * st.n_) / st.n_;
   }
 
   if (n == 2) {
-    return (st.sum2_ - 2 * st.sum_ * c) / st.n_ + c * c;
+    return (st.power_sum(2, current) - 2 * st.power_sum(1, current) * c) /
+        st.n_ + c * c;
+  }
+
+  if (n <= moment_order_) {
+    // binomial expansion of sum((d - c)^n) by the power sums
+    double ret = 0;
+    double binom = 1;  // n choose k
+    for (int k = 0; k <= n; ++k) {
+      const double power_sum = k == 0 ? st.n_ : st.power_sum(k, current);
+      ret += binom * std::pow(-c, n - k) * power_sum;
+      binom = binom * (n - k) / (k + 1);
+    }
+    return ret / st.n_;
   }
 
   // fallback
   double ret = 0;
   for (size_t i = 0; i < window_.size(); ++i) {
-    if (window_[i].second.first != key) {
+    if (window_[i].stat != &*p) {
       continue;
     }
-    ret += std::pow(window_[i].second.second - c, n);
+    ret += std::pow(window_[i].val - c, n);
   }
   return ret / st.n_;
 }
@@ -181,6 +223,7 @@ double stat::moment(const std::string& key, int n, double c) const {
 void stat::clear() {
   window_.clear();
   stats_.clear();
+  seq_ = 0;
 }
 
 void stat::pack(framework::packer& packer) const {
@@ -189,6 +232,41 @@ void stat::pack(framework::packer& packer) const {
 void stat::unpack(msgpack::object o) {
   o.convert(this);
 }
+void stat::msgpack_unpack(msgpack::object o) {
+  if (o.type != msgpack::type::ARRAY || o.via.array.size != 5) {
+    throw msgpack::type_error();
+  }
+  std::deque<std::pair<uint64_t, std::pair<std::string, double> > > window;
+  stats_t stats;  // recalculated from the window
+  o.via.array.ptr[0].convert(&window_size_);
+  o.via.array.ptr[1].convert(&window);
+  o.via.array.ptr[2].convert(&stats);
+  o.via.array.ptr[3].convert(&e_);
+  o.via.array.ptr[4].convert(&n_);
+  rebuild_window(window);
+}
+
+/**
+ * Rebuild the window and the statistics of keys from serialized values.
+ * Values are renumbered, as older models hold the time of push instead of
+ * the sequence number, which may not be unique.
+ */
+void stat::rebuild_window(
+    const std::deque<std::pair<uint64_t, std::pair<std::string, double> > >&
+        window) {
+  window_.clear();
+  stats_.clear();
+  seq_ = 0;
+  for (size_t i = 0; i < window.size(); ++i) {
+    window_entry entry;
+    entry.seq = seq_++;
+    entry.val = window[i].second.second;
+    get_stat_val(window[i].second.first, entry.stat).add(
+        entry.seq, entry.val, entry.seq / window_size_);
+    window_.push_back(entry);
+  }
+}
+
 std::string stat::type() const {
   return "stat";
 }
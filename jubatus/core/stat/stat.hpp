@@ -21,11 +21,14 @@
 #include <algorithm>
 #include <cstdlib>
 #include <deque>
+#include <functional>
 #include <string>
 #include <utility>
+#include <vector>
 #include "jubatus/util/concurrent/rwmutex.h"
 #include "jubatus/util/data/unordered_map.h"
 #include "jubatus/util/lang/enable_shared_from_this.h"
+#include "jubatus/util/lang/noncopyable.h"
 #include "jubatus/util/lang/shared_ptr.h"
 #include "../common/version.hpp"
 #include "../common/exception.hpp"
@@ -52,9 +55,16 @@ class stat_error : public common::exception::jubaexception<stat_error> {
   std::string msg_;
 };
 
-class stat : public jubatus::util::lang::enable_shared_from_this<stat> {
+// not copyable, as the window refers to elements of stats_
+class stat : public jubatus::util::lang::enable_shared_from_this<stat>,
+             jubatus::util::lang::noncopyable {
  public:
+  static const int DEFAULT_MOMENT_ORDER;
+
   explicit stat(size_t window_size);
+  // moments up to ``moment_order`` are kept as running sums; moments of
+  // higher order are calculated from the window
+  stat(size_t window_size, int moment_order);
   virtual ~stat();
 
   virtual void get_diff(std::pair<double, size_t>& ret) const;
@@ -83,75 +93,140 @@ class stat : public jubatus::util::lang::enable_shared_from_this<stat> {
   std::string type() const;
 
  protected:
+  /**
+   * Monotonic queue of (sequence number, value) pairs to track the extremum
+   * of a sliding window in amortized O(1).  Values that can never be the
+   * extremum again (older and not ``Better`` than a newer value) are
+   * dropped on push.
+   */
+  template <typename Better>
+  class extremum_queue {
+   public:
+    extremum_queue()
+        : head_(0) {
+    }
+
+    void push(uint64_t seq, double d) {
+      while (items_.size() > head_ && !Better()(items_.back().second, d)) {
+        items_.pop_back();
+      }
+      items_.push_back(std::make_pair(seq, d));
+    }
+
+    void pop(uint64_t seq) {
+      if (items_.size() > head_ && items_[head_].first == seq) {
+        ++head_;
+        if (head_ * 2 > items_.size()) {
+          items_.erase(items_.begin(), items_.begin() + head_);
+          head_ = 0;
+        }
+      }
+    }
+
+    double front() const {
+      return items_[head_].second;
+    }
+
+   private:
+    std::vector<std::pair<uint64_t, double> > items_;
+    size_t head_;
+  };
+
+  /**
+   * Statistics of a key in the window.
+   *
+   * Subtracting evicted values from the running sums loses the precision
+   * of small values after large ones (especially in higher powers).  So
+   * the values of each period of ``window_size`` pushes are also summed up
+   * separately (``fresh_*``, without subtraction); at the end of the period
+   * the window consists of those values only, and the fresh sums replace
+   * the running sums the next time the key is touched.  This keeps every
+   * push O(1) instead of recalculating the sums from the whole window.
+   */
   struct stat_val {
     stat_val()
         : n_(0),
           sum_(0),
           sum2_(0),
           max_(0),
-          min_(0) {
+          min_(0),
+          period_(0),
+          fresh_sum_(0),
+          fresh_sum2_(0) {
     }
 
-    void add(double d) {
+    void add(uint64_t seq, double d, uint64_t period) {
+      start_period(period);
       n_ += 1;
-      sum_ += d;
-      sum2_ += d * d;
+      add_powers(d, 1.0);
+      fresh_sum_ += d;
+      fresh_sum2_ += d * d;
+      double p = d * d;
+      for (size_t i = 0; i < fresh_power_sums_.size(); ++i) {
+        p *= d;
+        fresh_power_sums_[i] += p;
+      }
+
+      max_queue_.push(seq, d);
+      min_queue_.push(seq, d);
+      max_ = max_queue_.front();
+      min_ = min_queue_.front();
+    }
+
+    void rem(uint64_t seq, double d, uint64_t period) {
+      start_period(period);
+      n_ -= 1;
+      add_powers(d, -1.0);
 
-      if (n_ > 1) {
-        max_ = std::max(max_, d);
+      max_queue_.pop(seq);
+      min_queue_.pop(seq);
+      if (n_ > 0) {
+        max_ = max_queue_.front();
+        min_ = min_queue_.front();
       } else {
-        max_ = d;
+        max_ = 0;
+        min_ = 0;
       }
+    }
 
-      if (n_ > 1) {
-        min_ = std::min(min_, d);
-      } else {
-        min_ = d;
+    void add_powers(double d, double sign) {
+      sum_ += sign * d;
+      sum2_ += sign * d * d;
+      double p = d * d;
+      for (size_t i = 0; i < power_sums_.size(); ++i) {
+        p *= d;
+        power_sums_[i] += sign * p;
       }
     }
 
-    void rem(double d, const std::string& key, stat& st) {
-      n_ -= 1;
-      sum_ -= d;
-      sum2_ -= d * d;
-      if (max_ == d) {
-        if (n_ > 0) {
-          bool first = true;
-          for (size_t i = 0; i < st.window_.size(); ++i) {
-            if (st.window_[i].second.first != key) {
-              continue;
-            }
-            double d = st.window_[i].second.second;
-            if (first) {
-              max_ = d;
-              first = false;
-            } else {
-              max_ = std::max(max_, d);
-            }
-          }
-        } else {
-          max_ = 0;
-        }
+    void resize_powers(size_t n) {
+      power_sums_.resize(n);
+      fresh_power_sums_.resize(n);
+    }
+
+    // replaces the running sums by the fresh sums of the previous period
+    void start_period(uint64_t period) {
+      if (period_ == period) {
+        return;
       }
-      if (min_ == d) {
-        if (n_ > 0) {
-          bool first = true;
-          for (size_t i = 0; i < st.window_.size(); ++i) {
-            if (st.window_[i].second.first != key) {
-              continue;
-            }
-            double d = st.window_[i].second.second;
-            if (first) {
-              min_ = d;
-              first = false;
-            } else {
-              min_ = std::min(min_, d);
-            }
-          }
-        } else {
-          min_ = 0;
-        }
+      sum_ = fresh_sum_;
+      sum2_ = fresh_sum2_;
+      power_sums_.swap(fresh_power_sums_);
+      fresh_sum_ = 0;
+      fresh_sum2_ = 0;
+      std::fill(fresh_power_sums_.begin(), fresh_power_sums_.end(), 0.0);
+      period_ = period;
+    }
+
+    // sum of d^k in the window for 1 <= k <= moment order, as of ``period``
+    double power_sum(int k, uint64_t period) const {
+      const bool fresh = period_ != period;
+      if (k == 1) {
+        return fresh ? fresh_sum_ : sum_;
+      } else if (k == 2) {
+        return fresh ? fresh_sum2_ : sum2_;
       }
+      return fresh ? fresh_power_sums_[k - 3] : power_sums_[k - 3];
     }
 
     size_t n_;
@@ -160,20 +235,73 @@ class stat : public jubatus::util::lang::enable_shared_from_this<stat> {
     double max_;
     double min_;
 
+    // sums of d^k for 3 <= k <= moment order; not serialized
+    std::vector<double> power_sums_;
+    extremum_queue<std::greater<double> > max_queue_;
+    extremum_queue<std::less<double> > min_queue_;
+
+    // period of the fresh sums; not serialized
+    uint64_t period_;
+    double fresh_sum_, fresh_sum2_;
+    std::vector<double> fresh_power_sums_;
+
     MSGPACK_DEFINE(n_, sum_, sum2_, max_, min_);
   };
 
-  std::deque<std::pair<uint64_t, std::pair<std::string, double> > > window_;
-  jubatus::util::data::unordered_map<std::string, stat_val> stats_;
+  typedef jubatus::util::data::unordered_map<std::string, stat_val> stats_t;
+
+  /**
+   * An entry of the window.  Keys are interned in ``stats_``: an entry
+   * points to the element of its key, which is kept (and never moved) while
+   * the key has values in the window.  ``seq`` is the sequence number of
+   * the value; it identifies the value in the extremum queues.
+   */
+  struct window_entry {
+    uint64_t seq;
+    stats_t::value_type* stat;
+    double val;
+  };
+
+  stat_val& get_stat_val(const std::string& key, stats_t::value_type*& elem);
+  // period of window_size_ pushes that the next value belongs to
+  uint64_t period() const {
+    return seq_ / window_size_;
+  }
+  void rebuild_window(
+      const std::deque<std::pair<uint64_t, std::pair<std::string, double> > >&
+          window);
+
+  std::deque<window_entry> window_;
+  stats_t stats_;
 
  private:
   size_t window_size_;
+  int moment_order_;
+  uint64_t seq_;
 
   double e_;
   double n_;
 
  public:
-  MSGPACK_DEFINE(window_size_, window_, stats_, e_, n_);
+  // serialized in the same layout as
+  // (window_size_, deque<(seq, (key, val))>, stats_, e_, n_)
+  template <class Packer>
+  void msgpack_pack(Packer& packer) const {
+    packer.pack_array(5);
+    packer.pack(window_size_);
+    packer.pack_array(window_.size());
+    for (size_t i = 0; i < window_.size(); ++i) {
+      packer.pack_array(2);
+      packer.pack(window_[i].seq);
+      packer.pack_array(2);
+      packer.pack(window_[i].stat->first);
+      packer.pack(window_[i].val);
+    }
+    packer.pack(stats_);
+    packer.pack(e_);
+    packer.pack(n_);
+  }
+  void msgpack_unpack(msgpack::object o);
 };
 
 typedef framework::linear_mixable_helper<stat, std::pair<double, size_t> >
@@ -14,6 +14,10 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
 #include <utility>
 #include <gtest/gtest.h>
 #include "jubatus/util/math/random.h"
@@ -104,11 +108,94 @@ TEST(stat_test, mixed_entropy) {
   ASSERT_DOUBLE_EQ(p.entropy() + bias, p.entropy() + bias);
 }
 
+TEST(stat_test, sliding_window) {
+  const size_t window_size = 50;
+  core::stat::stat p(window_size, 4);
+  std::deque<std::pair<std::string, double> > window;
+
+  jubatus::util::math::random::mtrand rand(0);
+  for (int i = 0; i < 2000; ++i) {
+    const std::string key(1, static_cast<char>('a' + rand.next_int(3)));
+    const double val = rand.next_int(20);
+    p.push(key, val);
+    window.push_back(std::make_pair(key, val));
+    if (window.size() > window_size) {
+      window.pop_front();
+    }
+
+    for (char c = 'a'; c < 'd'; ++c) {
+      const std::string k(1, c);
+      size_t n = 0;
+      double sum = 0, max = 0, min = 0, m3 = 0, m5 = 0;
+      for (size_t j = 0; j < window.size(); ++j) {
+        if (window[j].first != k) {
+          continue;
+        }
+        const double d = window[j].second;
+        max = (n == 0) ? d : std::max(max, d);
+        min = (n == 0) ? d : std::min(min, d);
+        sum += d;
+        m3 += std::pow(d - 1.5, 3);
+        m5 += std::pow(d - 1.5, 5);
+        ++n;
+      }
+      if (n == 0) {
+        EXPECT_THROW(p.max(k), core::stat::stat_error);
+        continue;
+      }
+      EXPECT_EQ(max, p.max(k));
+      EXPECT_EQ(min, p.min(k));
+      EXPECT_DOUBLE_EQ(sum, p.sum(k));
+      EXPECT_NEAR(m3 / n, p.moment(k, 3, 1.5), 1e-6);
+      EXPECT_NEAR(m5 / n, p.moment(k, 5, 1.5), 1e-6);
+    }
+  }
+}
+
+TEST(stat_test, moments_after_large_values) {
+  const size_t window_size = 10;
+  core::stat::stat p(window_size, 3);
+  for (int i = 0; i < 100; ++i) {
+    p.push("a", 1e8);
+  }
+  // the large values have left the window; the sums must not keep
+  // the rounding errors of their removal
+  double m3 = 0;
+  for (int i = 1; i <= 10; ++i) {
+    p.push("a", i);
+    m3 += std::pow(i - 5.5, 3);
+  }
+  EXPECT_DOUBLE_EQ(55, p.sum("a"));
+  EXPECT_NEAR(m3 / 10, p.moment("a", 3, 5.5), 1e-9);
+  EXPECT_NEAR(std::sqrt(8.25), p.stddev("a"), 1e-9);
+}
+
+TEST(stat_test, moments_after_many_evictions) {
+  const size_t window_size = 10;
+  core::stat::stat p(window_size, 4);
+  // large and small values interleaved through many windows
+  for (int i = 0; i < 100000; ++i) {
+    p.push("a", i % 3 == 0 ? 1e8 + i : i % 7);
+  }
+  double sum = 0, m4 = 0;
+  for (int i = 1; i <= 10; ++i) {
+    p.push("a", i);
+    sum += i;
+    m4 += std::pow(i - 5.5, 4);
+  }
+  EXPECT_DOUBLE_EQ(sum, p.sum("a"));
+  EXPECT_NEAR(m4 / 10, p.moment("a", 4, 5.5), 1e-6);
+}
+
 TEST(stat_test, config_validation) {
   // 1 <= window_size
   ASSERT_THROW(core::stat::stat p0(0), core::common::invalid_parameter);
   ASSERT_NO_THROW(core::stat::stat p1(1));
   ASSERT_NO_THROW(core::stat::stat p2(2));
+
+  // 2 <= moment_order
+  ASSERT_THROW(core::stat::stat p3(1, 1), core::common::invalid_parameter);
+  ASSERT_NO_THROW(core::stat::stat p4(1, 2));
 }
 
 REGISTER_TYPED_TEST_CASE_P(
@@ -27,6 +27,7 @@
 #include <msgpack.hpp>
 #include "jubatus/util/lang/demangle.h"
 #include "jubatus/util/lang/noncopyable.h"
+#include "jubatus/util/lang/shared_ptr.h"
 #include "../common/assert.hpp"
 #include "../framework/packer.hpp"
 #include "storage_exception.hpp"
@@ -37,6 +38,8 @@ namespace jubatus {
 namespace core {
 namespace storage {
 
+class mapped_file;
+
 namespace detail {
 
 class abstract_column_base : jubatus::util::lang::noncopyable {
@@ -99,11 +102,18 @@ class abstract_column_base : jubatus::util::lang::noncopyable {
 
 }  // namespace detail
 
+/**
+ * Values of a column.  Columns of fixed-width types can also refer to an
+ * array in a read-only mapped file (see ``column_table::load_mapped``);
+ * the values are copied into the column on the first update.
+ */
 template <typename T>
 class typed_column : public detail::abstract_column_base {
  public:
   explicit typed_column(const column_type& type)
-      : detail::abstract_column_base(type) {
+      : detail::abstract_column_base(type),
+        mapped_(NULL),
+        mapped_size_(0) {
   }
 
   using detail::abstract_column_base::push_back;
@@ -111,6 +121,7 @@ class typed_column : public detail::abstract_column_base {
   using detail::abstract_column_base::update;
 
   void push_back(const T& value) {
+    materialize_();
     array_.push_back(value);
   }
   void push_back(const msgpack::object& obj) {
@@ -121,6 +132,7 @@ class typed_column : public detail::abstract_column_base {
     if (size() < target) {
       return false;
     }
+    materialize_();
     array_.insert(array_.begin() + target, value);
     return true;
   }
@@ -132,6 +144,7 @@ class typed_column : public detail::abstract_column_base {
     if (size() <= index) {
       return false;
     }
+    materialize_();
     array_[index] = value;
     return true;
   }
@@ -143,17 +156,19 @@ class typed_column : public detail::abstract_column_base {
     if (size() <= target) {
       return false;
     }
+    materialize_();
     using std::swap;
     swap(array_[target], array_.back());
     array_.pop_back();
     return true;
   }
   void clear() {
+    unmap_();
     array_.clear();
   }
 
   uint64_t size() const {
-    return array_.size();
+    return mapped_ ? mapped_size_ : array_.size();
   }
 
   const T& operator[](uint64_t index) const {
@@ -162,22 +177,44 @@ class typed_column : public detail::abstract_column_base {
         "invalid index [" +
         jubatus::util::lang::lexical_cast<std::string>(index) +
         "] for [" +
-        jubatus::util::lang::lexical_cast<std::string>(array_.size()));
+        jubatus::util::lang::lexical_cast<std::string>(size()));
     }
-    return array_[index];
+    return mapped_ ? mapped_[index] : array_[index];
   }
 
+  // Writable access, which copies a mapped column into memory; read
+  // through a const column instead, so that readers never modify it.
   T& operator[](uint64_t index) {
     if (size() <= index) {
       throw length_unmatch_exception(
         "invalid index [" +
         jubatus::util::lang::lexical_cast<std::string>(index) +
         "] for [" +
-        jubatus::util::lang::lexical_cast<std::string>(array_.size()));
+        jubatus::util::lang::lexical_cast<std::string>(size()));
     }
+    materialize_();
     return array_[index];
   }
 
+  // contiguous values of the column; valid until the column is modified
+  const T* data_unsafe() const {
+    return mapped_ ? mapped_ : (array_.empty() ? NULL : &array_[0]);
+  }
+
+  // refers to ``size`` values at ``data`` in the mapped ``file``
+  void attach_mapped(
+      const T* data,
+      uint64_t size,
+      jubatus::util::lang::shared_ptr<const mapped_file> file) {
+    std::vector<T>().swap(array_);
+    mapped_ = data;
+    mapped_size_ = size;
+    mapping_ = file;
+  }
+  bool is_mapped() const {
+    return mapped_ != NULL;
+  }
+
   void pack_with_index(
       const uint64_t index, framework::packer& pk) const {
     pk.pack((*this)[index]);
@@ -200,21 +237,48 @@ class typed_column : public detail::abstract_column_base {
 
   template<class Buffer>
   void pack_array(msgpack::packer<Buffer>& packer) const {
-    packer.pack(array_);
+    if (!mapped_) {
+      packer.pack(array_);
+      return;
+    }
+    // same layout as std::vector<T>
+    packer.pack_array(mapped_size_);
+    for (uint64_t i = 0; i < mapped_size_; ++i) {
+      packer.pack(mapped_[i]);
+    }
   }
   void unpack_array(msgpack::object o) {
+    unmap_();
     o.convert(&array_);
   }
 
  private:
   std::vector<T> array_;
+
+  const T* mapped_;
+  uint64_t mapped_size_;
+  jubatus::util::lang::shared_ptr<const mapped_file> mapping_;
+
+  void materialize_() {
+    if (mapped_) {
+      std::vector<T>(mapped_, mapped_ + mapped_size_).swap(array_);
+      unmap_();
+    }
+  }
+  void unmap_() {
+    mapped_ = NULL;
+    mapped_size_ = 0;
+    mapping_.reset();
+  }
 };
 
 template <>
 class typed_column<bit_vector> : public detail::abstract_column_base {
  public:
   explicit typed_column(const column_type& type)
-      : detail::abstract_column_base(type) {
+      : detail::abstract_column_base(type),
+        mapped_(NULL),
+        mapped_blocks_(0) {
   }
 
   using detail::abstract_column_base::push_back;
@@ -223,6 +287,7 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
 
   void push_back(const bit_vector& value) {
     check_bit_vector_(value);
+    materialize_();
     array_.resize(array_.size() + blocks_per_value_());
     update_at_(size() - 1, value.raw_data_unsafe());
   }
@@ -238,6 +303,7 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
     if (size() < target) {
       return false;
     }
+    materialize_();
     array_.insert(
         array_.begin() + target * blocks_per_value_(),
         blocks_per_value_(), 0);
@@ -266,11 +332,14 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
   }
 
   uint64_t size() const {
-    JUBATUS_ASSERT_EQ(array_.size() % blocks_per_value_(), 0u, "");
-    return array_.size() / blocks_per_value_();
+    const uint64_t blocks = mapped_ ? mapped_blocks_ : array_.size();
+    JUBATUS_ASSERT_EQ(blocks % blocks_per_value_(), 0u, "");
+    return blocks / blocks_per_value_();
   }
   bit_vector operator[](uint64_t index) {
-    return bit_vector(get_data_at_(index), type().bit_vector_length());
+    // bit_vector holds a copy of the value
+    const typed_column& self = *this;
+    return self[index];
   }
   bit_vector operator[](uint64_t index) const {
     return bit_vector(get_data_at_(index), type().bit_vector_length());
@@ -278,10 +347,15 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
   const uint64_t* get_data_at_unsafe(size_t index) const {
     return get_data_at_(index);
   }
+  // distance in blocks between adjacent values in get_data_at_unsafe
+  size_t blocks_per_value() const {
+    return blocks_per_value_();
+  }
   bool remove(uint64_t target) {
     if (target >= size()) {
       return false;
     }
+    materialize_();
     if (target < size() - 1) {
       const void* back = get_data_at_(size() - 1);
       memcpy(get_data_at_(target), back, bytes_per_value_());
@@ -291,8 +365,24 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
     return true;
   }
   void clear() {
+    unmap_();
     array_.clear();
   }
+
+  // refers to ``size`` values (of ``blocks_per_value`` blocks) at ``data``
+  // in the mapped ``file``
+  void attach_mapped(
+      const uint64_t* data,
+      uint64_t size,
+      jubatus::util::lang::shared_ptr<const mapped_file> file) {
+    std::vector<uint64_t>().swap(array_);
+    mapped_ = data;
+    mapped_blocks_ = size * blocks_per_value_();
+    mapping_ = file;
+  }
+  bool is_mapped() const {
+    return mapped_ != NULL;
+  }
   void pack_with_index(
       const uint64_t index, framework::packer& pk) const {
     pk.pack((*this)[index]);
@@ -315,15 +405,40 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
 
   template<class Buffer>
   void pack_array(msgpack::packer<Buffer>& packer) const {
-    packer.pack(array_);
+    if (!mapped_) {
+      packer.pack(array_);
+      return;
+    }
+    // same layout as std::vector<uint64_t>
+    packer.pack_array(mapped_blocks_);
+    for (uint64_t i = 0; i < mapped_blocks_; ++i) {
+      packer.pack(mapped_[i]);
+    }
   }
   void unpack_array(msgpack::object o) {
+    unmap_();
     o.convert(&array_);
   }
 
  private:
   std::vector<uint64_t> array_;
 
+  const uint64_t* mapped_;
+  uint64_t mapped_blocks_;
+  jubatus::util::lang::shared_ptr<const mapped_file> mapping_;
+
+  void materialize_() {
+    if (mapped_) {
+      std::vector<uint64_t>(mapped_, mapped_ + mapped_blocks_).swap(array_);
+      unmap_();
+    }
+  }
+  void unmap_() {
+    mapped_ = NULL;
+    mapped_blocks_ = 0;
+    mapping_.reset();
+  }
+
   size_t bytes_per_value_() const {
     return bit_vector::memory_size(type().bit_vector_length());
   }
@@ -333,11 +448,12 @@ class typed_column<bit_vector> : public detail::abstract_column_base {
 
   uint64_t* get_data_at_(size_t index) {
     JUBATUS_ASSERT_LT(index, size(), "");
+    materialize_();
     return &array_[blocks_per_value_() * index];
   }
   const uint64_t* get_data_at_(size_t index) const {
     JUBATUS_ASSERT_LT(index, size(), "");
-    return &array_[blocks_per_value_() * index];
+    return (mapped_ ? mapped_ : &array_[0]) + blocks_per_value_() * index;
   }
 
   void update_at_(size_t index, const void* raw_data) {
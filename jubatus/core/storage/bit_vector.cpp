@@ -16,8 +16,16 @@
 
 #include "bit_vector.hpp"
 
+#include <algorithm>
+
 #ifdef JUBATUS_USE_FMV
+#include <immintrin.h>
 #include <nmmintrin.h>
+// VPOPCNTQ needs a compiler that knows the avx512vpopcntdq target
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && \
+    __GNUC__ >= 8
+#define JUBATUS_USE_AVX512_POPCNT
+#endif
 #endif
 
 namespace jubatus {
@@ -103,8 +111,160 @@ size_t bit_count_impl(const uint64_t *x, size_t blocks) {
 }
 #endif
 
+// Batch kernels: distances between the query and ``n`` rows which are
+// stored contiguously in ``rows``, ``stride`` blocks apart.
+
+#ifdef JUBATUS_USE_FMV
+__attribute__((target("default")))
+#endif
+void calc_hamming_distances_impl(const uint64_t *query,
+                                 const uint64_t *rows,
+                                 size_t blocks,
+                                 size_t stride,
+                                 size_t n,
+                                 uint32_t *out) {
+  for (size_t r = 0; r < n; ++r, rows += stride) {
+    out[r] = calc_hamming_distance_impl(query, rows, blocks);
+  }
+}
+
+#ifdef JUBATUS_USE_FMV
+#ifdef __x86_64__
+// popcount of each 64-bit lane, using PSHUFB as a nibble lookup table
+__attribute__((target("avx2")))
+inline __m256i popcount_epi64_avx2(__m256i v) {
+  const __m256i lookup = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i lo = _mm256_and_si256(v, low_mask);
+  const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+  const __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+void calc_hamming_distances_impl(const uint64_t *query,
+                                 const uint64_t *rows,
+                                 size_t blocks,
+                                 size_t stride,
+                                 size_t n,
+                                 uint32_t *out) {
+  const size_t lanes = 4;
+  if (blocks == stride && lanes % blocks == 0) {
+    // Short rows (64, 128 or 256 bits): rows are packed into a vector
+    // side by side and compared with the query repeated in every row slot.
+    uint64_t pattern[lanes];
+    for (size_t k = 0; k < lanes; ++k) {
+      pattern[k] = query[k % blocks];
+    }
+    const __m256i q = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(pattern));
+    const size_t words = n * blocks;
+    std::fill(out, out + n, 0);
+    uint64_t counts[lanes];
+    size_t i = 0;
+    for (; i + lanes <= words; i += lanes) {
+      const __m256i x = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i)), q);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts),
+                          popcount_epi64_avx2(x));
+      for (size_t k = 0; k < lanes; ++k) {
+        out[(i + k) / blocks] += counts[k];
+      }
+    }
+    for (; i < words; ++i) {
+      out[i / blocks] += _mm_popcnt_u64(rows[i] ^ query[i % blocks]);
+    }
+    return;
+  }
+
+  for (size_t r = 0; r < n; ++r, rows += stride) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + lanes <= blocks; i += lanes) {
+      const __m256i x = _mm256_xor_si256(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i)),
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(query + i)));
+      acc = _mm256_add_epi64(acc, popcount_epi64_avx2(x));
+    }
+    uint64_t counts[lanes];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), acc);
+    uint64_t dist = counts[0] + counts[1] + counts[2] + counts[3];
+    for (; i < blocks; ++i) {
+      dist += _mm_popcnt_u64(rows[i] ^ query[i]);
+    }
+    out[r] = dist;
+  }
+}
+#endif  // #ifdef __x86_64__
+
+#ifdef JUBATUS_USE_AVX512_POPCNT
+__attribute__((target("avx512f,avx512vpopcntdq")))
+void calc_hamming_distances_impl(const uint64_t *query,
+                                 const uint64_t *rows,
+                                 size_t blocks,
+                                 size_t stride,
+                                 size_t n,
+                                 uint32_t *out) {
+  const size_t lanes = 8;
+  if (blocks == stride && lanes % blocks == 0) {
+    uint64_t pattern[lanes];
+    for (size_t k = 0; k < lanes; ++k) {
+      pattern[k] = query[k % blocks];
+    }
+    const __m512i q = _mm512_loadu_si512(pattern);
+    const size_t words = n * blocks;
+    std::fill(out, out + n, 0);
+    uint64_t counts[lanes];
+    size_t i = 0;
+    for (; i + lanes <= words; i += lanes) {
+      const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(rows + i), q);
+      _mm512_storeu_si512(counts, _mm512_popcnt_epi64(x));
+      for (size_t k = 0; k < lanes; ++k) {
+        out[(i + k) / blocks] += counts[k];
+      }
+    }
+    for (; i < words; ++i) {
+      out[i / blocks] += _mm_popcnt_u64(rows[i] ^ query[i % blocks]);
+    }
+    return;
+  }
+
+  uint64_t counts[lanes];
+  for (size_t r = 0; r < n; ++r, rows += stride) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + lanes <= blocks; i += lanes) {
+      const __m512i x = _mm512_xor_si512(_mm512_loadu_si512(rows + i),
+                                         _mm512_loadu_si512(query + i));
+      acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    // sum the lanes through memory, as the packed path does;
+    // _mm512_reduce_add_epi64 trips -Wmaybe-uninitialized on GCC 12
+    _mm512_storeu_si512(counts, acc);
+    uint64_t dist = 0;
+    for (size_t k = 0; k < lanes; ++k) {
+      dist += counts[k];
+    }
+    for (; i < blocks; ++i) {
+      dist += _mm_popcnt_u64(rows[i] ^ query[i]);
+    }
+    out[r] = dist;
+  }
+}
+#endif  // #ifdef JUBATUS_USE_AVX512_POPCNT
+#endif  // #ifdef JUBATUS_USE_FMV
+
 }  // namespace
 
+void calc_hamming_distances_internal(
+    const uint64_t *query, const uint64_t *rows,
+    size_t blocks, size_t stride, size_t n, uint32_t *out) {
+  calc_hamming_distances_impl(query, rows, blocks, stride, n, out);
+}
+
 size_t calc_hamming_distance_internal(
     const uint64_t *x, const uint64_t *y, size_t blocks) {
   return calc_hamming_distance_impl(x, y, blocks);
@@ -96,6 +96,9 @@ inline int bitcount(T);  // = delete;
 
 size_t calc_hamming_distance_internal(
     const uint64_t *x, const uint64_t *y, size_t blocks);
+void calc_hamming_distances_internal(
+    const uint64_t *query, const uint64_t *rows,
+    size_t blocks, size_t stride, size_t n, uint32_t *out);
 size_t bit_count_internal(const uint64_t *x, size_t blocks);
 
 }  // namespace detail
@@ -310,6 +313,19 @@ struct bit_vector_base {
     return detail::calc_hamming_distance_internal(
         bits_, bv, used_bytes() / sizeof(bit_base));
   }
+  // Hamming distances to ``n`` vectors stored back to back in ``rows``,
+  // each of them ``stride`` blocks long.
+  void calc_hamming_distances_unsafe(
+      const bit_base *rows, size_t stride, size_t n, uint32_t *out) const {
+    if (bits_ == NULL) {
+      for (size_t i = 0; i < n; ++i, rows += stride) {
+        out[i] = bit_count_unsafe(rows, used_bytes());
+      }
+      return;
+    }
+    detail::calc_hamming_distances_internal(
+        bits_, rows, used_bytes() / sizeof(bit_base), stride, n, out);
+  }
   size_t bit_count() const {
     return bit_count_unsafe(bits_, used_bytes());
   }
@@ -14,6 +14,7 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <algorithm>
 #include <vector>
 #include <string>
 
@@ -269,6 +270,41 @@ TEST(hamming_similarity, calc_with_skew) {
     }
   }
 }
+TEST(hamming_distance, batch) {
+  const size_t rows = 37;  // not a multiple of the vector width
+  const size_t lengths[] = {1, 64, 100, 192, 256, 500, 512, 1100};
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+    const size_t bits = lengths[l];
+    bit_vector query(bits);
+    for (size_t i = 0; i < bits; i += 3) {
+      query.set_bit(i);
+    }
+    const size_t stride = bit_vector::memory_size(bits) / sizeof(uint64_t);
+    std::vector<uint64_t> data(stride * rows);
+    for (size_t r = 0; r < rows; ++r) {
+      bit_vector bv(&data[r * stride], bits);
+      for (size_t i = r % 5; i < bits; i += r % 7 + 1) {
+        bv.set_bit(i);
+      }
+      std::copy(bv.raw_data_unsafe(), bv.raw_data_unsafe() + stride,
+                &data[r * stride]);
+    }
+
+    std::vector<uint32_t> dists(rows);
+    query.calc_hamming_distances_unsafe(&data[0], stride, rows, &dists[0]);
+    for (size_t r = 0; r < rows; ++r) {
+      EXPECT_EQ(query.calc_hamming_distance_unsafe(&data[r * stride]),
+                dists[r]) << "bits: " << bits << ", row: " << r;
+    }
+
+    bit_vector empty(bits);
+    empty.calc_hamming_distances_unsafe(&data[0], stride, rows, &dists[0]);
+    for (size_t r = 0; r < rows; ++r) {
+      EXPECT_EQ(bit_vector(&data[r * stride], bits).bit_count(), dists[r]);
+    }
+  }
+}
+
 TEST(memory_size, uint64_under_128) {
   for (size_t k = 1; k <= 64; ++k) {
     bit_vector_base<uint64_t> bv(k);
@@ -14,13 +14,17 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <stdint.h>
 #include <algorithm>
 #include <cstring>
+#include <ostream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "jubatus/util/lang/shared_ptr.h"
 #include "column_table.hpp"
+#include "mapped_file.hpp"
 #include "../common/assert.hpp"
 
 namespace jutil = jubatus::util;
@@ -55,6 +59,115 @@ void column_table::clear() {
   tuples_ = 0;
   clock_ = 0;
   index_.clear();
+  reset_change_log_();
+  rebuild_version_index_();
+}
+
+void column_table::enable_version_index() {
+  jutil::concurrent::scoped_wlock lk(table_lock_);
+  version_index_enabled_ = true;
+  rebuild_version_index_();
+}
+
+void column_table::get_rows_newer_than_nolock(
+    const std::map<owner, uint64_t>& clock,
+    std::vector<uint64_t>& ids) const {
+  ids.clear();
+  if (!version_index_enabled_) {
+    for (uint64_t i = 0; i < tuples_; ++i) {
+      std::map<owner, uint64_t>::const_iterator it =
+          clock.find(versions_[i].first);
+      if (it == clock.end() || it->second < versions_[i].second) {
+        ids.push_back(i);
+      }
+    }
+    return;
+  }
+
+  // table lock only excludes writers; sorting logs is guarded by ourselves
+  jutil::concurrent::scoped_lock lk(version_index_lock_);
+  for (version_index_t::iterator it = version_index_.begin();
+       it != version_index_.end(); ++it) {
+    const owner& o = it->first;
+    version_log& log = it->second;
+    sort_version_log_(log);
+
+    std::vector<std::pair<uint64_t, uint64_t> >::const_iterator entry =
+        log.entries.begin();
+    std::map<owner, uint64_t>::const_iterator c = clock.find(o);
+    if (c != clock.end()) {
+      entry = std::upper_bound(
+          log.entries.begin(), log.entries.end(),
+          std::make_pair(c->second, ~static_cast<uint64_t>(0)));
+    }
+    for (; entry != log.entries.end(); ++entry) {
+      const uint64_t index = entry->second;
+      if (index < tuples_ && versions_[index].second == entry->first &&
+          versions_[index].first == o) {
+        ids.push_back(index);
+      }
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+void column_table::unindex_version_(uint64_t index) {
+  if (!version_index_enabled_) {
+    return;
+  }
+  const owner& o = versions_[index].first;
+  version_log& log = version_index_[o];
+  if (log.stale * 2 > log.entries.size()) {
+    compact_version_log_(o, log);
+  }
+  ++log.stale;
+}
+
+void column_table::rebuild_version_index_() {
+  version_index_t().swap(version_index_);
+  if (!version_index_enabled_) {
+    return;
+  }
+  for (uint64_t i = 0; i < tuples_; ++i) {
+    index_version_(i);
+  }
+  for (version_index_t::iterator it = version_index_.begin();
+       it != version_index_.end(); ++it) {
+    sort_version_log_(it->second);
+  }
+}
+
+void column_table::compact_version_log_(
+    const owner& o,
+    version_log& log) const {
+  sort_version_log_(log);
+  std::vector<std::pair<uint64_t, uint64_t> > entries;
+  for (size_t i = 0; i < log.entries.size(); ++i) {
+    const uint64_t index = log.entries[i].second;
+    if (index < tuples_ && versions_[index].second == log.entries[i].first &&
+        versions_[index].first == o &&
+        (entries.empty() || entries.back() != log.entries[i])) {
+      entries.push_back(log.entries[i]);
+    }
+  }
+  log.entries.swap(entries);
+  log.sorted = log.entries.size();
+  log.stale = 0;
+}
+
+void column_table::sort_version_log_(version_log& log) {
+  if (log.sorted == log.entries.size()) {
+    return;
+  }
+  std::vector<std::pair<uint64_t, uint64_t> >::iterator middle =
+      log.entries.begin() + log.sorted;
+  std::sort(middle, log.entries.end());
+  // clocks of an owner mostly arrive in order, which needs no merge
+  if (log.sorted > 0 && *middle < *(middle - 1)) {
+    std::inplace_merge(log.entries.begin(), middle, log.entries.end());
+  }
+  log.sorted = log.entries.size();
 }
 
 std::pair<bool, uint64_t> column_table::exact_match(
@@ -171,6 +284,381 @@ const_bit_vector_column& column_table::get_bit_vector_column(
   return *static_cast<const_bit_vector_column*>(columns_[column_id].get());
 }
 
+namespace {
+
+/*
+ * Layout of the file written by save_mapped.  All integers are in the byte
+ * order of the host, and every section starts at an 8-byte boundary so that
+ * column values can be used in place.
+ *
+ *   header:  magic[8], uint32 format version, uint32 byte order mark,
+ *            uint64 tuples, uint64 clock, uint64 number of columns
+ *   columns: uint32 type, uint32 bit vector length, then
+ *            a section of raw values (fixed-width types) or
+ *            a string list (string_type)
+ *   keys:    string list
+ *   owners:  string list
+ *   clocks:  section of uint64 values
+ *
+ * A section is a uint64 byte size followed by the bytes and padding.  A
+ * string list is a section of ``n + 1`` uint64 offsets followed by a section
+ * of the concatenated strings.
+ */
+const char mapped_magic[8] = {'J', 'U', 'B', 'A', 'T', 'B', 'L', '\0'};
+const uint32_t mapped_format_version = 1;
+const uint32_t mapped_byte_order_mark = 0x01020304;
+
+void write_bytes(std::ostream& os, const void* data, uint64_t size) {
+  os.write(static_cast<const char*>(data), size);
+}
+
+template <typename T>
+void write_value(std::ostream& os, const T& value) {
+  write_bytes(os, &value, sizeof(T));
+}
+
+void write_padding(std::ostream& os, uint64_t size) {
+  static const char padding[8] = {0};
+  write_bytes(os, padding, (8 - size % 8) % 8);
+}
+
+void write_section(std::ostream& os, const void* data, uint64_t size) {
+  write_value(os, size);
+  write_bytes(os, data, size);
+  write_padding(os, size);
+}
+
+template <typename Strings, typename Get>
+void write_strings(std::ostream& os, const Strings& strings, uint64_t n,
+                   Get get) {
+  std::vector<uint64_t> offsets(1, 0);
+  offsets.reserve(n + 1);
+  for (uint64_t i = 0; i < n; ++i) {
+    offsets.push_back(offsets.back() + get(strings, i).size());
+  }
+  write_section(os, &offsets[0], offsets.size() * sizeof(uint64_t));
+  write_value(os, offsets.back());
+  for (uint64_t i = 0; i < n; ++i) {
+    const std::string& str = get(strings, i);
+    write_bytes(os, str.data(), str.size());
+  }
+  write_padding(os, offsets.back());
+}
+
+const std::string& key_at(const std::vector<std::string>& keys, uint64_t i) {
+  return keys[i];
+}
+
+const std::string& owner_at(
+    const std::vector<column_table::version_t>& versions, uint64_t i) {
+  return versions[i].first.name;
+}
+
+const std::string& string_at(const const_string_column& column, uint64_t i) {
+  return column[i];
+}
+
+template <typename T>
+void write_column(std::ostream& os, const detail::abstract_column& column) {
+  const typed_column<T>& c =
+      static_cast<const typed_column<T>&>(*column.get());
+  write_section(os, c.data_unsafe(), c.size() * sizeof(T));
+}
+
+template <>
+void write_column<bit_vector>(
+    std::ostream& os, const detail::abstract_column& column) {
+  const_bit_vector_column& c =
+      static_cast<const_bit_vector_column&>(*column.get());
+  if (c.size() == 0) {
+    write_section(os, NULL, 0);
+    return;
+  }
+  write_section(os, c.get_data_at_unsafe(0),
+                c.size() * c.blocks_per_value() * sizeof(uint64_t));
+}
+
+template <>
+void write_column<std::string>(
+    std::ostream& os, const detail::abstract_column& column) {
+  const_string_column& c = static_cast<const_string_column&>(*column.get());
+  write_strings(os, c, c.size(), &string_at);
+}
+
+// bounds-checked cursor over a file written by save_mapped
+class mapped_reader {
+ public:
+  mapped_reader(const mapped_file& file, uint64_t pos)
+      : file_(file), pos_(pos) {
+    if (pos_ % 8 != 0 || pos_ > file_.size()) {
+      broken("invalid offset");
+    }
+  }
+
+  uint64_t position() const {
+    return pos_;
+  }
+
+  const char* read(uint64_t size) {
+    if (size > file_.size() - pos_) {
+      broken("unexpected end of file");
+    }
+    const char* p = file_.data() + pos_;
+    pos_ += size;
+    return p;
+  }
+
+  template <typename T>
+  T read_value() {
+    T value;
+    std::memcpy(&value, read(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  const char* read_section(uint64_t& size) {
+    size = read_value<uint64_t>();
+    const char* p = read(size);
+    read((8 - size % 8) % 8);
+    return p;
+  }
+
+  void read_strings(uint64_t n, std::vector<std::string>& strings) {
+    uint64_t offsets_size;
+    const char* offsets = read_section(offsets_size);
+    if (offsets_size != (n + 1) * sizeof(uint64_t)) {
+      broken("invalid string list");
+    }
+    uint64_t blob_size;
+    const char* blob = read_section(blob_size);
+
+    strings.clear();
+    strings.reserve(n);
+    uint64_t begin;
+    std::memcpy(&begin, offsets, sizeof(uint64_t));
+    for (uint64_t i = 0; i < n; ++i) {
+      uint64_t end;
+      std::memcpy(&end, offsets + (i + 1) * sizeof(uint64_t),
+                  sizeof(uint64_t));
+      if (end < begin || blob_size < end) {
+        broken("invalid string list");
+      }
+      strings.push_back(std::string(blob + begin, end - begin));
+      begin = end;
+    }
+  }
+
+  void broken(const std::string& reason) const {
+    throw JUBATUS_EXCEPTION(storage_exception(
+        "broken mapped table: " + file_.path() + ": " + reason));
+  }
+
+ private:
+  const mapped_file& file_;
+  uint64_t pos_;
+};
+
+template <typename T>
+void read_column(
+    mapped_reader& reader,
+    uint64_t tuples,
+    const jubatus::util::lang::shared_ptr<const mapped_file>& file,
+    detail::abstract_column& column) {
+  uint64_t size;
+  const char* data = reader.read_section(size);
+  if (size != tuples * sizeof(T)) {
+    reader.broken("invalid column size");
+  }
+  static_cast<typed_column<T>&>(*column.get()).attach_mapped(
+      reinterpret_cast<const T*>(data), tuples, file);
+}
+
+template <>
+void read_column<bit_vector>(
+    mapped_reader& reader,
+    uint64_t tuples,
+    const jubatus::util::lang::shared_ptr<const mapped_file>& file,
+    detail::abstract_column& column) {
+  bit_vector_column& c = static_cast<bit_vector_column&>(*column.get());
+  uint64_t size;
+  const char* data = reader.read_section(size);
+  if (size != tuples * c.blocks_per_value() * sizeof(uint64_t)) {
+    reader.broken("invalid column size");
+  }
+  c.attach_mapped(reinterpret_cast<const uint64_t*>(data), tuples, file);
+}
+
+template <>
+void read_column<std::string>(
+    mapped_reader& reader,
+    uint64_t tuples,
+    const jubatus::util::lang::shared_ptr<const mapped_file>& file,
+    detail::abstract_column& column) {
+  std::vector<std::string> values;
+  reader.read_strings(tuples, values);
+  string_column& c = static_cast<string_column&>(*column.get());
+  for (uint64_t i = 0; i < tuples; ++i) {
+    c.push_back(values[i]);
+  }
+}
+
+typedef void (*write_column_t)(std::ostream&, const detail::abstract_column&);
+typedef void (*read_column_t)(
+    mapped_reader&,
+    uint64_t,
+    const jubatus::util::lang::shared_ptr<const mapped_file>&,
+    detail::abstract_column&);
+
+struct column_io {
+  write_column_t write;
+  read_column_t read;
+};
+
+column_io get_column_io(const column_type& type) {
+#define JUBATUS_COLUMN_IO(name, T) \
+  if (type.is(column_type::name)) { \
+    column_io io = {&write_column<T>, &read_column<T>}; \
+    return io; \
+  }
+  JUBATUS_COLUMN_IO(uint8_type, uint8_t)
+  JUBATUS_COLUMN_IO(uint16_type, uint16_t)
+  JUBATUS_COLUMN_IO(uint32_type, uint32_t)
+  JUBATUS_COLUMN_IO(uint64_type, uint64_t)
+  JUBATUS_COLUMN_IO(int8_type, int8_t)
+  JUBATUS_COLUMN_IO(int16_type, int16_t)
+  JUBATUS_COLUMN_IO(int32_type, int32_t)
+  JUBATUS_COLUMN_IO(int64_type, int64_t)
+  JUBATUS_COLUMN_IO(float_type, float)
+  JUBATUS_COLUMN_IO(double_type, double)
+  JUBATUS_COLUMN_IO(string_type, std::string)
+  JUBATUS_COLUMN_IO(bit_vector_type, bit_vector)
+#undef JUBATUS_COLUMN_IO
+  throw JUBATUS_EXCEPTION(
+      type_unmatch_exception("unsupported column type: " +
+                             type.type_as_string()));
+}
+
+}  // namespace
+
+void column_table::save_mapped(std::ostream& os) const {
+  jutil::concurrent::scoped_rlock lk(table_lock_);
+
+  write_bytes(os, mapped_magic, sizeof(mapped_magic));
+  write_value(os, mapped_format_version);
+  write_value(os, mapped_byte_order_mark);
+  write_value(os, tuples_);
+  write_value(os, clock_);
+  write_value(os, static_cast<uint64_t>(columns_.size()));
+
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    const column_type type = columns_[i].type();
+    write_value(os, static_cast<uint32_t>(type.name()));
+    write_value(os, static_cast<uint32_t>(
+        type.is(column_type::bit_vector_type) ? type.bit_vector_length() : 0));
+    get_column_io(type).write(os, columns_[i]);
+  }
+
+  write_strings(os, keys_, tuples_, &key_at);
+  write_strings(os, versions_, tuples_, &owner_at);
+  std::vector<uint64_t> clocks(tuples_);
+  for (uint64_t i = 0; i < tuples_; ++i) {
+    clocks[i] = versions_[i].second;
+  }
+  write_section(os, clocks.empty() ? NULL : &clocks[0],
+                clocks.size() * sizeof(uint64_t));
+}
+
+void column_table::load_mapped(const std::string& path) {
+  const jutil::lang::shared_ptr<const mapped_file> file(new mapped_file(path));
+  load_mapped(file, 0);
+}
+
+uint64_t column_table::load_mapped(
+    const jutil::lang::shared_ptr<const mapped_file>& file,
+    uint64_t offset) {
+  mapped_reader reader(*file, offset);
+
+  if (std::memcmp(reader.read(sizeof(mapped_magic)), mapped_magic,
+                  sizeof(mapped_magic)) != 0) {
+    reader.broken("not a mapped table");
+  }
+  if (reader.read_value<uint32_t>() != mapped_format_version) {
+    reader.broken("unsupported format version");
+  }
+  if (reader.read_value<uint32_t>() != mapped_byte_order_mark) {
+    reader.broken("byte order mismatch");
+  }
+  const uint64_t tuples = reader.read_value<uint64_t>();
+  const uint64_t clock = reader.read_value<uint64_t>();
+  const uint64_t column_num = reader.read_value<uint64_t>();
+  if (tuples > file->size()) {
+    reader.broken("invalid number of tuples");
+  }
+
+  // build the new contents aside so that a broken file leaves the table as is
+  std::vector<detail::abstract_column> columns;
+  for (uint64_t i = 0; i < column_num; ++i) {
+    const uint32_t name = reader.read_value<uint32_t>();
+    const uint32_t bit_vector_length = reader.read_value<uint32_t>();
+    if (name >= column_type::array_type) {
+      reader.broken("invalid column type");
+    }
+    const column_type type =
+        name == column_type::bit_vector_type ?
+        column_type(column_type::bit_vector_type, bit_vector_length) :
+        column_type(static_cast<column_type::type_name>(name));
+    columns.push_back(detail::abstract_column(type));
+    get_column_io(type).read(reader, tuples, file, columns.back());
+  }
+
+  std::vector<std::string> keys;
+  reader.read_strings(tuples, keys);
+  std::vector<std::string> owners;
+  reader.read_strings(tuples, owners);
+  uint64_t clocks_size;
+  const char* clocks = reader.read_section(clocks_size);
+  if (clocks_size != tuples * sizeof(uint64_t)) {
+    reader.broken("invalid version size");
+  }
+
+  std::vector<version_t> versions;
+  versions.reserve(tuples);
+  index_table index;
+  for (uint64_t i = 0; i < tuples; ++i) {
+    uint64_t version;
+    std::memcpy(&version, clocks + i * sizeof(uint64_t), sizeof(uint64_t));
+    versions.push_back(std::make_pair(owner(owners[i]), version));
+    if (!index.insert(std::make_pair(keys[i], i)).second) {
+      reader.broken("duplicate key: " + keys[i]);
+    }
+  }
+
+  jutil::concurrent::scoped_wlock lk(table_lock_);
+  if (!columns_.empty()) {
+    if (columns_.size() != columns.size()) {
+      throw JUBATUS_EXCEPTION(type_unmatch_exception(
+          "number of columns does not match the schema"));
+    }
+    for (size_t i = 0; i < columns_.size(); ++i) {
+      if (!(columns_[i].type() == columns[i].type())) {
+        throw JUBATUS_EXCEPTION(type_unmatch_exception(
+            "column " + jutil::lang::lexical_cast<std::string>(i) +
+            " does not match the schema: expected " +
+            columns_[i].type().type_as_string() + ", actual " +
+            columns[i].type().type_as_string()));
+      }
+    }
+  }
+  keys_.swap(keys);
+  versions_.swap(versions);
+  columns_.swap(columns);
+  index_.swap(index);
+  tuples_ = tuples;
+  clock_ = clock;
+  reset_change_log_();
+  rebuild_version_index_();
+  return reader.position();
+}
+
 
 }  // namespace storage
 }  // namespace core
@@ -20,6 +20,8 @@
 #include <stdint.h>
 #include <algorithm>
 #include <cstring>
+#include <iosfwd>
+#include <map>
 #include <string>
 #include <vector>
 #include <utility>
@@ -28,6 +30,7 @@
 #include "jubatus/util/lang/cast.h"
 #include "jubatus/util/lang/demangle.h"
 #include "jubatus/util/data/unordered_map.h"
+#include "jubatus/util/concurrent/mutex.h"
 #include "jubatus/util/concurrent/rwmutex.h"
 #include "jubatus/util/lang/shared_ptr.h"
 #include "../common/assert.hpp"
@@ -58,9 +61,13 @@ class column_table {
 
  public:
   typedef std::pair<owner, uint64_t> version_t;
+  // (generation of the change log, number of entries read)
+  typedef std::pair<uint64_t, uint64_t> change_log_position;
 
   column_table()
-      : tuples_(0), clock_(0) {
+      : tuples_(0), clock_(0),
+        change_log_enabled_(false), change_log_generation_(1),
+        version_index_enabled_(false) {
   }
   ~column_table() {
   }
@@ -82,7 +89,7 @@ class column_table {
     if (not_found) {
       // add tuple
       keys_.push_back(key);
-      versions_.push_back(std::make_pair(o, clock_));
+      append_version_(std::make_pair(o, clock_));
       columns_[0].push_back(v1);
       JUBATUS_ASSERT_EQ(keys_.size(), versions_.size(), "");
 
@@ -91,9 +98,10 @@ class column_table {
       ++tuples_;
     } else {  // key exists
       const uint64_t index = it->second;
-      versions_[index] = std::make_pair(o, clock_);
+      set_version_(index, std::make_pair(o, clock_));
       columns_[0].update(index, v1);
     }
+    log_change_(key);
     ++clock_;
     return not_found;
   }
@@ -113,7 +121,7 @@ class column_table {
     if (not_found) {
       // add tuple
       keys_.push_back(key);
-      versions_.push_back(std::make_pair(o , clock_));
+      append_version_(std::make_pair(o, clock_));
       columns_[0].push_back(v1);
       columns_[1].push_back(v2);
       JUBATUS_ASSERT_EQ(keys_.size(), versions_.size(), "");
@@ -123,10 +131,11 @@ class column_table {
       ++tuples_;
     } else {  // key exists
       const uint64_t index = it->second;
-      versions_[index] = std::make_pair(o, clock_);
+      set_version_(index, std::make_pair(o, clock_));
       columns_[0].update(index, v1);
       columns_[1].update(index, v2);
     }
+    log_change_(key);
     ++clock_;
     return not_found;
   }
@@ -143,9 +152,10 @@ class column_table {
     if (tuples_ < column_id || it == index_.end()) {
       return false;
     }
-    versions_[it->second] = std::make_pair(o, clock_);
+    set_version_(it->second, std::make_pair(o, clock_));
     columns_[column_id].update(it->second, v);
     columns_[column_id].update(it->second, v);
+    log_change_(key);
     ++clock_;
     return true;
   }
@@ -250,6 +260,10 @@ class column_table {
 
   void get_row(const uint64_t id, framework::packer& pk) const {
     jubatus::util::concurrent::scoped_rlock lk(table_lock_);
+    get_row_nolock(id, pk);
+  }
+
+  void get_row_nolock(const uint64_t id, framework::packer& pk) const {
     JUBATUS_ASSERT_GE(tuples_, id, "specified index is bigger than table size");
     pk.pack_array(3);  // [key, [owner, id], [data]]
     pk.pack(keys_[id]);  // key
@@ -282,7 +296,7 @@ class column_table {
 
       // add tuple
       keys_.push_back(key);
-      versions_.push_back(set_version);
+      append_version_(set_version);
       for (size_t i = 0; i < columns_.size(); ++i) {
         columns_[i].push_back(dat.via.array.ptr[i]);
       }
@@ -301,7 +315,7 @@ class column_table {
       // overwrite tuple if needed
       if (versions_[target].second <= set_version.second) {
         // needed!!
-        versions_[target] = set_version;
+        set_version_(target, set_version);
         for (size_t i = 0; i < columns_.size(); ++i) {
           columns_[i].update(target, dat.via.array.ptr[i]);
         }
@@ -309,6 +323,7 @@ class column_table {
         index_.insert(std::make_pair(key, tuples_));
       }
     }
+    log_change_(key);
     if (clock_ <= set_version.second) {
       clock_ = set_version.second + 1;
     }
@@ -321,7 +336,7 @@ class column_table {
     if (it == index_.end()) {
       return false;
     }
-    versions_[it->second] = std::make_pair(o, clock_);
+    set_version_(it->second, std::make_pair(o, clock_));
     ++clock_;
     return true;
   }
@@ -331,7 +346,7 @@ class column_table {
     if (size_nolock() < index) {
       return false;
     }
-    versions_[index] = std::make_pair(o, clock_);
+    set_version_(index, std::make_pair(o, clock_));
     ++clock_;
     return true;
   }
@@ -384,6 +399,70 @@ class column_table {
     return table_lock_;
   }
 
+  /**
+   * Starts recording keys of rows which are added, updated or deleted, so
+   * that secondary indexes over this table can follow the changes
+   * incrementally.
+   */
+  void enable_change_log() {
+    jubatus::util::concurrent::scoped_wlock lk(table_lock_);
+    if (!change_log_enabled_) {
+      change_log_enabled_ = true;
+      reset_change_log_();
+    }
+  }
+
+  /**
+   * Returns the position of the end of the change log.  Reading the log
+   * from it returns the rows changed afterwards.
+   *
+   * The caller must hold the table lock.
+   */
+  change_log_position get_change_log_end_nolock() const {
+    return std::make_pair(change_log_generation_, changed_keys_.size());
+  }
+
+  /**
+   * Copies keys of rows changed since ``pos`` into ``keys`` and moves
+   * ``pos`` to the end of the log.  Returns false when the changes since
+   * ``pos`` were not recorded individually (``pos`` is from before clear,
+   * unpack or a reset of the log because too many rows were changed, or
+   * is default constructed); the whole table must be scanned again in
+   * that case.
+   *
+   * The log is not modified, so any number of readers can follow it with
+   * their own positions under the table read lock.
+   */
+  bool read_changed_keys_nolock(
+      change_log_position& pos,
+      std::vector<std::string>& keys) const {
+    keys.clear();
+    const bool complete = pos.first == change_log_generation_ &&
+        pos.second <= changed_keys_.size();
+    if (complete) {
+      keys.assign(changed_keys_.begin() + pos.second, changed_keys_.end());
+    }
+    pos = get_change_log_end_nolock();
+    return complete;
+  }
+
+  /**
+   * Starts keeping the row indexes ordered by version for each owner, so
+   * that ``get_rows_newer_than_nolock`` does not have to scan the table.
+   */
+  void enable_version_index();
+
+  /**
+   * Collects indexes of rows whose version is newer than the one of its
+   * owner in ``clock``, or whose owner is not in ``clock``.  The indexes
+   * are sorted in ascending order.
+   *
+   * The caller must hold the table lock.
+   */
+  void get_rows_newer_than_nolock(
+      const std::map<owner, uint64_t>& clock,
+      std::vector<uint64_t>& ids) const;
+
   MSGPACK_DEFINE(keys_, tuples_, versions_, columns_, clock_, index_);
 
   void pack(framework::packer& packer) const {
@@ -394,8 +473,39 @@ class column_table {
   void unpack(msgpack::object o) {
     jubatus::util::concurrent::scoped_wlock lk(table_lock_);
     o.convert(this);
+    reset_change_log_();
+    rebuild_version_index_();
   }
 
+  /**
+   * Writes the table in a flat layout which ``load_mapped`` can use without
+   * parsing.  Values of fixed-width columns are written as raw arrays, so
+   * the file can only be loaded on hosts with the same byte order.
+   *
+   * The layout may follow other data at an 8-byte aligned offset of a
+   * file; driver::nearest_neighbor::save_mapped embeds it this way.
+   */
+  void save_mapped(std::ostream& os) const;
+
+  /**
+   * Loads the table written by ``save_mapped``.  The file is mapped into
+   * memory and fixed-width columns (including bit vectors) refer to it in
+   * place; each column is copied into memory on its first update.  Keys,
+   * versions and string columns are copied on load.
+   *
+   * If the schema is already initialized, it must match the one in the
+   * file.
+   */
+  void load_mapped(const std::string& path);
+
+  /**
+   * Same as above, but reads the table at ``offset`` (a multiple of 8) of
+   * ``file``.  Returns the offset just after the table.
+   */
+  uint64_t load_mapped(
+      const jubatus::util::lang::shared_ptr<const mapped_file>& file,
+      uint64_t offset);
+
  private:
   std::vector<std::string> keys_;
   std::vector<version_t> versions_;
@@ -405,6 +515,68 @@ class column_table {
   uint64_t clock_;
   index_table index_;
 
+  bool change_log_enabled_;
+  std::vector<std::string> changed_keys_;
+  uint64_t change_log_generation_;
+
+  /**
+   * Clocks and indexes of rows of an owner, appended on every version
+   * change.  Entries are invalidated (not removed) when the row gets a new
+   * version or moves, and are dropped once stale ones dominate.
+   */
+  struct version_log {
+    version_log()
+        : sorted(0), stale(0) {
+    }
+    std::vector<std::pair<uint64_t, uint64_t> > entries;  // (clock, index)
+    size_t sorted;  // entries[0, sorted) is sorted
+    size_t stale;
+  };
+  typedef std::map<owner, version_log> version_index_t;
+
+  bool version_index_enabled_;
+  mutable version_index_t version_index_;
+  mutable jubatus::util::concurrent::mutex version_index_lock_;
+
+  void append_version_(const version_t& version) {
+    versions_.push_back(version);
+    index_version_(versions_.size() - 1);
+  }
+
+  void set_version_(uint64_t index, const version_t& version) {
+    unindex_version_(index);
+    versions_[index] = version;
+    index_version_(index);
+  }
+
+  void index_version_(uint64_t index) {
+    if (version_index_enabled_) {
+      version_index_[versions_[index].first].entries.push_back(
+          std::make_pair(versions_[index].second, index));
+    }
+  }
+
+  void unindex_version_(uint64_t index);
+  void rebuild_version_index_();
+  void compact_version_log_(const owner& o, version_log& log) const;
+  static void sort_version_log_(version_log& log);
+
+  void log_change_(const std::string& key) {
+    if (!change_log_enabled_) {
+      return;
+    }
+    if (changed_keys_.size() > tuples_) {
+      // rescanning the table is cheaper than replaying the log
+      reset_change_log_();
+    }
+    changed_keys_.push_back(key);
+  }
+
+  void reset_change_log_() {
+    std::vector<std::string>().swap(changed_keys_);
+    ++change_log_generation_;
+  }
+
   void delete_row_(uint64_t index) {
     JUBATUS_ASSERT_LT(index, size_nolock(), "");
 
@@ -413,6 +585,12 @@ class column_table {
          ++jt) {
       jt->remove(index);
     }
+    log_change_(keys_[index]);
+    unindex_version_(index);
+    const uint64_t last = tuples_ - 1;
+    if (index != last) {
+      unindex_version_(last);
+    }
     {  // needs swap on last index
       index_table::iterator move_it = index_.find(keys_[tuples_ - 1]);
       move_it->second = index;
@@ -431,6 +609,9 @@ class column_table {
 
     --tuples_;
     ++clock_;
+    if (index != last) {
+      index_version_(index);
+    }
 
     JUBATUS_ASSERT_EQ(tuples_, index_.size(), "");
     JUBATUS_ASSERT_EQ(tuples_, keys_.size(), "");
@@ -14,6 +14,10 @@
 // License along with this library; if not, write to the Free Software
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
 #include <string>
 #include <set>
 #include <vector>
@@ -22,6 +26,7 @@
 #include <msgpack.hpp>
 #include "jubatus/util/text/json.h"
 #include "column_table.hpp"
+#include "mapped_file.hpp"
 #include "jubatus/util/math/random.h"
 #include "jubatus/util/lang/shared_ptr.h"
 #include "../../framework/packer.hpp"
@@ -34,6 +39,8 @@ using jubatus::core::storage::column_table;
 using jubatus::core::storage::column_type;
 using jubatus::core::storage::bit_vector;
 using jubatus::core::storage::owner;
+using jubatus::core::storage::storage_exception;
+using jubatus::core::storage::mapped_file;
 
 using jubatus::core::storage::const_bit_vector_column;
 using jubatus::core::storage::const_double_column;
@@ -958,3 +965,235 @@ TEST(table, delete_bv_row) {
     ASSERT_EQ(bv2, bc[0]);  // data will move
   }
 }
+
+TEST(table, rows_newer_than) {
+  jubatus::util::math::random::mtrand rand(0);
+  column_table scan, indexed;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::int32_type));
+  scan.init(schema);
+  indexed.init(schema);
+  indexed.enable_version_index();
+
+  const owner owners[] = { owner("a"), owner("b"), owner("c") };
+  for (int i = 0; i < 2000; ++i) {
+    const string key = jubatus::util::lang::lexical_cast<string>(
+        rand.next_int(300));
+    const owner& o = owners[rand.next_int(3)];
+    switch (rand.next_int(4)) {
+      case 0:
+        scan.delete_row(key);
+        indexed.delete_row(key);
+        break;
+      case 1:
+        scan.update_clock(key, o);
+        indexed.update_clock(key, o);
+        break;
+      default:
+        scan.add<int32_t>(key, o, i);
+        indexed.add<int32_t>(key, o, i);
+        break;
+    }
+
+    if (i % 50 == 0) {
+      std::map<owner, uint64_t> clock;
+      clock[owners[0]] = rand.next_int(i + 1);
+      clock[owners[1]] = rand.next_int(i + 1);
+
+      vector<uint64_t> expected, actual;
+      scan.get_rows_newer_than_nolock(clock, expected);
+      indexed.get_rows_newer_than_nolock(clock, actual);
+      ASSERT_EQ(expected, actual);
+    }
+  }
+  ASSERT_EQ(scan.size(), indexed.size());
+
+  std::map<owner, uint64_t> clock;
+  vector<uint64_t> all;
+  indexed.get_rows_newer_than_nolock(clock, all);
+  EXPECT_EQ(indexed.size(), all.size());
+
+  indexed.clear();
+  indexed.get_rows_newer_than_nolock(clock, all);
+  EXPECT_TRUE(all.empty());
+}
+
+class mapped_table_test : public ::testing::Test {
+ protected:
+  void SetUp() {
+    char path[] = "/tmp/jubatus_column_table_XXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    path_ = path;
+  }
+
+  void TearDown() {
+    unlink(path_.c_str());
+  }
+
+  void save(const column_table& table) {
+    std::ofstream ofs(path_.c_str(), std::ios::binary);
+    table.save_mapped(ofs);
+    ASSERT_TRUE(ofs.good());
+  }
+
+  string path_;
+};
+
+TEST_F(mapped_table_test, save_load) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::bit_vector_type, 100));
+  schema.push_back(column_type(column_type::double_type));
+  base.init(schema);
+
+  vector<bit_vector> bvs;
+  for (int i = 0; i < 10; ++i) {
+    bit_vector bv(100);
+    bv.set_bit(i * 7);
+    bv.set_bit(99 - i);
+    bvs.push_back(bv);
+    base.add(jubatus::util::lang::lexical_cast<string>(i),
+             owner(i % 2 ? "odd" : "even"), bv, i * 0.5);
+  }
+  save(base);
+
+  column_table loaded;
+  loaded.load_mapped(path_);
+  ASSERT_EQ(10u, loaded.size());
+  EXPECT_TRUE(loaded.get_bit_vector_column(0).is_mapped());
+  EXPECT_TRUE(loaded.get_double_column(1).is_mapped());
+  for (uint64_t i = 0; i < 10; ++i) {
+    const string key = jubatus::util::lang::lexical_cast<string>(i);
+    EXPECT_EQ(key, loaded.get_key(i));
+    EXPECT_EQ(base.get_version(i), loaded.get_version(i));
+    EXPECT_EQ(bvs[i], loaded.get_bit_vector_column(0)[i]);
+    EXPECT_EQ(i * 0.5, loaded.get_double_column(1)[i]);
+    EXPECT_TRUE(loaded.exact_match(key).first);
+  }
+
+  // columns are copied from the mapping on the first update
+  bit_vector bv(100);
+  bv.set_bit(50);
+  loaded.add("3", owner("even"), bv, -1.0);
+  EXPECT_FALSE(loaded.get_bit_vector_column(0).is_mapped());
+  EXPECT_FALSE(loaded.get_double_column(1).is_mapped());
+  EXPECT_EQ(bv, loaded.get_bit_vector_column(0)[3]);
+  EXPECT_EQ(-1.0, loaded.get_double_column(1)[3]);
+  EXPECT_EQ(bvs[4], loaded.get_bit_vector_column(0)[4]);
+
+  ASSERT_TRUE(loaded.delete_row("0"));
+  EXPECT_EQ(9u, loaded.size());
+  EXPECT_FALSE(loaded.exact_match("0").first);
+
+  // the file is left intact
+  column_table reloaded;
+  reloaded.load_mapped(path_);
+  EXPECT_EQ(bvs[3], reloaded.get_bit_vector_column(0)[3]);
+  ASSERT_TRUE(reloaded.delete_row("0"));
+  EXPECT_EQ(bvs[9], reloaded.get_bit_vector_column(0)[0]);
+  EXPECT_EQ(4.5, reloaded.get_double_column(1)[0]);
+}
+
+TEST_F(mapped_table_test, string_column) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::string_type));
+  schema.push_back(column_type(column_type::int32_type));
+  base.init(schema);
+  base.add<string, int32_t>("a", owner("x"), "", -1);
+  base.add<string, int32_t>("b", owner("y"), "hello", 2);
+  save(base);
+
+  column_table loaded;
+  loaded.init(schema);
+  loaded.load_mapped(path_);
+  ASSERT_EQ(2u, loaded.size());
+  EXPECT_EQ("", loaded.get_string_column(0)[0]);
+  EXPECT_EQ("hello", loaded.get_string_column(0)[1]);
+  EXPECT_EQ(-1, loaded.get_int32_column(1)[0]);
+  EXPECT_EQ(2, loaded.get_int32_column(1)[1]);
+}
+
+TEST_F(mapped_table_test, at_offset) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::int32_type));
+  base.init(schema);
+  base.add<int32_t>("a", owner("x"), 3);
+  {
+    // the table follows other data, as in a driver model file
+    std::ofstream ofs(path_.c_str(), std::ios::binary);
+    ofs.write("12345678", 8);
+    base.save_mapped(ofs);
+    ofs.write("tail", 4);
+  }
+
+  const jubatus::util::lang::shared_ptr<const mapped_file> file(
+      new mapped_file(path_));
+  column_table loaded;
+  EXPECT_EQ(file->size() - 4, loaded.load_mapped(file, 8));
+  ASSERT_EQ(1u, loaded.size());
+  EXPECT_EQ(3, loaded.get_int32_column(0)[0]);
+
+  // sections must be aligned
+  EXPECT_THROW(column_table().load_mapped(file, 4), storage_exception);
+}
+
+TEST_F(mapped_table_test, empty) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::bit_vector_type, 64));
+  base.init(schema);
+  save(base);
+
+  column_table loaded;
+  loaded.load_mapped(path_);
+  EXPECT_EQ(0u, loaded.size());
+  loaded.add("a", owner("x"), bit_vector(64));
+  EXPECT_EQ(1u, loaded.size());
+}
+
+TEST_F(mapped_table_test, schema_unmatch) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::float_type));
+  base.init(schema);
+  base.add("a", owner("x"), 1.0f);
+  save(base);
+
+  column_table loaded;
+  vector<column_type> other;
+  other.push_back(column_type(column_type::double_type));
+  loaded.init(other);
+  EXPECT_THROW(loaded.load_mapped(path_), storage_exception);
+  EXPECT_EQ(0u, loaded.size());
+}
+
+TEST_F(mapped_table_test, broken_file) {
+  column_table base;
+  vector<column_type> schema;
+  schema.push_back(column_type(column_type::uint64_type));
+  base.init(schema);
+  base.add<uint64_t>("a", owner("x"), 1);
+  base.add<uint64_t>("b", owner("x"), 2);
+  save(base);
+
+  // truncate the file
+  std::ifstream ifs(path_.c_str(), std::ios::binary);
+  const string data((std::istreambuf_iterator<char>(ifs)),
+                    std::istreambuf_iterator<char>());
+  ifs.close();
+  for (size_t size = 0; size < data.size(); size += 8) {
+    {
+      std::ofstream ofs(path_.c_str(), std::ios::binary | std::ios::trunc);
+      ofs.write(data.data(), size);
+    }
+    column_table loaded;
+    EXPECT_THROW(loaded.load_mapped(path_), storage_exception);
+  }
+
+  EXPECT_THROW(column_table().load_mapped(path_ + ".missing"),
+               storage_exception);
+}
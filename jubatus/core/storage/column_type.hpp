@@ -66,6 +66,9 @@ class column_type {
   bool is(const type_name& type) const {
     return type_ == type;
   }
+  type_name name() const {
+    return type_;
+  }
 
   std::string type_as_string() const {
     if (type_ == int8_type) {
@@ -23,9 +23,9 @@
 #include <utility>
 #include <vector>
 
+#include "../common/thread_pool.hpp"
 #include "../storage/fixed_size_heap.hpp"
 #include "jubatus/util/data/unordered_map.h"
-#include "jubatus/util/data/unordered_set.h"
 
 using std::istringstream;
 using std::make_pair;
@@ -38,13 +38,167 @@ using std::max;
 using std::string;
 using std::vector;
 using jubatus::util::data::unordered_map;
-using jubatus::util::data::unordered_set;
 
 namespace jubatus {
 namespace core {
 namespace storage {
 
-inverted_index_storage::inverted_index_storage() {
+namespace {
+
+template <typename Heap>
+void merge_score_heap(Heap& heap, const Heap& other) {
+  heap.merge(other);
+}
+
+// Accumulates inner products into a dense array indexed by column ID.
+struct dense_scores {
+  explicit dense_scores(size_t size)
+      : scores(size, 0.0) {
+  }
+  void add(uint64_t column_id, double val) {
+    scores[column_id] += val;
+  }
+  vector<double> scores;
+};
+
+// Accumulates inner products only for the columns the query touches.
+struct sparse_scores {
+  void add(uint64_t column_id, double val) {
+    scores[column_id] += val;
+  }
+  unordered_map<uint64_t, double> scores;
+};
+
+double max_abs_weight(const row_t& row) {
+  double ret = 0.0;
+  for (row_t::const_iterator it = row.begin(); it != row.end(); ++it) {
+    ret = std::max(ret, std::fabs(it->second));
+  }
+  return ret;
+}
+
+// Scoring functions for top-k pruning.  Scores must be non-decreasing in
+// the inner product ``ip`` of the query and the column.
+struct cosine_metric {
+  explicit cosine_metric(double query_squared_norm)
+      : query_squared_norm(query_squared_norm) {
+  }
+  // same as rank_cosine_scores
+  double score(double ip, double squared_norm) const {
+    if (squared_norm == query_squared_norm && squared_norm == ip) {
+      return 1.0;
+    }
+    return bound(ip, squared_norm);
+  }
+  double bound(double ip, double squared_norm) const {
+    return ip / std::sqrt(squared_norm) / std::sqrt(query_squared_norm);
+  }
+  // columns with no inner product are not ranked
+  bool accepts(double ip) const {
+    return ip != 0.0;
+  }
+  bool accepts_lower_bound(double lower) const {
+    return lower > 0.0;
+  }
+  // upper bound of the score of columns that only share features whose
+  // query vector has the norm ``rest_norm``
+  double unseen_bound(double rest_norm) const {
+    return rest_norm / std::sqrt(query_squared_norm);
+  }
+  double query_squared_norm;
+};
+
+struct euclid_metric {
+  explicit euclid_metric(double query_squared_norm)
+      : query_squared_norm(query_squared_norm) {
+  }
+  // same as calc_euclid_scores
+  double score(double ip, double squared_norm) const {
+    return bound(ip, squared_norm);
+  }
+  double bound(double ip, double squared_norm) const {
+    double d2 = query_squared_norm + squared_norm - 2 * ip;
+    return -std::sqrt(std::max(0.0, d2));
+  }
+  bool accepts(double) const {
+    return true;
+  }
+  bool accepts_lower_bound(double) const {
+    return true;
+  }
+  double unseen_bound(double rest_norm) const {
+    // minimum of |q|^2 + |c|^2 - 2 * rest_norm * |c| over |c|
+    return -std::sqrt(
+        std::max(0.0, query_squared_norm - rest_norm * rest_norm));
+  }
+  double query_squared_norm;
+};
+
+// Relative slack to absorb rounding errors in the bounds.
+const double PRUNING_SLACK = 1e-9;
+
+// State of a column during pruned ranking.
+struct candidate {
+  candidate()
+      : ip(0.0), seen_squared_norm(0.0), squared_norm(-1.0) {
+  }
+
+  // upper bound of the absolute inner product with the query features not
+  // processed yet
+  double rest_ip_bound(double rest_norm, double rest_max_ip) const {
+    const double rest_squared_norm =
+        std::max(0.0, squared_norm - seen_squared_norm) +
+        PRUNING_SLACK * squared_norm;
+    return std::min(rest_norm * std::sqrt(rest_squared_norm), rest_max_ip) *
+        (1 + PRUNING_SLACK);
+  }
+
+  double ip;
+  double seen_squared_norm;
+  double squared_norm;  // negative until fetched
+};
+
+typedef unordered_map<uint64_t, candidate> candidates_t;
+
+// Adds the weights of a posting list to the candidates; new columns are
+// admitted only when ``admit`` is set.
+struct candidate_scores {
+  candidate_scores(candidates_t& c, bool admit)
+      : c(c), admit(admit), q(0.0) {
+  }
+  void add(uint64_t column_id, double w) {
+    candidates_t::iterator it = admit ? c.insert(
+        make_pair(column_id, candidate())).first : c.find(column_id);
+    if (it != c.end()) {
+      it->second.ip += q * w;
+      it->second.seen_squared_norm += w * w;
+    }
+  }
+  candidates_t& c;
+  bool admit;
+  double q;
+};
+
+// Accumulates exact inner products of the surviving columns.
+struct survivor_scores {
+  explicit survivor_scores(candidates_t& c)
+      : c(c) {
+  }
+  void add(uint64_t column_id, double v) {
+    candidates_t::iterator it = c.find(column_id);
+    if (it != c.end()) {
+      it->second.ip += v;
+    }
+  }
+  candidates_t& c;
+};
+
+}  // namespace
+
+inverted_index_storage::inverted_index_storage()
+    : compact_(false),
+      threads_(0),
+      topk_pruning_(false) {
 }
 
 inverted_index_storage::~inverted_index_storage() {
@@ -63,6 +217,10 @@ void inverted_index_storage::set(
     column2norm_diff_[column_id] -= cur_val * cur_val;
   }
   inv_diff_[row][column_id] = val;
+  if (topk_pruning_) {
+    double& max_weight = row2max_weight_[row];
+    max_weight = std::max(max_weight, std::fabs(val));
+  }
   column2norm_diff_[column_id] += val * val;
   if (column2norm_diff_[column_id] == 0) {
     column2norm_diff_.erase(column_id);
@@ -85,7 +243,7 @@ double inverted_index_storage::get(
   }
   {
     bool exist = false;
-    double ret = get_from_tbl(row, column_id, inv_, exist);
+    double ret = get_from_master(row, column_id, exist);
     if (exist) {
       return ret;
     }
@@ -93,6 +251,22 @@ double inverted_index_storage::get(
   return 0.0;
 }
 
+double inverted_index_storage::get_from_master(
+    const std::string& row,
+    uint64_t column_id,
+    bool& exist) const {
+  if (!compact_) {
+    return get_from_tbl(row, column_id, inv_, exist);
+  }
+  exist = false;
+  posting_table_t::const_iterator it = inv_compact_.find(row);
+  double ret = 0.0;
+  if (it != inv_compact_.end()) {
+    exist = it->second.get(column_id, ret);
+  }
+  return ret;
+}
+
 double inverted_index_storage::get_from_tbl(
     const std::string& row,
     uint64_t column_id,
@@ -135,7 +309,7 @@ void inverted_index_storage::remove(
 
   // Test if the data exists in the master table.
   bool exist = false;
-  get_from_tbl(row, column_id, inv_, exist);
+  get_from_master(row, column_id, exist);
 
   // If the data exists in the master table, we should
   // keep it in the diff table until next MIX to propagate
@@ -179,8 +353,31 @@ void inverted_index_storage::mark_column_removed(const std::string& column) {
   }
 }
 
+void inverted_index_storage::set_compact_postings(bool compact) {
+  if (compact == compact_) {
+    return;
+  }
+  if (compact) {
+    for (tbl_t::const_iterator it = inv_.begin(); it != inv_.end(); ++it) {
+      if (!it->second.empty()) {
+        inv_compact_[it->first].assign(it->second);
+      }
+    }
+    tbl_t().swap(inv_);
+  } else {
+    for (posting_table_t::const_iterator it = inv_compact_.begin();
+         it != inv_compact_.end(); ++it) {
+      it->second.to_row(inv_[it->first]);
+    }
+    posting_table_t().swap(inv_compact_);
+  }
+  compact_ = compact;
+}
+
 void inverted_index_storage::clear() {
   tbl_t().swap(inv_);
+  posting_table_t().swap(inv_compact_);
+  unordered_map<string, double>().swap(row2max_weight_);
   tbl_t().swap(inv_diff_);
   imap_double_t().swap(column2norm_);
   imap_double_t().swap(column2norm_diff_);
@@ -279,7 +476,14 @@ bool inverted_index_storage::put_diff(
 
   for (size_t i = 0; i < ids.size(); ++i) {
     const string& row = ids[i];
-    row_t& v = inv_[row];
+    row_t decoded;
+    if (compact_) {
+      posting_table_t::const_iterator it = inv_compact_.find(row);
+      if (it != inv_compact_.end()) {
+        it->second.to_row(decoded);
+      }
+    }
+    row_t& v = compact_ ? decoded : inv_[row];
     vector<pair<string, double> > columns;
     mixed_diff.inv.get_row(row, columns);
 
@@ -298,6 +502,20 @@ bool inverted_index_storage::put_diff(
         }
       }
     }
+    if (compact_) {
+      if (v.empty()) {
+        inv_compact_.erase(row);
+      } else {
+        inv_compact_[row].assign(v);
+      }
+    }
+    if (topk_pruning_) {
+      if (v.empty()) {
+        row2max_weight_.erase(row);
+      } else {
+        row2max_weight_[row] = max_abs_weight(v);
+      }
+    }
   }
   inv_diff_.clear();
 
@@ -358,6 +576,120 @@ void inverted_index_storage::unpack(msgpack::object o) {
   o.convert(this);
 }
 
+void inverted_index_storage::pack_chunked(
+    framework::packer& packer, size_t chunk_rows) const {
+  packer.pack_array(5);
+  packer.pack(column2id_);
+  packer.pack(static_cast<uint64_t>(
+      compact_ ? inv_compact_.size() : inv_.size()));
+  packer.pack(static_cast<uint64_t>(inv_diff_.size()));
+  packer.pack(static_cast<uint64_t>(column2norm_.size()));
+  packer.pack(static_cast<uint64_t>(column2norm_diff_.size()));
+
+  if (compact_) {
+    // same layout as pack_map_chunks over tbl_t
+    chunk_rows = std::max<size_t>(chunk_rows, 1);
+    posting_table_t::const_iterator it = inv_compact_.begin();
+    for (size_t remaining = inv_compact_.size(); remaining > 0;) {
+      const size_t n = std::min(remaining, chunk_rows);
+      packer.pack_map(n);
+      for (size_t i = 0; i < n; ++i, ++it) {
+        row_t row;
+        it->second.to_row(row);
+        packer.pack(it->first);
+        packer.pack(row);
+      }
+      remaining -= n;
+    }
+  } else {
+    framework::pack_map_chunks(packer, inv_, chunk_rows);
+  }
+  framework::pack_map_chunks(packer, inv_diff_, chunk_rows);
+  framework::pack_map_chunks(packer, column2norm_, chunk_rows);
+  framework::pack_map_chunks(packer, column2norm_diff_, chunk_rows);
+}
+
+void inverted_index_storage::unpack_chunked(framework::unpacker& unpacker) {
+  common::key_manager column2id;
+  uint64_t inv_size;
+  uint64_t inv_diff_size;
+  uint64_t column2norm_size;
+  uint64_t column2norm_diff_size;
+  {
+    msgpack::unpacked header;
+    unpacker.next(header);
+    const msgpack::object o = header.get();
+    if (o.type != msgpack::type::ARRAY || o.via.array.size != 5) {
+      throw msgpack::type_error();
+    }
+    o.via.array.ptr[0].convert(&column2id);
+    o.via.array.ptr[1].convert(&inv_size);
+    o.via.array.ptr[2].convert(&inv_diff_size);
+    o.via.array.ptr[3].convert(&column2norm_size);
+    o.via.array.ptr[4].convert(&column2norm_diff_size);
+  }
+
+  tbl_t inv;
+  posting_table_t inv_compact;
+  if (compact_) {
+    tbl_t chunk;
+    while (inv_size > 0) {
+      chunk.clear();
+      unpacker.next_map_chunk(inv_size, chunk);
+      for (tbl_t::const_iterator it = chunk.begin(); it != chunk.end();
+           ++it) {
+        if (!it->second.empty()) {
+          inv_compact[it->first].assign(it->second);
+        }
+      }
+    }
+  } else {
+    while (inv_size > 0) {
+      unpacker.next_map_chunk(inv_size, inv);
+    }
+  }
+  tbl_t inv_diff;
+  while (inv_diff_size > 0) {
+    unpacker.next_map_chunk(inv_diff_size, inv_diff);
+  }
+  imap_double_t column2norm;
+  while (column2norm_size > 0) {
+    unpacker.next_map_chunk(column2norm_size, column2norm);
+  }
+  imap_double_t column2norm_diff;
+  while (column2norm_diff_size > 0) {
+    unpacker.next_map_chunk(column2norm_diff_size, column2norm_diff);
+  }
+
+  inv_.swap(inv);
+  inv_compact_.swap(inv_compact);
+  inv_diff_.swap(inv_diff);
+  column2norm_.swap(column2norm);
+  column2norm_diff_.swap(column2norm_diff);
+  column2id_.swap(column2id);
+  rebuild_max_weights();
+}
+
+void inverted_index_storage::msgpack_unpack(msgpack::object o) {
+  if (o.type != msgpack::type::ARRAY || o.via.array.size != 5) {
+    throw msgpack::type_error();
+  }
+  tbl_t inv;
+  o.via.array.ptr[0].convert(&inv);
+  o.via.array.ptr[1].convert(&inv_diff_);
+  o.via.array.ptr[2].convert(&column2norm_);
+  o.via.array.ptr[3].convert(&column2norm_diff_);
+  o.via.array.ptr[4].convert(&column2id_);
+
+  inv_.swap(inv);
+  posting_table_t().swap(inv_compact_);
+  rebuild_max_weights();
+  if (compact_) {
+    compact_ = false;
+    set_compact_postings(true);
+  }
+}
+
 void inverted_index_storage::calc_scores(
     const common::sfv_t& query,
     vector<pair<string, double> >& scores,
@@ -367,19 +699,54 @@ void inverted_index_storage::calc_scores(
     return;
   }
 
-  std::vector<double> i_scores(column2id_.get_max_id() + 1, 0.0);
-  for (size_t i = 0; i < query.size(); ++i) {
-    const string& fid = query[i].first;
-    double val = query[i].second;
-    add_inp_scores(fid, val, i_scores);
+  score_heap_t heap(ret_num);
+  if (topk_pruning_) {
+    rank_pruned(query, cosine_metric(query_squared_norm), false, ret_num,
+                heap);
+  } else {
+    sparse_scores acc;
+    for (size_t i = 0; i < query.size(); ++i) {
+      const string& fid = query[i].first;
+      double val = query[i].second;
+      add_inp_scores(fid, val, acc);
+    }
+    const vector<pair<uint64_t, double> > i_scores(
+        acc.scores.begin(), acc.scores.end());
+    if (threads_ > 1) {
+      common::default_thread_pool::parallel_reduce<score_heap_t>(
+          0, i_scores.size(), threads_,
+          jubatus::util::lang::bind(
+              &inverted_index_storage::rank_cosine_scores, this, &i_scores,
+              query_squared_norm, ret_num,
+              jubatus::util::lang::_1, jubatus::util::lang::_2),
+          &merge_score_heap<score_heap_t>, heap);
+    } else {
+      heap = rank_cosine_scores(
+          &i_scores, query_squared_norm, ret_num, 0, i_scores.size());
+    }
   }
 
-  storage::fixed_size_heap<
-      pair<double, uint64_t>,
-      std::greater<pair<double, uint64_t> > > heap(ret_num);
+  vector<pair<double, uint64_t> > sorted_scores;
+  heap.get_sorted(sorted_scores);
+
+  for (size_t i = 0; i < sorted_scores.size() && i < ret_num; ++i) {
+    scores.push_back(
+        make_pair(column2id_.get_key(sorted_scores[i].second),
+                  std::min(std::max(-1.0, sorted_scores[i].first), 1.0)));
+  }
+}
 
-  for (size_t i = 0; i < i_scores.size(); ++i) {
-    double score = i_scores[i];
+inverted_index_storage::score_heap_t
+inverted_index_storage::rank_cosine_scores(
+    const std::vector<std::pair<uint64_t, double> >* i_scores,
+    double query_squared_norm,
+    size_t ret_num,
+    size_t begin,
+    size_t end) const {
+  score_heap_t heap(ret_num);
+  for (size_t k = begin; k < end; ++k) {
+    const uint64_t i = (*i_scores)[k].first;
+    double score = (*i_scores)[k].second;
     if (score == 0.0)
       continue;
     double squared_norm = calc_column_squared_l2norm(i);
@@ -393,14 +760,7 @@ void inverted_index_storage::calc_scores(
     }
     heap.push(make_pair(cosine_similarity, i));
   }
-  vector<pair<double, uint64_t> > sorted_scores;
-  heap.get_sorted(sorted_scores);
-
-  for (size_t i = 0; i < sorted_scores.size() && i < ret_num; ++i) {
-    scores.push_back(
-        make_pair(column2id_.get_key(sorted_scores[i].second),
-                  std::min(std::max(-1.0, sorted_scores[i].first), 1.0)));
-  }
+  return heap;
 }
 
 /**
@@ -412,33 +772,39 @@ void inverted_index_storage::calc_euclid_scores(
     const common::sfv_t& query,
     vector<pair<string, double> >& scores,
     size_t ret_num) const {
-  std::vector<double> i_scores(column2id_.get_max_id() + 1, 0.0);
-  for (size_t i = 0; i < query.size(); ++i) {
-    const string& fid = query[i].first;
-    double val = query[i].second;
-    add_inp_scores(fid, val, i_scores);
-  }
-
   storage::fixed_size_heap<
       pair<double, uint64_t>,
       std::greater<pair<double, uint64_t> > > heap(ret_num);
 
   double squared_query_norm = calc_squared_l2norm(query);
-  for (size_t i = 0; i < i_scores.size(); ++i) {
-    double squared_norm = calc_column_squared_l2norm(i);
-
-    if (squared_norm == 0.0) {
-      // The column is already removed.
-      continue;
+  if (topk_pruning_) {
+    rank_pruned(query, euclid_metric(squared_query_norm), true, ret_num,
+                heap);
+  } else {
+    dense_scores acc(column2id_.get_max_id() + 1);
+    for (size_t i = 0; i < query.size(); ++i) {
+      const string& fid = query[i].first;
+      double val = query[i].second;
+      add_inp_scores(fid, val, acc);
     }
+    const vector<double>& i_scores = acc.scores;
+
+    for (size_t i = 0; i < i_scores.size(); ++i) {
+      double squared_norm = calc_column_squared_l2norm(i);
+
+      if (squared_norm == 0.0) {
+        // The column is already removed.
+        continue;
+      }
 
-    // `d2` is a squared euclidean distance.
-    // In edgy cases, `d2` may sliglty become negative (which is actually
-    // expected to be 0) due to the floating point precision problem.
-    // This cause `sqrt(d2)` to return NaN, which is not what we want.
-    // To avoid this we use `sqrt(max(0, d2))`.
-    double d2 = squared_query_norm + squared_norm - 2 * i_scores[i];
-    heap.push(make_pair(-std::sqrt(std::max(0.0, d2)), i));
+      // `d2` is a squared euclidean distance.
+      // In edgy cases, `d2` may sliglty become negative (which is actually
+      // expected to be 0) due to the floating point precision problem.
+      // This cause `sqrt(d2)` to return NaN, which is not what we want.
+      // To avoid this we use `sqrt(max(0, d2))`.
+      double d2 = squared_query_norm + squared_norm - 2 * i_scores[i];
+      heap.push(make_pair(-std::sqrt(std::max(0.0, d2)), i));
+    }
   }
 
   vector<pair<double, uint64_t> > sorted_scores;
@@ -455,37 +821,41 @@ void inverted_index_storage::calc_euclid_scores_ignore_orthogonal(
     const common::sfv_t& query,
     vector<pair<string, double> >& scores,
     size_t ret_num) const {
-  std::vector<double> i_scores(column2id_.get_max_id() + 1, 0.0);
-  unordered_set<int> i_scores_index_set;
-  for (size_t i = 0; i < query.size(); ++i) {
-    const string& fid = query[i].first;
-    double val = query[i].second;
-    add_inp_scores(fid, val, i_scores, i_scores_index_set);
-  }
-
   storage::fixed_size_heap<
       pair<double, uint64_t>,
       std::greater<pair<double, uint64_t> > > heap(ret_num);
 
   double squared_query_norm = calc_squared_l2norm(query);
+  if (topk_pruning_) {
+    rank_pruned(query, euclid_metric(squared_query_norm), false, ret_num,
+                heap);
+  } else {
+    sparse_scores acc;
+    for (size_t i = 0; i < query.size(); ++i) {
+      const string& fid = query[i].first;
+      double val = query[i].second;
+      add_inp_scores(fid, val, acc);
+    }
 
-  for (unordered_set<int>::const_iterator it = i_scores_index_set.begin();
-       it != i_scores_index_set.end();
-       ++it) {
-    double squared_norm = calc_column_squared_l2norm(*(it));
+    for (unordered_map<uint64_t, double>::const_iterator it =
+             acc.scores.begin();
+         it != acc.scores.end();
+         ++it) {
+      double squared_norm = calc_column_squared_l2norm(it->first);
 
-    if (squared_norm == 0.0) {
-      // The column is already removed.
-      continue;
-    }
+      if (squared_norm == 0.0) {
+        // The column is already removed.
+        continue;
+      }
 
-    // `d2` is a squared euclidean distance.
-    // In edgy cases, `d2` may sliglty become negative (which is actually
-    // expected to be 0) due to the floating point precision problem.
-    // This cause `sqrt(d2)` to return NaN, which is not what we want.
-    // To avoid this we use `sqrt(max(0, d2))`.
-    double d2 = squared_query_norm + squared_norm - 2 * i_scores[*(it)];
-    heap.push(make_pair(-std::sqrt(std::max(0.0, d2)), *(it)));
+      // `d2` is a squared euclidean distance.
+      // In edgy cases, `d2` may sliglty become negative (which is actually
+      // expected to be 0) due to the floating point precision problem.
+      // This cause `sqrt(d2)` to return NaN, which is not what we want.
+      // To avoid this we use `sqrt(max(0, d2))`.
+      double d2 = squared_query_norm + squared_norm - 2 * it->second;
+      heap.push(make_pair(-std::sqrt(std::max(0.0, d2)), it->first));
+    }
   }
 
   vector<pair<double, uint64_t> > sorted_scores;
@@ -529,78 +899,287 @@ double inverted_index_storage::calc_column_squared_l2norm(
   return ret;
 }
 
-void inverted_index_storage::add_inp_scores(
-    const std::string& row,
+size_t inverted_index_storage::postings::size() const {
+  size_t ret = diff ? diff->size() : 0;
+  if (master) {
+    ret += master->size();
+  } else if (compact) {
+    ret += compact->size();
+  }
+  return ret;
+}
+
+double inverted_index_storage::postings::find(uint64_t column_id) const {
+  if (diff) {
+    row_t::const_iterator it = diff->find(column_id);
+    if (it != diff->end()) {
+      return it->second;
+    }
+  }
+  double ret = 0.0;
+  if (master) {
+    row_t::const_iterator it = master->find(column_id);
+    if (it != master->end()) {
+      ret = it->second;
+    }
+  } else if (compact) {
+    compact->get(column_id, ret);
+  }
+  return ret;
+}
+
+template <typename Scores>
+void inverted_index_storage::postings::for_each(
     double val,
-    std::vector<double>& scores) const {
-  tbl_t::const_iterator it_diff = inv_diff_.find(row);
-  if (it_diff != inv_diff_.end()) {
-    const row_t& row_v = it_diff->second;
-    for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-        ++row_it) {
-      scores[row_it->first] += row_it->second * val;
+    Scores& scores) const {
+  if (diff) {
+    for (row_t::const_iterator it = diff->begin(); it != diff->end(); ++it) {
+      scores.add(it->first, it->second * val);
     }
   }
 
-  tbl_t::const_iterator it = inv_.find(row);
-  if (it != inv_.end()) {
-    const row_t& row_v = it->second;
-    if (it_diff == inv_diff_.end()) {
-      for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-          ++row_it) {
-        scores[row_it->first] += row_it->second * val;
+  // values in the diff table override the master table
+  if (master) {
+    for (row_t::const_iterator it = master->begin(); it != master->end();
+         ++it) {
+      if (!diff || diff->find(it->first) == diff->end()) {
+        scores.add(it->first, it->second * val);
       }
-    } else {
-      const row_t& row_diff_v = it_diff->second;
-      for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-          ++row_it) {
-        if (row_diff_v.find(row_it->first) == row_diff_v.end()) {
-          scores[row_it->first] += row_it->second * val;
-        }
+    }
+  } else if (compact) {
+    for (posting_list::const_iterator it(*compact); !it.end(); it.next()) {
+      if (!diff || diff->find(it.id()) == diff->end()) {
+        scores.add(it.id(), it.weight() * val);
       }
     }
   }
 }
 
-void inverted_index_storage::add_inp_scores(
-    const std::string& row,
-    double val,
-    std::vector<double>& scores,
-    unordered_set<int>& scores_index_set) const {
+inverted_index_storage::postings inverted_index_storage::get_postings(
+    const std::string& row) const {
+  postings ret;
   tbl_t::const_iterator it_diff = inv_diff_.find(row);
   if (it_diff != inv_diff_.end()) {
-    const row_t& row_v = it_diff->second;
-    for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-         ++row_it) {
-      scores[row_it->first] += row_it->second * val;
-      // records the row index when dot product is calculated
-      scores_index_set.insert(row_it->first);
-    }
-  }
-
-  tbl_t::const_iterator it = inv_.find(row);
-  if (it != inv_.end()) {
-    const row_t& row_v = it->second;
-    if (it_diff == inv_diff_.end()) {
-      for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-           ++row_it) {
-        scores[row_it->first] += row_it->second * val;
-        // records the row index when dot product is calculated
-        scores_index_set.insert(row_it->first);
+    ret.diff = &it_diff->second;
+  }
+  if (compact_) {
+    posting_table_t::const_iterator it = inv_compact_.find(row);
+    if (it != inv_compact_.end()) {
+      ret.compact = &it->second;
+    }
+  } else {
+    tbl_t::const_iterator it = inv_.find(row);
+    if (it != inv_.end()) {
+      ret.master = &it->second;
+    }
+  }
+  return ret;
+}
+
+double inverted_index_storage::get_max_weight(const std::string& row) const {
+  unordered_map<string, double>::const_iterator it =
+      row2max_weight_.find(row);
+  return it == row2max_weight_.end() ? 0.0 : it->second;
+}
+
+void inverted_index_storage::set_topk_pruning(bool pruning) {
+  if (pruning == topk_pruning_) {
+    return;
+  }
+  topk_pruning_ = pruning;
+  rebuild_max_weights();
+}
+
+void inverted_index_storage::rebuild_max_weights() {
+  unordered_map<string, double>().swap(row2max_weight_);
+  if (!topk_pruning_) {
+    return;
+  }
+  for (tbl_t::const_iterator it = inv_.begin(); it != inv_.end(); ++it) {
+    row2max_weight_[it->first] = max_abs_weight(it->second);
+  }
+  for (posting_table_t::const_iterator it = inv_compact_.begin();
+       it != inv_compact_.end(); ++it) {
+    double& max_weight = row2max_weight_[it->first];
+    for (posting_list::const_iterator p(it->second); !p.end(); p.next()) {
+      max_weight = std::max(max_weight, std::fabs(p.weight()));
+    }
+  }
+  for (tbl_t::const_iterator it = inv_diff_.begin(); it != inv_diff_.end();
+       ++it) {
+    double& max_weight = row2max_weight_[it->first];
+    max_weight = std::max(max_weight, max_abs_weight(it->second));
+  }
+}
+
+/**
+ * Term-at-a-time MaxScore.  Query features are processed in the order of
+ * their posting list length.  After each feature, the inner product of a
+ * column with the remaining features is bounded by both
+ * |q_rest| * |c_rest| (Cauchy-Schwarz) and sum(|q_f| * max_weight_f), which
+ * gives lower and upper bounds of its score.  Once columns not seen yet
+ * cannot beat the ``ret_num``-th best lower bound, no new columns are
+ * admitted, and columns whose upper bound falls below it are dropped.  The
+ * remaining columns are then scored exactly in the query order, so that
+ * the scores are identical to the ones without pruning.
+ */
+template <typename Metric>
+void inverted_index_storage::rank_pruned(
+    const common::sfv_t& query,
+    const Metric& metric,
+    bool all_columns,
+    size_t ret_num,
+    score_heap_t& heap) const {
+  if (ret_num == 0) {
+    return;
+  }
+
+  // duplicated features are merged for the bounds to hold
+  unordered_map<string, double> merged;
+  for (size_t i = 0; i < query.size(); ++i) {
+    merged[query[i].first] += query[i].second;
+  }
+  vector<postings> lists;
+  vector<double> weights;
+  vector<double> max_weights;
+  vector<pair<size_t, size_t> > order;
+  for (unordered_map<string, double>::const_iterator it = merged.begin();
+       it != merged.end(); ++it) {
+    order.push_back(make_pair(lists.size(), lists.size()));
+    lists.push_back(get_postings(it->first));
+    weights.push_back(it->second);
+    max_weights.push_back(get_max_weight(it->first));
+    order.back().first = lists.back().size();
+  }
+  std::sort(order.begin(), order.end());
+
+  // bounds of the query features not processed yet
+  const size_t n = order.size();
+  vector<double> rest_squared_norm(n + 1, 0.0);
+  vector<double> rest_max_ip(n + 1, 0.0);
+  for (size_t k = n; k > 0; --k) {
+    const size_t i = order[k - 1].second;
+    rest_squared_norm[k - 1] = rest_squared_norm[k] + weights[i] * weights[i];
+    rest_max_ip[k - 1] =
+        rest_max_ip[k] + std::fabs(weights[i]) * max_weights[i];
+  }
+
+  candidates_t candidates;
+  if (all_columns) {
+    for (uint64_t i = 0; i < column2id_.get_max_id() + 1; ++i) {
+      candidates[i].squared_norm = calc_column_squared_l2norm(i);
+    }
+  }
+  bool admit = !all_columns;
+  vector<double> lower;
+  for (size_t k = 0; k < n; ++k) {
+    const size_t i = order[k].second;
+    const postings& p = lists[i];
+    candidate_scores acc(candidates, admit);
+    acc.q = weights[i];
+    if (!admit && p.fast_find() &&
+        candidates.size() * (std::log(p.size() + 1.0) + 1) < p.size()) {
+      for (candidates_t::iterator it = candidates.begin();
+           it != candidates.end(); ++it) {
+        const double w = p.find(it->first);
+        if (w != 0.0) {
+          acc.add(it->first, w);
+        }
       }
     } else {
-      const row_t& row_diff_v = it_diff->second;
-      for (row_t::const_iterator row_it = row_v.begin(); row_it != row_v.end();
-           ++row_it) {
-        if (row_diff_v.find(row_it->first) == row_diff_v.end()) {
-          scores[row_it->first] += row_it->second * val;
-          scores_index_set.insert(row_it->first);
+      p.for_each(1.0, acc);
+    }
+
+    const double rest_norm = std::sqrt(rest_squared_norm[k + 1]);
+    lower.clear();
+    for (candidates_t::iterator it = candidates.begin();
+         it != candidates.end(); ++it) {
+      candidate& c = it->second;
+      if (c.squared_norm < 0.0) {
+        c.squared_norm = calc_column_squared_l2norm(it->first);
+      }
+      if (c.squared_norm == 0.0) {
+        continue;
+      }
+      const double lower_bound = metric.bound(
+          c.ip - c.rest_ip_bound(rest_norm, rest_max_ip[k + 1]),
+          c.squared_norm);
+      if (metric.accepts_lower_bound(lower_bound)) {
+        lower.push_back(lower_bound);
+      }
+    }
+    if (lower.size() < ret_num) {
+      continue;
+    }
+    std::nth_element(lower.begin(), lower.begin() + ret_num - 1, lower.end(),
+                     std::greater<double>());
+    const double kth = lower[ret_num - 1];
+    const double threshold = kth - PRUNING_SLACK * (1 + std::fabs(kth));
+
+    if (admit) {
+      if (metric.unseen_bound(rest_norm) >= threshold) {
+        continue;
+      }
+      admit = false;
+    }
+    for (candidates_t::iterator it = candidates.begin();
+         it != candidates.end();) {
+      const candidate& c = it->second;
+      if (c.squared_norm == 0.0 ||
+          metric.bound(
+              c.ip + c.rest_ip_bound(rest_norm, rest_max_ip[k + 1]),
+              c.squared_norm) < threshold) {
+        candidates.erase(it++);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // exact scores, accumulated in the same order as add_inp_scores
+  for (candidates_t::iterator it = candidates.begin();
+       it != candidates.end(); ++it) {
+    it->second.ip = 0.0;
+  }
+  for (size_t i = 0; i < query.size(); ++i) {
+    const postings p = get_postings(query[i].first);
+    const double val = query[i].second;
+    if (p.fast_find() &&
+        candidates.size() * (std::log(p.size() + 1.0) + 1) < p.size()) {
+      for (candidates_t::iterator it = candidates.begin();
+           it != candidates.end(); ++it) {
+        const double w = p.find(it->first);
+        if (w != 0.0) {
+          it->second.ip += w * val;
         }
       }
+    } else {
+      survivor_scores acc(candidates);
+      p.for_each(val, acc);
+    }
+  }
+
+  for (candidates_t::iterator it = candidates.begin();
+       it != candidates.end(); ++it) {
+    candidate& c = it->second;
+    if (c.squared_norm < 0.0) {
+      c.squared_norm = calc_column_squared_l2norm(it->first);
     }
+    if (c.squared_norm == 0.0 || !metric.accepts(c.ip)) {
+      continue;
+    }
+    heap.push(make_pair(metric.score(c.ip, c.squared_norm), it->first));
   }
 }
 
+template <typename Scores>
+void inverted_index_storage::add_inp_scores(
+    const std::string& row,
+    double val,
+    Scores& scores) const {
+  get_postings(row).for_each(val, scores);
+}
+
 std::string inverted_index_storage::name() const {
   return string("inverted_index_storage");
 }
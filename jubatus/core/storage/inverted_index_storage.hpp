@@ -17,6 +17,7 @@
 #ifndef JUBATUS_CORE_STORAGE_INVERTED_INDEX_STORAGE_HPP_
 #define JUBATUS_CORE_STORAGE_INVERTED_INDEX_STORAGE_HPP_
 
+#include <functional>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,6 +33,8 @@
 #include "../common/key_manager.hpp"
 #include "../framework/mixable_helper.hpp"
 #include "../unlearner/unlearner_base.hpp"
+#include "fixed_size_heap.hpp"
+#include "posting_list.hpp"
 #include "sparse_matrix_storage.hpp"
 
 using jubatus::util::lang::function;
@@ -58,6 +61,27 @@ class inverted_index_storage {
     unlearner_ = unlearner;
   }
 
+  // number of threads used to rank columns in calc_scores
+  void set_threads(uint32_t threads) {
+    threads_ = threads;
+  }
+
+  /**
+   * Keeps the master table (``inv_``) as compact posting lists instead of
+   * maps; weights are then held in single precision.  The diff table and
+   * the serialized form are not affected.
+   */
+  void set_compact_postings(bool compact);
+
+  /**
+   * Ranks columns with MaxScore-style dynamic pruning: query features are
+   * processed from the shortest posting list, and columns whose score upper
+   * bound cannot reach the current top ``ret_num`` are dropped before the
+   * long posting lists are scanned.  Surviving columns are scored exactly,
+   * so the results are the same as without pruning.
+   */
+  void set_topk_pruning(bool pruning);
+
   void set(const std::string& row, const std::string& column, double val);
   double get(const std::string& row, const std::string& column) const;
   void remove(const std::string& row, const std::string& column);
@@ -93,9 +117,83 @@ class inverted_index_storage {
   void pack(framework::packer& packer) const;
   void unpack(msgpack::object o);
 
-  MSGPACK_DEFINE(inv_, inv_diff_, column2norm_, column2norm_diff_, column2id_);
+  /**
+   * Writes the model as a header followed by batches of at most
+   * ``chunk_rows`` rows of each table, to be read by ``unpack_chunked``.
+   * Compact postings are expanded one row at a time, and are built row by
+   * row on load, so the whole table is never held twice.
+   */
+  void pack_chunked(framework::packer& packer, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
+
+  template <class Packer>
+  void msgpack_pack(Packer& packer) const {
+    packer.pack_array(5);
+    if (compact_) {
+      // same layout as tbl_t
+      packer.pack_map(inv_compact_.size());
+      for (posting_table_t::const_iterator it = inv_compact_.begin();
+           it != inv_compact_.end(); ++it) {
+        row_t row;
+        it->second.to_row(row);
+        packer.pack(it->first);
+        packer.pack(row);
+      }
+    } else {
+      packer.pack(inv_);
+    }
+    packer.pack(inv_diff_);
+    packer.pack(column2norm_);
+    packer.pack(column2norm_diff_);
+    packer.pack(column2id_);
+  }
+  void msgpack_unpack(msgpack::object o);
 
  private:
+  typedef fixed_size_heap<
+      std::pair<double, uint64_t>,
+      std::greater<std::pair<double, uint64_t> > > score_heap_t;
+
+  /**
+   * Read-only view of the postings of a row, with the diff table overlaid
+   * on the master table.
+   */
+  struct postings {
+    postings()
+        : diff(NULL), master(NULL), compact(NULL) {
+    }
+    size_t size() const;
+    double find(uint64_t column_id) const;
+    bool fast_find() const {
+      return compact == NULL;
+    }
+    template <typename Scores>
+    void for_each(double val, Scores& scores) const;
+
+    const row_t* diff;
+    const row_t* master;
+    const posting_list* compact;
+  };
+
+  postings get_postings(const std::string& row) const;
+  double get_max_weight(const std::string& row) const;
+  void rebuild_max_weights();
+
+  template <typename Metric>
+  void rank_pruned(
+      const common::sfv_t& query,
+      const Metric& metric,
+      bool all_columns,
+      size_t ret_num,
+      score_heap_t& heap) const;
+
+  score_heap_t rank_cosine_scores(
+      const std::vector<std::pair<uint64_t, double> >* i_scores,
+      double query_squared_norm,
+      size_t ret_num,
+      size_t begin,
+      size_t end) const;
+
   static double calc_l2norm(const common::sfv_t& sfv);
   static double calc_squared_l2norm(const common::sfv_t& sfv);
   double calc_columnl2norm(uint64_t column_id) const;
@@ -105,17 +203,16 @@ class inverted_index_storage {
       uint64_t column_id,
       const tbl_t& tbl,
       bool& exist) const;
-
-  void add_inp_scores(
+  double get_from_master(
       const std::string& row,
-      double val,
-      std::vector<double>& scores) const;
+      uint64_t column_id,
+      bool& exist) const;
 
+  template <typename Scores>
   void add_inp_scores(
       const std::string& row,
       double val,
-      std::vector<double>& scores,
-      util::data::unordered_set<int>& score_index_set) const;
+      Scores& scores) const;
 
   /**
    * inv_ / inv_diff_ is a master / diff table of the inverted index.
@@ -126,6 +223,12 @@ class inverted_index_storage {
   tbl_t inv_;
   tbl_t inv_diff_;
 
+  /**
+   * inv_compact_ replaces inv_ when compact postings are enabled.
+   */
+  posting_table_t inv_compact_;
+  bool compact_;
+
   /**
    * column2norm_ is a master table of norm index.  The key of this table
    * is a local column ID.
@@ -157,6 +260,15 @@ class inverted_index_storage {
    */
   imap_double_t column2norm_diff_;
 
+  /**
+   * row2max_weight_ holds an upper bound of the absolute weights in each
+   * row of inv_ and inv_diff_, used to prune columns in top-k ranking.
+   * It is raised on every update and recomputed for the rows merged on
+   * put_diff; it is not serialized.  It is only kept while topk_pruning_
+   * is enabled, and rebuilt when pruning is turned on.
+   */
+  jubatus::util::data::unordered_map<std::string, double> row2max_weight_;
+
   /**
    * column2id_ holds the mapping of global column IDs and local column IDs.
    * Global column ID is a string value specified by user.  Local column ID
@@ -166,6 +278,9 @@ class inverted_index_storage {
   common::key_manager column2id_;
 
   util::lang::shared_ptr<unlearner::unlearner_base> unlearner_;
+
+  uint32_t threads_;
+  bool topk_pruning_;
 };
 
 typedef framework::linear_mixable_helper<
@@ -15,13 +15,16 @@
 // Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <cmath>
+#include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 #include <gtest/gtest.h>
 #include "inverted_index_storage.hpp"
+#include "../framework/stream_reader.hpp"
 #include "../framework/stream_writer.hpp"
 #include "jubatus/util/lang/cast.h"
+#include "jubatus/util/math/random.h"
 
 using std::make_pair;
 using std::pair;
@@ -303,6 +306,260 @@ TEST(inverted_index_storage, empty) {
   EXPECT_EQ(0u, scores.size());
 }
 
+TEST(posting_list, round_trip) {
+  row_t row;
+  row[0] = 1.0;
+  row[3] = -0.5;
+  row[200] = 2.25;
+  row[1ULL << 40] = 4.0;
+
+  posting_list list(row);
+  EXPECT_EQ(4u, list.size());
+
+  row_t decoded;
+  list.to_row(decoded);
+  ASSERT_EQ(row.size(), decoded.size());
+  for (row_t::const_iterator it = row.begin(); it != row.end(); ++it) {
+    EXPECT_EQ(it->second, decoded[it->first]);
+  }
+
+  double val = 0.0;
+  EXPECT_TRUE(list.get(200, val));
+  EXPECT_EQ(2.25, val);
+  EXPECT_FALSE(list.get(4, val));
+
+  vector<uint64_t> ids;
+  for (posting_list::const_iterator it(list); !it.end(); it.next()) {
+    ids.push_back(it.id());
+  }
+  ASSERT_EQ(4u, ids.size());
+  EXPECT_EQ(0u, ids[0]);
+  EXPECT_EQ(3u, ids[1]);
+  EXPECT_EQ(200u, ids[2]);
+  EXPECT_EQ(1ULL << 40, ids[3]);
+}
+
+TEST(inverted_index_storage, compact_postings) {
+  inverted_index_storage s, c;
+  for (int i = 0; i < 2; ++i) {
+    inverted_index_storage& t = i == 0 ? s : c;
+    t.set("c1", "r1", 1.0);
+    t.set("c2", "r1", 0.5);
+    t.set("c1", "r2", 2.0);
+    t.set("c3", "r3", 1.0);
+    t.set("c2", "r3", 1.5);
+  }
+  c.set_compact_postings(true);
+
+  vector<pair<string, double> > expected, actual;
+  common::sfv_t v;
+  v.push_back(make_pair("c1", 1.0));
+  v.push_back(make_pair("c2", 1.0));
+
+  // the diff table is overlaid on the compact master table
+  {
+    inverted_index_storage::diff_type d;
+    c.get_diff(d);
+    c.put_diff(d);
+    s.get_diff(d);
+    s.put_diff(d);
+  }
+  s.set("c2", "r2", 4.0);
+  c.set("c2", "r2", 4.0);
+  s.remove("c1", "r1");
+  c.remove("c1", "r1");
+
+  s.calc_scores(v, expected, 10);
+  c.calc_scores(v, actual, 10);
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(s.get("c2", "r2"), c.get("c2", "r2"));
+  EXPECT_EQ(0.0, c.get("c1", "r1"));
+
+  s.calc_euclid_scores(v, expected, 10);
+  c.calc_euclid_scores(v, actual, 10);
+  EXPECT_EQ(expected, actual);
+
+  s.calc_euclid_scores_ignore_orthogonal(v, expected, 10);
+  c.calc_euclid_scores_ignore_orthogonal(v, actual, 10);
+  EXPECT_EQ(expected, actual);
+
+  // MIX into the compact master table, then back to maps
+  {
+    inverted_index_storage::diff_type d;
+    c.get_diff(d);
+    c.put_diff(d);
+  }
+  c.set_compact_postings(false);
+  c.calc_scores(v, actual, 10);
+  s.calc_scores(v, expected, 10);
+  EXPECT_EQ(expected, actual);
+}
+
+TEST(inverted_index_storage, compact_postings_pack) {
+  inverted_index_storage s;
+  s.set_compact_postings(true);
+  s.set("c1", "r1", 1.0);
+  s.set("c2", "r2", 0.5);
+  {
+    inverted_index_storage::diff_type d;
+    s.get_diff(d);
+    s.put_diff(d);
+  }
+
+  msgpack::sbuffer buf;
+  framework::stream_writer<msgpack::sbuffer> st(buf);
+  framework::jubatus_packer jp(st);
+  framework::packer packer(jp);
+  s.pack(packer);
+
+  inverted_index_storage s2;
+  s2.set_compact_postings(true);
+  msgpack::unpacked unpacked;
+  msgpack::unpack(&unpacked, buf.data(), buf.size());
+  s2.unpack(unpacked.get());
+
+  EXPECT_EQ(1.0, s2.get("c1", "r1"));
+  EXPECT_EQ(0.5, s2.get("c2", "r2"));
+  s2.set_compact_postings(false);
+  EXPECT_EQ(0.5, s2.get("c2", "r2"));
+}
+
+class inverted_index_storage_chunked_test
+    : public testing::TestWithParam<pair<bool, bool> > {
+};
+
+TEST_P(inverted_index_storage_chunked_test, pack_chunked) {
+  jubatus::util::math::random::mtrand rand(0);
+  inverted_index_storage s;
+  s.set_compact_postings(GetParam().first);
+  for (int i = 0; i < 30; ++i) {
+    const string column = "c" + lexical_cast<string>(i);
+    for (int j = 0; j < 4; ++j) {
+      s.set("r" + lexical_cast<string>(rand.next_int(20)), column,
+            rand.next_int(5) + 1);
+    }
+    if (i == 20) {
+      // move the first columns to the master table
+      inverted_index_storage::diff_type d;
+      s.get_diff(d);
+      s.put_diff(d);
+    }
+  }
+
+  std::stringstream ss;
+  {
+    framework::stream_writer<std::stringstream> st(ss);
+    framework::jubatus_packer jp(st);
+    framework::packer packer(jp);
+    s.pack_chunked(packer, 4);
+  }
+
+  inverted_index_storage s2;
+  s2.set_compact_postings(GetParam().second);
+  framework::stream_reader<std::stringstream> sr(ss);
+  framework::unpacker unpacker(sr);
+  s2.unpack_chunked(unpacker);
+
+  vector<string> ids, ids2;
+  s.get_all_column_ids(ids);
+  s2.get_all_column_ids(ids2);
+  EXPECT_EQ(ids, ids2);
+  for (int i = 0; i < 20; ++i) {
+    common::sfv_t query;
+    query.push_back(make_pair("r" + lexical_cast<string>(i), 1.0));
+    query.push_back(make_pair("r" + lexical_cast<string>((i + 7) % 20), 2.0));
+    vector<pair<string, double> > expected, actual;
+    s.calc_scores(query, expected, 10);
+    s2.calc_scores(query, actual, 10);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      EXPECT_NEAR(expected[j].second, actual[j].second, 1e-6);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    inverted_index_storage_chunked_test_instance,
+    inverted_index_storage_chunked_test,
+    testing::Values(make_pair(false, false), make_pair(false, true),
+                    make_pair(true, false), make_pair(true, true)));
+
+TEST(inverted_index_storage, topk_pruning) {
+  jubatus::util::math::random::mtrand rand(0);
+  inverted_index_storage s, p, c, l;
+  p.set_topk_pruning(true);
+  c.set_topk_pruning(true);
+  c.set_compact_postings(true);
+
+  // a few common features and a long tail of rare ones
+  for (int i = 0; i < 300; ++i) {
+    const string column = "c" + lexical_cast<string>(i);
+    for (int j = 0; j < 8; ++j) {
+      const int feature = j < 4 ? rand.next_int(5) : rand.next_int(200);
+      const string row = "r" + lexical_cast<string>(feature);
+      const double val =
+          (rand.next_int(2) ? 1.0 : -1.0) * (rand.next_int(8) + 1);
+      s.set(row, column, val);
+      p.set(row, column, val);
+      c.set(row, column, val);
+      l.set(row, column, val);
+    }
+    if (i == 150) {
+      // move the first half to the master table
+      inverted_index_storage::diff_type d;
+      s.get_diff(d);
+      s.put_diff(d);
+      p.get_diff(d);
+      p.put_diff(d);
+      c.get_diff(d);
+      c.put_diff(d);
+      l.get_diff(d);
+      l.put_diff(d);
+    }
+  }
+  for (int i = 0; i < 20; ++i) {
+    const string column = "c" + lexical_cast<string>(i * 7);
+    const string row = "r" + lexical_cast<string>(i);
+    s.remove(row, column);
+    p.remove(row, column);
+    c.remove(row, column);
+    l.remove(row, column);
+  }
+  // the weight bounds are not kept until pruning is turned on
+  l.set_topk_pruning(true);
+
+  for (int n = 0; n < 20; ++n) {
+    common::sfv_t q;
+    for (int j = 0; j < 6; ++j) {
+      const int feature = j < 2 ? rand.next_int(5) : rand.next_int(200);
+      q.push_back(make_pair("r" + lexical_cast<string>(feature),
+                            rand.next_int(5) - 2.0));
+    }
+    const size_t ret_num = n % 2 ? 10 : 1;
+
+    vector<pair<string, double> > expected, actual, compact, late;
+    s.calc_scores(q, expected, ret_num);
+    p.calc_scores(q, actual, ret_num);
+    EXPECT_EQ(expected, actual);
+    c.calc_scores(q, compact, ret_num);
+    EXPECT_EQ(expected, compact);
+    l.calc_scores(q, late, ret_num);
+    EXPECT_EQ(expected, late);
+
+    expected.clear();
+    actual.clear();
+    s.calc_euclid_scores(q, expected, ret_num);
+    p.calc_euclid_scores(q, actual, ret_num);
+    EXPECT_EQ(expected, actual);
+
+    expected.clear();
+    actual.clear();
+    s.calc_euclid_scores_ignore_orthogonal(q, expected, ret_num);
+    p.calc_euclid_scores_ignore_orthogonal(q, actual, ret_num);
+    EXPECT_EQ(expected, actual);
+  }
+}
+
 }  // namespace storage
 }  // namespace core
 }  // namespace jubatus
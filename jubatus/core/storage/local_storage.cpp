@@ -95,9 +95,14 @@ void local_storage::get3_nolock(const string& feature,
 
 void local_storage::inp(const common::sfv_t& sfv, map_feature_val1_t& ret)
     const {
+  scoped_rlock lk(mutex_);
+  inp_nolock(sfv, ret);
+}
+
+void local_storage::inp_nolock(const common::sfv_t& sfv,
+                               map_feature_val1_t& ret) const {
   ret.clear();
 
-  scoped_rlock lk(mutex_);
   // Use uin64_t map instead of string map as hash function for string is slow
   jubatus::util::data::unordered_map<uint64_t, double> ret_id;
   for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
@@ -286,6 +291,52 @@ void local_storage::unpack(msgpack::object o) {
   o.convert(this);
 }
 
+void local_storage::pack_chunked(
+    framework::packer& packer, size_t chunk_rows) const {
+  scoped_rlock lk(mutex_);
+  packer.pack_array(4);
+  packer.pack(class2id_);
+  packer.pack(model_version_);
+  packer.pack(static_cast<uint64_t>(tbl_.size()));
+  packer.pack(static_cast<uint64_t>(tbl_diff_.size()));
+  framework::pack_map_chunks(packer, tbl_, chunk_rows);
+  framework::pack_map_chunks(packer, tbl_diff_, chunk_rows);
+}
+
+void local_storage::unpack_chunked(framework::unpacker& unpacker) {
+  common::key_manager class2id;
+  version model_version;
+  uint64_t tbl_size;
+  uint64_t tbl_diff_size;
+  {
+    msgpack::unpacked header;
+    unpacker.next(header);
+    const msgpack::object o = header.get();
+    if (o.type != msgpack::type::ARRAY || o.via.array.size != 4) {
+      throw msgpack::type_error();
+    }
+    o.via.array.ptr[0].convert(&class2id);
+    o.via.array.ptr[1].convert(&model_version);
+    o.via.array.ptr[2].convert(&tbl_size);
+    o.via.array.ptr[3].convert(&tbl_diff_size);
+  }
+
+  id_features3_t tbl;
+  while (tbl_size > 0) {
+    unpacker.next_map_chunk(tbl_size, tbl);
+  }
+  id_features3_t tbl_diff;
+  while (tbl_diff_size > 0) {
+    unpacker.next_map_chunk(tbl_diff_size, tbl_diff);
+  }
+
+  scoped_wlock lk(mutex_);
+  tbl_.swap(tbl);
+  class2id_.swap(class2id);
+  tbl_diff_.swap(tbl_diff);
+  model_version_ = model_version;
+}
+
 std::string local_storage::type() const {
   return "local_storage";
 }
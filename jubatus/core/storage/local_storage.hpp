@@ -49,6 +49,7 @@ class local_storage : public storage_base {
 
   // inner product
   void inp(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
+  void inp_nolock(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
 
   void set(
       const std::string& feature,
@@ -100,6 +101,8 @@ class local_storage : public storage_base {
 
   void pack(framework::packer& packer) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& packer, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
   storage::version get_version() const {
     return storage::version();
   }
@@ -0,0 +1,685 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include "local_storage_flat.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+#include "jubatus/util/concurrent/lock.h"
+#include "jubatus/util/lang/cast.h"
+#include "../common/hash.hpp"
+
+using std::string;
+using std::vector;
+using jubatus::util::concurrent::scoped_rlock;
+using jubatus::util::concurrent::scoped_wlock;
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+namespace {
+
+const size_t MIN_INDEX_CAPACITY = 16;
+
+inline size_t bucket_of(uint64_t hash, size_t capacity) {
+  // capacity is always a power of two
+  return static_cast<size_t>(hash) & (capacity - 1);
+}
+
+}  // namespace
+
+const uint32_t local_storage_flat::EMPTY;
+const uint8_t local_storage_flat::MIXED;
+const uint8_t local_storage_flat::UPDATED;
+
+local_storage_flat::local_storage_flat(size_t slots)
+    : slots_(std::min<size_t>(std::max<size_t>(slots, 1), 3)),
+      columns_(0),
+      column_capacity_(0) {
+}
+
+local_storage_flat::~local_storage_flat() {
+}
+
+int64_t local_storage_flat::find_row(const string& feature) const {
+  if (index_.empty()) {
+    return -1;
+  }
+  const uint64_t hash = common::hash_util::calc_string_hash(feature);
+  const size_t capacity = index_.size();
+  for (size_t b = bucket_of(hash, capacity); ; b = (b + 1) & (capacity - 1)) {
+    const uint32_t entry = index_[b];
+    if (entry == EMPTY) {
+      return -1;
+    }
+    const size_t row = entry - 1;
+    if (hashes_[row] == hash && keys_[row] == feature) {
+      return row;
+    }
+  }
+}
+
+size_t local_storage_flat::find_or_insert_row(const string& feature) {
+  reserve_index(keys_.size() + 1);
+  const uint64_t hash = common::hash_util::calc_string_hash(feature);
+  const size_t capacity = index_.size();
+  size_t b = bucket_of(hash, capacity);
+  for (; index_[b] != EMPTY; b = (b + 1) & (capacity - 1)) {
+    const size_t row = index_[b] - 1;
+    if (hashes_[row] == hash && keys_[row] == feature) {
+      return row;
+    }
+  }
+
+  const size_t row = keys_.size();
+  keys_.push_back(feature);
+  hashes_.push_back(hash);
+  values_.resize(values_.size() + stride(), 0.0);
+  present_.resize(present_.size() + column_capacity_, 0);
+  index_[b] = static_cast<uint32_t>(row + 1);
+  return row;
+}
+
+size_t local_storage_flat::label_column(const string& label) {
+  const uint64_t id = class2id_.get_id(label);
+  if (id >= columns_) {
+    resize_columns(id + 1);
+  }
+  return id;
+}
+
+double* local_storage_flat::cell(size_t row, size_t column) {
+  row_present(row)[column] |= UPDATED;
+  return row_values(row) + column;
+}
+
+val3_t local_storage_flat::read_val3(const double* v, size_t lane) const {
+  return val3_t(v[lane * column_capacity_],
+                slots_ > 1 ? v[(lane + 1) * column_capacity_] : 0.0,
+                slots_ > 2 ? v[(lane + 2) * column_capacity_] : 0.0);
+}
+
+void local_storage_flat::reserve_index(size_t rows) {
+  // keep the load factor at or below 1/2
+  if (rows * 2 <= index_.size()) {
+    return;
+  }
+  size_t capacity = std::max(index_.size(), MIN_INDEX_CAPACITY);
+  while (capacity < rows * 2) {
+    capacity *= 2;
+  }
+  rebuild_index(capacity);
+}
+
+void local_storage_flat::rebuild_index(size_t capacity) {
+  std::vector<uint32_t>(capacity, EMPTY).swap(index_);
+  for (size_t row = 0; row < hashes_.size(); ++row) {
+    size_t b = bucket_of(hashes_[row], capacity);
+    while (index_[b] != EMPTY) {
+      b = (b + 1) & (capacity - 1);
+    }
+    index_[b] = static_cast<uint32_t>(row + 1);
+  }
+}
+
+void local_storage_flat::resize_columns(size_t columns) {
+  if (columns <= column_capacity_) {
+    // unused columns are kept zero
+    columns_ = columns;
+    return;
+  }
+  const size_t capacity = std::max(columns, column_capacity_ * 2);
+  const size_t rows = keys_.size();
+  std::vector<double> values(rows * capacity * lanes(), 0.0);
+  std::vector<uint8_t> present(rows * capacity, 0);
+  for (size_t row = 0; columns_ > 0 && row < rows; ++row) {
+    for (size_t l = 0; l < lanes(); ++l) {
+      const double* lane = row_values(row) + l * column_capacity_;
+      std::copy(lane, lane + columns_,
+                &values[(row * lanes() + l) * capacity]);
+    }
+    std::copy(row_present(row), row_present(row) + columns_,
+              &present[row * capacity]);
+  }
+  values_.swap(values);
+  present_.swap(present);
+  columns_ = columns;
+  column_capacity_ = capacity;
+}
+
+void local_storage_flat::widen_slots(size_t slots) {
+  if (slots <= slots_) {
+    return;
+  }
+  // the new lanes are inserted after the weights and after the weights of
+  // the last MIX
+  const size_t rows = keys_.size();
+  const size_t capacity = column_capacity_;
+  std::vector<double> values(rows * capacity * 2 * slots, 0.0);
+  for (size_t row = 0; row < rows; ++row) {
+    const double* src = row_values(row);
+    double* dst = &values[row * capacity * 2 * slots];
+    for (size_t l = 0; l < lanes(); ++l) {
+      const size_t to = l < slots_ ? l : l - slots_ + slots;
+      std::copy(src + l * capacity, src + (l + 1) * capacity,
+                dst + to * capacity);
+    }
+  }
+  values_.swap(values);
+  slots_ = slots;
+}
+
+void local_storage_flat::get(const string& feature, feature_val1_t& ret) const {
+  scoped_rlock lk(mutex_);
+  get_nolock(feature, ret);
+}
+
+void local_storage_flat::get_nolock(const string& feature,
+                                    feature_val1_t& ret) const {
+  ret.clear();
+  const int64_t row = find_row(feature);
+  if (row < 0) {
+    return;
+  }
+  const double* v = row_values(row);
+  const uint8_t* p = row_present(row);
+  for (size_t c = 0; c < columns_; ++c) {
+    if (p[c]) {
+      ret.push_back(make_pair(class2id_.get_key(c), v[c]));
+    }
+  }
+}
+
+void local_storage_flat::get2(const string& feature,
+                              feature_val2_t& ret) const {
+  scoped_rlock lk(mutex_);
+  get2_nolock(feature, ret);
+}
+
+void local_storage_flat::get2_nolock(const string& feature,
+                                     feature_val2_t& ret) const {
+  ret.clear();
+  const int64_t row = find_row(feature);
+  if (row < 0) {
+    return;
+  }
+  const double* v = row_values(row);
+  const uint8_t* p = row_present(row);
+  for (size_t c = 0; c < columns_; ++c) {
+    if (p[c]) {
+      const double* w = v + c;
+      ret.push_back(make_pair(class2id_.get_key(c),
+                              val2_t(w[0],
+                                     slots_ > 1 ? w[column_capacity_] : 0.0)));
+    }
+  }
+}
+
+void local_storage_flat::get3(const string& feature,
+                              feature_val3_t& ret) const {
+  scoped_rlock lk(mutex_);
+  get3_nolock(feature, ret);
+}
+
+void local_storage_flat::get3_nolock(const string& feature,
+                                     feature_val3_t& ret) const {
+  ret.clear();
+  const int64_t row = find_row(feature);
+  if (row < 0) {
+    return;
+  }
+  const double* v = row_values(row);
+  const uint8_t* p = row_present(row);
+  for (size_t c = 0; c < columns_; ++c) {
+    if (p[c]) {
+      ret.push_back(make_pair(class2id_.get_key(c), read_val3(v + c, 0)));
+    }
+  }
+}
+
+void local_storage_flat::inp(const common::sfv_t& sfv,
+                             map_feature_val1_t& ret) const {
+  scoped_rlock lk(mutex_);
+  inp_nolock(sfv, ret);
+}
+
+int64_t local_storage_flat::get_label_id_nolock(const string& label) const {
+  const uint64_t id = class2id_.get_id_const(label);
+  if (id == common::key_manager::NOTFOUND) {
+    return -1;
+  }
+  return id;
+}
+
+void local_storage_flat::inp_dense_nolock(
+    const common::sfv_t& sfv,
+    std::vector<double>& scores) const {
+  scores.assign(columns_, 0.0);
+  double* s = scores.empty() ? NULL : &scores[0];
+  for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
+    const int64_t row = find_row(it->first);
+    if (row < 0) {
+      continue;
+    }
+    const double val = it->second;
+    // v1 of all labels is the first lane of the row, so the loop is
+    // vectorized as an axpy
+    const double* v = row_values(row);
+    for (size_t c = 0; c < columns_; ++c) {
+      s[c] += v[c] * val;
+    }
+  }
+}
+
+double local_storage_flat::calc_variance_nolock(
+    const common::sfv_t& sfv,
+    int64_t pos_id,
+    int64_t neg_id) const {
+  double var = 0.0;
+  for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
+    double pos_covar = 1.0;
+    double neg_covar = 1.0;
+    const int64_t row = find_row(it->first);
+    if (row >= 0) {
+      if (pos_id >= 0 && row_present(row)[pos_id]) {
+        pos_covar =
+            slots_ > 1 ? row_values(row)[column_capacity_ + pos_id] : 0.0;
+      }
+      if (neg_id >= 0 && row_present(row)[neg_id]) {
+        neg_covar =
+            slots_ > 1 ? row_values(row)[column_capacity_ + neg_id] : 0.0;
+      }
+    }
+    var += (pos_covar + neg_covar) * it->second * it->second;
+  }
+  return var;
+}
+
+void local_storage_flat::inp_nolock(const common::sfv_t& sfv,
+                                    map_feature_val1_t& ret) const {
+  ret.clear();
+
+  // absent cells are zero, so the whole row can be accumulated at once
+  std::vector<double> scores;
+  inp_dense_nolock(sfv, scores);
+
+  // label IDs are kept dense, so every column is a live label
+  for (size_t c = 0; c < columns_; ++c) {
+    ret[class2id_.get_key(c)] = scores[c];
+  }
+}
+
+void local_storage_flat::set(
+    const string& feature,
+    const string& klass,
+    const val1_t& w) {
+  scoped_wlock lk(mutex_);
+  set_nolock(feature, klass, w);
+}
+
+void local_storage_flat::set_nolock(
+    const string& feature,
+    const string& klass,
+    const val1_t& w) {
+  const size_t column = label_column(klass);
+  cell(find_or_insert_row(feature), column)[0] = w;
+}
+
+void local_storage_flat::set2(
+    const string& feature,
+    const string& klass,
+    const val2_t& w) {
+  scoped_wlock lk(mutex_);
+  set2_nolock(feature, klass, w);
+}
+
+void local_storage_flat::set2_nolock(
+    const string& feature,
+    const string& klass,
+    const val2_t& w) {
+  widen_slots(2);
+  const size_t column = label_column(klass);
+  double* v = cell(find_or_insert_row(feature), column);
+  v[0] = w.v1;
+  v[column_capacity_] = w.v2;
+}
+
+void local_storage_flat::set3(
+    const string& feature,
+    const string& klass,
+    const val3_t& w) {
+  scoped_wlock lk(mutex_);
+  set3_nolock(feature, klass, w);
+}
+
+void local_storage_flat::set3_nolock(
+    const string& feature,
+    const string& klass,
+    const val3_t& w) {
+  widen_slots(3);
+  const size_t column = label_column(klass);
+  double* v = cell(find_or_insert_row(feature), column);
+  v[0] = w.v1;
+  v[column_capacity_] = w.v2;
+  v[2 * column_capacity_] = w.v3;
+}
+
+void local_storage_flat::get_status(
+    std::map<string, string>& status) const {
+  scoped_rlock lk(mutex_);
+  status["num_features"] =
+    jubatus::util::lang::lexical_cast<string>(keys_.size());
+  status["num_classes"] =
+    jubatus::util::lang::lexical_cast<string>(class2id_.size());
+  status["num_slots"] =
+    jubatus::util::lang::lexical_cast<string>(slots_);
+  status["column_capacity"] =
+    jubatus::util::lang::lexical_cast<string>(column_capacity_);
+  status["model_version"] =
+    jubatus::util::lang::lexical_cast<string>(model_version_.get_number());
+}
+
+void local_storage_flat::bulk_update(
+    const common::sfv_t& sfv,
+    double step_width,
+    const string& inc_class,
+    const string& dec_class) {
+  scoped_wlock lk(mutex_);
+  const size_t inc_column = label_column(inc_class);
+  typedef common::sfv_t::const_iterator iter_t;
+  if (dec_class != "") {
+    const size_t dec_column = label_column(dec_class);
+    for (iter_t it = sfv.begin(); it != sfv.end(); ++it) {
+      const double val = it->second * step_width;
+      const size_t row = find_or_insert_row(it->first);
+      cell(row, inc_column)[0] += val;
+      cell(row, dec_column)[0] -= val;
+    }
+  } else {
+    for (iter_t it = sfv.begin(); it != sfv.end(); ++it) {
+      const double val = it->second * step_width;
+      cell(find_or_insert_row(it->first), inc_column)[0] += val;
+    }
+  }
+}
+
+void local_storage_flat::update(
+    const string& feature,
+    const string& inc_class,
+    const string& dec_class,
+    const val1_t& v) {
+  scoped_wlock lk(mutex_);
+  const size_t inc_column = label_column(inc_class);
+  const size_t dec_column = label_column(dec_class);
+  const size_t row = find_or_insert_row(feature);
+  cell(row, inc_column)[0] += v;
+  cell(row, dec_column)[0] -= v;
+}
+
+void local_storage_flat::get_diff(diff_t& ret) const {
+  scoped_rlock lk(mutex_);
+  ret.diff.clear();
+  for (size_t row = 0; row < keys_.size(); ++row) {
+    const double* v = row_values(row);
+    const uint8_t* p = row_present(row);
+    feature_val3_t diff;
+    for (size_t c = 0; c < columns_; ++c) {
+      if (p[c] & UPDATED) {
+        diff.push_back(make_pair(class2id_.get_key(c),
+                                 read_val3(v + c, 0) -
+                                 read_val3(v + c, slots_)));
+      }
+    }
+    if (!diff.empty()) {
+      ret.diff.push_back(make_pair(keys_[row], diff));
+    }
+  }
+  ret.expect_version = model_version_;
+}
+
+bool local_storage_flat::set_average_and_clear_diff(const diff_t& average) {
+  scoped_wlock lk(mutex_);
+  if (average.expect_version != model_version_) {
+    return false;
+  }
+
+  // the average includes the local updates, so they are reverted first
+  for (size_t row = 0; row < keys_.size(); ++row) {
+    double* v = row_values(row);
+    uint8_t* p = row_present(row);
+    for (size_t c = 0; c < columns_; ++c) {
+      if (p[c] & UPDATED) {
+        for (size_t s = 0; s < slots_; ++s) {
+          v[s * column_capacity_ + c] =
+              v[(slots_ + s) * column_capacity_ + c];
+        }
+        p[c] &= ~UPDATED;
+      }
+    }
+  }
+
+  size_t slots = slots_;
+  for (features3_t::const_iterator it = average.diff.begin();
+       it != average.diff.end(); ++it) {
+    for (feature_val3_t::const_iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2) {
+      if (it2->second.v3 != 0) {
+        slots = 3;
+      } else if (it2->second.v2 != 0) {
+        slots = std::max<size_t>(slots, 2);
+      }
+    }
+  }
+  widen_slots(slots);
+
+  for (features3_t::const_iterator it = average.diff.begin();
+       it != average.diff.end(); ++it) {
+    const size_t row = find_or_insert_row(it->first);
+    for (feature_val3_t::const_iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2) {
+      const size_t column = label_column(it2->first);
+      double* v = row_values(row) + column;
+      const double average_val[] = {
+        it2->second.v1, it2->second.v2, it2->second.v3
+      };
+      for (size_t s = 0; s < slots_; ++s) {
+        v[(slots_ + s) * column_capacity_] += average_val[s];
+        v[s * column_capacity_] = v[(slots_ + s) * column_capacity_];
+      }
+      row_present(row)[column] = MIXED;
+    }
+  }
+  model_version_.increment();
+  return true;
+}
+
+util::concurrent::rw_mutex& local_storage_flat::get_lock() const {
+  return mutex_;
+}
+
+void local_storage_flat::register_label(const string& label) {
+  scoped_wlock lk(mutex_);
+  label_column(label);
+}
+
+vector<string> local_storage_flat::get_labels() const {
+  scoped_rlock lk(mutex_);
+  return class2id_.get_all_id2key();
+}
+
+bool local_storage_flat::set_label(const string& label) {
+  scoped_wlock lk(mutex_);
+  if (class2id_.get_id_const(label) != common::key_manager::NOTFOUND) {
+    return false;
+  }
+  label_column(label);
+  return true;
+}
+
+bool local_storage_flat::delete_label(const string& label) {
+  scoped_wlock lk(mutex_);
+  return delete_label_nolock(label);
+}
+
+bool local_storage_flat::delete_label_nolock(const string& label) {
+  const uint64_t delete_id = class2id_.get_id_const(label);
+  if (delete_id == common::key_manager::NOTFOUND) {
+    return false;
+  }
+
+  // Drop the column and every row left without any label, so that label
+  // IDs stay dense and equal to column positions.
+  const size_t columns = columns_ - 1;
+  vector<string> id2key;
+  id2key.reserve(columns);
+  for (size_t c = 0; c < columns_; ++c) {
+    if (c != delete_id) {
+      id2key.push_back(class2id_.get_key(c));
+    }
+  }
+
+  size_t rows = 0;
+  for (size_t row = 0; row < keys_.size(); ++row) {
+    const double* v = row_values(row);
+    const uint8_t* p = row_present(row);
+    bool used = false;
+    for (size_t c = 0; c < columns_; ++c) {
+      used = used || (c != delete_id && p[c]);
+    }
+    if (!used) {
+      continue;
+    }
+
+    // rows are compacted in place; the destination never overtakes the
+    // source, and the column left unused is cleared
+    const size_t capacity = column_capacity_;
+    double* dv = &values_[rows * capacity * lanes()];
+    uint8_t* dp = &present_[rows * capacity];
+    for (size_t l = 0; l < lanes(); ++l) {
+      for (size_t c = 0, d = 0; c < columns_; ++c) {
+        if (c != delete_id) {
+          dv[l * capacity + d++] = v[l * capacity + c];
+        }
+      }
+      dv[l * capacity + columns] = 0.0;
+    }
+    for (size_t c = 0, d = 0; c < columns_; ++c) {
+      if (c != delete_id) {
+        dp[d++] = p[c];
+      }
+    }
+    dp[columns] = 0;
+    keys_[rows].swap(keys_[row]);
+    hashes_[rows] = hashes_[row];
+    ++rows;
+  }
+
+  keys_.resize(rows);
+  hashes_.resize(rows);
+  values_.resize(rows * column_capacity_ * lanes());
+  present_.resize(rows * column_capacity_);
+  columns_ = columns;
+  class2id_.init_by_id2key(id2key);
+  rebuild_index(index_.size());
+  return true;
+}
+
+void local_storage_flat::clear() {
+  scoped_wlock lk(mutex_);
+  clear_nolock();
+}
+
+void local_storage_flat::clear_nolock() {
+  // Clear and minimize
+  columns_ = 0;
+  column_capacity_ = 0;
+  vector<string>().swap(keys_);
+  vector<uint64_t>().swap(hashes_);
+  vector<double>().swap(values_);
+  vector<uint8_t>().swap(present_);
+  vector<uint32_t>().swap(index_);
+  common::key_manager().swap(class2id_);
+}
+
+void local_storage_flat::pack(framework::packer& packer) const {
+  scoped_rlock lk(mutex_);
+  packer.pack(*this);
+}
+
+void local_storage_flat::unpack(msgpack::object o) {
+  scoped_wlock lk(mutex_);
+  o.convert(this);
+  if (!is_consistent()) {
+    clear_nolock();
+    throw msgpack::type_error();
+  }
+  vector<uint32_t>().swap(index_);
+  reserve_index(keys_.size());
+}
+
+bool local_storage_flat::is_consistent() const {
+  if (slots_ < 1 || 3 < slots_) {
+    return false;
+  }
+  // label IDs are exactly the column positions 0 .. columns_ - 1
+  if (class2id_.size() != columns_ ||
+      (columns_ > 0 && class2id_.get_max_id() != columns_ - 1)) {
+    return false;
+  }
+  const size_t rows = keys_.size();
+  if (rows >= std::numeric_limits<uint32_t>::max() ||
+      hashes_.size() != rows) {
+    return false;
+  }
+  const size_t capacity = column_capacity_;
+  if (capacity < columns_ || (capacity > 0 &&
+      rows > std::numeric_limits<size_t>::max() / capacity / lanes())) {
+    return false;
+  }
+  if (present_.size() != rows * capacity ||
+      values_.size() != rows * capacity * lanes()) {
+    return false;
+  }
+  // unused columns are taken as they are when labels are added
+  for (size_t row = 0; row < rows; ++row) {
+    const double* v = row_values(row);
+    const uint8_t* p = row_present(row);
+    for (size_t c = columns_; c < capacity; ++c) {
+      if (p[c]) {
+        return false;
+      }
+      for (size_t l = 0; l < lanes(); ++l) {
+        if (v[l * capacity + c] != 0.0) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+string local_storage_flat::type() const {
+  return "local_storage_flat";
+}
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
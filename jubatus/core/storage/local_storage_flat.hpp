@@ -0,0 +1,262 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef JUBATUS_CORE_STORAGE_LOCAL_STORAGE_FLAT_HPP_
+#define JUBATUS_CORE_STORAGE_LOCAL_STORAGE_FLAT_HPP_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "jubatus/util/concurrent/rwmutex.h"
+#include "storage_base.hpp"
+#include "../common/key_manager.hpp"
+#include "../common/version.hpp"
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+// Weight storage backed by a flat open-addressing table.
+//
+// Each feature owns one row of `column_capacity_ * lanes()` doubles stored
+// contiguously in `values_`.  A row is laid out as lanes of
+// `column_capacity_` doubles indexed by label ID, of which the first
+// `columns_` are used: lane 0 holds v1 of every label, lane 1 v2 and
+// lane 2 v3, so scoring reads v1 with unit stride whatever the number of
+// slots is.  `slots_` is the number of values kept per (feature, label)
+// cell: it starts at the value given to the constructor and is widened on
+// the first set2()/set3() call, so that algorithms which use only v1 (PA,
+// perceptron) pay for fewer doubles per cell.
+//
+// The next `slots_` lanes keep the weights of the last MIX, so that
+// get_diff() returns the local updates of the cells flagged as UPDATED.
+// Every cell is thus stored twice, whereas local_storage_mixture keeps
+// only the updated cells twice; in exchange scoring reads a single array.
+//
+// `column_capacity_` grows geometrically, so that adding labels one by one
+// copies the table O(log(labels)) times rather than once per label.  The
+// unused columns, always zero, cost less than `columns_` doubles per lane;
+// "column_capacity" in get_status() reports the current capacity.
+class local_storage_flat : public storage_base {
+ public:
+  explicit local_storage_flat(size_t slots = 1);
+  ~local_storage_flat();
+
+  void get(const std::string &feature, feature_val1_t& ret) const;
+  void get_nolock(const std::string &feature, feature_val1_t& ret) const;
+  void get2(const std::string &feature, feature_val2_t& ret) const;
+  void get2_nolock(const std::string &feature, feature_val2_t& ret) const;
+  void get3(const std::string &feature, feature_val3_t& ret) const;
+  void get3_nolock(const std::string &feature, feature_val3_t& ret) const;
+
+  // inner product
+  void inp(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
+  void inp_nolock(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
+
+  void set(
+      const std::string& feature,
+      const std::string& klass,
+      const val1_t& w);
+  void set_nolock(
+      const std::string& feature,
+      const std::string& klass,
+      const val1_t& w);
+  void set2(
+      const std::string& feature,
+      const std::string& klass,
+      const val2_t& w);
+  void set2_nolock(
+      const std::string& feature,
+      const std::string& klass,
+      const val2_t& w);
+  void set3(
+      const std::string& feature,
+      const std::string& klass,
+      const val3_t& w);
+  void set3_nolock(
+      const std::string& feature,
+      const std::string& klass,
+      const val3_t& w);
+
+  void get_diff(diff_t& ret) const;
+  bool set_average_and_clear_diff(const diff_t& average);
+
+  void get_status(std::map<std::string, std::string>& status) const;
+
+  void update(
+      const std::string& feature,
+      const std::string& inc_class,
+      const std::string& dec_class,
+      const val1_t& v);
+  void bulk_update(
+      const common::sfv_t& sfv,
+      double step_width,
+      const std::string& inc_class,
+      const std::string& dec_class);
+
+  util::concurrent::rw_mutex& get_lock() const;
+
+  void register_label(const std::string& label);
+  bool delete_label(const std::string& label);
+  bool delete_label_nolock(const std::string& label);
+
+  void clear();
+  std::vector<std::string> get_labels() const;
+  bool set_label(const std::string& label);
+
+  void pack(framework::packer& packer) const;
+  void unpack(msgpack::object o);
+  storage::version get_version() const {
+    return model_version_;
+  }
+  std::string type() const;
+
+  size_t get_slots() const {
+    return slots_;
+  }
+
+  // Label-indexed access for linear classifiers; the caller must hold
+  // get_lock().  Label IDs are dense in [0, get_label_count_nolock()).
+
+  size_t get_label_count_nolock() const {
+    return columns_;
+  }
+  const std::string& get_label_nolock(size_t id) const {
+    return class2id_.get_key(id);
+  }
+  // returns -1 if the label does not exist
+  int64_t get_label_id_nolock(const std::string& label) const;
+
+  // scores[id] is the inner product of sfv and the weights of label id
+  void inp_dense_nolock(
+      const common::sfv_t& sfv,
+      std::vector<double>& scores) const;
+
+  // sum of (v2 of pos_id + v2 of neg_id) * x^2 over the features, where
+  // the v2 of absent weights (or of label -1) is 1.0
+  double calc_variance_nolock(
+      const common::sfv_t& sfv,
+      int64_t pos_id,
+      int64_t neg_id) const;
+
+  // Calls update(x, pos, neg) for each feature value x of sfv, where pos
+  // and neg are the (v1, v2) weights of the labels, (0.0, 1.0) if absent,
+  // and stores them back in place.  neg is discarded if neg_label is empty.
+  template <typename Update>
+  void update2_nolock(
+      const common::sfv_t& sfv,
+      const std::string& pos_label,
+      const std::string& neg_label,
+      const Update& update) {
+    widen_slots(2);
+    const size_t pos_column = label_column(pos_label);
+    const bool has_neg = neg_label != "";
+    const size_t neg_column = has_neg ? label_column(neg_label) : 0;
+    for (common::sfv_t::const_iterator it = sfv.begin();
+         it != sfv.end(); ++it) {
+      const size_t row = find_or_insert_row(it->first);
+      val2_t pos = get_val2(row, pos_column);
+      val2_t neg = has_neg ? get_val2(row, neg_column) : val2_t(0.0, 1.0);
+      update(it->second, pos, neg);
+      set_val2(row, pos_column, pos);
+      if (has_neg) {
+        set_val2(row, neg_column, neg);
+      }
+    }
+  }
+
+  // index_ is rebuilt from hashes_ on unpack
+  MSGPACK_DEFINE(slots_, columns_, column_capacity_, keys_, hashes_,
+      values_, present_, class2id_, model_version_);
+
+ private:
+  static const uint32_t EMPTY = 0;
+  // flags of present_; a cell exists if any of them is set
+  static const uint8_t MIXED = 1;    // in the model of the last MIX
+  static const uint8_t UPDATED = 2;  // updated since the last MIX
+
+  size_t lanes() const {
+    return 2 * slots_;
+  }
+  size_t stride() const {
+    return column_capacity_ * lanes();
+  }
+  double* row_values(size_t row) {
+    return &values_[row * stride()];
+  }
+  const double* row_values(size_t row) const {
+    return &values_[row * stride()];
+  }
+  uint8_t* row_present(size_t row) {
+    return &present_[row * column_capacity_];
+  }
+  const uint8_t* row_present(size_t row) const {
+    return &present_[row * column_capacity_];
+  }
+
+  // returns the row of `feature`, or -1 if it does not exist
+  int64_t find_row(const std::string& feature) const;
+  size_t find_or_insert_row(const std::string& feature);
+  size_t label_column(const std::string& label);
+
+  // marks the cell updated and returns its v1; slot s of the cell is at
+  // [s * column_capacity_] of the returned pointer
+  double* cell(size_t row, size_t column);
+  // reads the slots of a cell starting from `lane`
+  val3_t read_val3(const double* v, size_t lane) const;
+  val2_t get_val2(size_t row, size_t column) const {
+    if (!row_present(row)[column]) {
+      return val2_t(0.0, 1.0);
+    }
+    const double* v = row_values(row) + column;
+    return val2_t(v[0], v[column_capacity_]);
+  }
+  void set_val2(size_t row, size_t column, const val2_t& w) {
+    double* v = cell(row, column);
+    v[0] = w.v1;
+    v[column_capacity_] = w.v2;
+  }
+
+  void reserve_index(size_t rows);
+  void rebuild_index(size_t capacity);
+  void resize_columns(size_t columns);
+  void widen_slots(size_t slots);
+  void clear_nolock();
+  bool is_consistent() const;
+
+  mutable util::concurrent::rw_mutex mutex_;
+
+  size_t slots_;
+  size_t columns_;
+  size_t column_capacity_;
+  std::vector<std::string> keys_;
+  std::vector<uint64_t> hashes_;
+  std::vector<double> values_;
+  std::vector<uint8_t> present_;
+  common::key_manager class2id_;
+  version model_version_;
+
+  // open-addressing buckets holding (row + 1), or EMPTY
+  std::vector<uint32_t> index_;
+};
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_STORAGE_LOCAL_STORAGE_FLAT_HPP_
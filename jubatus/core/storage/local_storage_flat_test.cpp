@@ -0,0 +1,299 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <msgpack.hpp>
+#include "jubatus/util/lang/cast.h"
+#include "../common/key_manager.hpp"
+#include "local_storage_flat.hpp"
+
+using std::make_pair;
+using std::sort;
+using std::string;
+using std::vector;
+using jubatus::util::lang::lexical_cast;
+
+// common tests for storages are written in storage_test.cpp
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+TEST(local_storage_flat, widen_slots) {
+  local_storage_flat st;
+  EXPECT_EQ(1u, st.get_slots());
+
+  st.set("a", "x", 1);
+  st.set("b", "y", 2);
+  st.set2("a", "y", val2_t(3, 33));
+  EXPECT_EQ(2u, st.get_slots());
+
+  feature_val2_t a;
+  st.get2("a", a);
+  sort(a.begin(), a.end());
+  ASSERT_EQ(2u, a.size());
+  EXPECT_EQ(make_pair(string("x"), val2_t(1, 0)), a[0]);
+  EXPECT_EQ(make_pair(string("y"), val2_t(3, 33)), a[1]);
+
+  feature_val1_t b;
+  st.get("b", b);
+  ASSERT_EQ(1u, b.size());
+  EXPECT_EQ(make_pair(string("y"), val1_t(2)), b[0]);
+}
+
+TEST(local_storage_flat, scores_with_two_slots) {
+  local_storage_flat st;
+  st.set2("a", "x", val2_t(1, 0.5));
+  st.set2("b", "x", val2_t(2, 0.25));
+  // labels added after the rows exist widen every lane of the rows
+  st.set2("a", "y", val2_t(-3, 0.75));
+  st.set2("b", "z", val2_t(4, 0.125));
+  ASSERT_EQ(2u, st.get_slots());
+
+  common::sfv_t fv;
+  fv.push_back(make_pair(string("a"), 1.0));
+  fv.push_back(make_pair(string("b"), 2.0));
+  map_feature_val1_t ret;
+  st.inp(fv, ret);
+  ASSERT_EQ(3u, ret.size());
+  EXPECT_DOUBLE_EQ(5.0, ret["x"]);
+  EXPECT_DOUBLE_EQ(-3.0, ret["y"]);
+  EXPECT_DOUBLE_EQ(8.0, ret["z"]);
+
+  // (0.5 + 0.75) * 1 + (0.25 + 1.0) * 4 for labels x and y
+  EXPECT_DOUBLE_EQ(6.25, st.calc_variance_nolock(fv, 0, 1));
+
+  feature_val2_t b;
+  st.get2("b", b);
+  sort(b.begin(), b.end());
+  ASSERT_EQ(2u, b.size());
+  EXPECT_EQ(make_pair(string("x"), val2_t(2, 0.25)), b[0]);
+  EXPECT_EQ(make_pair(string("z"), val2_t(4, 0.125)), b[1]);
+}
+
+TEST(local_storage_flat, many_features) {
+  local_storage_flat st;
+  const size_t n = 10000;
+  common::sfv_t fv;
+  for (size_t i = 0; i < n; ++i) {
+    fv.push_back(make_pair(lexical_cast<string>(i), 1.0));
+  }
+  st.bulk_update(fv, 1.0, "x", "y");
+  st.register_label("z");
+
+  for (size_t i = 0; i < n; i += 997) {
+    feature_val1_t v;
+    st.get(fv[i].first, v);
+    sort(v.begin(), v.end());
+    ASSERT_EQ(2u, v.size());
+    EXPECT_EQ(1.0, v[0].second);
+    EXPECT_EQ(-1.0, v[1].second);
+  }
+
+  map_feature_val1_t ret;
+  st.inp(fv, ret);
+  ASSERT_EQ(3u, ret.size());
+  EXPECT_DOUBLE_EQ(n, ret["x"]);
+  EXPECT_DOUBLE_EQ(-1.0 * n, ret["y"]);
+  EXPECT_DOUBLE_EQ(0.0, ret["z"]);
+}
+
+TEST(local_storage_flat, column_capacity) {
+  local_storage_flat st;
+  for (int i = 0; i < 5; ++i) {
+    st.set2("a", lexical_cast<string>(i), val2_t(i, i * 10));
+  }
+  std::map<string, string> status;
+  st.get_status(status);
+  EXPECT_EQ("8", status["column_capacity"]);
+
+  feature_val2_t a;
+  st.get2("a", a);
+  sort(a.begin(), a.end());
+  ASSERT_EQ(5u, a.size());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(make_pair(lexical_cast<string>(i), val2_t(i, i * 10)), a[i]);
+  }
+
+  // a label added in the column left by a deleted one starts from zero
+  EXPECT_TRUE(st.delete_label("4"));
+  st.set("b", "5", 1);
+  st.get2("a", a);
+  EXPECT_EQ(4u, a.size());
+  common::sfv_t fv;
+  fv.push_back(make_pair(string("a"), 1.0));
+  map_feature_val1_t scores;
+  st.inp(fv, scores);
+  EXPECT_DOUBLE_EQ(0.0, scores["5"]);
+  EXPECT_DOUBLE_EQ(3.0, scores["3"]);
+
+  st.get_status(status);
+  EXPECT_EQ("8", status["column_capacity"]);
+}
+
+TEST(local_storage_flat, delete_label_keeps_other_labels) {
+  local_storage_flat st;
+  st.set3("a", "x", val3_t(1, 11, 111));
+  st.set3("a", "y", val3_t(2, 22, 222));
+  st.set3("b", "x", val3_t(3, 33, 333));
+  st.set3("c", "z", val3_t(4, 44, 444));
+
+  EXPECT_TRUE(st.delete_label("x"));
+
+  vector<string> labels = st.get_labels();
+  sort(labels.begin(), labels.end());
+  ASSERT_EQ(2u, labels.size());
+  EXPECT_EQ("y", labels[0]);
+  EXPECT_EQ("z", labels[1]);
+
+  feature_val3_t v;
+  st.get3("a", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(make_pair(string("y"), val3_t(2, 22, 222)), v[0]);
+
+  st.get3("b", v);
+  EXPECT_TRUE(v.empty());
+
+  st.get3("c", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(make_pair(string("z"), val3_t(4, 44, 444)), v[0]);
+
+  std::map<string, string> status;
+  st.get_status(status);
+  EXPECT_EQ("2", status["num_features"]);
+
+  // new labels and features are still accepted after compaction
+  st.set3("d", "w", val3_t(5, 55, 555));
+  st.get3("d", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(make_pair(string("w"), val3_t(5, 55, 555)), v[0]);
+}
+
+TEST(local_storage_flat, set_average_and_clear_diff) {
+  local_storage_flat st;
+  st.set3("f1", "c1", val3_t(1, 2, 3));
+  st.set3("f1", "c2", val3_t(4, 5, 6));
+
+  diff_t diff;
+  st.get_diff(diff);
+  ASSERT_TRUE(st.set_average_and_clear_diff(diff));
+  // the same diff is rejected as the model version has been incremented
+  EXPECT_FALSE(st.set_average_and_clear_diff(diff));
+
+  feature_val3_t v;
+  st.get3("f1", v);
+  sort(v.begin(), v.end());
+  ASSERT_EQ(2u, v.size());
+  EXPECT_EQ(make_pair(string("c1"), val3_t(1, 2, 3)), v[0]);
+  EXPECT_EQ(make_pair(string("c2"), val3_t(4, 5, 6)), v[1]);
+
+  // set after MIX only updates the diff
+  st.set3("f1", "c1", val3_t(2, 2, 3));
+  st.get_diff(diff);
+  ASSERT_EQ(1u, diff.diff.size());
+  ASSERT_EQ(1u, diff.diff[0].second.size());
+  EXPECT_EQ(make_pair(string("c1"), val3_t(1, 0, 0)), diff.diff[0].second[0]);
+
+  ASSERT_TRUE(st.delete_label("c2"));
+  ASSERT_TRUE(st.set_average_and_clear_diff(diff));
+  st.get3("f1", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(make_pair(string("c1"), val3_t(2, 2, 3)), v[0]);
+  st.get_diff(diff);
+  EXPECT_TRUE(diff.diff.empty());
+}
+
+TEST(local_storage_flat, average_replaces_local_updates) {
+  local_storage_flat st;
+  st.set("a", "x", 1);
+  diff_t diff;
+  st.get_diff(diff);
+  ASSERT_TRUE(st.set_average_and_clear_diff(diff));
+
+  // updates of this server are replaced with those of the whole cluster
+  st.set("a", "x", 3);
+  st.set("b", "y", 5);
+  diff_t average;
+  average.expect_version = st.get_version();
+  feature_val3_t a;
+  a.push_back(make_pair(string("x"), val3_t(1, 0, 0)));
+  a.push_back(make_pair(string("z"), val3_t(-1, 0.5, 0)));
+  average.diff.push_back(make_pair(string("a"), a));
+  ASSERT_TRUE(st.set_average_and_clear_diff(average));
+  EXPECT_EQ(2u, st.get_slots());
+
+  feature_val2_t v;
+  st.get2("a", v);
+  sort(v.begin(), v.end());
+  ASSERT_EQ(2u, v.size());
+  EXPECT_EQ(make_pair(string("x"), val2_t(2, 0)), v[0]);
+  EXPECT_EQ(make_pair(string("z"), val2_t(-1, 0.5)), v[1]);
+  // cells only updated locally are dropped like in local_storage_mixture
+  st.get2("b", v);
+  EXPECT_TRUE(v.empty());
+
+  map_feature_val1_t scores;
+  common::sfv_t fv;
+  fv.push_back(make_pair(string("a"), 1.0));
+  st.inp(fv, scores);
+  EXPECT_DOUBLE_EQ(2.0, scores["x"]);
+  EXPECT_DOUBLE_EQ(-1.0, scores["z"]);
+}
+
+TEST(local_storage_flat, unpack_broken_model) {
+  common::key_manager labels;
+  labels.get_id("x");
+  vector<string> keys(2, "a");
+  keys[1] = "b";
+  vector<uint64_t> hashes(2, 0);
+
+  // slots, columns, column capacity, keys, hashes, values, present, labels,
+  // version
+  msgpack::sbuffer buf;
+  msgpack::packer<msgpack::sbuffer> packer(buf);
+  packer.pack_array(9);
+  packer.pack(static_cast<uint64_t>(1));
+  packer.pack(static_cast<uint64_t>(1));
+  packer.pack(static_cast<uint64_t>(1));
+  packer.pack(keys);
+  packer.pack(hashes);
+  packer.pack(vector<double>(3, 1.0));  // one value short
+  packer.pack(vector<uint8_t>(2, 1));
+  packer.pack(labels);
+  packer.pack(version());
+
+  msgpack::unpacked unpacked;
+  msgpack::unpack(&unpacked, buf.data(), buf.size());
+  local_storage_flat st;
+  EXPECT_THROW(st.unpack(unpacked.get()), msgpack::type_error);
+
+  // the storage is left empty and usable
+  feature_val1_t a;
+  st.get("a", a);
+  EXPECT_TRUE(a.empty());
+  st.set("a", "x", 1);
+  st.get("a", a);
+  EXPECT_EQ(1u, a.size());
+}
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
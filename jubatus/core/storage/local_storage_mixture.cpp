@@ -20,6 +20,7 @@
 #include <string>
 #include <vector>
 #include "jubatus/util/data/intern.h"
+#include "../common/hash.hpp"
 
 using std::string;
 
@@ -29,12 +30,26 @@ namespace storage {
 
 namespace {
 
+// number of shards of the weight table in snapshot mode
+const size_t SNAPSHOT_SHARDS = 64;
+
 void increase(val3_t& a, const val3_t& b) {
   a.v1 += b.v1;
   a.v2 += b.v2;
   a.v3 += b.v3;
 }
 
+void add_diff(const id_features3_t& diff, id_features3_t& tbl) {
+  for (id_features3_t::const_iterator it = diff.begin(); it != diff.end();
+       ++it) {
+    id_feature_val3_t& row = tbl[it->first];
+    for (id_feature_val3_t::const_iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2) {
+      increase(row[it2->first], it2->second);
+    }
+  }
+}
+
 void delete_label_from_weight(uint64_t delete_id, id_features3_t& tbl) {
   for (id_features3_t::iterator it = tbl.begin(); it != tbl.end(); ) {
     it->second.erase(delete_id);
@@ -46,9 +61,31 @@ void delete_label_from_weight(uint64_t delete_id, id_features3_t& tbl) {
   }
 }
 
+typedef jubatus::util::data::unordered_map<string, uint64_t> label_ids_t;
+
+void assign_label_ids(common::key_manager& class2id, label_ids_t& label_ids) {
+  for (label_ids_t::iterator it = label_ids.begin(); it != label_ids.end();
+       ++it) {
+    it->second = class2id.get_id(it->first);  // may create
+  }
+}
+
+void apply_average_row(
+    const feature_val3_t& avg,
+    const label_ids_t& label_ids,
+    id_feature_val3_t& orig) {
+  for (feature_val3_t::const_iterator it = avg.begin(); it != avg.end();
+       ++it) {
+    val3_t& triple = orig[label_ids.find(it->first)->second];
+    increase(triple, it->second);
+  }
+}
+
 }  // namespace
 
-local_storage_mixture::local_storage_mixture() {
+local_storage_mixture::local_storage_mixture(bool snapshot_mix)
+    : snapshot_mix_(snapshot_mix) {
+  reset_tbl();
 }
 
 local_storage_mixture::~local_storage_mixture() {
@@ -58,16 +95,21 @@ bool local_storage_mixture::get_internal(
     const string& feature,
     id_feature_val3_t& ret) const {
   ret.clear();
-  id_features3_t::const_iterator it = tbl_.find(feature);
+  const id_features3_t& shard = *tbl_[shard_of(feature)];
+  id_features3_t::const_iterator it = shard.find(feature);
 
   bool found = false;
-  if (it != tbl_.end()) {
+  if (it != shard.end()) {
     ret = it->second;
     found = true;
   }
 
-  id_features3_t::const_iterator it_diff = tbl_diff_.find(feature);
-  if (it_diff != tbl_diff_.end()) {
+  const id_features3_t* diffs[] = { &mixing_diff_, &tbl_diff_ };
+  for (size_t i = 0; i < sizeof(diffs) / sizeof(diffs[0]); ++i) {
+    id_features3_t::const_iterator it_diff = diffs[i]->find(feature);
+    if (it_diff == diffs[i]->end()) {
+      continue;
+    }
     found = true;
     for (id_feature_val3_t::const_iterator it2 = it_diff->second.begin();
         it2 != it_diff->second.end(); ++it2) {
@@ -78,6 +120,81 @@ bool local_storage_mixture::get_internal(
   return found;
 }
 
+val3_t local_storage_mixture::get_from_tbl(
+    const string& feature,
+    uint64_t class_id) {
+  val3_t ret;
+  shard_ptr& shard = tbl_[shard_of(feature)];
+  if (shard.use_count() > 1) {
+    // MIX is building the next version from this shard; leave it untouched
+    id_features3_t::const_iterator it = shard->find(feature);
+    if (it != shard->end()) {
+      id_feature_val3_t::const_iterator it2 = it->second.find(class_id);
+      if (it2 != it->second.end()) {
+        ret = it2->second;
+      }
+    }
+  } else {
+    ret = (*shard)[feature][class_id];
+  }
+
+  // the diff being mixed is part of the weight until the average replaces it
+  id_features3_t::const_iterator it = mixing_diff_.find(feature);
+  if (it != mixing_diff_.end()) {
+    id_feature_val3_t::const_iterator it2 = it->second.find(class_id);
+    if (it2 != it->second.end()) {
+      increase(ret, it2->second);
+    }
+  }
+  return ret;
+}
+
+size_t local_storage_mixture::shard_of(const string& feature) const {
+  if (tbl_.size() == 1) {
+    return 0;
+  }
+  return common::hash_util::calc_fast_hash(feature) % tbl_.size();
+}
+
+id_features3_t& local_storage_mixture::mutable_shard(size_t shard) {
+  if (tbl_[shard].use_count() > 1) {
+    tbl_[shard].reset(new id_features3_t(*tbl_[shard]));
+  }
+  return *tbl_[shard];
+}
+
+void local_storage_mixture::reset_tbl() {
+  shards_t tbl;
+  make_shards(tbl);
+  tbl_.swap(tbl);
+}
+
+void local_storage_mixture::make_shards(shards_t& tbl) const {
+  tbl.resize(snapshot_mix_ ? SNAPSHOT_SHARDS : 1);
+  for (size_t i = 0; i < tbl.size(); ++i) {
+    tbl[i].reset(new id_features3_t);
+  }
+}
+
+size_t local_storage_mixture::num_features() const {
+  size_t n = 0;
+  for (size_t i = 0; i < tbl_.size(); ++i) {
+    n += tbl_[i]->size();
+  }
+  return n;
+}
+
+void local_storage_mixture::get_pending_diff(id_features3_t& ret) const {
+  ret = mixing_diff_;
+  add_diff(tbl_diff_, ret);
+}
+
+void local_storage_mixture::restore_mixing_diff() {
+  add_diff(tbl_diff_, mixing_diff_);
+  tbl_diff_.swap(mixing_diff_);
+  id_features3_t().swap(mixing_diff_);
+}
+
 void local_storage_mixture::get(
     const std::string& feature,
     feature_val1_t& ret) const {
@@ -136,9 +253,14 @@ void local_storage_mixture::get3_nolock(
 
 void local_storage_mixture::inp(const common::sfv_t& sfv,
                                 map_feature_val1_t& ret) const {
+  util::concurrent::scoped_rlock lk(mutex_);
+  inp_nolock(sfv, ret);
+}
+
+void local_storage_mixture::inp_nolock(const common::sfv_t& sfv,
+                                       map_feature_val1_t& ret) const {
   ret.clear();
 
-  util::concurrent::scoped_rlock lk(mutex_);
   // Use uin64_t map instead of string map as hash function for string is slow
   jubatus::util::data::unordered_map<uint64_t, double> ret_id;
   for (common::sfv_t::const_iterator it = sfv.begin(); it != sfv.end(); ++it) {
@@ -176,7 +298,7 @@ void local_storage_mixture::set_nolock(
     const string& klass,
     const val1_t& w) {
   uint64_t class_id = class2id_.get_id(klass);
-  double w_in_table = tbl_[feature][class_id].v1;
+  double w_in_table = get_from_tbl(feature, class_id).v1;
   tbl_diff_[feature][class_id].v1 = w - w_in_table;
 }
 
@@ -192,8 +314,9 @@ void local_storage_mixture::set2_nolock(
     const string& klass,
     const val2_t& w) {
   uint64_t class_id = class2id_.get_id(klass);
-  double w1_in_table = tbl_[feature][class_id].v1;
-  double w2_in_table = tbl_[feature][class_id].v2;
+  const val3_t v = get_from_tbl(feature, class_id);
+  double w1_in_table = v.v1;
+  double w2_in_table = v.v2;
 
   val3_t& triple = tbl_diff_[feature][class_id];
   triple.v1 = w.v1 - w1_in_table;
@@ -212,19 +335,24 @@ void local_storage_mixture::set3_nolock(
     const string& klass,
     const val3_t& w) {
   uint64_t class_id = class2id_.get_id(klass);
-  val3_t v = tbl_[feature][class_id];
+  val3_t v = get_from_tbl(feature, class_id);
   tbl_diff_[feature][class_id] = w - v;
 }
 
 void local_storage_mixture::get_status(
     std::map<std::string, std::string>& status) const {
   util::concurrent::scoped_rlock lk(mutex_);
+  size_t num_features_diff = tbl_diff_.size();
+  for (id_features3_t::const_iterator it = mixing_diff_.begin();
+       it != mixing_diff_.end(); ++it) {
+    num_features_diff += tbl_diff_.count(it->first) == 0;
+  }
   status["num_features"] =
-    jubatus::util::lang::lexical_cast<std::string>(tbl_.size());
+    jubatus::util::lang::lexical_cast<std::string>(num_features());
   status["num_classes"] = jubatus::util::lang::lexical_cast<std::string>(
       class2id_.size());
   status["num_features_diff"] =
-    jubatus::util::lang::lexical_cast<std::string>(tbl_diff_.size());
+    jubatus::util::lang::lexical_cast<std::string>(num_features_diff);
   status["model_version"] = jubatus::util::lang::lexical_cast<std::string>(
       model_version_.get_number());
 }
@@ -268,8 +396,13 @@ void local_storage_mixture::bulk_update(
 void local_storage_mixture::get_diff(diff_t& ret) const {
   util::concurrent::scoped_rlock lk(mutex_);
   ret.diff.clear();
-  for (jubatus::util::data::unordered_map<string, id_feature_val3_t>::
-      const_iterator it = tbl_diff_.begin(); it != tbl_diff_.end(); ++it) {
+  id_features3_t merged;
+  if (!mixing_diff_.empty()) {
+    get_pending_diff(merged);
+  }
+  const id_features3_t& diff = mixing_diff_.empty() ? tbl_diff_ : merged;
+  for (id_features3_t::const_iterator it = diff.begin(); it != diff.end();
+       ++it) {
     id_feature_val3_t::const_iterator it2 = it->second.begin();
     feature_val3_t fv3;
     for (; it2 != it->second.end(); ++it2) {
@@ -282,25 +415,81 @@ void local_storage_mixture::get_diff(diff_t& ret) const {
 
 bool local_storage_mixture::set_average_and_clear_diff(
     const diff_t& average) {
-  util::concurrent::scoped_wlock lk(mutex_);
-  if (average.expect_version == model_version_) {
+  label_ids_t label_ids;
+  for (features3_t::const_iterator it = average.diff.begin();
+       it != average.diff.end(); ++it) {
+    for (feature_val3_t::const_iterator it2 = it->second.begin();
+         it2 != it->second.end(); ++it2) {
+      label_ids[it2->first];
+    }
+  }
+
+  if (!snapshot_mix_) {
+    util::concurrent::scoped_wlock lk(mutex_);
+    if (average.expect_version != model_version_) {
+      return false;
+    }
+    assign_label_ids(class2id_, label_ids);
     for (features3_t::const_iterator it = average.diff.begin();
-         it != average.diff.end();
-         ++it) {
-      const feature_val3_t& avg = it->second;
-      id_feature_val3_t& orig = tbl_[it->first];
-      for (feature_val3_t::const_iterator it2 = avg.begin(); it2 != avg.end();
-           ++it2) {
-        val3_t& triple = orig[class2id_.get_id(it2->first)];  // may create
-        increase(triple, it2->second);
-      }
+         it != average.diff.end(); ++it) {
+      apply_average_row(it->second, label_ids,
+                        mutable_shard(shard_of(it->first))[it->first]);
     }
     model_version_.increment();
     tbl_diff_.clear();
     return true;
+  }
+
+  util::concurrent::scoped_lock mix_lk(mix_mutex_);
+  shards_t base;
+  {
+    util::concurrent::scoped_wlock lk(mutex_);
+    if (average.expect_version != model_version_) {
+      return false;
+    }
+    assign_label_ids(class2id_, label_ids);
+    base = tbl_;
+    // the average includes the diff made so far; later updates go to a
+    // fresh tbl_diff_ and are kept for the next MIX
+    mixing_diff_.swap(tbl_diff_);
+  }
+
+  // Writers copy a shard instead of modifying it while we hold base, so
+  // base can be read here without the lock.  Only the shards touched by
+  // the average are copied.
+  shards_t next(base);
+  std::vector<bool> copied(next.size(), false);
+  for (features3_t::const_iterator it = average.diff.begin();
+       it != average.diff.end(); ++it) {
+    const size_t shard = shard_of(it->first);
+    if (!copied[shard]) {
+      next[shard].reset(new id_features3_t(*base[shard]));
+      copied[shard] = true;
+    }
+    apply_average_row(it->second, label_ids, (*next[shard])[it->first]);
+  }
+
+  util::concurrent::scoped_wlock lk(mutex_);
+  if (tbl_ != base) {
+    // tbl_ was modified (delete_label, clear or unpack) while building
+    // the next version; merge the average into the current one instead.
+    if (average.expect_version != model_version_) {
+      restore_mixing_diff();
+      return false;
+    }
+    assign_label_ids(class2id_, label_ids);
+    for (features3_t::const_iterator it = average.diff.begin();
+         it != average.diff.end(); ++it) {
+      apply_average_row(it->second, label_ids,
+                        mutable_shard(shard_of(it->first))[it->first]);
+    }
   } else {
-    return false;
+    tbl_.swap(next);
   }
+  base.clear();
+  model_version_.increment();
+  id_features3_t().swap(mixing_diff_);
+  return true;
 }
 
 void local_storage_mixture::register_label(const std::string& label) {
@@ -319,7 +508,10 @@ bool local_storage_mixture::delete_label_nolock(const std::string& label) {
   if (delete_id == common::key_manager::NOTFOUND) {
     return false;
   }
-  delete_label_from_weight(delete_id, tbl_);
+  for (size_t i = 0; i < tbl_.size(); ++i) {
+    delete_label_from_weight(delete_id, mutable_shard(i));
+  }
+  delete_label_from_weight(delete_id, mixing_diff_);
   delete_label_from_weight(delete_id, tbl_diff_);
   class2id_.delete_key(label);
   return true;
@@ -328,9 +520,10 @@ bool local_storage_mixture::delete_label_nolock(const std::string& label) {
 void local_storage_mixture::clear() {
   util::concurrent::scoped_wlock lk(mutex_);
   // Clear and minimize
-  id_features3_t().swap(tbl_);
+  reset_tbl();
   common::key_manager().swap(class2id_);
   id_features3_t().swap(tbl_diff_);
+  id_features3_t().swap(mixing_diff_);
 }
 
 std::vector<std::string> local_storage_mixture::get_labels() const {
@@ -353,6 +546,93 @@ void local_storage_mixture::unpack(msgpack::object o) {
   o.convert(this);
 }
 
+void local_storage_mixture::msgpack_unpack(msgpack::object o) {
+  if (o.type != msgpack::type::ARRAY || o.via.array.size != 4) {
+    throw msgpack::type_error();
+  }
+  id_features3_t tbl;
+  o.via.array.ptr[0].convert(&tbl);
+  o.via.array.ptr[1].convert(&class2id_);
+  o.via.array.ptr[2].convert(&tbl_diff_);
+  o.via.array.ptr[3].convert(&model_version_);
+
+  reset_tbl();
+  if (tbl_.size() == 1) {
+    tbl_[0]->swap(tbl);
+  } else {
+    for (id_features3_t::iterator it = tbl.begin(); it != tbl.end(); ++it) {
+      (*tbl_[shard_of(it->first)])[it->first].swap(it->second);
+    }
+  }
+  id_features3_t().swap(mixing_diff_);
+}
+
+void local_storage_mixture::pack_chunked(
+    framework::packer& packer, size_t chunk_rows) const {
+  util::concurrent::scoped_rlock lk(mutex_);
+  id_features3_t merged;
+  if (!mixing_diff_.empty()) {
+    get_pending_diff(merged);
+  }
+  const id_features3_t& diff = mixing_diff_.empty() ? tbl_diff_ : merged;
+  packer.pack_array(4);
+  packer.pack(class2id_);
+  packer.pack(model_version_);
+  packer.pack(static_cast<uint64_t>(num_features()));
+  packer.pack(static_cast<uint64_t>(diff.size()));
+  // shards are written one after another; the reader only counts rows
+  for (size_t i = 0; i < tbl_.size(); ++i) {
+    framework::pack_map_chunks(packer, *tbl_[i], chunk_rows);
+  }
+  framework::pack_map_chunks(packer, diff, chunk_rows);
+}
+
+void local_storage_mixture::unpack_chunked(framework::unpacker& unpacker) {
+  common::key_manager class2id;
+  version model_version;
+  uint64_t tbl_size;
+  uint64_t tbl_diff_size;
+  {
+    msgpack::unpacked header;
+    unpacker.next(header);
+    const msgpack::object o = header.get();
+    if (o.type != msgpack::type::ARRAY || o.via.array.size != 4) {
+      throw msgpack::type_error();
+    }
+    o.via.array.ptr[0].convert(&class2id);
+    o.via.array.ptr[1].convert(&model_version);
+    o.via.array.ptr[2].convert(&tbl_size);
+    o.via.array.ptr[3].convert(&tbl_diff_size);
+  }
+
+  // rows are moved into the shards chunk by chunk, so at most one chunk is
+  // held twice
+  shards_t tbl;
+  make_shards(tbl);
+  id_features3_t chunk;
+  while (tbl_size > 0) {
+    unpacker.next_map_chunk(tbl_size, chunk);
+    for (id_features3_t::iterator it = chunk.begin(); it != chunk.end();
+         ++it) {
+      const size_t shard = tbl.size() == 1 ? 0 :
+          common::hash_util::calc_fast_hash(it->first) % tbl.size();
+      (*tbl[shard])[it->first].swap(it->second);
+    }
+    chunk.clear();
+  }
+  id_features3_t tbl_diff;
+  while (tbl_diff_size > 0) {
+    unpacker.next_map_chunk(tbl_diff_size, tbl_diff);
+  }
+
+  util::concurrent::scoped_wlock lk(mutex_);
+  tbl_.swap(tbl);
+  class2id_.swap(class2id);
+  tbl_diff_.swap(tbl_diff);
+  id_features3_t().swap(mixing_diff_);
+  model_version_ = model_version;
+}
+
 std::string local_storage_mixture::type() const {
   return "local_storage_mixture";
 }
@@ -21,8 +21,10 @@
 #include <map>
 #include <string>
 #include <vector>
+#include "jubatus/util/concurrent/mutex.h"
 #include "jubatus/util/concurrent/rwmutex.h"
 #include "jubatus/util/data/intern.h"
+#include "jubatus/util/lang/shared_ptr.h"
 #include "local_storage.hpp"
 #include "../common/version.hpp"
 
@@ -32,7 +34,15 @@ namespace storage {
 
 class local_storage_mixture : public storage_base {
  public:
-  local_storage_mixture();
+  /**
+   * When snapshot_mix is true, the weight table is split into shards and
+   * set_average_and_clear_diff builds new versions of the shards touched by
+   * the average without holding the storage lock, and only takes the write
+   * lock to publish them.  Readers and writers are not blocked while MIX is
+   * merging the average, at the cost of keeping two versions of the touched
+   * shards in memory during MIX.
+   */
+  explicit local_storage_mixture(bool snapshot_mix = false);
   ~local_storage_mixture();
 
   void get(const std::string& feature, feature_val1_t& ret) const;
@@ -44,6 +54,7 @@ class local_storage_mixture : public storage_base {
 
   /// inner product
   void inp(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
+  void inp_nolock(const common::sfv_t& sfv, map_feature_val1_t& ret) const;
 
   void get_diff(diff_t& ret) const;
   bool set_average_and_clear_diff(const diff_t& average);
@@ -101,6 +112,8 @@ class local_storage_mixture : public storage_base {
 
   void pack(framework::packer& packer) const;
   void unpack(msgpack::object o);
+  void pack_chunked(framework::packer& packer, size_t chunk_rows) const;
+  void unpack_chunked(framework::unpacker& unpacker);
 
   version get_version() const {
     return model_version_;
@@ -108,15 +121,59 @@ class local_storage_mixture : public storage_base {
 
   std::string type() const;
 
-  MSGPACK_DEFINE(tbl_, class2id_, tbl_diff_, model_version_);
+  template <class Packer>
+  void msgpack_pack(Packer& packer) const {
+    // shards are packed as one map to keep the model format
+    packer.pack_array(4);
+    packer.pack_map(num_features());
+    for (size_t i = 0; i < tbl_.size(); ++i) {
+      for (id_features3_t::const_iterator it = tbl_[i]->begin();
+           it != tbl_[i]->end(); ++it) {
+        packer.pack(it->first);
+        packer.pack(it->second);
+      }
+    }
+    packer.pack(class2id_);
+    if (mixing_diff_.empty()) {
+      packer.pack(tbl_diff_);
+    } else {
+      id_features3_t diff;
+      get_pending_diff(diff);
+      packer.pack(diff);
+    }
+    packer.pack(model_version_);
+  }
+  void msgpack_unpack(msgpack::object o);
 
  private:
+  typedef util::lang::shared_ptr<id_features3_t> shard_ptr;
+  typedef std::vector<shard_ptr> shards_t;
+
   bool get_internal(const std::string& feature, id_feature_val3_t& ret) const;
+  val3_t get_from_tbl(const std::string& feature, uint64_t class_id);
+  size_t shard_of(const std::string& feature) const;
+  id_features3_t& mutable_shard(size_t shard);
+  void reset_tbl();
+  void make_shards(shards_t& tbl) const;
+  size_t num_features() const;
+  void get_pending_diff(id_features3_t& ret) const;
+  void restore_mixing_diff();
 
   mutable util::concurrent::rw_mutex mutex_;
-  id_features3_t tbl_;
+  // serializes set_average_and_clear_diff in snapshot mode;
+  // must be acquired before mutex_
+  util::concurrent::mutex mix_mutex_;
+  const bool snapshot_mix_;
+
+  // Published version of the weight table, split by shard_of.  In snapshot
+  // mode a running MIX may share a shard, so it must be copied (see
+  // mutable_shard) before modifying.
+  shards_t tbl_;
   common::key_manager class2id_;
   id_features3_t tbl_diff_;
+  // Diff included in the average a snapshot MIX is applying; cleared when
+  // the average is published, so updates made meanwhile stay in tbl_diff_.
+  id_features3_t mixing_diff_;
   version model_version_;
 };
 
@@ -16,10 +16,12 @@
 
 #include <algorithm>
 #include <fstream>
+#include <map>
 #include <string>
 #include <vector>
 
 #include <gtest/gtest.h>
+#include "jubatus/util/lang/cast.h"
 #include "local_storage_mixture.hpp"
 #include "../framework/stream_writer.hpp"
 
@@ -204,6 +206,49 @@ TEST(local_storage_mixture, put_diff) {
   ASSERT_EQ(2u, s.get_version().get_number());
 }
 
+TEST(local_storage_mixture, snapshot_put_diff) {
+  local_storage_mixture s(true);
+  // spread the features over many shards
+  for (int i = 0; i < 200; ++i) {
+    s.set3("f" + jubatus::util::lang::lexical_cast<string>(i), "x",
+           val3_t(i, 1, 2));
+  }
+  diff_t diff;
+  s.get_diff(diff);
+  ASSERT_TRUE(s.set_average_and_clear_diff(diff));
+
+  // an update after get_diff was not included in the average,
+  // but a stale average must not drop it
+  s.update("f1", "x", "y", 0.5);
+  diff_t stale;
+  ASSERT_FALSE(s.set_average_and_clear_diff(stale));
+
+  feature_val3_t v;
+  s.get3("f1", v);
+  sort(v.begin(), v.end());
+  ASSERT_EQ(2u, v.size());
+  EXPECT_EQ(1.5, v[0].second.v1);
+  EXPECT_EQ(1, v[0].second.v2);
+  EXPECT_EQ(-0.5, v[1].second.v1);
+
+  s.get3("f199", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(199, v[0].second.v1);
+
+  std::map<string, string> status;
+  s.get_status(status);
+  EXPECT_EQ("200", status["num_features"]);
+  EXPECT_EQ("1", status["num_features_diff"]);
+
+  // delete_label copies the shards; MIX still applies on the new ones
+  ASSERT_TRUE(s.delete_label("y"));
+  s.get_diff(diff);
+  ASSERT_TRUE(s.set_average_and_clear_diff(diff));
+  s.get3("f1", v);
+  ASSERT_EQ(1u, v.size());
+  EXPECT_EQ(1.5, v[0].second.v1);
+}
+
 }  // namespace storage
 }  // namespace core
 }  // namespace jubatus
@@ -25,6 +25,7 @@
 #include "jubatus/util/data/unordered_set.h"
 #include "jubatus/util/lang/cast.h"
 #include "jubatus/util/math/random.h"
+#include "../common/thread_pool.hpp"
 #include "lsh_util.hpp"
 
 using std::copy;
@@ -124,7 +125,8 @@ void retrieve_hit_rows_from_table(
 
 }  // namespace
 
-lsh_index_storage::lsh_index_storage() {
+lsh_index_storage::lsh_index_storage()
+    : threads_(0) {
 }
 
 lsh_index_storage::lsh_index_storage(
@@ -132,7 +134,8 @@ lsh_index_storage::lsh_index_storage(
     size_t table_num,
     uint32_t seed)
     : shift_(lsh_num * table_num),
-      table_num_(table_num) {
+      table_num_(table_num),
+      threads_(0) {
   initialize_shift(seed, shift_);
 }
 
@@ -140,7 +143,8 @@ lsh_index_storage::lsh_index_storage(
     size_t table_num,
     const vector<float>& shift)
     : shift_(shift),
-      table_num_(table_num) {
+      table_num_(table_num),
+      threads_(0) {
 }
 
 lsh_index_storage::~lsh_index_storage() {
@@ -483,17 +487,22 @@ void lsh_index_storage::get_sorted_similar_rows(
     uint64_t ret_num,
     vector<pair<string, double> >& ids) const {
   // Avoid string copy as far as possible
+  const vector<uint64_t> cand_ids(cands.begin(), cands.end());
+  vector<double> dists(cand_ids.size());
+  common::default_thread_pool::parallel_for(
+      0, cand_ids.size(), threads_,
+      jubatus::util::lang::bind(
+          &lsh_index_storage::calc_candidate_distances, this,
+          &cand_ids, &query_simhash, query_norm, &dists,
+          jubatus::util::lang::_1, jubatus::util::lang::_2));
+
   vector<pair<uint64_t, double> > scored;
-  scored.reserve(cands.size());
-  for (unordered_set<uint64_t>::const_iterator it = cands.begin();
-      it != cands.end(); ++it) {
-    const lsh_entry* entry = get_lsh_entry(key_manager_.get_key(*it));
-    if (!entry || entry->lsh_hash.empty()) {
+  scored.reserve(cand_ids.size());
+  for (size_t i = 0; i < cand_ids.size(); ++i) {
+    if (dists[i] < 0) {
       continue;
     }
-    const double dist = calc_euclidean_distance(*entry, query_simhash,
-                                               query_norm);
-    scored.push_back(make_pair(*it, -dist));
+    scored.push_back(make_pair(cand_ids[i], -dists[i]));
   }
 
   if (scored.size() <= ret_num) {
@@ -512,6 +521,24 @@ void lsh_index_storage::get_sorted_similar_rows(
   }
 }
 
+// Stores -1 for candidates which are no longer in the table.
+void lsh_index_storage::calc_candidate_distances(
+    const vector<uint64_t>* cands,
+    const bit_vector* query_simhash,
+    double query_norm,
+    vector<double>* dists,
+    size_t begin,
+    size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    const lsh_entry* entry = get_lsh_entry(key_manager_.get_key((*cands)[i]));
+    if (!entry || entry->lsh_hash.empty()) {
+      (*dists)[i] = -1;
+      continue;
+    }
+    (*dists)[i] = calc_euclidean_distance(*entry, *query_simhash, query_norm);
+  }
+}
+
 const lsh_entry* lsh_index_storage::get_lsh_entry(const string& row) const {
   lsh_master_table_t::const_iterator it = master_table_diff_.find(row);
   if (it == master_table_diff_.end()) {
@@ -61,6 +61,11 @@ class lsh_index_storage {
     unlearner_ = unlearner;
   }
 
+  // number of threads used to score candidates in similar_row
+  void set_threads(uint32_t threads) {
+    threads_ = threads;
+  }
+
   // hash is a randomly-projected and scaled hash values without shifting
   void set_row(
       const std::string& row,
@@ -123,6 +128,13 @@ class lsh_index_storage {
       double query_norm,
       uint64_t ret_num,
       std::vector<std::pair<std::string, double> >& ids) const;
+  void calc_candidate_distances(
+      const std::vector<uint64_t>* cands,
+      const bit_vector* query_simhash,
+      double query_norm,
+      std::vector<double>* dists,
+      size_t begin,
+      size_t end) const;
   const lsh_entry* get_lsh_entry(const std::string& row) const;
   void remove_model_row(const std::string& row);
   void set_mixed_row(const std::string& row, const lsh_entry& entry);
@@ -138,6 +150,8 @@ class lsh_index_storage {
   common::key_manager key_manager_;
 
   util::lang::shared_ptr<unlearner::unlearner_base> unlearner_;
+
+  uint32_t threads_;
 };
 
 typedef framework::linear_mixable_helper<lsh_index_storage, lsh_master_table_t>
@@ -0,0 +1,84 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#include "mapped_file.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+#include "../common/exception.hpp"
+#include "storage_exception.hpp"
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+namespace {
+
+storage_exception file_error(
+    const std::string& path,
+    const std::string& func,
+    int err) {
+  return storage_exception("cannot map file: " + path)
+      << common::exception::error_api_func(func)
+      << common::exception::error_errno(err)
+      << common::exception::error_file_name(path);
+}
+
+}  // namespace
+
+mapped_file::mapped_file(const std::string& path)
+    : path_(path),
+      data_(NULL),
+      size_(0) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw JUBATUS_EXCEPTION(file_error(path, "open", errno));
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    const int err = errno;
+    ::close(fd);
+    throw JUBATUS_EXCEPTION(file_error(path, "fstat", err));
+  }
+  size_ = st.st_size;
+  if (size_ > 0) {
+    void* p = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      const int err = errno;
+      ::close(fd);
+      throw JUBATUS_EXCEPTION(file_error(path, "mmap", err));
+    }
+    data_ = static_cast<const char*>(p);
+  }
+  // the mapping remains valid after the descriptor is closed
+  ::close(fd);
+}
+
+mapped_file::~mapped_file() {
+  if (data_) {
+    ::munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
@@ -0,0 +1,60 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+
+#ifndef JUBATUS_CORE_STORAGE_MAPPED_FILE_HPP_
+#define JUBATUS_CORE_STORAGE_MAPPED_FILE_HPP_
+
+#include <stddef.h>
+#include <string>
+
+#include "jubatus/util/lang/noncopyable.h"
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+/**
+ * Read-only private mapping of a whole file.  The mapping is released on
+ * destruction; holders of pointers into the mapping must keep the object
+ * alive (e.g. with shared_ptr).
+ */
+class mapped_file : jubatus::util::lang::noncopyable {
+ public:
+  explicit mapped_file(const std::string& path);
+  ~mapped_file();
+
+  const char* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+  const std::string& path() const {
+    return path_;
+  }
+
+ private:
+  std::string path_;
+  const char* data_;
+  size_t size_;
+};
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_STORAGE_MAPPED_FILE_HPP_
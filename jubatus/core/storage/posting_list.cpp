@@ -0,0 +1,68 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#include "posting_list.hpp"
+
+#include <vector>
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+void posting_list::assign(const row_t& row) {
+  std::vector<uint8_t> ids;
+  std::vector<float> weights;
+  ids.reserve(row.size() * 2);
+  weights.reserve(row.size());
+
+  uint64_t prev = 0;
+  for (row_t::const_iterator it = row.begin(); it != row.end(); ++it) {
+    uint64_t delta = it->first - prev;
+    prev = it->first;
+    while (delta >= 0x80) {
+      ids.push_back(static_cast<uint8_t>(delta | 0x80));
+      delta >>= 7;
+    }
+    ids.push_back(static_cast<uint8_t>(delta));
+    weights.push_back(static_cast<float>(it->second));
+  }
+  ids_.swap(ids);
+  weights_.swap(weights);
+}
+
+void posting_list::to_row(row_t& row) const {
+  row_t decoded;
+  for (const_iterator it(*this); !it.end(); it.next()) {
+    decoded[it.id()] = it.weight();  // appended, as IDs are sorted
+  }
+  row = decoded;
+}
+
+bool posting_list::get(uint64_t id, double& val) const {
+  for (const_iterator it(*this); !it.end(); it.next()) {
+    if (it.id() == id) {
+      val = it.weight();
+      return true;
+    } else if (id < it.id()) {
+      break;
+    }
+  }
+  return false;
+}
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
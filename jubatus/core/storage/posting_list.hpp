@@ -0,0 +1,118 @@
+// Jubatus: Online machine learning framework for distributed environment
+// Copyright (C) 2016 Preferred Networks and Nippon Telegraph and Telephone Corporation.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Lesser General Public
+// License version 2.1 as published by the Free Software Foundation.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public
+// License along with this library; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+#ifndef JUBATUS_CORE_STORAGE_POSTING_LIST_HPP_
+#define JUBATUS_CORE_STORAGE_POSTING_LIST_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "jubatus/util/data/unordered_map.h"
+#include "storage_type.hpp"
+
+namespace jubatus {
+namespace core {
+namespace storage {
+
+/**
+ * Read-only compact form of ``row_t``.  Column IDs are sorted, delta-encoded
+ * and stored as varints in one byte array; weights are stored as float in a
+ * parallel array.  A list is rebuilt as a whole by ``assign``.
+ */
+class posting_list {
+ public:
+  class const_iterator {
+   public:
+    explicit const_iterator(const posting_list& list)
+        : list_(&list), byte_(0), pos_(0), id_(0) {
+      if (!end()) {
+        decode_next();
+      }
+    }
+
+    bool end() const {
+      return pos_ == list_->weights_.size();
+    }
+    uint64_t id() const {
+      return id_;
+    }
+    double weight() const {
+      return list_->weights_[pos_];
+    }
+    void next() {
+      ++pos_;
+      if (!end()) {
+        decode_next();
+      }
+    }
+
+   private:
+    void decode_next() {
+      uint64_t delta = 0;
+      for (int shift = 0; ; shift += 7) {
+        const uint8_t b = list_->ids_[byte_++];
+        delta |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+          break;
+        }
+      }
+      id_ += delta;
+    }
+
+    const posting_list* list_;
+    size_t byte_;
+    size_t pos_;
+    uint64_t id_;
+  };
+
+  posting_list() {
+  }
+  explicit posting_list(const row_t& row) {
+    assign(row);
+  }
+
+  void assign(const row_t& row);
+  void to_row(row_t& row) const;
+  bool get(uint64_t id, double& val) const;
+
+  size_t size() const {
+    return weights_.size();
+  }
+  bool empty() const {
+    return weights_.empty();
+  }
+  size_t memory_size() const {
+    return ids_.capacity() + weights_.capacity() * sizeof(float);
+  }
+
+  void swap(posting_list& other) {
+    ids_.swap(other.ids_);
+    weights_.swap(other.weights_);
+  }
+
+ private:
+  std::vector<uint8_t> ids_;
+  std::vector<float> weights_;
+};
+
+typedef jubatus::util::data::unordered_map<std::string, posting_list>
+    posting_table_t;
+
+}  // namespace storage
+}  // namespace core
+}  // namespace jubatus
+
+#endif  // JUBATUS_CORE_STORAGE_POSTING_LIST_HPP_
@@ -24,6 +24,17 @@ namespace jubatus {
 namespace core {
 namespace storage {
 
+void storage_base::pack_chunked(
+    framework::packer& packer, size_t chunk_rows) const {
+  pack(packer);
+}
+
+void storage_base::unpack_chunked(framework::unpacker& unpacker) {
+  msgpack::unpacked model;
+  unpacker.next(model);
+  unpack(model.get());
+}
+
 void storage_base::update(
     const string& feature,
     const string& inc_class,
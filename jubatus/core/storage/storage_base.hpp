@@ -52,6 +52,8 @@ class storage_base : public framework::model {
 
   // inner product
   virtual void inp(const common::sfv_t& sfv, map_feature_val1_t& ret) const = 0;
+  virtual void inp_nolock(const common::sfv_t& sfv,
+                          map_feature_val1_t& ret) const = 0;
 
   virtual void set(
       const std::string& feature,
@@ -83,6 +85,17 @@ class storage_base : public framework::model {
   virtual void pack(framework::packer& packer) const = 0;
   virtual void unpack(msgpack::object o) = 0;
 
+  /**
+   * Writes the model as a header followed by batches of at most
+   * ``chunk_rows`` rows, so that neither saving nor loading holds the whole
+   * model as a single msgpack object.  The stream can only be read by
+   * ``unpack_chunked`` of the same storage type.  Storages which do not
+   * support batches write the model as a single object.
+   */
+  virtual void pack_chunked(
+      framework::packer& packer, size_t chunk_rows) const;
+  virtual void unpack_chunked(framework::unpacker& unpacker);
+
   virtual version get_version() const = 0;
 
   virtual void update(
@@ -22,6 +22,7 @@
 #include "storage_base.hpp"
 #include "local_storage.hpp"
 #include "local_storage_mixture.hpp"
+#include "local_storage_flat.hpp"
 
 using jubatus::util::lang::shared_ptr;
 
@@ -35,6 +36,10 @@ shared_ptr<storage_base> storage_factory::create_storage(
     return shared_ptr<storage_base>(new local_storage);
   } else if (name == "local_mixture") {
     return shared_ptr<storage_base>(new local_storage_mixture);
+  } else if (name == "local_mixture_snapshot") {
+    return shared_ptr<storage_base>(new local_storage_mixture(true));
+  } else if (name == "local_flat") {
+    return shared_ptr<storage_base>(new local_storage_flat);
   }
 
   // maybe bug or configuration mistake
@@ -20,6 +20,7 @@
 #include "storage_factory.hpp"
 #include "local_storage.hpp"
 #include "local_storage_mixture.hpp"
+#include "local_storage_flat.hpp"
 
 using jubatus::util::lang::shared_ptr;
 
@@ -37,6 +38,16 @@ TEST(storage_factory, trivial) {
         storage_factory::create_storage("local_mixture");
     EXPECT_EQ(typeid(local_storage_mixture), typeid(*s));
   }
+  {
+    shared_ptr<storage_base> s =
+        storage_factory::create_storage("local_mixture_snapshot");
+    EXPECT_EQ(typeid(local_storage_mixture), typeid(*s));
+  }
+  {
+    shared_ptr<storage_base> s =
+        storage_factory::create_storage("local_flat");
+    EXPECT_EQ(typeid(local_storage_flat), typeid(*s));
+  }
   {
     EXPECT_THROW(storage_factory::create_storage("unknown"),
                 std::exception);
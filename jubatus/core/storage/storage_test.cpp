@@ -17,12 +17,17 @@
 #include <algorithm>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <gtest/gtest.h>
 #include "jubatus/util/concurrent/rwmutex.h"
+#include "jubatus/util/lang/cast.h"
+#include "../framework/stream_reader.hpp"
+#include "../framework/stream_writer.hpp"
 #include "local_storage.hpp"
 #include "local_storage_mixture.hpp"
+#include "local_storage_flat.hpp"
 
 using std::make_pair;
 using std::map;
@@ -41,6 +46,7 @@ using jubatus::core::storage::val2_t;
 using jubatus::core::storage::val3_t;
 using jubatus::core::storage::local_storage;
 using jubatus::core::storage::local_storage_mixture;
+using jubatus::core::storage::local_storage_flat;
 
 namespace jubatus {
 namespace core {
@@ -253,6 +259,9 @@ class stub_storage : public storage_base {
       }
     }
   }
+  void inp_nolock(const common::sfv_t& sfv, map_feature_val1_t& ret) const {
+    inp(sfv, ret);
+  }
 
   std::string type() const {
     return "stub_storage";
@@ -260,10 +269,19 @@ class stub_storage : public storage_base {
   mutable util::concurrent::rw_mutex mutex_;
 };
 
+class local_storage_mixture_snapshot : public local_storage_mixture {
+ public:
+  local_storage_mixture_snapshot()
+      : local_storage_mixture(true) {
+  }
+};
+
 }  // namespace storage
 }  // namespace core
 }  // namespace jubatus
 
+using jubatus::core::storage::local_storage_mixture_snapshot;
+
 TEST(key_manager, trivial) {
   key_manager km;
   ASSERT_EQ(0u, km.get_id("x"));
@@ -274,6 +292,165 @@ TEST(key_manager, trivial) {
   msgpack::pack(&buf, km);
 }
 
+void expect_val3(const val3_t& expected, const val3_t& actual) {
+  EXPECT_EQ(expected.v1, actual.v1);
+  EXPECT_EQ(expected.v2, actual.v2);
+  EXPECT_EQ(expected.v3, actual.v3);
+}
+
+TEST(local_storage, pack_chunked) {
+  local_storage s;
+  for (int i = 0; i < 10; ++i) {
+    const string feature =
+        "f" + jubatus::util::lang::lexical_cast<string>(i);
+    s.set3(feature, "a", val3_t(i, i * 2, i * 3));
+    if (i % 3 == 0) {
+      s.set3(feature, "b", val3_t(-i, 0, 1));
+    }
+  }
+
+  std::stringstream ss;
+  {
+    jubatus::core::framework::stream_writer<std::stringstream> st(ss);
+    jubatus::core::framework::jubatus_packer jp(st);
+    jubatus::core::framework::packer packer(jp);
+    s.pack_chunked(packer, 3);
+    // the stream must end where the model does
+    packer.pack(string("next"));
+  }
+
+  local_storage s2;
+  s2.set3("old", "c", val3_t(1, 1, 1));
+  jubatus::core::framework::stream_reader<std::stringstream> sr(ss);
+  jubatus::core::framework::unpacker unpacker(sr);
+  s2.unpack_chunked(unpacker);
+
+  EXPECT_EQ(s.get_labels().size(), s2.get_labels().size());
+  for (int i = 0; i < 10; ++i) {
+    const string feature =
+        "f" + jubatus::util::lang::lexical_cast<string>(i);
+    feature_val3_t expected, actual;
+    s.get3(feature, expected);
+    s2.get3(feature, actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      EXPECT_EQ(expected[j].first, actual[j].first);
+      expect_val3(expected[j].second, actual[j].second);
+    }
+  }
+  feature_val3_t old;
+  s2.get3("old", old);
+  EXPECT_TRUE(old.empty());
+
+  msgpack::unpacked next;
+  unpacker.next(next);
+  EXPECT_EQ("next", next.get().as<string>());
+  EXPECT_THROW(unpacker.next(next), msgpack::type_error);
+}
+
+class local_storage_mixture_mix_test : public testing::TestWithParam<bool> {
+};
+
+TEST_P(local_storage_mixture_mix_test, set_average_and_clear_diff) {
+  local_storage_mixture s(GetParam());
+  s.set3("f1", "c1", val3_t(1, 2, 3));
+  s.set3("f1", "c2", val3_t(4, 5, 6));
+
+  jubatus::core::storage::diff_t diff;
+  s.get_diff(diff);
+  ASSERT_TRUE(s.set_average_and_clear_diff(diff));
+  // the same diff is rejected as the model version has been incremented
+  EXPECT_FALSE(s.set_average_and_clear_diff(diff));
+
+  feature_val3_t v;
+  s.get3("f1", v);
+  sort(v.begin(), v.end());
+  ASSERT_EQ(2u, v.size());
+  EXPECT_EQ("c1", v[0].first);
+  expect_val3(val3_t(1, 2, 3), v[0].second);
+  EXPECT_EQ("c2", v[1].first);
+  expect_val3(val3_t(4, 5, 6), v[1].second);
+
+  // set after MIX only updates the diff
+  s.set3("f1", "c1", val3_t(2, 2, 3));
+  s.get_diff(diff);
+  ASSERT_EQ(1u, diff.diff.size());
+  ASSERT_EQ(1u, diff.diff[0].second.size());
+  expect_val3(val3_t(1, 0, 0), diff.diff[0].second[0].second);
+
+  ASSERT_TRUE(s.delete_label("c2"));
+  ASSERT_TRUE(s.set_average_and_clear_diff(diff));
+  s.get3("f1", v);
+  ASSERT_EQ(1u, v.size());
+  expect_val3(val3_t(2, 2, 3), v[0].second);
+}
+
+TEST_P(local_storage_mixture_mix_test, pack_chunked) {
+  local_storage_mixture s(GetParam());
+  for (int i = 0; i < 10; ++i) {
+    const string feature =
+        "f" + jubatus::util::lang::lexical_cast<string>(i);
+    s.set3(feature, "a", val3_t(i, i * 2, i * 3));
+  }
+  jubatus::core::storage::diff_t diff;
+  s.get_diff(diff);
+  ASSERT_TRUE(s.set_average_and_clear_diff(diff));
+  // rows both in the table and in the diff
+  for (int i = 0; i < 10; i += 3) {
+    const string feature =
+        "f" + jubatus::util::lang::lexical_cast<string>(i);
+    s.set3(feature, "b", val3_t(-i, 0, 1));
+  }
+
+  std::stringstream ss;
+  {
+    jubatus::core::framework::stream_writer<std::stringstream> st(ss);
+    jubatus::core::framework::jubatus_packer jp(st);
+    jubatus::core::framework::packer packer(jp);
+    s.pack_chunked(packer, 3);
+    packer.pack(string("next"));
+  }
+
+  local_storage_mixture s2(GetParam());
+  s2.set3("old", "c", val3_t(1, 1, 1));
+  jubatus::core::framework::stream_reader<std::stringstream> sr(ss);
+  jubatus::core::framework::unpacker unpacker(sr);
+  s2.unpack_chunked(unpacker);
+
+  EXPECT_EQ(s.get_labels().size(), s2.get_labels().size());
+  EXPECT_TRUE(s.get_version() == s2.get_version());
+  for (int i = 0; i < 10; ++i) {
+    const string feature =
+        "f" + jubatus::util::lang::lexical_cast<string>(i);
+    feature_val3_t expected, actual;
+    s.get3(feature, expected);
+    s2.get3(feature, actual);
+    sort(expected.begin(), expected.end());
+    sort(actual.begin(), actual.end());
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t j = 0; j < expected.size(); ++j) {
+      EXPECT_EQ(expected[j].first, actual[j].first);
+      expect_val3(expected[j].second, actual[j].second);
+    }
+  }
+  feature_val3_t old;
+  s2.get3("old", old);
+  EXPECT_TRUE(old.empty());
+
+  jubatus::core::storage::diff_t diff2;
+  s.get_diff(diff);
+  s2.get_diff(diff2);
+  EXPECT_EQ(diff.diff.size(), diff2.diff.size());
+
+  msgpack::unpacked next;
+  unpacker.next(next);
+  EXPECT_EQ("next", next.get().as<string>());
+}
+
+INSTANTIATE_TEST_CASE_P(local_storage_mixture_mix_test_instance,
+    local_storage_mixture_mix_test,
+    testing::Bool());
+
 template <typename T>
 class storage_test : public testing::Test {
 };
@@ -480,6 +657,27 @@ TYPED_TEST_P(storage_test, inp) {
   EXPECT_DOUBLE_EQ(99.0, ret["class_z"]);
 }
 
+TYPED_TEST_P(storage_test, inp_nolock) {
+  TypeParam s;
+  s.set3("f1", "class_x", val3_t(1, 11, 111));
+  s.set3("f1", "class_y", val3_t(2, 22, 222));
+  s.set3("f2", "class_x", val3_t(12, 1212, 121212));
+
+  sfv_t fv;
+  fv.push_back(make_pair("f1", 3.0));
+  fv.push_back(make_pair("f2", 2.0));
+
+  map_feature_val1_t expected;
+  s.inp(fv, expected);
+
+  map_feature_val1_t ret;
+  {
+    jubatus::util::concurrent::scoped_rlock lk(s.get_lock());
+    s.inp_nolock(fv, ret);
+  }
+  EXPECT_EQ(expected, ret);
+}
+
 template <typename T>
 void get_expect_status(
     map<string, string>& before,
@@ -508,6 +706,25 @@ void get_expect_status<local_storage_mixture>(
   after["num_classes"] = "3";
 }
 
+template<>
+void get_expect_status<local_storage_mixture_snapshot>(
+    map<string, string>& before,
+    map<string, string>& after) {
+  get_expect_status<local_storage_mixture>(before, after);
+}
+
+template<>
+void get_expect_status<local_storage_flat>(
+    map<string, string>& before,
+    map<string, string>& after) {
+  before["num_features"] = "0";
+  before["num_classes"] = "0";
+
+  after["num_features"] = "2";
+  after["num_classes"] = "3";
+  after["num_slots"] = "3";
+}
+
 TYPED_TEST_P(storage_test, get_status) {
   TypeParam s;
   map<string, string> status;
@@ -732,6 +949,7 @@ REGISTER_TYPED_TEST_CASE_P(storage_test,
                            val3d,
                            messagepack,
                            inp,
+                           inp_nolock,
                            get_status,
                            update,
                            bulk_update,
@@ -744,6 +962,8 @@ REGISTER_TYPED_TEST_CASE_P(storage_test,
 typedef testing::Types<
     jubatus::core::storage::stub_storage,
     local_storage,
-    local_storage_mixture> storage_types;
+    local_storage_mixture,
+    local_storage_mixture_snapshot,
+    local_storage_flat> storage_types;
 
 INSTANTIATE_TYPED_TEST_CASE_P(st, storage_test, storage_types);